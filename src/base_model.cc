@@ -7,6 +7,7 @@
 #include "./formatter.h"
 #include "./database.h"
 #include "./model_change.h"
+#include "./related_data.h"
 
 #include "Poco/Timestamp.h"
 #include "Poco/DateTime.h"
@@ -37,6 +38,22 @@ bool BaseModel::NeedsToBeSaved() const {
     return !local_id_ || dirty_;
 }
 
+void BaseModel::SetDirty() {
+    if (!dirty_ && index_) {
+        index_->Changed(this);
+    }
+    dirty_ = true;
+    fieldChanged();
+}
+
+void BaseModel::relatedIDChanged(
+    const RelatedIDKind kind,
+    const Poco::UInt64 previous) {
+    if (index_) {
+        index_->RelatedIDChanged(this, kind, previous);
+    }
+}
+
 void BaseModel::EnsureGUID() {
     if (!guid_.empty()) {
         return;
@@ -47,42 +64,50 @@ void BaseModel::EnsureGUID() {
 void BaseModel::SetDeletedAt(const Poco::UInt64 value) {
     if (deleted_at_ != value) {
         deleted_at_ = value;
-        dirty_ = true;
+        SetDirty();
     }
 }
 
 void BaseModel::SetUpdatedAt(const Poco::UInt64 value) {
     if (updated_at_ != value) {
         updated_at_ = value;
-        dirty_ = true;
+        SetDirty();
     }
 }
 
 void BaseModel::SetGUID(const std::string value) {
     if (guid_ != value) {
+        guid previous = guid_;
         guid_ = value;
-        dirty_ = true;
+        SetDirty();
+        if (index_) {
+            index_->GUIDChanged(this, previous);
+        }
     }
 }
 
 void BaseModel::SetUIModifiedAt(const Poco::UInt64 value) {
     if (ui_modified_at_ != value) {
         ui_modified_at_ = value;
-        dirty_ = true;
+        SetDirty();
     }
 }
 
 void BaseModel::SetUID(const Poco::UInt64 value) {
     if (uid_ != value) {
         uid_ = value;
-        dirty_ = true;
+        SetDirty();
     }
 }
 
 void BaseModel::SetID(const Poco::UInt64 value) {
     if (id_ != value) {
+        Poco::UInt64 previous = id_;
         id_ = value;
-        dirty_ = true;
+        SetDirty();
+        if (index_) {
+            index_->IDChanged(this, previous);
+        }
     }
 }
 
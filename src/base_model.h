@@ -17,6 +17,18 @@
 
 namespace kopsik {
 
+class ModelIndex;
+
+// IDs of other models a model belongs to. ModelIndex
+// looks models up by them, see ModelIndex::ByRelatedID.
+enum RelatedIDKind {
+    kRelatedWID = 0,
+    kRelatedCID,
+    kRelatedPID,
+    kRelatedTID,
+    kRelatedIDKinds
+};
+
 class BaseModel {
  public:
     BaseModel()
@@ -28,7 +40,8 @@ class BaseModel {
     , dirty_(false)
     , deleted_at_(0)
     , is_marked_as_deleted_on_server_(false)
-    , updated_at_(0) {}
+    , updated_at_(0)
+    , index_(0) {}
     virtual ~BaseModel() {}
 
     Poco::Int64 LocalID() const {
@@ -61,9 +74,8 @@ class BaseModel {
     }
     void SetUID(const Poco::UInt64 value);
 
-    void SetDirty() {
-        dirty_ = true;
-    }
+    // Marks model as changed, so it's saved with next SaveUser.
+    void SetDirty();
     bool Dirty() const {
         return dirty_;
     }
@@ -128,6 +140,21 @@ class BaseModel {
         return false;
     }
 
+    // ID of the workspace, client, project or task the
+    // model belongs to, zero if it has none of that kind.
+    virtual Poco::UInt64 RelatedID(const RelatedIDKind) const {
+        return 0;
+    }
+
+    // Index the model has been added to, if any.
+    // Notified when ID, GUID or a related ID changes.
+    ModelIndex *Index() const {
+        return index_;
+    }
+    void SetIndex(ModelIndex *value) {
+        index_ = value;
+    }
+
     void LoadFromDataString(const std::string);
     void LoadFromJSONString(const std::string);
 
@@ -145,6 +172,15 @@ class BaseModel {
 
     bool userCannotAccessWorkspace(const kopsik::error err) const;
 
+    // Called after a field has been changed and the model
+    // has been marked dirty.
+    virtual void fieldChanged() {}
+
+    // Setters of related IDs call this after the change
+    void relatedIDChanged(
+        const RelatedIDKind kind,
+        const Poco::UInt64 previous);
+
  private:
     std::string batchUpdateRelativeURL() const;
     std::string batchUpdateMethod() const;
@@ -162,6 +198,8 @@ class BaseModel {
     // If model push to backend results in an error,
     // the error is attached to the model for later inspection.
     kopsik::error error_;
+
+    ModelIndex *index_;
 };
 
 }  // namespace kopsik
@@ -82,8 +82,14 @@ void BatchUpdateResult::ProcessResponseArray(
         logger.debug(result.String());
 
         poco_assert(!result.GUID.empty());
-        BaseModel *model = (*models)[result.GUID];
-        poco_assert(model);
+        std::map<std::string, BaseModel *>::const_iterator found =
+            models->find(result.GUID);
+        if (found == models->end()) {
+            logger.warning("Model is gone, skipping result for GUID "
+                           + result.GUID);
+            continue;
+        }
+        BaseModel *model = found->second;
 
         error err = model->ApplyBatchUpdateResult(&result);
         if (err != noError) {
@@ -20,14 +20,25 @@ std::string Client::String() const {
 void Client::SetName(const std::string value) {
     if (name_ != value) {
         name_ = value;
-        dirty_ = true;
+        SetDirty();
+    }
+}
+
+Poco::UInt64 Client::RelatedID(const RelatedIDKind kind) const {
+    switch (kind) {
+    case kRelatedWID:
+        return wid_;
+    default:
+        return 0;
     }
 }
 
 void Client::SetWID(const Poco::UInt64 value) {
     if (wid_ != value) {
+        Poco::UInt64 previous = wid_;
         wid_ = value;
-        dirty_ = true;
+        SetDirty();
+        relatedIDChanged(kRelatedWID, previous);
     }
 }
 
@@ -34,6 +34,8 @@ class Client : public BaseModel {
 
     std::string String() const;
 
+    Poco::UInt64 RelatedID(const RelatedIDKind kind) const;
+
     std::string ModelName() const {
         return "client";
     }
@@ -49,7 +51,6 @@ class Client : public BaseModel {
  private:
     Poco::UInt64 wid_;
     std::string name_;
-    bool dirty_;
 };
 
 bool CompareClientByName(Client *a, Client *b);
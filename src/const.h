@@ -9,6 +9,8 @@
 
 #define kReminderThrottleMicros 600000000
 
+#define kSaveThrottleMicros 250000
+
 #define kAutocompleteItemTE  0
 #define kAutocompleteItemTask 1
 #define kAutocompleteItemProject 2
@@ -24,6 +26,21 @@
 
 #define kMaxTimeEntryDurationSeconds 3600000
 
+#define kBulkInsertMinimumModels 100
+
+#define kTimeEntryWindowDays 28
+
+#define kDatabaseReaderSessions 4
+#define kDatabaseBusyTimeoutMillis 5000
+
+#define kDatabasePageSize 4096
+#define kDatabaseCacheSizeKiB 8192
+#define kDatabaseMmapSize 67108864
+#define kDatabaseIncrementalVacuumPages 256
+#define kDatabaseIncrementalVacuumSteps 16
+#define kDatabaseMaintenanceIntervalMicros 600000000
+#define kDatabaseMaintenanceIdleMicros 60000000
+
 #ifdef WIN32
 #define kVerifyServerCertificate 0
 #else
@@ -45,7 +45,12 @@ Context::Context(
   next_partial_sync_at_(0),
   next_fetch_updates_at_(0),
   next_update_timeline_settings_at_(0),
-  next_reminder_at_(0) {
+  next_reminder_at_(0),
+  next_save_at_(0),
+  save_requested_(false),
+  push_after_save_(false) {
+    snapshot_ = new ViewSnapshot();
+
     Poco::ErrorHandler::set(&error_handler_);
     Poco::Net::initializeSSL();
 
@@ -57,6 +62,15 @@ Context::Context(
 }
 
 Context::~Context() {
+    {
+        Poco::Mutex::ScopedLock lock(save_timer_m_);
+        save_timer_.cancel(true);
+    }
+    error err = flushSave();
+    if (err != noError) {
+        logger().error(err);
+    }
+
     if (window_change_recorder_) {
         Poco::Mutex::ScopedLock lock(window_change_recorder_m_);
         delete window_change_recorder_;
@@ -128,6 +142,7 @@ error Context::verifyCallbacks() {
 }
 
 void Context::exportUserLoginState() {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         on_user_login_callback_(0, "", "");
         return;
@@ -158,9 +173,37 @@ void Context::Shutdown() {
         timer_.cancel(true);
     }
 
+    // write out whatever is still queued
+    {
+        Poco::Mutex::ScopedLock lock(save_timer_m_);
+        save_timer_.cancel(true);
+    }
+    error err = flushSave();
+    if (err != noError) {
+        logger().error(err);
+    }
+    writeSnapshot();
+
     Poco::ThreadPool::defaultPool().joinAll();
 }
 
+// Snapshot is only a faster way to load the user,
+// failing to write it is not an error.
+void Context::writeSnapshot() {
+    Poco::Mutex::ScopedLock lock(user_m_);
+    if (!user_ || !db_) {
+        return;
+    }
+    kopsik::error err = db_->WriteSnapshot(user_);
+    if (err != kopsik::noError) {
+        logger().warning("Failed to write snapshot: " + err);
+    }
+}
+
+_Bool Context::FlushSave() {
+    return exportErrorState(flushSave());
+}
+
 void Context::PasswordForgot() {
     on_open_url_callback_(kLostPasswordURL);
 }
@@ -185,22 +228,88 @@ _Bool Context::ConfigureProxy() {
 error Context::save(const bool push_changes) {
     logger().debug("save");
 
-    std::vector<kopsik::ModelChange> changes;
-    kopsik::error err = db_->SaveUser(user_, true, &changes);
+    {
+        Poco::Mutex::ScopedLock lock(save_m_);
+        save_requested_ = true;
+        if (push_changes) {
+            push_after_save_ = true;
+        }
+    }
+
+    next_save_at_ = postpone(kSaveThrottleMicros);
+    Poco::Util::TimerTask::Ptr ptask =
+        new Poco::Util::TimerTaskAdapter<Context>(*this, &Context::onSave);
+
+    Poco::Mutex::ScopedLock lock(save_timer_m_);
+    save_timer_.schedule(ptask, next_save_at_);
+
+    return noError;
+}
+
+void Context::onSave(Poco::Util::TimerTask& task) {  // NOLINT
+    if (isPostponed(next_save_at_, kSaveThrottleMicros)) {
+        logger().debug("onSave postponed");
+        return;
+    }
+    logger().debug("onSave executing");
+
+    kopsik::error err = flushSave();
     if (err != kopsik::noError) {
-        return err;
+        on_error_callback_(err.c_str());
     }
-    if (!on_model_change_callback_) {
-        return noError;
+}
+
+error Context::flushSave() {
+    // Model changes are delivered under this lock, so that
+    // they arrive in the order they were committed.
+    Poco::Mutex::ScopedLock flush_lock(flush_m_);
+
+    bool push_changes(false);
+    std::vector<kopsik::ModelChange> changes;
+    {
+        // Models are not changed while they are being saved
+        Poco::Mutex::ScopedLock lock(user_m_);
+        {
+            Poco::Mutex::ScopedLock save_lock(save_m_);
+            if (!save_requested_) {
+                return noError;
+            }
+            save_requested_ = false;
+            push_changes = push_after_save_;
+            push_after_save_ = false;
+        }
+
+        if (!db_ || !user_) {
+            return noError;
+        }
+
+        kopsik::error err = db_->SaveUser(user_, true, &changes);
+
+        // Built here, on the saving thread, while nothing can
+        // change the models; queries read it from now on.
+        publishSnapshot();
+
+        if (err != kopsik::noError) {
+            // Changes are still pending, try again with next save
+            Poco::Mutex::ScopedLock save_lock(save_m_);
+            save_requested_ = true;
+            if (push_changes) {
+                push_after_save_ = true;
+            }
+            return err;
+        }
     }
-    for (std::vector<kopsik::ModelChange>::const_iterator it =
-        changes.begin();
-            it != changes.end();
-            it++) {
-        KopsikModelChange *ch = model_change_init();
-        model_change_to_change_item(*it, ch);
-        on_model_change_callback_(ch);
-        model_change_clear(ch);
+
+    if (on_model_change_callback_) {
+        for (std::vector<kopsik::ModelChange>::const_iterator it =
+            changes.begin();
+                it != changes.end();
+                it++) {
+            KopsikModelChange *ch = model_change_init();
+            model_change_to_change_item(*it, ch);
+            on_model_change_callback_(ch);
+            model_change_clear(ch);
+        }
     }
 
     if (push_changes) {
@@ -249,7 +358,7 @@ void Context::onFullSync(Poco::Util::TimerTask& task) {  // NOLINT
     logger().debug("onFullSync executing");
 
     kopsik::HTTPSClient https_client = get_https_client();
-    kopsik::error err = user_->FullSync(&https_client);
+    kopsik::error err = user_->FullSync(&https_client, &user_m_);
     if (err != kopsik::noError) {
         on_error_callback_(err.c_str());
         return;
@@ -284,7 +393,7 @@ void Context::onPartialSync(Poco::Util::TimerTask& task) {  // NOLINT
     logger().debug("onPartialSync executing");
 
     kopsik::HTTPSClient https_client = get_https_client();
-    kopsik::error err = user_->PartialSync(&https_client);
+    kopsik::error err = user_->PartialSync(&https_client, &user_m_);
     if (err != kopsik::noError) {
         on_error_callback_(err.c_str());
         return;
@@ -336,6 +445,7 @@ _Bool Context::LoadUpdateFromJSONString(const std::string json) {
     ss << "LoadUpdateFromJSONString json=" << json;
     logger().debug(ss.str());
 
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         return false;
     }
@@ -359,10 +469,18 @@ void Context::SwitchWebSocketOn() {
 void Context::onSwitchWebSocketOn(Poco::Util::TimerTask& task) {  // NOLINT
     logger().debug("onSwitchWebSocketOn");
 
-    poco_assert(!user_->APIToken().empty());
+    std::string api_token("");
+    {
+        Poco::Mutex::ScopedLock lock(user_m_);
+        if (!user_) {
+            return;
+        }
+        api_token = user_->APIToken();
+    }
+    poco_assert(!api_token.empty());
 
     Poco::Mutex::ScopedLock lock(ws_client_m_);
-    ws_client_->Start(this, user_->APIToken(), on_websocket_message);
+    ws_client_->Start(this, api_token, on_websocket_message);
 }
 
 // Start/stop timeline recording on local machine
@@ -407,12 +525,19 @@ void Context::SwitchTimelineOn() {
 void Context::onSwitchTimelineOn(Poco::Util::TimerTask& task) {  // NOLINT
     logger().debug("onSwitchTimelineOn");
 
-    if (!user_) {
-        return;
-    }
+    Poco::UInt64 user_id(0);
+    std::string api_token("");
+    {
+        Poco::Mutex::ScopedLock lock(user_m_);
+        if (!user_) {
+            return;
+        }
 
-    if (!user_->RecordTimeline()) {
-        return;
+        if (!user_->RecordTimeline()) {
+            return;
+        }
+        user_id = user_->ID();
+        api_token = user_->APIToken();
     }
 
     {
@@ -422,8 +547,8 @@ void Context::onSwitchTimelineOn(Poco::Util::TimerTask& task) {  // NOLINT
             timeline_uploader_ = 0;
         }
         timeline_uploader_ = new kopsik::TimelineUploader(
-            user_->ID(),
-            user_->APIToken(),
+            user_id,
+            api_token,
             timeline_upload_url_,
             app_name_,
             app_version_);
@@ -435,7 +560,7 @@ void Context::onSwitchTimelineOn(Poco::Util::TimerTask& task) {  // NOLINT
             delete window_change_recorder_;
             window_change_recorder_ = 0;
         }
-        window_change_recorder_ = new kopsik::WindowChangeRecorder(user_->ID());
+        window_change_recorder_ = new kopsik::WindowChangeRecorder(user_id);
     }
 }
 
@@ -481,6 +606,42 @@ void Context::onPeriodicUpdateCheck(Poco::Util::TimerTask& task) {  // NOLINT
     startPeriodicUpdateCheck();
 }
 
+void Context::scheduleDatabaseMaintenance() {
+    logger().debug("scheduleDatabaseMaintenance");
+
+    Poco::Util::TimerTask::Ptr ptask =
+        new Poco::Util::TimerTaskAdapter<Context>
+    (*this, &Context::onDatabaseMaintenance);
+
+    Poco::Timestamp next_maintenance_at =
+        Poco::Timestamp() + kDatabaseMaintenanceIntervalMicros;
+    Poco::Mutex::ScopedLock lock(timer_m_);
+    timer_.schedule(ptask, next_maintenance_at);
+}
+
+void Context::onDatabaseMaintenance(Poco::Util::TimerTask& task) {  // NOLINT
+    // Only run while user is not making changes
+    if (Poco::Timestamp() - next_save_at_ < kDatabaseMaintenanceIdleMicros) {
+        logger().debug("onDatabaseMaintenance postponed");
+        scheduleDatabaseMaintenance();
+        return;
+    }
+    logger().debug("onDatabaseMaintenance executing");
+
+    {
+        Poco::Mutex::ScopedLock lock(db_m_);
+        if (db_) {
+            kopsik::error err = db_->Maintain();
+            if (err != kopsik::noError) {
+                logger().error(err);
+            }
+            writeSnapshot();
+        }
+    }
+
+    scheduleDatabaseMaintenance();
+}
+
 void Context::executeUpdateCheck() {
     logger().debug("executeUpdateCheck");
 
@@ -579,14 +740,22 @@ void Context::onTimelineUpdateServerSettings(Poco::Util::TimerTask& task) {  //
     logger().debug("onTimelineUpdateServerSettings executing");
 
     std::string json(kRecordTimelineDisabledJSON);
-    if (user_->RecordTimeline()) {
-        json = kRecordTimelineEnabledJSON;
+    std::string api_token("");
+    {
+        Poco::Mutex::ScopedLock lock(user_m_);
+        if (!user_) {
+            return;
+        }
+        if (user_->RecordTimeline()) {
+            json = kRecordTimelineEnabledJSON;
+        }
+        api_token = user_->APIToken();
     }
 
     std::string response_body("");
     kopsik::error err = get_https_client().PostJSON("/api/v8/timeline_settings",
                         json,
-                        user_->APIToken(),
+                        api_token,
                         "api_token",
                         &response_body);
     if (err != kopsik::noError) {
@@ -622,10 +791,19 @@ _Bool Context::SendFeedback(Feedback fb) {
 void Context::onSendFeedback(Poco::Util::TimerTask& task) {  // NOLINT
     logger().debug("onSendFeedback");
 
+    std::string api_token("");
+    {
+        Poco::Mutex::ScopedLock lock(user_m_);
+        if (!user_) {
+            return;
+        }
+        api_token = user_->APIToken();
+    }
+
     std::string response_body("");
     kopsik::error err = get_https_client().PostJSON("/api/v8/feedback",
                         feedback_.JSON(),
-                        user_->APIToken(),
+                        api_token,
                         "api_token",
                         &response_body);
     if (err != kopsik::noError) {
@@ -724,11 +902,19 @@ _Bool Context::SetDBPath(
     const std::string path) {
     try {
         Poco::Mutex::ScopedLock lock(db_m_);
+        bool maintenance_scheduled(db_ != 0);
         if (db_) {
             delete db_;
             db_ = 0;
         }
         db_ = new kopsik::Database(path);
+        db_->SetTimeEntryWindowDays(kTimeEntryWindowDays);
+        if (path != ":memory:") {
+            db_->SetSnapshotPath(path + ".snapshot");
+        }
+        if (!maintenance_scheduled) {
+            scheduleDatabaseMaintenance();
+        }
     } catch(const Poco::Exception& exc) {
         return exportErrorState(exc.displayText());
     } catch(const std::exception& ex) {
@@ -751,9 +937,12 @@ _Bool Context::SetCurrentAPIToken(
 _Bool Context::LoadCurrentUser(kopsik::User **result) {
     poco_assert(!*result);
 
-    if (user_) {
-        *result = user_;
-        return true;
+    {
+        Poco::Mutex::ScopedLock lock(user_m_);
+        if (user_) {
+            *result = user_;
+            return true;
+        }
     }
 
     kopsik::User *user = new kopsik::User(app_name_, app_version_);
@@ -769,7 +958,7 @@ _Bool Context::LoadCurrentUser(kopsik::User **result) {
     }
 
     setUser(user);
-    *result = user_;
+    *result = user;
 
     return true;
 }
@@ -815,11 +1004,20 @@ _Bool Context::Login(
 }
 
 void Context::setUser(User *value) {
+    error err = flushSave();
+    if (err != noError) {
+        logger().error(err);
+    }
+
     Poco::Mutex::ScopedLock lock(user_m_);
-    if (user_) {
-        delete user_;
+    {
+        Poco::Mutex::ScopedLock save_lock(save_m_);
+        if (user_) {
+            delete user_;
+        }
+        user_ = value;
     }
-    user_ = value;
+    publishSnapshot();
     exportUserLoginState();
 }
 
@@ -876,7 +1074,14 @@ _Bool Context::ClearCache() {
             logger().warning("User is logged out, cannot clear cache");
             return true;
         }
-        kopsik::error err = db_->DeleteUser(user_, true);
+        kopsik::error err = flushSave();
+        if (err != kopsik::noError) {
+            return exportErrorState(err);
+        }
+        {
+            Poco::Mutex::ScopedLock lock(user_m_);
+            err = db_->DeleteUser(user_, true);
+        }
         if (err != kopsik::noError) {
             return exportErrorState(err);
         }
@@ -893,6 +1098,7 @@ _Bool Context::ClearCache() {
 }
 
 bool Context::CanSeeBillable(const std::string GUID) const {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         return false;
     }
@@ -914,6 +1120,7 @@ bool Context::CanSeeBillable(const std::string GUID) const {
 }
 
 bool Context::CanAddProjects(const Poco::UInt64 workspace_id) const {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         return false;
     }
@@ -928,10 +1135,12 @@ bool Context::CanAddProjects(const Poco::UInt64 workspace_id) const {
 }
 
 bool Context::UserIsLoggedIn() const {
+    Poco::Mutex::ScopedLock lock(user_m_);
     return (user_ && user_->ID());
 }
 
 Poco::UInt64 Context::UsersDefaultWID() const {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         return 0;
     }
@@ -942,6 +1151,7 @@ void Context::CollectPushableTimeEntries(
     std::vector<kopsik::TimeEntry *> *models) const {
     poco_assert(models);
 
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         return;
     }
@@ -949,57 +1159,23 @@ void Context::CollectPushableTimeEntries(
 }
 
 std::vector<std::string> Context::Tags() const {
-    std::vector<std::string> tags;
-    if (!user_) {
-        return tags;
-    }
-    std::set<std::string> unique_names;
-    for (std::vector<kopsik::Tag *>::const_iterator it =
-        user_->related.Tags.begin();
-            it != user_->related.Tags.end();
-            it++) {
-        kopsik::Tag *tag = *it;
-        if (unique_names.find(tag->Name()) != unique_names.end()) {
-            continue;
-        }
-        unique_names.insert(tag->Name());
-        tags.push_back(tag->Name());
-    }
-    std::sort(tags.rbegin(), tags.rend());
-    return tags;
+    return Snapshot()->Tags;
 }
 
-std::vector<kopsik::Workspace *> Context::Workspaces() const {
-    std::vector<kopsik::Workspace *> result;
-    if (!user_) {
-        logger().warning("User logged out, cannot fetch workspaces");
-        return result;
-    }
-    result = user_->related.Workspaces;
-    std::sort(result.rbegin(), result.rend(), CompareWorkspaceByName);
-    return result;
+std::vector<kopsik::Workspace> Context::Workspaces() const {
+    return Snapshot()->Workspaces;
 }
 
-std::vector<kopsik::Client *> Context::Clients(
+std::vector<kopsik::Client> Context::Clients(
     const Poco::UInt64 workspace_id) const {
     poco_assert(workspace_id);
-    std::vector<kopsik::Client *> result;
-    if (!user_) {
-        logger().warning("User logged out, cannot fetch clients");
-        return result;
-    }
-    for (std::vector<kopsik::Client *>::const_iterator it =
-        user_->related.Clients.begin();
-            it != user_->related.Clients.end();
-            it++) {
-        kopsik::Client *client = *it;
-        if (client->WID() != workspace_id) {
-            continue;
-        }
-        result.push_back(client);
+    ViewSnapshotRef snapshot = Snapshot();
+    std::map<Poco::UInt64, std::vector<kopsik::Client> >::const_iterator it =
+        snapshot->ClientsByWorkspace.find(workspace_id);
+    if (it == snapshot->ClientsByWorkspace.end()) {
+        return std::vector<kopsik::Client>();
     }
-    std::sort(result.rbegin(), result.rend(), CompareClientByName);
-    return result;
+    return it->second;
 }
 
 _Bool Context::Start(
@@ -1010,6 +1186,7 @@ _Bool Context::Start(
     kopsik::TimeEntry **result) {
     poco_assert(result);
 
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         logger().warning("Cannot start tracking, user logged out");
         return true;
@@ -1025,6 +1202,7 @@ _Bool Context::ContinueLatest(
     kopsik::TimeEntry **result) {
     poco_assert(result);
 
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         logger().warning("Cannot continue tracking, user logged out");
         return true;
@@ -1048,6 +1226,7 @@ _Bool Context::Continue(
     kopsik::TimeEntry **result) {
     poco_assert(result);
 
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         logger().warning("Cannot continue time entry, user logged out");
         return true;
@@ -1057,6 +1236,8 @@ _Bool Context::Continue(
         return exportErrorState("Missing GUID");
     }
 
+    // Page in the entry if it's outside of the in-memory window
+    GetTimeEntryByGUID(GUID);
 
     kopsik::error err = user_->Continue(GUID, result);
     if (err != kopsik::noError) {
@@ -1067,42 +1248,100 @@ _Bool Context::Continue(
 }
 
 _Bool Context::DeleteTimeEntryByGUID(const std::string GUID) {
+    if (GUID.empty()) {
+        return exportErrorState("Missing GUID");
+    }
+
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         logger().warning("Cannot delete time entry, user logged out");
         return true;
     }
-    if (GUID.empty()) {
-        return exportErrorState("Missing GUID");
-    }
-    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    kopsik::TimeEntry *te = GetTimeEntryByGUID(GUID);
     if (!te) {
         logger().warning("Time entry not found: " + GUID);
         return true;
     }
     te->Delete();
 
-    kopsik::ModelChange mc("time_entry", "delete", te->ID(), te->GUID());
-    if (on_model_change_callback_) {
-        KopsikModelChange *ch = model_change_init();
-        model_change_to_change_item(mc, ch);
-        on_model_change_callback_(ch);
-        model_change_clear(ch);
+    // The delete is delivered as a model change once it's saved
+    return exportErrorState(save());
+}
+
+_Bool Context::LoadTimeEntryByGUID(
+    const std::string GUID,
+    kopsik::TimeEntry **result) const {
+    poco_assert(result);
+
+    *result = 0;
+    Poco::UInt64 UID(0);
+    {
+        Poco::Mutex::ScopedLock lock(user_m_);
+        if (!user_) {
+            logger().warning("Cannot load time entry, user logged out");
+            return true;
+        }
+        UID = user_->ID();
     }
+    return exportErrorState(db_->TimeEntryByGUID(UID, GUID, result));
+}
 
-    return exportErrorState(save());
+_Bool Context::LoadTimeEntriesInRange(
+    const Poco::Int64 from,
+    const Poco::Int64 to,
+    std::vector<kopsik::TimeEntry *> *result) const {
+    poco_assert(result);
+
+    Poco::UInt64 UID(0);
+    {
+        Poco::Mutex::ScopedLock lock(user_m_);
+        if (!user_) {
+            logger().warning("Cannot load time entries, user logged out");
+            return true;
+        }
+        UID = user_->ID();
+    }
+    return exportErrorState(db_->LoadTimeEntriesInRange(UID, from, to, result));
 }
 
 kopsik::TimeEntry *Context::GetTimeEntryByGUID(const std::string GUID) const {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         logger().warning("Cannot get time entry, user logged out");
         return 0;
     }
-    return user_->GetTimeEntryByGUID(GUID);
+    kopsik::TimeEntry *te = 0;
+    kopsik::error err = db_->LoadTimeEntryByGUID(user_, GUID, &te);
+    if (err != kopsik::noError) {
+        logger().error(err);
+        return 0;
+    }
+    return te;
+}
+
+_Bool Context::LoadOlderTimeEntries(_Bool *has_more) {
+    poco_assert(has_more);
+
+    *has_more = false;
+    Poco::Mutex::ScopedLock lock(user_m_);
+    if (!user_) {
+        logger().warning("Cannot load time entries, user logged out");
+        return true;
+    }
+    kopsik::error err =
+        db_->LoadOlderTimeEntries(user_, kTimeEntryWindowDays);
+    if (err != kopsik::noError) {
+        return exportErrorState(err);
+    }
+    *has_more = user_->related.TimeEntriesLoadedSince != 0;
+    publishSnapshot();
+    return true;
 }
 
 _Bool Context::SetTimeEntryDuration(
     const std::string GUID,
     const std::string duration) {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (GUID.empty()) {
         return exportErrorState("Missing GUID");
     }
@@ -1110,7 +1349,7 @@ _Bool Context::SetTimeEntryDuration(
         logger().warning("Cannot set duration, user logged out");
         return true;
     }
-    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    kopsik::TimeEntry *te = GetTimeEntryByGUID(GUID);
     if (!te) {
         logger().warning("Time entry not found: " + GUID);
         return true;
@@ -1128,6 +1367,7 @@ _Bool Context::SetTimeEntryProject(
     const Poco::UInt64 task_id,
     const Poco::UInt64 project_id,
     const std::string project_guid) {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (GUID.empty()) {
         return exportErrorState("Missing GUID");
     }
@@ -1136,7 +1376,7 @@ _Bool Context::SetTimeEntryProject(
         return true;
     }
 
-    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    kopsik::TimeEntry *te = GetTimeEntryByGUID(GUID);
     if (!te) {
         logger().warning("Time entry not found: " + GUID);
         return true;
@@ -1168,6 +1408,7 @@ _Bool Context::SetTimeEntryProject(
 _Bool Context::SetTimeEntryStartISO8601(
     const std::string GUID,
     const std::string value) {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (GUID.empty()) {
         return exportErrorState("Missing GUID");
     }
@@ -1175,7 +1416,7 @@ _Bool Context::SetTimeEntryStartISO8601(
         logger().warning("Cannot change start time, user logged out");
         return true;
     }
-    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    kopsik::TimeEntry *te = GetTimeEntryByGUID(GUID);
     if (!te) {
         logger().warning("Time entry not found: " + GUID);
         return true;
@@ -1193,6 +1434,7 @@ _Bool Context::SetTimeEntryStartISO8601(
 _Bool Context::SetTimeEntryEndISO8601(
     const std::string GUID,
     const std::string value) {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (GUID.empty()) {
         return exportErrorState("Missing GUID");
     }
@@ -1200,7 +1442,7 @@ _Bool Context::SetTimeEntryEndISO8601(
         logger().warning("Cannot change end time, user logged out");
         return true;
     }
-    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    kopsik::TimeEntry *te = GetTimeEntryByGUID(GUID);
     if (!te) {
         logger().warning("Time entry not found: " + GUID);
         return true;
@@ -1218,6 +1460,7 @@ _Bool Context::SetTimeEntryEndISO8601(
 _Bool Context::SetTimeEntryTags(
     const std::string GUID,
     const std::string value) {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (GUID.empty()) {
         return exportErrorState("Missing GUID");
     }
@@ -1225,7 +1468,7 @@ _Bool Context::SetTimeEntryTags(
         logger().warning("Cannot set tags, user logged out");
         return true;
     }
-    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    kopsik::TimeEntry *te = GetTimeEntryByGUID(GUID);
     if (!te) {
         logger().warning("Time entry not found: " + GUID);
         return true;
@@ -1241,6 +1484,7 @@ _Bool Context::SetTimeEntryTags(
 _Bool Context::SetTimeEntryBillable(
     const std::string GUID,
     const bool value) {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (GUID.empty()) {
         return exportErrorState("Missing GUID");
     }
@@ -1248,7 +1492,7 @@ _Bool Context::SetTimeEntryBillable(
         logger().warning("Cannot set billable, user logged out");
         return true;
     }
-    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    kopsik::TimeEntry *te = GetTimeEntryByGUID(GUID);
     if (!te) {
         logger().warning("Time entry not found: " + GUID);
         return true;
@@ -1264,6 +1508,7 @@ _Bool Context::SetTimeEntryBillable(
 _Bool Context::SetTimeEntryDescription(
     const std::string GUID,
     const std::string value) {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (GUID.empty()) {
         return exportErrorState("Missing GUID");
     }
@@ -1271,7 +1516,7 @@ _Bool Context::SetTimeEntryDescription(
         logger().warning("Cannot set description, user logged out");
         return true;
     }
-    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    kopsik::TimeEntry *te = GetTimeEntryByGUID(GUID);
     if (!te) {
         logger().warning("Time entry not found: " + GUID);
         return true;
@@ -1286,6 +1531,7 @@ _Bool Context::SetTimeEntryDescription(
 
 _Bool Context::Stop(kopsik::TimeEntry **stopped_entry) {
     *stopped_entry = 0;
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         logger().warning("Cannot stop tracking, user logged out");
         return true;
@@ -1306,6 +1552,7 @@ _Bool Context::StopAt(
 
     poco_assert(result);
 
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         logger().warning("Cannot stop time entry, user logged out");
         return true;
@@ -1322,17 +1569,8 @@ _Bool Context::StopAt(
     return exportErrorState(save());
 }
 
-_Bool Context::RunningTimeEntry(
-    kopsik::TimeEntry **running) const {
-    if (!user_) {
-        logger().warning("Cannot fetch time entry, user logged out");
-        return true;
-    }
-    *running = user_->RunningTimeEntry();
-    return true;
-}
-
 _Bool Context::ToggleTimelineRecording() {
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         logger().warning("Cannot toggle timeline, user logged out");
         return true;
@@ -1361,16 +1599,36 @@ _Bool Context::ToggleTimelineRecording() {
     return true;
 }
 
-_Bool Context::TimeEntries(
-    std::map<std::string, Poco::Int64> *date_durations,
-    std::vector<kopsik::TimeEntry *> *visible) const {
+ViewSnapshotRef Context::Snapshot() const {
+    Poco::Mutex::ScopedLock lock(snapshot_m_);
+    return ViewSnapshotRef(snapshot_);
+}
+
+void Context::publishSnapshot() {
+    Poco::Mutex::ScopedLock user_lock(user_m_);
+    Poco::Mutex::ScopedLock lock(publish_m_);
+    Poco::SharedPtr<ViewSnapshot> snapshot(buildSnapshot());
+    {
+        Poco::Mutex::ScopedLock lock(snapshot_m_);
+        snapshot_.swap(snapshot);
+    }
+    // Previous snapshot is freed here, after the swap, unless
+    // a query is still reading it.
+}
+
+ViewSnapshot *Context::buildSnapshot() {
+    ViewSnapshot *snapshot = new ViewSnapshot();
     if (!user_) {
-        return true;
+        return snapshot;
     }
 
+    // Already in the order they are shown in
+    const std::vector<kopsik::TimeEntry *> &ordered =
+        user_->related.TimeEntriesByStart.Ordered();
+    snapshot->TimeEntries.reserve(ordered.size());
     for (std::vector<kopsik::TimeEntry *>::const_iterator it =
-        user_->related.TimeEntries.begin();
-            it != user_->related.TimeEntries.end(); it++) {
+        ordered.begin();
+            it != ordered.end(); it++) {
         kopsik::TimeEntry *te = *it;
         poco_assert(!te->GUID().empty());
         if (te->DurationInSeconds() < 0) {
@@ -1379,39 +1637,90 @@ _Bool Context::TimeEntries(
         if (te->DeletedAt() > 0) {
             continue;
         }
-        visible->push_back(te);
 
-        std::string date_header = te->DateHeaderString();
-        Poco::Int64 duration = (*date_durations)[date_header];
-        duration += te->DurationInSeconds();
-        (*date_durations)[date_header] = duration;
+        std::string project_label("");
+        std::string color_code("");
+        ProjectLabelAndColorCode(te, &project_label, &color_code);
+        snapshot->TimeEntries.push_back(
+            TimeEntryView(*te, project_label, color_code));
+
+        std::string date_header = snapshot->TimeEntries.back().DateHeader;
+        if (snapshot->DateDurations.find(date_header)
+                == snapshot->DateDurations.end()) {
+            snapshot->DateDurations[date_header] =
+                user_->related.TrackedPerDay.ForDay(te->Start());
+        }
     }
 
-    std::sort(visible->begin(), visible->end(), CompareTimeEntriesByStart);
+    snapshot->Reindex();
 
-    return true;
+    kopsik::TimeEntry *running = user_->RunningTimeEntry();
+    if (running) {
+        std::string project_label("");
+        std::string color_code("");
+        ProjectLabelAndColorCode(running, &project_label, &color_code);
+        snapshot->Running.push_back(
+            TimeEntryView(*running, project_label, color_code));
+    }
+
+    snapshot->TrackedPerDay = user_->related.TrackedPerDay;
+    snapshot->LongestDuration =
+        user_->related.TimeEntriesByStart.LongestDuration();
+    snapshot->TimeEntriesLoadedSince = user_->related.TimeEntriesLoadedSince;
+
+    getTimeEntryAutocompleteItems(&snapshot->AutocompleteItems);
+    getTaskAutocompleteItems(&snapshot->AutocompleteItems);
+    getProjectAutocompleteItems(&snapshot->AutocompleteItems);
+    std::sort(snapshot->AutocompleteItems.begin(),
+              snapshot->AutocompleteItems.end(),
+              CompareAutocompleteItems);
+
+    std::vector<std::string> &tags = snapshot->Tags;
+    tags.reserve(user_->related.Tags.size());
+    for (std::vector<kopsik::Tag *>::const_iterator it =
+        user_->related.Tags.begin();
+            it != user_->related.Tags.end();
+            it++) {
+        tags.push_back((*it)->Name());
+    }
+    std::sort(tags.rbegin(), tags.rend());
+    tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+
+    std::vector<kopsik::Workspace *> workspaces = user_->related.Workspaces;
+    std::sort(workspaces.rbegin(), workspaces.rend(), CompareWorkspaceByName);
+    for (std::vector<kopsik::Workspace *>::const_iterator it =
+        workspaces.begin();
+            it != workspaces.end();
+            it++) {
+        snapshot->Workspaces.push_back(**it);
+        snapshot->Workspaces.back().SetIndex(0);
+    }
+
+    std::vector<kopsik::Client *> clients = user_->related.Clients;
+    std::sort(clients.rbegin(), clients.rend(), CompareClientByName);
+    for (std::vector<kopsik::Client *>::const_iterator it =
+        clients.begin();
+            it != clients.end();
+            it++) {
+        std::vector<kopsik::Client> &list =
+            snapshot->ClientsByWorkspace[(*it)->WID()];
+        list.push_back(**it);
+        list.back().SetIndex(0);
+    }
+
+    return snapshot;
 }
 
 _Bool Context::TrackedPerDateHeader(
     const std::string date_header,
     int *sum) const {
-    if (!user_) {
-        logger().warning("Cannot access time entries, user logged out");
-        return true;
-    }
-    for (std::vector<kopsik::TimeEntry *>::const_iterator it =
-        user_->related.TimeEntries.begin();
-            it != user_->related.TimeEntries.end(); it++) {
-        kopsik::TimeEntry *te = *it;
-        if (te->DurationInSeconds() >= 0 && !te->DeletedAt() &&
-                te->DateHeaderString() == date_header) {
-            sum += te->DurationInSeconds();
-        }
-    }
+    *sum = static_cast<int>(
+        Snapshot()->TrackedPerDay.ForDateHeader(date_header));
     return true;
 }
 
 bool Context::RecordTimeline() const {
+    Poco::Mutex::ScopedLock lock(user_m_);
     return user_ && user_->RecordTimeline();
 }
 
@@ -1421,6 +1730,15 @@ _Bool Context::SaveUpdateChannel(
     return exportErrorState(db_->SaveUpdateChannel(std::string(channel)));
 }
 
+_Bool Context::DatabaseStats(
+    Poco::UInt64 *file_size,
+    Poco::UInt64 *wal_size,
+    Poco::UInt64 *freelist_pages,
+    double *cache_hit_ratio) {
+    return exportErrorState(db_->Stats(
+        file_size, wal_size, freelist_pages, cache_hit_ratio));
+}
+
 _Bool Context::LoadUpdateChannel(std::string *channel) {
     return exportErrorState(db_->LoadUpdateChannel(channel));
 }
@@ -1433,6 +1751,7 @@ void Context::ProjectLabelAndColorCode(
     poco_assert(project_and_task_label);
     poco_assert(color_code);
 
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         return;
     }
@@ -1510,62 +1829,71 @@ void Context::getTimeEntryAutocompleteItems(
     for (std::vector<kopsik::TimeEntry *>::const_iterator it =
         user_->related.TimeEntries.begin();
             it != user_->related.TimeEntries.end(); it++) {
-        kopsik::TimeEntry *te = *it;
-
-        if (te->DeletedAt() || te->IsMarkedAsDeletedOnServer()
-                || te->Description().empty()) {
-            continue;
+        AutocompleteItem autocomplete_item;
+        if (timeEntryAutocompleteItem(*it, &autocomplete_item)) {
+            list->push_back(autocomplete_item);
         }
+    }
+}
 
-        kopsik::Task *t = 0;
-        if (te->TID()) {
-            t = user_->GetTaskByID(te->TID());
-        }
+bool Context::timeEntryAutocompleteItem(
+    kopsik::TimeEntry *te,
+    AutocompleteItem *autocomplete_item) const {
+    poco_assert(te);
+    poco_assert(autocomplete_item);
 
-        kopsik::Project *p = 0;
-        if (t && t->PID()) {
-            p = user_->GetProjectByID(t->PID());
-        } else if (te->PID()) {
-            p = user_->GetProjectByID(te->PID());
-        }
+    if (te->DeletedAt() || te->IsMarkedAsDeletedOnServer()
+            || te->Description().empty()) {
+        return false;
+    }
 
-        if (p && !p->Active()) {
-            continue;
-        }
+    kopsik::Task *t = 0;
+    if (te->TID()) {
+        t = user_->GetTaskByID(te->TID());
+    }
 
-        kopsik::Client *c = 0;
-        if (p && p->CID()) {
-            c = user_->GetClientByID(p->CID());
-        }
+    kopsik::Project *p = 0;
+    if (t && t->PID()) {
+        p = user_->GetProjectByID(t->PID());
+    } else if (te->PID()) {
+        p = user_->GetProjectByID(te->PID());
+    }
 
-        std::string project_label = Formatter::JoinTaskNameReverse(t, p, c);
+    if (p && !p->Active()) {
+        return false;
+    }
 
-        std::stringstream search_parts;
-        search_parts << te->Description();
-        std::string description = search_parts.str();
-        if (!project_label.empty()) {
-            search_parts << " - " << project_label;
-        }
+    kopsik::Client *c = 0;
+    if (p && p->CID()) {
+        c = user_->GetClientByID(p->CID());
+    }
 
-        std::string text = search_parts.str();
-        if (text.empty()) {
-            continue;
-        }
+    std::string project_label = Formatter::JoinTaskNameReverse(t, p, c);
 
-        AutocompleteItem autocomplete_item;
-        autocomplete_item.Description = description;
-        autocomplete_item.Text = text;
-        autocomplete_item.ProjectAndTaskLabel = project_label;
-        if (p) {
-            autocomplete_item.ProjectColor = p->ColorCode();
-            autocomplete_item.ProjectID = p->ID();
-        }
-        if (t) {
-            autocomplete_item.TaskID = t->ID();
-        }
-        autocomplete_item.Type = kAutocompleteItemTE;
-        list->push_back(autocomplete_item);
+    std::stringstream search_parts;
+    search_parts << te->Description();
+    std::string description = search_parts.str();
+    if (!project_label.empty()) {
+        search_parts << " - " << project_label;
+    }
+
+    std::string text = search_parts.str();
+    if (text.empty()) {
+        return false;
+    }
+
+    autocomplete_item->Description = description;
+    autocomplete_item->Text = text;
+    autocomplete_item->ProjectAndTaskLabel = project_label;
+    if (p) {
+        autocomplete_item->ProjectColor = p->ColorCode();
+        autocomplete_item->ProjectID = p->ID();
     }
+    if (t) {
+        autocomplete_item->TaskID = t->ID();
+    }
+    autocomplete_item->Type = kAutocompleteItemTE;
+    return true;
 }
 
 // Add tasks, in format:
@@ -1666,23 +1994,52 @@ void Context::AutocompleteItems(
     const bool include_tasks,
     const bool include_projects) const {
     poco_assert(list);
-    if (!user_) {
-        return;
-    }
 
-    if (include_time_entries) {
-        getTimeEntryAutocompleteItems(list);
+    // Items of the snapshot are already sorted, and
+    // leaving out some of them keeps them sorted.
+    ViewSnapshotRef snapshot = Snapshot();
+    for (std::vector<AutocompleteItem>::const_iterator it =
+        snapshot->AutocompleteItems.begin();
+            it != snapshot->AutocompleteItems.end(); it++) {
+        if ((it->IsTimeEntry() && include_time_entries)
+                || (it->IsTask() && include_tasks)
+                || (it->IsProject() && include_projects)) {
+            list->push_back(*it);
+        }
     }
+}
 
-    if (include_tasks) {
-        getTaskAutocompleteItems(list);
-    }
+_Bool Context::SearchTimeEntries(
+    const std::string query,
+    const unsigned int limit,
+    std::vector<AutocompleteItem> *list) {
+    poco_assert(list);
 
-    if (include_projects) {
-        getProjectAutocompleteItems(list);
+    Poco::Mutex::ScopedLock lock(user_m_);
+    if (!user_) {
+        logger().warning("User logged out, cannot search time entries");
+        return true;
     }
 
-    std::sort(list->begin(), list->end(), CompareAutocompleteItems);
+    // Searches all stored time entries, not only the loaded ones
+    std::vector<kopsik::TimeEntry *> found;
+    kopsik::error err = db_->SearchTimeEntries(
+        user_->ID(), query, limit, &found);
+    if (err == kopsik::noError) {
+        for (std::vector<kopsik::TimeEntry *>::const_iterator it =
+            found.begin();
+                it != found.end(); it++) {
+            AutocompleteItem autocomplete_item;
+            if (timeEntryAutocompleteItem(*it, &autocomplete_item)) {
+                list->push_back(autocomplete_item);
+            }
+        }
+    }
+    for (std::vector<kopsik::TimeEntry *>::const_iterator it = found.begin();
+            it != found.end(); it++) {
+        delete *it;
+    }
+    return exportErrorState(err);
 }
 
 _Bool Context::AddProject(
@@ -1693,6 +2050,7 @@ _Bool Context::AddProject(
     Project **result) {
     poco_assert(result);
 
+    Poco::Mutex::ScopedLock lock(user_m_);
     if (!user_) {
         logger().warning("Cannot add project, user logged out");
         return true;
@@ -1768,6 +2126,11 @@ void Context::onRemind(Poco::Util::TimerTask& task) {  // NOLINT
         return;
     }
 
+    Poco::Mutex::ScopedLock lock(user_m_);
+    if (!user_) {
+        return;
+    }
+
     if (user_->RunningTimeEntry()) {
         logger().debug("User is already tracking time, no need to remind");
         return;
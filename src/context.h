@@ -14,6 +14,7 @@
 #include "./timeline_uploader.h"
 #include "./CustomErrorHandler.h"
 #include "./autocomplete_item.h"
+#include "./view_snapshot.h"
 #include "./feedback.h"
 #include "./kopsik_api.h"
 
@@ -21,6 +22,7 @@
 #include "Poco/Util/TimerTask.h"
 #include "Poco/Util/Timer.h"
 #include "Poco/LocalDateTime.h"
+#include "Poco/SharedPtr.h"
 
 namespace kopsik {
 
@@ -37,6 +39,9 @@ class Context {
     // Close connections and wait for tasks to finish
     void Shutdown();
 
+    // Commit queued saves now and deliver their model changes
+    _Bool FlushSave();
+
     // Start tasks
     void FullSync();
     void SwitchWebSocketOff();
@@ -140,13 +145,26 @@ class Context {
 
     std::vector<std::string> Tags() const;
 
-    std::vector<kopsik::Workspace *> Workspaces() const;
+    std::vector<kopsik::Workspace> Workspaces() const;
 
-    std::vector<kopsik::Client *> Clients(
+    std::vector<kopsik::Client> Clients(
         const Poco::UInt64 workspace_id) const;
 
     kopsik::TimeEntry *GetTimeEntryByGUID(const std::string GUID) const;
 
+    // Reads a time entry as it was last saved, for entries that
+    // are not in the snapshot. Caller owns it.
+    _Bool LoadTimeEntryByGUID(
+        const std::string GUID,
+        kopsik::TimeEntry **result) const;
+
+    // Reads time entries in range as they were last saved, for
+    // ranges outside of the snapshot. Caller owns them.
+    _Bool LoadTimeEntriesInRange(
+        const Poco::Int64 from,
+        const Poco::Int64 to,
+        std::vector<kopsik::TimeEntry *> *result) const;
+
     _Bool Start(
         const std::string description,
         const std::string duration,
@@ -199,14 +217,15 @@ class Context {
         const Poco::Int64 at,
         kopsik::TimeEntry **result);
 
-    _Bool RunningTimeEntry(
-        kopsik::TimeEntry **running) const;
-
     _Bool ToggleTimelineRecording();
 
-    _Bool TimeEntries(
-        std::map<std::string, Poco::Int64> *date_durations,
-        std::vector<kopsik::TimeEntry *> *visible) const;
+    // Data last published for UI queries. Reading it takes no
+    // locks that syncs or saves hold while they run, only the one
+    // that guards copying the pointer.
+    ViewSnapshotRef Snapshot() const;
+
+    // Loads time entries that are older than the ones in memory
+    _Bool LoadOlderTimeEntries(_Bool *has_more);
 
     _Bool TrackedPerDateHeader(
         const std::string date_header,
@@ -219,6 +238,12 @@ class Context {
 
     _Bool LoadUpdateChannel(std::string *channel);
 
+    _Bool DatabaseStats(
+        Poco::UInt64 *file_size,
+        Poco::UInt64 *wal_size,
+        Poco::UInt64 *freelist_pages,
+        double *cache_hit_ratio);
+
     void ProjectLabelAndColorCode(
         kopsik::TimeEntry *te,
         std::string *project_and_task_label,
@@ -230,6 +255,12 @@ class Context {
         const bool include_tasks,
         const bool include_projects) const;
 
+    // Time entries matching the query, most recently tracked first
+    _Bool SearchTimeEntries(
+        const std::string query,
+        const unsigned int limit,
+        std::vector<AutocompleteItem> *list);
+
     _Bool AddProject(
         const Poco::UInt64 workspace_id,
         const Poco::UInt64 client_id,
@@ -254,8 +285,13 @@ class Context {
 
     void sync(const bool full_sync);
 
+    // Queue a save on the persistence thread. Bursts of
+    // saves are coalesced into a single SaveUser call.
     error save(const bool push_changes = true);
 
+    // Run the queued save, if any, on the calling thread
+    error flushSave();
+
     void partialSync();
 
     // timer_ callbacks
@@ -270,12 +306,22 @@ class Context {
     void onTimelineUpdateServerSettings(Poco::Util::TimerTask& task);  // NOLINT
     void onSendFeedback(Poco::Util::TimerTask& task);  // NOLINT
     void onRemind(Poco::Util::TimerTask&);  // NOLINT
+    void onSave(Poco::Util::TimerTask& task);  // NOLINT
+    void onDatabaseMaintenance(Poco::Util::TimerTask& task);  // NOLINT
 
     void startPeriodicUpdateCheck();
+    void scheduleDatabaseMaintenance();
+
+    // Written at shutdown and while idle, not on every save
+    void writeSnapshot();
+
     void executeUpdateCheck();
 
     void getTimeEntryAutocompleteItems(
         std::vector<AutocompleteItem> *list) const;
+    bool timeEntryAutocompleteItem(
+        kopsik::TimeEntry *te,
+        AutocompleteItem *autocomplete_item) const;
     void getTaskAutocompleteItems(
         std::vector<AutocompleteItem> *list) const;
     void getProjectAutocompleteItems(
@@ -297,12 +343,28 @@ class Context {
 
     void setUser(User *value);
 
+    // Builds a snapshot of current user data and publishes it.
+    // Called after user data has been saved, and when the user
+    // or the time entries in memory are replaced.
+    void publishSnapshot();
+    ViewSnapshot *buildSnapshot();
+
     Poco::Mutex db_m_;
     kopsik::Database *db_;
 
-    Poco::Mutex user_m_;
+    // Held while user_ or its models are read or changed, and while
+    // they are saved, so that a save never sees a model halfway
+    // through a change. Not held during requests to the server.
+    mutable Poco::Mutex user_m_;
     kopsik::User *user_;
 
+    // Held only while swapping or copying the pointer, as
+    // copying a Poco::SharedPtr is not atomic
+    mutable Poco::Mutex snapshot_m_;
+    Poco::SharedPtr<ViewSnapshot> snapshot_;
+    // Keeps snapshots published in the order they were built
+    Poco::Mutex publish_m_;
+
     Poco::Mutex ws_client_m_;
     kopsik::WebSocketClient *ws_client_;
 
@@ -338,10 +400,20 @@ class Context {
     Poco::Timestamp next_fetch_updates_at_;
     Poco::Timestamp next_update_timeline_settings_at_;
     Poco::Timestamp next_reminder_at_;
+    Poco::Timestamp next_save_at_;
 
     // Schedule tasks using a timer:
     Poco::Mutex timer_m_;
     Poco::Util::Timer timer_;
+
+    // Saves are written behind on their own thread, so that
+    // long syncs on timer_ do not delay them:
+    Poco::Mutex save_m_;
+    Poco::Mutex flush_m_;
+    bool save_requested_;
+    bool push_after_save_;
+    Poco::Mutex save_timer_m_;
+    Poco::Util::Timer save_timer_;
 };
 
 }  // namespace kopsik
@@ -1,31 +1,155 @@
 // Copyright 2014 Toggl Desktop developers.
 
-// All session access should be locked.
+// Access to the writer session should be locked with mutex_.
+// Reads go through ReadSession, which hands out a reader session
+// from the pool, or locks the writer session if none is free.
 
 #include "./database.h"
 
 #include <limits>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "./user.h"
+#include "./snapshot.h"
+#include "./const.h"
+#include "./timeline_constants.h"
 
+#include "Poco/File.h"
 #include "Poco/Logger.h"
+#include "Poco/LocalDateTime.h"
+#include "Poco/Timespan.h"
 #include "Poco/UUID.h"
 #include "Poco/UUIDGenerator.h"
 #include "Poco/Stopwatch.h"
+#include "Poco/String.h"
 #include "Poco/Data/Common.h"
-#include "Poco/Data/RecordSet.h"
 #include "Poco/Data/Statement.h"
 #include "Poco/Data/Binding.h"
 #include "Poco/Data/SQLite/SessionImpl.h"
 #include "Poco/Data/SQLite/Utility.h"
+#include "Poco/Data/SessionPool.h"
+#include "Poco/Data/DataException.h"
 
 namespace kopsik {
 
+void CountingMutex::lock() {
+    if (mutex_.tryLock()) {
+        locks_++;
+        return;
+    }
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+    mutex_.lock();
+    stopwatch.stop();
+    locks_++;
+    contended_locks_++;
+    wait_time_ += stopwatch.elapsed();
+}
+
+void CountingMutex::unlock() {
+    mutex_.unlock();
+}
+
+// Reader sessions may only read. SQLite 3.7.17 has no query_only
+// pragma and Poco opens sessions without flags, so statements that
+// would write are refused when they are prepared.
+static int authorizeRead(
+    void *,
+    int action,
+    const char *,
+    const char *value,
+    const char *,
+    const char *) {
+    switch (action) {
+    case SQLITE_SELECT:
+    case SQLITE_READ:
+    case SQLITE_FUNCTION:
+    case SQLITE_TRANSACTION:
+        return SQLITE_OK;
+    case SQLITE_PRAGMA:
+        // Setting a pragma may write, querying it does not
+        return value ? SQLITE_DENY : SQLITE_OK;
+    }
+    return SQLITE_DENY;
+}
+
+// Sessions that are only used for reading.
+// Idle sessions are kept open: the janitor timer would run in the
+// default thread pool, which is joined on shutdown.
+class ReaderSessionPool : public Poco::Data::SessionPool {
+ public:
+    explicit ReaderSessionPool(const std::string db_path)
+        : Poco::Data::SessionPool(
+        "SQLite", db_path, 1, kDatabaseReaderSessions, 0) {}
+
+ protected:
+    void customizeSession(Poco::Data::Session &session) {  // NOLINT
+        Poco::Data::SQLite::SessionImpl *impl =
+            static_cast<Poco::Data::SQLite::SessionImpl *>(session.impl());
+        sqlite3_busy_timeout(impl->db(), kDatabaseBusyTimeoutMillis);
+        session << "PRAGMA mmap_size = " << kDatabaseMmapSize,
+                Poco::Data::now;
+        sqlite3_set_authorizer(impl->db(), authorizeRead, 0);
+    }
+};
+
+// Gives a reader session from the pool, or the writer session
+// (holding the writer lock) if all reader sessions are in use.
+class ReadSession {
+ public:
+    explicit ReadSession(Database *db)
+        : db_(db)
+    , pooled_(0) {
+        if (db_->readers_) {
+            try {
+                pooled_ = new Poco::Data::Session(db_->readers_->get());
+                db_->pooled_reads_++;
+                return;
+            } catch(const Poco::Data::SessionPoolExhaustedException &) {
+                // All reader sessions are in use
+            }
+        }
+        db_->mutex_.lock();
+        db_->writer_reads_++;
+    }
+
+    ~ReadSession() {
+        if (pooled_) {
+            delete pooled_;
+        } else {
+            db_->mutex_.unlock();
+        }
+    }
+
+    Poco::Data::Session &operator*() {
+        if (pooled_) {
+            return *pooled_;
+        }
+        return *db_->session;
+    }
+
+ private:
+    Database *db_;
+    Poco::Data::Session *pooled_;
+};
+
 Database::Database(const std::string db_path)
     : session(0)
-, desktop_id_("") {
+, db_path_(db_path)
+, desktop_id_("")
+, prepared_statement_hits_(0)
+, prepared_statement_misses_(0)
+, prepared_statement_compile_time_(0)
+, time_entry_window_days_(0)
+, saved_totals_(0)
+, schema_check_time_(0)
+, applied_migrations_(0)
+, full_text_search_(false)
+, readers_(0)
+, timeline_writer_(this, &Database::timeline_writer_loop) {
     Poco::Data::SQLite::Connector::registerConnector();
 
     session = new Poco::Data::Session("SQLite", db_path);
@@ -40,7 +164,12 @@ Database::Database(const std::string db_path)
         poco_assert(is_sqlite_threadsafe);
     }
 
-    error err = setJournalMode("wal");
+    error err = configure();
+    if (err != noError) {
+        logger().error(err);
+    }
+
+    err = setJournalMode("wal");
     poco_assert(err == noError);
     {
         std::string mode("");
@@ -60,6 +189,11 @@ Database::Database(const std::string db_path)
     }
     poco_assert(err == noError);
 
+    // In-memory databases cannot be shared between sessions
+    if (db_path != ":memory:") {
+        readers_ = new ReaderSessionPool(db_path);
+    }
+
     Poco::NotificationCenter& nc =
         Poco::NotificationCenter::defaultCenter();
 
@@ -77,9 +211,36 @@ Database::Database(const std::string db_path)
     observeDelete(*this,
                   &Database::handleDeleteTimelineBatchNotification);
     nc.addObserver(observeDelete);
+
+    timeline_writer_.start();
 }
 
 Database::~Database() {
+    Poco::NotificationCenter& nc =
+        Poco::NotificationCenter::defaultCenter();
+
+    nc.removeObserver(Poco::Observer<Database, TimelineEventNotification>(
+        *this, &Database::handleTimelineEventNotification));
+    nc.removeObserver(
+        Poco::Observer<Database, CreateTimelineBatchNotification>(
+            *this, &Database::handleCreateTimelineBatchNotification));
+    nc.removeObserver(
+        Poco::Observer<Database, DeleteTimelineBatchNotification>(
+            *this, &Database::handleDeleteTimelineBatchNotification));
+
+    timeline_writer_.stop();
+    timeline_flush_requested_.set();
+    timeline_writer_.wait();
+    error err = FlushTimelineEvents();
+    if (err != noError) {
+        logger().error(err);
+    }
+
+    if (readers_) {
+        delete readers_;
+        readers_ = 0;
+    }
+    clearPreparedStatements();
     if (session) {
         delete session;
         session = 0;
@@ -97,6 +258,11 @@ error Database::DeleteUser(
         return err;
     }
     if (with_related_data) {
+        Poco::UInt64 deleted_generation(0);
+        err = bumpGeneration(&deleted_generation);
+        if (err != noError) {
+            return err;
+        }
         err = deleteAllFromTableByUID("workspaces", model->ID());
         if (err != noError) {
             return err;
@@ -121,6 +287,10 @@ error Database::DeleteUser(
         if (err != noError) {
             return err;
         }
+        err = deleteAllFromTableByUID("daily_totals", model->ID());
+        if (err != noError) {
+            return err;
+        }
     }
     return noError;
 }
@@ -132,7 +302,7 @@ error Database::deleteAllFromTableByUID(
     poco_assert(UID > 0);
     poco_assert(!table_name.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         *session << "delete from " + table_name + " where uid = :uid",
@@ -152,7 +322,7 @@ error Database::journalMode(std::string *mode) {
     poco_assert(session);
     poco_assert(mode);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         *session << "PRAGMA journal_mode",
@@ -172,7 +342,7 @@ error Database::setJournalMode(const std::string mode) {
     poco_assert(session);
     poco_assert(!mode.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         *session << "PRAGMA journal_mode=" << mode,
@@ -187,6 +357,170 @@ error Database::setJournalMode(const std::string mode) {
     return last_error("setJournalMode");
 }
 
+error Database::configure() {
+    poco_assert(session);
+
+    std::stringstream ss;
+    ss << "PRAGMA page_size = " << kDatabasePageSize << "; "
+       << "PRAGMA auto_vacuum = INCREMENTAL; "
+       << "PRAGMA cache_size = -" << kDatabaseCacheSizeKiB << "; "
+       << "PRAGMA mmap_size = " << kDatabaseMmapSize << "; "
+       << "PRAGMA synchronous = NORMAL; "
+       // Rows replaced by INSERT OR REPLACE fire delete triggers too
+       << "PRAGMA recursive_triggers = ON; "
+       << "PRAGMA temp_store = MEMORY;";
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+    if (sqlite3_exec(sqlite->db(), ss.str().c_str(), 0, 0, 0) != SQLITE_OK) {
+        return last_error("configure");
+    }
+    return noError;
+}
+
+error Database::pragma(
+    const std::string name,
+    Poco::Int64 *result) {
+    poco_assert(session);
+    poco_assert(!name.empty());
+    poco_assert(result);
+
+    *result = 0;
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        *session << "PRAGMA " << name,
+                 Poco::Data::into(*result),
+                 Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("pragma " + name);
+}
+
+error Database::Maintain() {
+    poco_assert(session);
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+
+    // Does not wait for readers, pages still in use are
+    // checkpointed on some later run.
+    int wal_pages(0), checkpointed_pages(0);
+    {
+        CountingMutex::ScopedLock lock(mutex_);
+        int rc = sqlite3_wal_checkpoint_v2(sqlite->db(), 0,
+                                           SQLITE_CHECKPOINT_PASSIVE,
+                                           &wal_pages, &checkpointed_pages);
+        if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+            return last_error("Maintain");
+        }
+    }
+
+    Poco::Int64 auto_vacuum(0);
+    error err = pragma("auto_vacuum", &auto_vacuum);
+    if (err != noError) {
+        return err;
+    }
+    Poco::Int64 freelist_pages(0);
+    err = pragma("freelist_count", &freelist_pages);
+    if (err != noError) {
+        return err;
+    }
+
+    // Free pages are given back in small steps, and the writer is
+    // released between them so that saves don't wait for long.
+    // Files created before auto vacuum was enabled would need a
+    // full VACUUM instead; their free pages are only reused.
+    std::stringstream ss;
+    ss << "PRAGMA incremental_vacuum("
+       << kDatabaseIncrementalVacuumPages << ");";
+    int steps(0);
+    Poco::Int64 remaining_pages(auto_vacuum ? freelist_pages : 0);
+    while (remaining_pages > 0 && steps < kDatabaseIncrementalVacuumSteps) {
+        CountingMutex::ScopedLock lock(mutex_);
+        if (sqlite3_exec(sqlite->db(), ss.str().c_str(), 0, 0, 0)
+                != SQLITE_OK) {
+            return last_error("Maintain");
+        }
+        remaining_pages -= kDatabaseIncrementalVacuumPages;
+        steps++;
+    }
+
+    stopwatch.stop();
+
+    std::stringstream done;
+    done << "Maintain checkpointed " << checkpointed_pages << " of "
+         << wal_pages << " WAL pages, " << freelist_pages
+         << " free pages, ran " << steps << " incremental vacuum steps in "
+         << stopwatch.elapsed() / 1000 << " ms";
+    logger().debug(done.str());
+
+    return noError;
+}
+
+error Database::Stats(
+    Poco::UInt64 *file_size,
+    Poco::UInt64 *wal_size,
+    Poco::UInt64 *freelist_pages,
+    double *cache_hit_ratio) {
+    poco_assert(session);
+    poco_assert(file_size);
+    poco_assert(wal_size);
+    poco_assert(freelist_pages);
+    poco_assert(cache_hit_ratio);
+
+    *file_size = 0;
+    *wal_size = 0;
+    *freelist_pages = 0;
+    *cache_hit_ratio = 0;
+
+    try {
+        Poco::File db_file(db_path_);
+        if (db_file.exists()) {
+            *file_size = db_file.getSize();
+        }
+        Poco::File wal_file(db_path_ + "-wal");
+        if (wal_file.exists()) {
+            *wal_size = wal_file.getSize();
+        }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    }
+
+    Poco::Int64 free_pages(0);
+    error err = pragma("freelist_count", &free_pages);
+    if (err != noError) {
+        return err;
+    }
+    *freelist_pages = free_pages;
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+    int hits(0), misses(0), highwater(0);
+    sqlite3_db_status(sqlite->db(), SQLITE_DBSTATUS_CACHE_HIT,
+                      &hits, &highwater, 0);
+    sqlite3_db_status(sqlite->db(), SQLITE_DBSTATUS_CACHE_MISS,
+                      &misses, &highwater, 0);
+    if (hits + misses > 0) {
+        *cache_hit_ratio = static_cast<double>(hits) / (hits + misses);
+    }
+
+    return noError;
+}
+
 Poco::Logger &Database::logger() const {
     return Poco::Logger::get("database");
 }
@@ -201,17 +535,18 @@ error Database::deleteFromTable(
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     std::stringstream ss;
     ss << "Deleting from table " << table_name
        << ", local ID: " << local_id;
     logger().debug(ss.str());
     try {
-        *session << "delete from " + table_name +
-                 " where local_id = :local_id",
-                 Poco::Data::use(local_id),
-                 Poco::Data::now;
+        PreparedStatement *statement = prepared(
+            table_name + ".delete",
+            "delete from " + table_name + " where local_id = :local_id");
+        statement->Use(local_id);
+        statement->Execute();
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -225,7 +560,7 @@ error Database::deleteFromTable(
 error Database::last_error(const std::string was_doing) {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     Poco::Data::SessionImpl* impl = session->impl();
     Poco::Data::SQLite::SessionImpl* sqlite =
@@ -237,6 +572,172 @@ error Database::last_error(const std::string was_doing) {
     return noError;
 }
 
+PreparedStatement::~PreparedStatement() {
+    sqlite3_finalize(stmt_);
+}
+
+void PreparedStatement::Use(const Poco::Int64 value) {
+    sqlite3_bind_int64(stmt_, ++position_, value);
+}
+
+void PreparedStatement::Use(const Poco::UInt64 value) {
+    sqlite3_bind_int64(stmt_, ++position_, static_cast<sqlite3_int64>(value));
+}
+
+void PreparedStatement::Use(const bool value) {
+    sqlite3_bind_int(stmt_, ++position_, value ? 1 : 0);
+}
+
+void PreparedStatement::Use(const std::string &value) {
+    sqlite3_bind_text(stmt_, ++position_, value.c_str(),
+                      static_cast<int>(value.size()), SQLITE_TRANSIENT);
+}
+
+bool PreparedStatement::Execute() {
+    int rc = sqlite3_step(stmt_);
+    reset();
+    return SQLITE_DONE == rc || SQLITE_ROW == rc;
+}
+
+bool PreparedStatement::Fetch() {
+    if (SQLITE_ROW == sqlite3_step(stmt_)) {
+        return true;
+    }
+    reset();
+    return false;
+}
+
+void PreparedStatement::reset() {
+    // Resetting leaves the result code of the step in
+    // the database handle, and releases the statement
+    // so it can be bound again on next use.
+    sqlite3_reset(stmt_);
+    sqlite3_clear_bindings(stmt_);
+    position_ = 0;
+}
+
+Poco::Int64 PreparedStatement::Int64(const int column) const {
+    return sqlite3_column_int64(stmt_, column);
+}
+
+Poco::UInt64 PreparedStatement::UInt64(const int column) const {
+    return static_cast<Poco::UInt64>(sqlite3_column_int64(stmt_, column));
+}
+
+bool PreparedStatement::Bool(const int column) const {
+    return sqlite3_column_int(stmt_, column) != 0;
+}
+
+std::string PreparedStatement::String(const int column) const {
+    const unsigned char *text = sqlite3_column_text(stmt_, column);
+    if (!text) {
+        return std::string("");
+    }
+    return std::string(reinterpret_cast<const char *>(text),
+                       sqlite3_column_bytes(stmt_, column));
+}
+
+PreparedStatement *Database::prepared(
+    const std::string key,
+    const std::string sql) {
+    poco_assert(session);
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    std::map<std::string, PreparedStatement *>::const_iterator it =
+        prepared_statements_.find(key);
+    if (it != prepared_statements_.end()) {
+        prepared_statement_hits_++;
+        return it->second;
+    }
+    prepared_statement_misses_++;
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+    sqlite3_stmt *stmt = 0;
+    int rc = sqlite3_prepare_v2(sqlite->db(), sql.c_str(), -1, &stmt, 0);
+    if (rc != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        Poco::Data::SQLite::Utility::throwException(
+            rc, Poco::Data::SQLite::Utility::lastError(sqlite->db()));
+    }
+    PreparedStatement *statement = new PreparedStatement(sqlite->db(), stmt);
+    prepared_statements_[key] = statement;
+
+    stopwatch.stop();
+    prepared_statement_compile_time_ += stopwatch.elapsed();
+
+    return statement;
+}
+
+void Database::clearPreparedStatements() {
+    CountingMutex::ScopedLock lock(mutex_);
+
+    for (std::map<std::string, PreparedStatement *>::iterator it =
+        prepared_statements_.begin();
+            it != prepared_statements_.end();
+            ++it) {
+        delete it->second;
+    }
+    prepared_statements_.clear();
+}
+
+Poco::Int64 Database::lastInsertRowID() {
+    poco_assert(session);
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+    return sqlite3_last_insert_rowid(sqlite->db());
+}
+
+void Database::LockStats(
+    Poco::UInt64 *write_locks,
+    Poco::UInt64 *contended_write_locks,
+    Poco::Timestamp::TimeDiff *write_lock_wait,
+    Poco::UInt64 *pooled_reads,
+    Poco::UInt64 *writer_reads) {
+    poco_assert(write_locks);
+    poco_assert(contended_write_locks);
+    poco_assert(write_lock_wait);
+    poco_assert(pooled_reads);
+    poco_assert(writer_reads);
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    *write_locks = mutex_.Locks();
+    *contended_write_locks = mutex_.ContendedLocks();
+    *write_lock_wait = mutex_.WaitTime();
+    *pooled_reads = pooled_reads_.value();
+    *writer_reads = writer_reads_.value();
+}
+
+void Database::PreparedStatementStats(
+    Poco::UInt64 *hits,
+    Poco::UInt64 *misses) {
+    poco_assert(hits);
+    poco_assert(misses);
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    *hits = prepared_statement_hits_;
+    *misses = prepared_statement_misses_;
+}
+
+void Database::SchemaStats(
+    Poco::Timestamp::TimeDiff *check_time,
+    Poco::UInt64 *applied_migrations) const {
+    poco_assert(check_time);
+    poco_assert(applied_migrations);
+
+    *check_time = schema_check_time_;
+    *applied_migrations = applied_migrations_;
+}
+
 std::string Database::GenerateGUID() {
     Poco::UUIDGenerator& generator = Poco::UUIDGenerator::defaultGenerator();
     Poco::UUID uuid(generator.createRandom());
@@ -272,19 +773,18 @@ error Database::LoadSettings(
     poco_assert(on_top);
     poco_assert(reminder);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
-
     try {
-        *session << "select use_idle_detection, menubar_timer, dock_icon, "
-                 "on_top, reminder "
-                 "from settings",
-                 Poco::Data::into(*use_idle_detection),
-                 Poco::Data::into(*menubar_timer),
-                 Poco::Data::into(*dock_icon),
-                 Poco::Data::into(*on_top),
-                 Poco::Data::into(*reminder),
-                 Poco::Data::limit(1),
-                 Poco::Data::now;
+        ReadSession reader(this);
+        *reader << "select use_idle_detection, menubar_timer, dock_icon, "
+                "on_top, reminder "
+                "from settings",
+                Poco::Data::into(*use_idle_detection),
+                Poco::Data::into(*menubar_timer),
+                Poco::Data::into(*dock_icon),
+                Poco::Data::into(*on_top),
+                Poco::Data::into(*reminder),
+                Poco::Data::limit(1),
+                Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -292,7 +792,7 @@ error Database::LoadSettings(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("LoadSettings");
+    return noError;
 }
 
 error Database::LoadProxySettings(
@@ -302,19 +802,18 @@ error Database::LoadProxySettings(
     poco_assert(use_proxy);
     poco_assert(proxy);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
-
     try {
-        *session << "select use_proxy, proxy_host, proxy_port, "
-                 "proxy_username, proxy_password "
-                 "from settings",
-                 Poco::Data::into(*use_proxy),
-                 Poco::Data::into(proxy->host),
-                 Poco::Data::into(proxy->port),
-                 Poco::Data::into(proxy->username),
-                 Poco::Data::into(proxy->password),
-                 Poco::Data::limit(1),
-                 Poco::Data::now;
+        ReadSession reader(this);
+        *reader << "select use_proxy, proxy_host, proxy_port, "
+                "proxy_username, proxy_password "
+                "from settings",
+                Poco::Data::into(*use_proxy),
+                Poco::Data::into(proxy->host),
+                Poco::Data::into(proxy->port),
+                Poco::Data::into(proxy->username),
+                Poco::Data::into(proxy->password),
+                Poco::Data::limit(1),
+                Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -322,7 +821,7 @@ error Database::LoadProxySettings(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("LoadProxySettings");
+    return noError;
 }
 
 error Database::SaveSettings(
@@ -333,7 +832,7 @@ error Database::SaveSettings(
     const bool reminder) {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         *session << "update settings set "
@@ -363,7 +862,7 @@ error Database::SaveProxySettings(
     const Proxy *proxy) {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         *session << "update settings set "
@@ -393,13 +892,12 @@ error Database::LoadUpdateChannel(
     poco_assert(session);
     poco_assert(update_channel);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
-
     try {
-        *session << "select update_channel from settings",
-                 Poco::Data::into(*update_channel),
-                 Poco::Data::limit(1),
-                 Poco::Data::now;
+        ReadSession reader(this);
+        *reader << "select update_channel from settings",
+                Poco::Data::into(*update_channel),
+                Poco::Data::limit(1),
+                Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -407,7 +905,7 @@ error Database::LoadUpdateChannel(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("LoadUpdateChannel");
+    return noError;
 }
 
 error Database::SaveUpdateChannel(
@@ -420,7 +918,7 @@ error Database::SaveUpdateChannel(
         return error("Invalid update channel");
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         *session << "update settings set "
@@ -445,7 +943,7 @@ error Database::LoadUserByAPIToken(
     poco_assert(model);
     poco_assert(!api_token.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     Poco::UInt64 uid(0);
     model->SetAPIToken(api_token);
@@ -472,7 +970,24 @@ error Database::LoadUserByAPIToken(
     return LoadUserByID(uid, model, with_related_data);
 }
 
+// Unix timestamp of local midnight, given number of days before given time
+Poco::Int64 startOfDayBefore(const Poco::Int64 at, const Poco::UInt64 days) {
+    Poco::LocalDateTime date(Poco::Timestamp::fromEpochTime(at));
+    date -= Poco::Timespan(static_cast<int>(days), 0, 0, 0, 0);
+    Poco::LocalDateTime midnight(date.year(), date.month(), date.day());
+    return midnight.timestamp().epochTime();
+}
+
 error Database::loadUsersRelatedData(User *user) {
+    if (!snapshot_path_.empty()) {
+        error err = loadSnapshot(user);
+        if (err == noError) {
+            user->related.Reindex();
+            return noError;
+        }
+        logger().debug("Loading user from database: " + err);
+    }
+
     error err = loadWorkspaces(user->ID(), &user->related.Workspaces);
     if (err != noError) {
         return err;
@@ -497,11 +1012,30 @@ error Database::loadUsersRelatedData(User *user) {
         return err;
     }
 
-    err = loadTimeEntries(user->ID(), &user->related.TimeEntries);
+    Poco::Int64 since(0);
+    if (time_entry_window_days_) {
+        since = startOfDayBefore(time(0), time_entry_window_days_);
+    }
+    err = loadTimeEntries(user->ID(), since, &user->related.TimeEntries);
+    if (err != noError) {
+        return err;
+    }
+    bool has_older(false);
+    if (since) {
+        err = hasTimeEntriesStartedBefore(user->ID(), since, &has_older);
+        if (err != noError) {
+            return err;
+        }
+    }
+    user->related.TimeEntriesLoadedSince = has_older ? since : 0;
+
+    err = loadDailyTotals(user->ID(), &user->related.TrackedPerDay);
     if (err != noError) {
         return err;
     }
 
+    user->related.Reindex();
+
     return noError;
 }
 
@@ -513,7 +1047,7 @@ error Database::LoadUserByID(
     poco_assert(session);
     poco_assert(UID > 0);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     Poco::Stopwatch stopwatch;
     stopwatch.start();
@@ -592,147 +1126,1287 @@ error Database::LoadUserByID(
     return noError;
 }
 
-error Database::loadWorkspaces(
-    const Poco::UInt64 UID,
-    std::vector<Workspace *> *list) {
-    poco_assert(UID > 0);
-    poco_assert(list);
+// Columns of the current row are read straight into model
+// fields, in the order they are selected by the loaders.
+// Rows are either selected or read from a snapshot.
+template <typename Row>
+void decodeRow(const Row &row, Workspace *model) {
+    model->SetLocalID(row.Int64(0));
+    model->SetID(row.UInt64(1));
+    model->SetUID(row.UInt64(2));
+    model->SetName(row.String(3));
+    model->SetPremium(row.Bool(4));
+    model->SetOnlyAdminsMayCreateProjects(row.Bool(5));
+    model->SetAdmin(row.Bool(6));
+}
 
-    list->clear();
+template <typename Row>
+void decodeRow(const Row &row, Client *model) {
+    model->SetLocalID(row.Int64(0));
+    model->SetID(row.UInt64(1));
+    model->SetUID(row.UInt64(2));
+    model->SetName(row.String(3));
+    model->SetGUID(row.String(4));
+    model->SetWID(row.UInt64(5));
+}
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+template <typename Row>
+void decodeRow(const Row &row, Project *model) {
+    model->SetLocalID(row.Int64(0));
+    model->SetID(row.UInt64(1));
+    model->SetUID(row.UInt64(2));
+    model->SetName(row.String(3));
+    model->SetGUID(row.String(4));
+    model->SetWID(row.UInt64(5));
+    model->SetColor(row.String(6));
+    model->SetCID(row.UInt64(7));
+    model->SetActive(row.Bool(8));
+    model->SetBillable(row.Bool(9));
+}
 
-    try {
-        Poco::Data::Statement select(*session);
-        select <<
-               "SELECT local_id, id, uid, name, premium, "
-               "only_admins_may_create_projects, admin "
-               "FROM workspaces "
-               "WHERE uid = :uid "
-               "ORDER BY name",
-               Poco::Data::use(UID);
-        error err = last_error("loadWorkspaces");
-        if (err != noError) {
-            return err;
-        }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Workspace *model = new Workspace();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetPremium(rs[4].convert<bool>());
-                model->SetOnlyAdminsMayCreateProjects(rs[5].convert<bool>());
-                model->SetAdmin(rs[6].convert<bool>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
-            }
-        }
-    } catch(const Poco::Exception& exc) {
-        return exc.displayText();
-    } catch(const std::exception& ex) {
-        return ex.what();
-    } catch(const std::string& ex) {
-        return ex;
-    }
-    return last_error("loadWorkspaces");
+template <typename Row>
+void decodeRow(const Row &row, Task *model) {
+    model->SetLocalID(row.Int64(0));
+    model->SetID(row.UInt64(1));
+    model->SetUID(row.UInt64(2));
+    model->SetName(row.String(3));
+    model->SetWID(row.UInt64(4));
+    model->SetPID(row.UInt64(5));
 }
 
-error Database::loadClients(
-    const Poco::UInt64 UID,
-    std::vector<Client *> *list) {
-    poco_assert(UID > 0);
-    poco_assert(list);
+template <typename Row>
+void decodeRow(const Row &row, Tag *model) {
+    model->SetLocalID(row.Int64(0));
+    model->SetID(row.UInt64(1));
+    model->SetUID(row.UInt64(2));
+    model->SetName(row.String(3));
+    model->SetWID(row.UInt64(4));
+    model->SetGUID(row.String(5));
+}
 
-    list->clear();
+template <typename Row>
+void decodeRow(const Row &row, TimeEntry *model) {
+    model->SetLocalID(row.Int64(0));
+    model->SetID(row.UInt64(1));
+    model->SetUID(row.UInt64(2));
+    model->SetDescription(row.String(3));
+    model->SetWID(row.UInt64(4));
+    model->SetGUID(row.String(5));
+    model->SetPID(row.UInt64(6));
+    model->SetTID(row.UInt64(7));
+    model->SetBillable(row.Bool(8));
+    model->SetDurOnly(row.Bool(9));
+    model->SetUIModifiedAt(row.UInt64(10));
+    model->SetStart(row.UInt64(11));
+    model->SetStop(row.UInt64(12));
+    model->SetDurationInSeconds(row.Int64(13));
+    model->SetCreatedWith(row.String(14));
+    model->SetDeletedAt(row.UInt64(15));
+    model->SetUpdatedAt(row.UInt64(16));
+    model->SetProjectGUID(row.String(17));
+}
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+// Models are written into a snapshot in the column order of
+// their selects, so that decodeRow reads them back.
+void encodeRow(const Workspace &model, SnapshotWriter *row) {
+    row->Int(model.LocalID());
+    row->Int(model.ID());
+    row->Int(model.UID());
+    row->String(model.Name());
+    row->Int(model.Premium());
+    row->Int(model.OnlyAdminsMayCreateProjects());
+    row->Int(model.Admin());
+}
 
-    try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, name, guid, wid "
-               "FROM clients "
-               "WHERE uid = :uid "
-               "ORDER BY name",
-               Poco::Data::use(UID);
-
-        error err = last_error("loadClients");
-        if (err != noError) {
-            return err;
-        }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Client *model = new Client();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetGUID(rs[4].convert<std::string>());
-                model->SetWID(rs[5].convert<Poco::UInt64>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
-            }
-        }
-    } catch(const Poco::Exception& exc) {
-        return exc.displayText();
-    } catch(const std::exception& ex) {
-        return ex.what();
-    } catch(const std::string& ex) {
-        return ex;
+void encodeRow(const Client &model, SnapshotWriter *row) {
+    row->Int(model.LocalID());
+    row->Int(model.ID());
+    row->Int(model.UID());
+    row->String(model.Name());
+    row->String(model.GUID());
+    row->Int(model.WID());
+}
+
+void encodeRow(const Project &model, SnapshotWriter *row) {
+    row->Int(model.LocalID());
+    row->Int(model.ID());
+    row->Int(model.UID());
+    row->String(model.Name());
+    row->String(model.GUID());
+    row->Int(model.WID());
+    row->String(model.Color());
+    row->Int(model.CID());
+    row->Int(model.Active());
+    row->Int(model.Billable());
+}
+
+void encodeRow(const Task &model, SnapshotWriter *row) {
+    row->Int(model.LocalID());
+    row->Int(model.ID());
+    row->Int(model.UID());
+    row->String(model.Name());
+    row->Int(model.WID());
+    row->Int(model.PID());
+}
+
+void encodeRow(const Tag &model, SnapshotWriter *row) {
+    row->Int(model.LocalID());
+    row->Int(model.ID());
+    row->Int(model.UID());
+    row->String(model.Name());
+    row->Int(model.WID());
+    row->String(model.GUID());
+}
+
+// Tags follow the selected columns, as they are
+// loaded from a table of their own otherwise.
+void encodeRow(const TimeEntry &model, SnapshotWriter *row) {
+    row->Int(model.LocalID());
+    row->Int(model.ID());
+    row->Int(model.UID());
+    row->String(model.Description());
+    row->Int(model.WID());
+    row->String(model.GUID());
+    row->Int(model.PID());
+    row->Int(model.TID());
+    row->Int(model.Billable());
+    row->Int(model.DurOnly());
+    row->Int(model.UIModifiedAt());
+    row->Int(model.Start());
+    row->Int(model.Stop());
+    row->Int(model.DurationInSeconds());
+    row->String(model.CreatedWith());
+    row->Int(model.DeletedAt());
+    row->Int(model.UpdatedAt());
+    row->String(model.ProjectGUID());
+    row->String(model.Tags());
+}
+
+template <typename T>
+void decodeTags(const SnapshotReader &, T *) {}
+
+void decodeTags(const SnapshotReader &row, TimeEntry *model) {
+    model->SetTags(row.String(18));
+    model->ClearTagsChanged();
+}
+
+// A list is written as a row with the number of models,
+// followed by a row per model.
+template <typename T>
+void encodeModels(const std::vector<T *> &list, SnapshotWriter *writer) {
+    Poco::Int64 count(0);
+    for (size_t i = 0; i < list.size(); i++) {
+        if (list[i]->LocalID()) {
+            count++;
+        }
+    }
+    writer->Int(count);
+    writer->EndRow();
+    for (size_t i = 0; i < list.size(); i++) {
+        if (list[i]->LocalID()) {
+            encodeRow(*list[i], writer);
+            writer->EndRow();
+        }
+    }
+}
+
+template <typename T>
+bool decodeModels(SnapshotReader *reader, std::vector<T *> *list) {
+    if (!reader->Next()) {
+        return false;
+    }
+    const Poco::Int64 count = reader->Int64(0);
+    for (Poco::Int64 i = 0; i < count && reader->Next(); i++) {
+        T *model = new T();
+        decodeRow(*reader, model);
+        decodeTags(*reader, model);
+        model->ClearDirty();
+        list->push_back(model);
+    }
+    return reader->Valid() && list->size() == static_cast<size_t>(count);
+}
+
+template <typename T>
+void deleteModels(std::vector<T *> *list) {
+    for (size_t i = 0; i < list->size(); i++) {
+        delete (*list)[i];
+    }
+    list->clear();
+}
+
+template <typename T>
+error Database::fetchModels(
+    PreparedStatement *select,
+    const std::string was_doing,
+    std::vector<T *> *list) {
+    poco_assert(select);
+    poco_assert(list);
+
+    const size_t first = list->size();
+    while (select->Fetch()) {
+        T *model = new T();
+        decodeRow(*select, model);
+        model->ClearDirty();
+        list->push_back(model);
+    }
+    error err = last_error(was_doing);
+    if (err != noError) {
+        for (size_t i = first; i < list->size(); i++) {
+            delete (*list)[i];
+        }
+        list->resize(first);
+    }
+    return err;
+}
+
+// Rows of the select are pairs of time entry local ID and tag name ID,
+// with the tags of an entry following each other in order.
+error Database::fetchTimeEntryTags(
+    PreparedStatement *select,
+    const std::string was_doing,
+    std::vector<TimeEntry *> *list,
+    const size_t first) {
+    poco_assert(select);
+    poco_assert(list);
+
+    Poco::HashMap<Poco::Int64, TimeEntry *> by_local_id;
+    for (size_t i = first; i < list->size(); i++) {
+        by_local_id[(*list)[i]->LocalID()] = (*list)[i];
+    }
+
+    std::vector<std::pair<Poco::Int64, Poco::Int64> > rows;
+    while (select->Fetch()) {
+        rows.push_back(std::make_pair(select->Int64(0), select->Int64(1)));
+    }
+    error err = last_error(was_doing);
+    if (err != noError) {
+        return err;
+    }
+
+    size_t i = 0;
+    while (i < rows.size()) {
+        const Poco::Int64 local_id = rows[i].first;
+        std::vector<TagNameID> ids;
+        for (; i < rows.size() && rows[i].first == local_id; i++) {
+            TagNameID id(0);
+            err = tagNameID(rows[i].second, &id);
+            if (err != noError) {
+                return err;
+            }
+            ids.push_back(id);
+        }
+        Poco::HashMap<Poco::Int64, TimeEntry *>::Iterator it =
+            by_local_id.find(local_id);
+        if (it == by_local_id.end()) {
+            continue;
+        }
+        TimeEntry *te = it->second;
+        te->SetTagIDs(ids);
+        te->ClearTagsChanged();
+        te->ClearDirty();
+    }
+    return noError;
+}
+
+// Tag name IDs in database are not the ones interned in memory,
+// both ways are cached once looked up.
+error Database::tagNameID(
+    const Poco::Int64 rowid,
+    TagNameID *result) {
+    poco_assert(result);
+
+    std::map<Poco::Int64, TagNameID>::const_iterator it =
+        tag_names_by_rowid_.find(rowid);
+    if (it != tag_names_by_rowid_.end()) {
+        *result = it->second;
+        return noError;
+    }
+
+    PreparedStatement *select = prepared(
+        "tag_names.select",
+        "SELECT name FROM tag_names WHERE id = :id");
+    select->Use(rowid);
+    if (!select->Fetch()) {
+        error err = last_error("tagNameID");
+        if (err != noError) {
+            return err;
+        }
+        return error("Unknown tag name ID");
+    }
+    std::string name = select->String(0);
+    select->Fetch();
+
+    *result = TimeEntry::InternTagName(name);
+    tag_names_by_rowid_[rowid] = *result;
+    tag_name_rowids_[*result] = rowid;
+    return noError;
+}
+
+error Database::tagNameRowID(
+    const TagNameID id,
+    Poco::Int64 *result) {
+    poco_assert(result);
+
+    std::map<TagNameID, Poco::Int64>::const_iterator it =
+        tag_name_rowids_.find(id);
+    if (it != tag_name_rowids_.end()) {
+        *result = it->second;
+        return noError;
+    }
+
+    const std::string name = TimeEntry::TagName(id);
+
+    PreparedStatement *insert = prepared(
+        "tag_names.insert",
+        "INSERT OR IGNORE INTO tag_names(name) VALUES(:name)");
+    insert->Use(name);
+    if (!insert->Execute()) {
+        return last_error("tagNameRowID");
+    }
+
+    PreparedStatement *select = prepared(
+        "tag_names.select_by_name",
+        "SELECT id FROM tag_names WHERE name = :name");
+    select->Use(name);
+    if (!select->Fetch()) {
+        error err = last_error("tagNameRowID");
+        if (err != noError) {
+            return err;
+        }
+        return error("Tag name was not saved: " + name);
+    }
+    *result = select->Int64(0);
+    select->Fetch();
+
+    tag_name_rowids_[id] = *result;
+    tag_names_by_rowid_[*result] = id;
+    return noError;
+}
+
+// Only called when tags of the entry have changed, or the
+// entry has just been inserted; other saves leave them be.
+error Database::saveTimeEntryTags(TimeEntry *model) {
+    poco_assert(model);
+    poco_assert(model->LocalID());
+
+    PreparedStatement *clear = prepared(
+        "time_entry_tags.delete",
+        "DELETE FROM time_entry_tags WHERE time_entry_id = :time_entry_id");
+    clear->Use(model->LocalID());
+    if (!clear->Execute()) {
+        return last_error("saveTimeEntryTags");
+    }
+
+    const std::vector<TagNameID> &ids = model->TagIDs();
+    for (size_t i = 0; i < ids.size(); i++) {
+        Poco::Int64 rowid(0);
+        error err = tagNameRowID(ids[i], &rowid);
+        if (err != noError) {
+            return err;
+        }
+        PreparedStatement *insert = prepared(
+            "time_entry_tags.insert",
+            "INSERT INTO time_entry_tags(time_entry_id, position, "
+            "tag_name_id) VALUES(:time_entry_id, :position, :tag_name_id)");
+        insert->Use(model->LocalID());
+        insert->Use(static_cast<Poco::Int64>(i));
+        insert->Use(rowid);
+        if (!insert->Execute()) {
+            return last_error("saveTimeEntryTags");
+        }
+    }
+    model->ClearTagsChanged();
+    return noError;
+}
+
+error Database::generation(Poco::UInt64 *result) {
+    poco_assert(result);
+
+    *result = 0;
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        PreparedStatement *select = prepared(
+            "kopsik_generation.select",
+            "SELECT generation FROM kopsik_generation WHERE id = 1");
+        if (select->Fetch()) {
+            *result = select->UInt64(0);
+            select->Fetch();
+        }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("generation");
+}
+
+// Every write of user data moves the generation on,
+// which makes snapshots written before it stale.
+error Database::bumpGeneration(Poco::UInt64 *result) {
+    poco_assert(result);
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    PreparedStatement *update = prepared(
+        "kopsik_generation.update",
+        "UPDATE kopsik_generation SET generation = generation + 1 "
+        "WHERE id = 1");
+    if (!update->Execute()) {
+        return last_error("bumpGeneration");
+    }
+    return generation(result);
+}
+
+error Database::loadSnapshot(User *user) {
+    poco_assert(user);
+    poco_assert(!snapshot_path_.empty());
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    Poco::UInt64 current(0);
+    error err = generation(&current);
+    if (err != noError) {
+        return err;
+    }
+
+    SnapshotReader reader;
+    err = reader.Open(snapshot_path_, user->ID(), current);
+    if (err != noError) {
+        return err;
+    }
+
+    std::vector<Workspace *> workspaces;
+    std::vector<Client *> clients;
+    std::vector<Project *> projects;
+    std::vector<Task *> tasks;
+    std::vector<Tag *> tags;
+    std::vector<TimeEntry *> time_entries;
+    DailyTotals totals;
+    Poco::Int64 loaded_since(0);
+
+    bool valid = reader.Next();
+    if (valid) {
+        loaded_since = reader.Int64(0);
+    }
+    valid = valid
+            && decodeModels(&reader, &workspaces)
+            && decodeModels(&reader, &clients)
+            && decodeModels(&reader, &projects)
+            && decodeModels(&reader, &tasks)
+            && decodeModels(&reader, &tags)
+            && decodeModels(&reader, &time_entries);
+    while (valid && reader.Next()) {
+        totals.Load(reader.Int64(0), reader.Int64(1));
+    }
+    if (!valid || !reader.Valid()) {
+        deleteModels(&workspaces);
+        deleteModels(&clients);
+        deleteModels(&projects);
+        deleteModels(&tasks);
+        deleteModels(&tags);
+        deleteModels(&time_entries);
+        return error("Snapshot is malformed");
+    }
+
+    RelatedData &related = user->related;
+    related.Workspaces.insert(related.Workspaces.end(),
+                              workspaces.begin(), workspaces.end());
+    related.Clients.insert(related.Clients.end(),
+                           clients.begin(), clients.end());
+    related.Projects.insert(related.Projects.end(),
+                            projects.begin(), projects.end());
+    related.Tasks.insert(related.Tasks.end(), tasks.begin(), tasks.end());
+    related.Tags.insert(related.Tags.end(), tags.begin(), tags.end());
+    related.TimeEntries.insert(related.TimeEntries.end(),
+                               time_entries.begin(), time_entries.end());
+    related.TrackedPerDay = totals;
+    related.TimeEntriesLoadedSince = loaded_since;
+
+    stopwatch.stop();
+    std::stringstream ss;
+    ss << "Loaded " << time_entries.size() << " time entries from snapshot "
+       << "in " << stopwatch.elapsed() / 1000 << " ms";
+    logger().debug(ss.str());
+
+    return noError;
+}
+
+bool hasUnsavedChanges(const User &user) {
+    const RelatedData &related = user.related;
+    return user.NeedsToBeSaved()
+           || !related.WorkspaceIndex.ChangedModels().empty()
+           || !related.ClientIndex.ChangedModels().empty()
+           || !related.ProjectIndex.ChangedModels().empty()
+           || !related.TaskIndex.ChangedModels().empty()
+           || !related.TagIndex.ChangedModels().empty()
+           || !related.TimeEntryIndex.ChangedModels().empty()
+           || !related.TrackedPerDay.ChangedDays().empty();
+}
+
+// Time entries are written the same as they're selected from the
+// database, only the window and the ones that are not pushed yet.
+// Older entries that were paged in are left out, so that loading
+// the snapshot takes as long as loading the window does.
+bool inSnapshotWindow(const TimeEntry &model, const Poco::Int64 since) {
+    return static_cast<Poco::Int64>(model.Start()) >= since
+           || !model.ID() || model.UIModifiedAt()
+           || model.DeletedAt() || model.DurationInSeconds() < 0;
+}
+
+error Database::WriteSnapshot(User *user) {
+    poco_assert(user);
+
+    if (snapshot_path_.empty() || !user->ID()) {
+        return noError;
+    }
+    if (hasUnsavedChanges(*user)) {
+        logger().debug("Snapshot not written, user has unsaved changes");
+        return noError;
+    }
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    Poco::UInt64 current(0);
+    error err = generation(&current);
+    if (err != noError) {
+        return err;
+    }
+
+    Poco::Int64 since(0);
+    if (time_entry_window_days_) {
+        since = startOfDayBefore(time(0), time_entry_window_days_);
+    }
+    bool has_older(false);
+    if (since) {
+        err = hasTimeEntriesStartedBefore(user->ID(), since, &has_older);
+        if (err != noError) {
+            return err;
+        }
+    }
+
+    const RelatedData &related = user->related;
+
+    std::vector<TimeEntry *> time_entries;
+    time_entries.reserve(related.TimeEntries.size());
+    for (std::vector<TimeEntry *>::const_iterator it =
+        related.TimeEntries.begin();
+            it != related.TimeEntries.end(); ++it) {
+        if (!has_older || inSnapshotWindow(**it, since)) {
+            time_entries.push_back(*it);
+        }
+    }
+
+    SnapshotWriter writer;
+    writer.Int(has_older ? since : 0);
+    writer.EndRow();
+    encodeModels(related.Workspaces, &writer);
+    encodeModels(related.Clients, &writer);
+    encodeModels(related.Projects, &writer);
+    encodeModels(related.Tasks, &writer);
+    encodeModels(related.Tags, &writer);
+    encodeModels(time_entries, &writer);
+
+    const std::map<Poco::Int64, Poco::Int64> &days =
+        related.TrackedPerDay.Days();
+    for (std::map<Poco::Int64, Poco::Int64>::const_iterator it =
+        days.begin();
+            it != days.end(); ++it) {
+        writer.Int(it->first);
+        writer.Int(it->second);
+        writer.EndRow();
+    }
+
+    err = writer.Save(snapshot_path_, user->ID(), current);
+    if (err != noError) {
+        return err;
+    }
+
+    stopwatch.stop();
+    std::stringstream ss;
+    ss << "Wrote " << time_entries.size() << " time entries to snapshot "
+       << "in " << stopwatch.elapsed() / 1000 << " ms";
+    logger().debug(ss.str());
+
+    return noError;
+}
+
+error Database::loadWorkspaces(
+    const Poco::UInt64 UID,
+    std::vector<Workspace *> *list) {
+    poco_assert(UID > 0);
+    poco_assert(list);
+
+    list->clear();
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        PreparedStatement *select = prepared(
+            "workspaces.select",
+            "SELECT local_id, id, uid, name, premium, "
+            "only_admins_may_create_projects, admin "
+            "FROM workspaces "
+            "WHERE uid = :uid "
+            "ORDER BY name");
+        select->Use(UID);
+        return fetchModels(select, "loadWorkspaces", list);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return noError;
+}
+
+error Database::loadClients(
+    const Poco::UInt64 UID,
+    std::vector<Client *> *list) {
+    poco_assert(UID > 0);
+    poco_assert(list);
+
+    list->clear();
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        PreparedStatement *select = prepared(
+            "clients.select",
+            "SELECT local_id, id, uid, name, guid, wid "
+            "FROM clients "
+            "WHERE uid = :uid "
+            "ORDER BY name");
+        select->Use(UID);
+        return fetchModels(select, "loadClients", list);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return noError;
+}
+
+error Database::loadProjects(
+    const Poco::UInt64 UID,
+    std::vector<Project *> *list) {
+    poco_assert(UID > 0);
+    poco_assert(list);
+
+    list->clear();
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        PreparedStatement *select = prepared(
+            "projects.select",
+            "SELECT local_id, id, uid, name, guid, wid, color, cid, "
+            "active, billable "
+            "FROM projects "
+            "WHERE uid = :uid "
+            "ORDER BY name");
+        select->Use(UID);
+        return fetchModels(select, "loadProjects", list);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return noError;
+}
+
+error Database::loadTasks(
+    const Poco::UInt64 UID,
+    std::vector<Task *> *list) {
+    poco_assert(UID > 0);
+    poco_assert(list);
+
+    list->clear();
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        PreparedStatement *select = prepared(
+            "tasks.select",
+            "SELECT local_id, id, uid, name, wid, pid "
+            "FROM tasks "
+            "WHERE uid = :uid "
+            "ORDER BY name");
+        select->Use(UID);
+        return fetchModels(select, "loadTasks", list);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return noError;
+}
+
+error Database::loadTags(
+    const Poco::UInt64 UID,
+    std::vector<Tag *> *list) {
+    poco_assert(UID > 0);
+    poco_assert(list);
+
+    list->clear();
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        PreparedStatement *select = prepared(
+            "tags.select",
+            "SELECT local_id, id, uid, name, wid, guid "
+            "FROM tags "
+            "WHERE uid = :uid "
+            "ORDER BY name");
+        select->Use(UID);
+        return fetchModels(select, "loadTags", list);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return noError;
+}
+
+error Database::loadTimeEntries(
+    const Poco::UInt64 UID,
+    const Poco::Int64 since,
+    std::vector<TimeEntry *> *list) {
+    poco_assert(UID > 0);
+    poco_assert(list);
+
+    list->clear();
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        // Entries that are running or have not been pushed yet
+        // are loaded regardless of when they were started.
+        PreparedStatement *select = prepared(
+            "time_entries.select",
+            "SELECT local_id, id, uid, description, wid, guid, pid, "
+            "tid, billable, duronly, ui_modified_at, start, stop, "
+            "duration, created_with, deleted_at, updated_at, "
+            "project_guid "
+            "FROM time_entries "
+            "WHERE uid = :uid "
+            "AND (start >= :since OR ifnull(id, 0) = 0 "
+            "OR ui_modified_at > 0 OR deleted_at > 0 OR duration < 0) "
+            "ORDER BY start DESC");
+        select->Use(UID);
+        select->Use(since);
+        const size_t first = list->size();
+        error err = fetchModels(select, "loadTimeEntries", list);
+        if (err != noError) {
+            return err;
+        }
+
+        // Driving the join from time entries, tags of
+        // each entry come out together and in order.
+        PreparedStatement *tags = prepared(
+            "time_entry_tags.select",
+            "SELECT t.time_entry_id, t.tag_name_id "
+            "FROM time_entries e "
+            "CROSS JOIN time_entry_tags t ON t.time_entry_id = e.local_id "
+            "WHERE e.uid = :uid "
+            "AND (e.start >= :since OR ifnull(e.id, 0) = 0 "
+            "OR e.ui_modified_at > 0 OR e.deleted_at > 0 OR e.duration < 0)");
+        tags->Use(UID);
+        tags->Use(since);
+        err = fetchTimeEntryTags(tags, "loadTimeEntries", list, first);
+        if (err != noError) {
+            return err;
+        }
+
+        // Ensure all time entries have a GUID.
+        for (std::vector<TimeEntry *>::iterator it = list->begin();
+                it != list->end();
+                ++it) {
+            TimeEntry *te = *it;
+            te->EnsureGUID();
+            if (te->Dirty()) {
+                te->SetUIModified();
+            }
+        }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return noError;
+}
+
+error Database::loadTimeEntriesStartedBetween(
+    const Poco::UInt64 UID,
+    const Poco::Int64 from,
+    const Poco::Int64 to,
+    std::vector<TimeEntry *> *list) {
+    poco_assert(UID > 0);
+    poco_assert(from < to);
+    poco_assert(list);
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        PreparedStatement *select = prepared(
+            "time_entries.select_started_between",
+            "SELECT local_id, id, uid, description, wid, guid, pid, "
+            "tid, billable, duronly, ui_modified_at, start, stop, "
+            "duration, created_with, deleted_at, updated_at, "
+            "project_guid "
+            "FROM time_entries "
+            "WHERE uid = :uid AND start >= :from AND start < :to "
+            "ORDER BY start DESC");
+        select->Use(UID);
+        select->Use(from);
+        select->Use(to);
+        const size_t first = list->size();
+        error err = fetchModels(select, "loadTimeEntriesStartedBetween", list);
+        if (err != noError) {
+            return err;
+        }
+
+        PreparedStatement *tags = prepared(
+            "time_entry_tags.select_started_between",
+            "SELECT t.time_entry_id, t.tag_name_id "
+            "FROM time_entries e "
+            "CROSS JOIN time_entry_tags t ON t.time_entry_id = e.local_id "
+            "WHERE e.uid = :uid AND e.start >= :from AND e.start < :to");
+        tags->Use(UID);
+        tags->Use(from);
+        tags->Use(to);
+        return fetchTimeEntryTags(
+            tags, "loadTimeEntriesStartedBetween", list, first);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return noError;
+}
+
+// Stopped entries cannot be longer than kMaxTimeEntryDurationSeconds,
+// so only the ones started that much before from can reach into the
+// range. Running entries last until now, however long ago they were
+// started, and are found through the (uid, duration) index. Stopped
+// entries without a stop time last for their duration, as in the view
+// snapshot.
+error Database::LoadTimeEntriesInRange(
+    const Poco::UInt64 UID,
+    const Poco::Int64 from,
+    const Poco::Int64 to,
+    std::vector<TimeEntry *> *result) {
+    poco_assert(UID > 0);
+    poco_assert(result);
+
+    if (from >= to) {
+        return noError;
+    }
+    const Poco::Int64 earliest = from - kMaxTimeEntryDurationSeconds;
+    const Poco::Int64 last = to - 1;
+
+    std::vector<TimeEntry *> list;
+    error err = noError;
+    {
+        CountingMutex::ScopedLock lock(mutex_);
+
+        try {
+            PreparedStatement *select = prepared(
+                "time_entries.select_in_range",
+                "SELECT local_id, id, uid, description, wid, guid, pid, "
+                "tid, billable, duronly, ui_modified_at, start, stop, "
+                "duration, created_with, deleted_at, updated_at, "
+                "project_guid "
+                "FROM time_entries "
+                "WHERE ifnull(deleted_at, 0) = 0 "
+                "AND ((uid = :uid AND start BETWEEN :earliest AND :last "
+                "AND (start >= :from "
+                "OR (CASE WHEN ifnull(stop, 0) = 0 THEN start + duration "
+                "ELSE stop END) > :after)) "
+                "OR (uid = :running_uid AND duration < 0 "
+                "AND start <= :started_by)) "
+                "ORDER BY start DESC");
+            select->Use(UID);
+            select->Use(earliest);
+            select->Use(last);
+            select->Use(from);
+            select->Use(from);
+            select->Use(UID);
+            select->Use(last);
+            err = fetchModels(select, "LoadTimeEntriesInRange", &list);
+
+            if (err == noError) {
+                PreparedStatement *tags = prepared(
+                    "time_entry_tags.select_in_range",
+                    "SELECT t.time_entry_id, t.tag_name_id "
+                    "FROM time_entries e "
+                    "CROSS JOIN time_entry_tags t "
+                    "ON t.time_entry_id = e.local_id "
+                    "WHERE ifnull(e.deleted_at, 0) = 0 "
+                    "AND ((e.uid = :uid "
+                    "AND e.start BETWEEN :earliest AND :last "
+                    "AND (e.start >= :from "
+                    "OR (CASE WHEN ifnull(e.stop, 0) = 0 "
+                    "THEN e.start + e.duration ELSE e.stop END) > :after)) "
+                    "OR (e.uid = :running_uid AND e.duration < 0 "
+                    "AND e.start <= :started_by))");
+                tags->Use(UID);
+                tags->Use(earliest);
+                tags->Use(last);
+                tags->Use(from);
+                tags->Use(from);
+                tags->Use(UID);
+                tags->Use(last);
+                err = fetchTimeEntryTags(
+                    tags, "LoadTimeEntriesInRange", &list, 0);
+            }
+        } catch(const Poco::Exception& exc) {
+            err = exc.displayText();
+        } catch(const std::exception& ex) {
+            err = ex.what();
+        } catch(const std::string& ex) {
+            err = ex;
+        }
+    }
+
+    if (err != noError) {
+        for (size_t i = 0; i < list.size(); i++) {
+            delete list[i];
+        }
+        return err;
+    }
+    result->insert(result->end(), list.begin(), list.end());
+    return noError;
+}
+
+error Database::hasTimeEntriesStartedBefore(
+    const Poco::UInt64 UID,
+    const Poco::Int64 before,
+    bool *result) {
+    poco_assert(UID > 0);
+    poco_assert(result);
+
+    *result = false;
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        Poco::Int64 count(0);
+        *session << "SELECT count(1) FROM ("
+                 "SELECT 1 FROM time_entries "
+                 "WHERE uid = :uid AND start < :before LIMIT 1)",
+                 Poco::Data::into(count),
+                 Poco::Data::use(UID),
+                 Poco::Data::use(before),
+                 Poco::Data::now;
+        *result = count > 0;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("hasTimeEntriesStartedBefore");
+}
+
+// Totals are summed up from time entries once, when the
+// user has none yet, and kept up to date on save after that.
+error Database::loadDailyTotals(
+    const Poco::UInt64 UID,
+    DailyTotals *totals) {
+    poco_assert(UID > 0);
+    poco_assert(totals);
+
+    totals->Clear();
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        PreparedStatement *exists = prepared(
+            "daily_totals.exists",
+            "SELECT count(1) FROM ("
+            "SELECT 1 FROM daily_totals WHERE uid = :uid LIMIT 1)");
+        exists->Use(UID);
+        Poco::Int64 count(0);
+        if (exists->Fetch()) {
+            count = exists->Int64(0);
+            exists->Fetch();
+        }
+        error err = last_error("loadDailyTotals");
+        if (err != noError) {
+            return err;
+        }
+
+        if (!count) {
+            PreparedStatement *sum = prepared(
+                "daily_totals.sum_all",
+                "INSERT OR REPLACE INTO daily_totals(uid, day, duration) "
+                "SELECT uid, CAST(strftime('%s', date(start, 'unixepoch', "
+                "'localtime'), 'utc') AS INTEGER) AS day, sum(duration) "
+                "FROM time_entries "
+                "WHERE uid = :uid AND duration >= 0 "
+                "AND ifnull(deleted_at, 0) = 0 "
+                "GROUP BY day");
+            sum->Use(UID);
+            if (!sum->Execute()) {
+                return last_error("loadDailyTotals");
+            }
+        }
+
+        PreparedStatement *select = prepared(
+            "daily_totals.select",
+            "SELECT day, duration FROM daily_totals WHERE uid = :uid");
+        select->Use(UID);
+        while (select->Fetch()) {
+            totals->Load(select->Int64(0), select->Int64(1));
+        }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("loadDailyTotals");
+}
+
+void requeueDays(
+    const std::set<Poco::Int64> &days,
+    std::set<Poco::Int64>::const_iterator from,
+    DailyTotals *totals) {
+    for (; from != days.end(); ++from) {
+        totals->Changed(*from);
+    }
+}
+
+// Changed days are summed up again from the time entries saved.
+// Every entry started since the window start is in memory, so those
+// days are summed up over the columns, in one pass for all of them.
+// Days before the window are summed up in the database, so that
+// entries outside of the window are included.
+// Totals in memory are set to the sums too: an entry that was
+// outside of the window is counted in the loaded totals already,
+// and once more when it arrives through sync as a new model.
+error Database::saveDailyTotals(
+    const Poco::UInt64 UID,
+    const TimeEntryColumns &columns,
+    const Poco::Int64 loaded_since,
+    DailyTotals *totals) {
+    poco_assert(UID > 0);
+    poco_assert(totals);
+
+    std::set<Poco::Int64> days(totals->ChangedDays());
+    totals->ClearChanged();
+
+    std::map<Poco::Int64, Poco::Int64> in_window;
+    std::set<Poco::Int64>::const_iterator first_in_window =
+        days.lower_bound(loaded_since);
+    if (first_in_window != days.end()) {
+        columns.SecondsPerDay(
+            *first_in_window,
+            DailyTotals::StartOfDay(*days.rbegin() + 36 * 3600),
+            &in_window);
+    }
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    for (std::set<Poco::Int64>::const_iterator it = days.begin();
+            it != days.end();
+            ++it) {
+        try {
+            if (*it >= loaded_since) {
+                Poco::Int64 seconds(0);
+                std::map<Poco::Int64, Poco::Int64>::const_iterator found =
+                    in_window.find(*it);
+                if (found != in_window.end()) {
+                    seconds = found->second;
+                }
+                if (replaceDailyTotal(UID, *it, seconds)) {
+                    totals->Load(*it, seconds);
+                    continue;
+                }
+                requeueDays(days, it, totals);
+                return last_error("saveDailyTotals");
+            }
+
+            PreparedStatement *sum = prepared(
+                "daily_totals.sum_day",
+                "SELECT ifnull(sum(duration), 0) "
+                "FROM time_entries "
+                "WHERE uid = :uid AND start >= :from AND start < :to "
+                "AND duration >= 0 AND ifnull(deleted_at, 0) = 0");
+            sum->Use(UID);
+            sum->Use(*it);
+            // Days are 23 to 25 hours long
+            sum->Use(DailyTotals::StartOfDay(*it + 36 * 3600));
+            Poco::Int64 seconds(0);
+            if (sum->Fetch()) {
+                seconds = sum->Int64(0);
+                sum->Fetch();
+            }
+            if (last_error("saveDailyTotals") == noError
+                    && replaceDailyTotal(UID, *it, seconds)) {
+                totals->Load(*it, seconds);
+                continue;
+            }
+        } catch(const Poco::Exception& exc) {
+            requeueDays(days, it, totals);
+            return exc.displayText();
+        } catch(const std::exception& ex) {
+            requeueDays(days, it, totals);
+            return ex.what();
+        } catch(const std::string& ex) {
+            requeueDays(days, it, totals);
+            return ex;
+        }
+        requeueDays(days, it, totals);
+        return last_error("saveDailyTotals");
+    }
+    return noError;
+}
+
+bool Database::replaceDailyTotal(
+    const Poco::UInt64 UID,
+    const Poco::Int64 day,
+    const Poco::Int64 seconds) {
+    PreparedStatement *replace = prepared(
+        "daily_totals.replace",
+        "INSERT OR REPLACE INTO daily_totals(uid, day, duration) "
+        "VALUES(:uid, :day, :duration)");
+    replace->Use(UID);
+    replace->Use(day);
+    replace->Use(seconds);
+    return replace->Execute();
+}
+
+error Database::LoadOlderTimeEntries(
+    User *user,
+    const Poco::UInt64 days) {
+    poco_assert(user);
+    poco_assert(days > 0);
+
+    const Poco::Int64 to = user->related.TimeEntriesLoadedSince;
+    if (!to) {
+        return noError;
+    }
+    const Poco::Int64 from = startOfDayBefore(to, days);
+
+    std::vector<TimeEntry *> list;
+    error err = loadTimeEntriesStartedBetween(user->ID(), from, to, &list);
+    if (err != noError) {
+        for (size_t i = 0; i < list.size(); i++) {
+            delete list[i];
+        }
+        return err;
+    }
+    size_t added(0);
+    for (size_t i = 0; i < list.size(); i++) {
+        TimeEntry *te = list[i];
+        // Running and unpushed entries are in memory already
+        if (user->GetTimeEntryByGUID(te->GUID())) {
+            delete te;
+            continue;
+        }
+        user->related.AddTimeEntry(te);
+        added++;
+    }
+
+    bool has_older(false);
+    err = hasTimeEntriesStartedBefore(user->ID(), from, &has_older);
+    if (err != noError) {
+        return err;
+    }
+    user->related.TimeEntriesLoadedSince = has_older ? from : 0;
+
+    std::stringstream ss;
+    ss << "Loaded " << added << " older time entries, started since "
+       << from;
+    logger().debug(ss.str());
+
+    return noError;
+}
+
+error Database::LoadTimeEntryByGUID(
+    User *user,
+    const guid GUID,
+    TimeEntry **result) {
+    poco_assert(user);
+    poco_assert(result);
+
+    *result = user->GetTimeEntryByGUID(GUID);
+    if (*result || GUID.empty() || !user->related.TimeEntriesLoadedSince) {
+        return noError;
+    }
+
+    error err = TimeEntryByGUID(user->ID(), GUID, result);
+    if (err != noError) {
+        return err;
     }
-    return last_error("loadClients");
+    if (*result) {
+        user->related.AddTimeEntry(*result);
+    }
+    return noError;
 }
 
-error Database::loadProjects(
+error Database::TimeEntryByGUID(
     const Poco::UInt64 UID,
-    std::vector<Project *> *list) {
+    const guid GUID,
+    TimeEntry **result) {
     poco_assert(UID > 0);
-    poco_assert(list);
+    poco_assert(result);
 
-    list->clear();
+    *result = 0;
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
+    std::vector<TimeEntry *> list;
     try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, name, guid, wid, color, cid, "
-               "active, billable "
-               "FROM projects "
-               "WHERE uid = :uid "
-               "ORDER BY name",
-               Poco::Data::use(UID);
-        error err = last_error("loadProjects");
+        PreparedStatement *select = prepared(
+            "time_entries.select_by_guid",
+            "SELECT local_id, id, uid, description, wid, guid, pid, "
+            "tid, billable, duronly, ui_modified_at, start, stop, "
+            "duration, created_with, deleted_at, updated_at, "
+            "project_guid "
+            "FROM time_entries "
+            "WHERE uid = :uid AND guid = :guid");
+        select->Use(UID);
+        select->Use(GUID);
+        error err = fetchModels(select, "TimeEntryByGUID", &list);
         if (err != noError) {
             return err;
         }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Project *model = new Project();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetGUID(rs[4].convert<std::string>());
-                model->SetWID(rs[5].convert<Poco::UInt64>());
-                model->SetColor(rs[6].convert<std::string>());
-                model->SetCID(rs[7].convert<Poco::UInt64>());
-                model->SetActive(rs[8].convert<bool>());
-                model->SetBillable(rs[9].convert<bool>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
+        if (!list.empty()) {
+            PreparedStatement *tags = prepared(
+                "time_entry_tags.select_by_time_entry",
+                "SELECT time_entry_id, tag_name_id FROM time_entry_tags "
+                "WHERE time_entry_id = :time_entry_id");
+            tags->Use(list.front()->LocalID());
+            err = fetchTimeEntryTags(tags, "TimeEntryByGUID", &list, 0);
+            if (err != noError) {
+                for (size_t i = 0; i < list.size(); i++) {
+                    delete list[i];
+                }
+                return err;
             }
         }
     } catch(const Poco::Exception& exc) {
@@ -742,144 +2416,248 @@ error Database::loadProjects(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("loadProjects");
+
+    if (list.empty()) {
+        return noError;
+    }
+
+    // GUID is unique per user
+    *result = list[0];
+
+    return noError;
 }
 
-error Database::loadTasks(
+// Models that were not reached because of an error
+// are kept for the next save.
+void requeueChanged(
+    const std::vector<BaseModel *> &changed,
+    const size_t from,
+    ModelIndex *index) {
+    for (size_t i = from; i < changed.size(); i++) {
+        index->Changed(changed[i]);
+    }
+}
+
+template <typename T>
+error Database::saveRelatedModels(
     const Poco::UInt64 UID,
-    std::vector<Task *> *list) {
+    const std::string table_name,
+    ModelIndex *index,
+    std::vector<ModelChange> *changes) {
     poco_assert(UID > 0);
-    poco_assert(list);
-
-    list->clear();
+    poco_assert(index);
+    poco_assert(changes);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    // Only models that have changed since last save
+    // need to be looked at; the index keeps track of them.
+    std::vector<BaseModel *> changed(index->ChangedModels());
+    index->ClearChanged();
 
-    try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, name, wid, pid "
-               "FROM tasks "
-               "WHERE uid = :uid "
-               "ORDER BY name",
-               Poco::Data::use(UID);
-        error err = last_error("loadTasks");
+    for (size_t i = 0; i < changed.size(); i++) {
+        T *model = static_cast<T *>(changed[i]);
+        rememberSaved(model, index);
+        if (model->IsMarkedAsDeletedOnServer()) {
+            error err = deleteFromTable(table_name, model->LocalID());
+            if (err != noError) {
+                requeueChanged(changed, i + 1, index);
+                return err;
+            }
+            changes->push_back(ModelChange(
+                model->ModelName(), "delete", model->ID(), model->GUID()));
+            purge_.insert(index);
+            continue;
+        }
+        model->SetUID(UID);
+        error err = saveModel(model, changes);
         if (err != noError) {
+            requeueChanged(changed, i + 1, index);
             return err;
         }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Task *model = new Task();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetWID(rs[4].convert<Poco::UInt64>());
-                model->SetPID(rs[5].convert<Poco::UInt64>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
-            }
-        }
-    } catch(const Poco::Exception& exc) {
-        return exc.displayText();
-    } catch(const std::exception& ex) {
-        return ex.what();
-    } catch(const std::string& ex) {
-        return ex;
     }
-    return last_error("loadTasks");
+
+    return noError;
 }
 
-error Database::loadTags(
-    const Poco::UInt64 UID,
-    std::vector<Tag *> *list) {
-    poco_assert(UID > 0);
+template <typename T>
+void Database::purgeDeletedModels(
+    std::vector<T *> *list,
+    ModelIndex *index) {
     poco_assert(list);
+    poco_assert(index);
 
-    list->clear();
+    if (!purge_.count(index)) {
+        return;
+    }
+
+    std::vector<T *> kept;
+    kept.reserve(list->size());
+    for (typename std::vector<T *>::const_iterator it = list->begin();
+            it != list->end();
+            ++it) {
+        T *model = *it;
+        if (model->IsMarkedAsDeletedOnServer()) {
+            index->Remove(model);
+            delete model;
+        } else {
+            kept.push_back(model);
+        }
+    }
+    list->swap(kept);
+}
+
+void Database::rememberSaved(BaseModel *model, ModelIndex *index) {
+    poco_assert(model);
+    SavedModel saved;
+    saved.model = model;
+    saved.index = index;
+    saved.time_entry = 0;
+    saved.local_id = model->LocalID();
+    saved.dirty = model->Dirty();
+    saved.tags_changed = false;
+    saved_models_.push_back(saved);
+}
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+void Database::rememberSaved(TimeEntry *model, ModelIndex *index) {
+    rememberSaved(static_cast<BaseModel *>(model), index);
+    saved_models_.back().time_entry = model;
+    saved_models_.back().tags_changed = model->TagsChanged();
+}
 
+error Database::rollbackSave(const error err) {
     try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, name, wid, guid "
-               "FROM tags "
-               "WHERE uid = :uid "
-               "ORDER BY name",
-               Poco::Data::use(UID);
-        error err = last_error("loadTags");
-        if (err != noError) {
-            return err;
+        session->rollback();
+    } catch(const Poco::Exception& exc) {
+        logger().error("Rollback failed: " + exc.displayText());
+    }
+
+    for (std::vector<SavedModel>::const_reverse_iterator it =
+        saved_models_.rbegin();
+            it != saved_models_.rend();
+            ++it) {
+        it->model->SetLocalID(it->local_id);
+        if (it->dirty && !it->model->Dirty()) {
+            it->model->SetDirty();
         }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Tag *model = new Tag();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetWID(rs[4].convert<Poco::UInt64>());
-                model->SetGUID(rs[5].convert<std::string>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
-            }
+        if (it->time_entry && it->tags_changed) {
+            it->time_entry->MarkTagsChanged();
+        }
+        if (it->index) {
+            it->index->Changed(it->model);
+        }
+    }
+    saved_models_.clear();
+
+    if (saved_totals_) {
+        for (std::set<Poco::Int64>::const_iterator it = saved_days_.begin();
+                it != saved_days_.end();
+                ++it) {
+            saved_totals_->Changed(*it);
         }
-    } catch(const Poco::Exception& exc) {
-        return exc.displayText();
-    } catch(const std::exception& ex) {
-        return ex.what();
-    } catch(const std::string& ex) {
-        return ex;
     }
-    return last_error("loadTags");
+    saved_totals_ = 0;
+    saved_days_.clear();
+    purge_.clear();
+
+    // Tag names inserted by the transaction are gone too
+    tag_name_rowids_.clear();
+    tag_names_by_rowid_.clear();
+
+    return err;
 }
 
-error Database::loadTimeEntries(
+// When there are many new time entries, for example on first
+// login, insert them in one pass without the per-row logging
+// and error formatting that saveModel does.
+// Only entries that already have a server side ID are handled here.
+error Database::bulkInsertTimeEntries(
     const Poco::UInt64 UID,
-    std::vector<TimeEntry *> *list) {
+    ModelIndex *index,
+    std::vector<ModelChange> *changes) {
     poco_assert(UID > 0);
-    poco_assert(list);
+    poco_assert(index);
+    poco_assert(changes);
 
-    list->clear();
+    std::vector<TimeEntry *> models;
+    const std::vector<BaseModel *> &changed = index->ChangedModels();
+    for (size_t i = 0; i < changed.size(); i++) {
+        TimeEntry *model = static_cast<TimeEntry *>(changed[i]);
+        if (!model->LocalID() && model->ID()
+                && !model->IsMarkedAsDeletedOnServer()) {
+            models.push_back(model);
+        }
+    }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    if (models.size() < kBulkInsertMinimumModels) {
+        return noError;
+    }
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, description, wid, guid, pid, "
-               "tid, billable, duronly, ui_modified_at, start, stop, "
-               "duration, tags, created_with, deleted_at, updated_at, "
-               "project_guid "
-               "FROM time_entries "
-               "WHERE uid = :uid "
-               "ORDER BY start DESC",
-               Poco::Data::use(UID);
-        error err = last_error("loadTimeEntries");
-        if (err != noError) {
-            return err;
+        // Replaces entries that are outside of the in-memory window
+        PreparedStatement *statement = prepared(
+            "time_entries.bulk_insert",
+            "insert or replace into time_entries(id, uid, description, "
+            "wid, guid, pid, tid, billable, "
+            "duronly, ui_modified_at, "
+            "start, stop, duration, "
+            "created_with, deleted_at, updated_at, "
+            "project_guid) "
+            "values(:id, :uid, :description, :wid, "
+            ":guid, :pid, :tid, :billable, "
+            ":duronly, :ui_modified_at, "
+            ":start, :stop, :duration, "
+            ":created_with, :deleted_at, :updated_at, "
+            ":project_guid)");
+        for (std::vector<TimeEntry *>::const_iterator it = models.begin();
+                it != models.end();
+                ++it) {
+            TimeEntry *model = *it;
+            // Undone by rollbackSave if the transaction fails
+            rememberSaved(model, index);
+            model->EnsureGUID();
+            model->SetUID(UID);
+            statement->Use(model->ID());
+            statement->Use(model->UID());
+            statement->Use(model->Description());
+            statement->Use(model->WID());
+            statement->Use(model->GUID());
+            statement->Use(model->PID());
+            statement->Use(model->TID());
+            statement->Use(model->Billable());
+            statement->Use(model->DurOnly());
+            statement->Use(model->UIModifiedAt());
+            statement->Use(model->Start());
+            statement->Use(model->Stop());
+            statement->Use(model->DurationInSeconds());
+            statement->Use(model->CreatedWith());
+            statement->Use(model->DeletedAt());
+            statement->Use(model->UpdatedAt());
+            statement->Use(model->ProjectGUID());
+            if (!statement->Execute()) {
+                return last_error("bulkInsertTimeEntries");
+            }
+            model->SetLocalID(lastInsertRowID());
+            if (!model->TagIDs().empty()) {
+                error err = saveTimeEntryTags(model);
+                if (err != noError) {
+                    return err;
+                }
+            }
+            model->ClearDirty();
+            changes->push_back(ModelChange(
+                model->ModelName(), "insert", model->ID(), model->GUID()));
         }
-        err = loadTimeEntriesFromSQLStatement(&select, list);
+
+        // Local IDs of the inserted entries are ascending
+        error err = refreshSearchIndex(models.front()->LocalID(),
+                                       models.back()->LocalID());
         if (err != noError) {
             return err;
         }
-
-        // Ensure all time entries have a GUID.
-        for (std::vector<TimeEntry *>::iterator it = list->begin();
-                it != list->end();
-                ++it) {
-            TimeEntry *te = *it;
-            te->EnsureGUID();
-            if (te->Dirty()) {
-                te->SetUIModified();
-            }
-        }
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -887,45 +2665,118 @@ error Database::loadTimeEntries(
     } catch(const std::string& ex) {
         return ex;
     }
+
+    stopwatch.stop();
+
+    std::stringstream ss;
+    ss << "Bulk inserted " << models.size() << " time entries in "
+       << stopwatch.elapsed() / 1000 << " ms";
+    logger().debug(ss.str());
+
+    return noError;
+}
+
+// Project labels are indexed as client, project and task names,
+// same as the autocomplete shows them.
+error Database::refreshSearchIndex(
+    const Poco::Int64 from,
+    const Poco::Int64 to) {
+    poco_assert(from <= to);
+
+    if (!full_text_search_) {
+        return noError;
+    }
+
+    PreparedStatement *statement = prepared(
+        "time_entry_search.replace",
+        "INSERT OR REPLACE INTO time_entry_search("
+        "docid, description, project_label) "
+        "SELECT e.local_id, e.description, "
+        "trim(ifnull(c.name, '') || ' ' || ifnull(p.name, '') || ' ' "
+        "|| ifnull(t.name, '')) "
+        "FROM time_entries e "
+        "LEFT JOIN tasks t ON t.uid = e.uid AND t.id = e.tid "
+        "LEFT JOIN projects p ON p.uid = e.uid "
+        "AND p.id = ifnull(nullif(t.pid, 0), e.pid) "
+        "LEFT JOIN clients c ON c.uid = e.uid AND c.id = p.cid "
+        "WHERE e.local_id >= :from AND e.local_id <= :to");
+    statement->Use(from);
+    statement->Use(to);
+    if (!statement->Execute()) {
+        return last_error("refreshSearchIndex");
+    }
     return noError;
 }
 
-error Database::loadTimeEntriesFromSQLStatement(
-    Poco::Data::Statement *select,
-    std::vector<TimeEntry *> *list) {
-    poco_assert(select);
-    poco_assert(list);
-    try {
-        Poco::Data::RecordSet rs(*select);
-        while (!select->done()) {
-            select->execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                TimeEntry *model = new TimeEntry();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetDescription(rs[3].convert<std::string>());
-                model->SetWID(rs[4].convert<Poco::UInt64>());
-                model->SetGUID(rs[5].convert<std::string>());
-                model->SetPID(rs[6].convert<Poco::UInt64>());
-                model->SetTID(rs[7].convert<Poco::UInt64>());
-                model->SetBillable(rs[8].convert<bool>());
-                model->SetDurOnly(rs[9].convert<bool>());
-                model->SetUIModifiedAt(rs[10].convert<Poco::UInt64>());
-                model->SetStart(rs[11].convert<Poco::UInt64>());
-                model->SetStop(rs[12].convert<Poco::UInt64>());
-                model->SetDurationInSeconds(rs[13].convert<Poco::Int64>());
-                model->SetTags(rs[14].convert<std::string>());
-                model->SetCreatedWith(rs[15].convert<std::string>());
-                model->SetDeletedAt(rs[16].convert<Poco::UInt64>());
-                model->SetUpdatedAt(rs[17].convert<Poco::UInt64>());
-                model->SetProjectGUID(rs[18].convert<std::string>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
+// Every word of the query has to match a word, or the
+// beginning of a word, in the description or project label.
+static std::string searchMatchExpression(const std::string query) {
+    std::stringstream ss(Poco::toLower(query));
+    std::string result("");
+    std::string word;
+    while (ss >> word) {
+        std::string token("");
+        for (size_t i = 0; i < word.size(); i++) {
+            unsigned char c = word[i];
+            if (c >= 0x80 || isalnum(c)) {
+                token += word[i];
             }
         }
+        if (token.empty()) {
+            continue;
+        }
+        if (!result.empty()) {
+            result += " ";
+        }
+        result += token + "*";
+    }
+    return result;
+}
+
+// Without the full-text index, the whole query has to appear
+// in the description or the project label.
+error Database::searchTimeEntriesLike(
+    const Poco::UInt64 UID,
+    const std::string query,
+    const Poco::UInt64 limit,
+    std::vector<TimeEntry *> *result) {
+    std::string pattern("%");
+    const std::string trimmed = Poco::trim(query);
+    for (size_t i = 0; i < trimmed.size(); i++) {
+        if ('%' == trimmed[i] || '_' == trimmed[i] || '!' == trimmed[i]) {
+            pattern += '!';
+        }
+        pattern += trimmed[i];
+    }
+    pattern += "%";
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        PreparedStatement *select = prepared(
+            "time_entries.select_like",
+            "SELECT e.local_id, e.id, e.uid, e.description, e.wid, "
+            "e.guid, e.pid, e.tid, e.billable, e.duronly, "
+            "e.ui_modified_at, e.start, e.stop, e.duration, "
+            "e.created_with, e.deleted_at, e.updated_at, "
+            "e.project_guid, max(e.start) AS last_start "
+            "FROM time_entries e "
+            "LEFT JOIN tasks t ON t.uid = e.uid AND t.id = e.tid "
+            "LEFT JOIN projects p ON p.uid = e.uid "
+            "AND p.id = ifnull(nullif(t.pid, 0), e.pid) "
+            "LEFT JOIN clients c ON c.uid = e.uid AND c.id = p.cid "
+            "WHERE e.uid = :uid AND ifnull(e.deleted_at, 0) = 0 "
+            "AND (e.description LIKE :pattern ESCAPE '!' "
+            "OR trim(ifnull(c.name, '') || ' ' || ifnull(p.name, '') "
+            "|| ' ' || ifnull(t.name, '')) LIKE :pattern ESCAPE '!') "
+            "GROUP BY e.description, e.pid, e.tid "
+            "ORDER BY last_start DESC "
+            "LIMIT :limit");
+        select->Use(UID);
+        select->Use(pattern);
+        select->Use(pattern);
+        select->Use(limit);
+        return fetchModels(select, "searchTimeEntriesLike", result);
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -936,47 +2787,53 @@ error Database::loadTimeEntriesFromSQLStatement(
     return noError;
 }
 
-template <typename T>
-error Database::saveRelatedModels(
+error Database::SearchTimeEntries(
     const Poco::UInt64 UID,
-    const std::string table_name,
-    std::vector<T *> *list,
-    std::vector<ModelChange> *changes) {
+    const std::string query,
+    const Poco::UInt64 limit,
+    std::vector<TimeEntry *> *result) {
     poco_assert(UID > 0);
-    poco_assert(list);
-    poco_assert(changes);
-
-    typedef typename std::vector<T *>::iterator iterator;
+    poco_assert(result);
 
-    for (size_t i = 0; i < list->size(); i++) {
-        T *model = list->at(i);
-        if (model->IsMarkedAsDeletedOnServer()) {
-            error err = deleteFromTable(table_name, model->LocalID());
-            if (err != noError) {
-                return err;
-            }
-            changes->push_back(ModelChange(
-                model->ModelName(), "delete", model->ID(), model->GUID()));
-            continue;
-        }
-        model->SetUID(UID);
-        error err = saveModel(model, changes);
-        if (err != noError) {
-            return err;
-        }
+    const std::string match = searchMatchExpression(query);
+    if (match.empty() || !limit) {
+        return noError;
     }
 
-    // Purge deleted models from memory
-    iterator it = list->begin();
-    while (it != list->end()) {
-        T *model = *it;
-        if (model->IsMarkedAsDeletedOnServer()) {
-            it = list->erase(it);
-        } else {
-            ++it;
-        }
+    if (!full_text_search_) {
+        return searchTimeEntriesLike(UID, query, limit, result);
     }
 
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        // Same description with same project and task
+        // is returned once, as it was last tracked.
+        PreparedStatement *select = prepared(
+            "time_entry_search.select",
+            "SELECT e.local_id, e.id, e.uid, e.description, e.wid, "
+            "e.guid, e.pid, e.tid, e.billable, e.duronly, "
+            "e.ui_modified_at, e.start, e.stop, e.duration, "
+            "e.created_with, e.deleted_at, e.updated_at, "
+            "e.project_guid, max(e.start) AS last_start "
+            "FROM time_entry_search s "
+            "CROSS JOIN time_entries e ON e.local_id = s.docid "
+            "WHERE time_entry_search MATCH :match "
+            "AND e.uid = :uid AND ifnull(e.deleted_at, 0) = 0 "
+            "GROUP BY e.description, e.pid, e.tid "
+            "ORDER BY last_start DESC "
+            "LIMIT :limit");
+        select->Use(match);
+        select->Use(UID);
+        select->Use(limit);
+        return fetchModels(select, "SearchTimeEntries", result);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
     return noError;
 }
 
@@ -999,7 +2856,7 @@ error Database::saveModel(
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         if (model->LocalID()) {
@@ -1009,75 +2866,87 @@ error Database::saveModel(
             logger().debug(ss.str());
 
             if (model->ID()) {
-                *session << "update time_entries set "
-                         "id = :id, uid = :uid, description = :description, "
-                         "wid = :wid, guid = :guid, pid = :pid, tid = :tid, "
-                         "billable = :billable, "
-                         "duronly = :duronly, "
-                         "ui_modified_at = :ui_modified_at, "
-                         "start = :start, stop = :stop, duration = :duration, "
-                         "tags = :tags, created_with = :created_with, "
-                         "deleted_at = :deleted_at, "
-                         "updated_at = :updated_at, "
-                         "project_guid = :project_guid "
-                         "where local_id = :local_id",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Description()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::use(model->GUID()),
-                         Poco::Data::use(model->PID()),
-                         Poco::Data::use(model->TID()),
-                         Poco::Data::use(model->Billable()),
-                         Poco::Data::use(model->DurOnly()),
-                         Poco::Data::use(model->UIModifiedAt()),
-                         Poco::Data::use(model->Start()),
-                         Poco::Data::use(model->Stop()),
-                         Poco::Data::use(model->DurationInSeconds()),
-                         Poco::Data::use(model->Tags()),
-                         Poco::Data::use(model->CreatedWith()),
-                         Poco::Data::use(model->DeletedAt()),
-                         Poco::Data::use(model->UpdatedAt()),
-                         Poco::Data::use(model->ProjectGUID()),
-                         Poco::Data::use(model->LocalID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "time_entries.update_with_id",
+                    "update time_entries set "
+                    "id = :id, uid = :uid, description = :description, "
+                    "wid = :wid, guid = :guid, pid = :pid, tid = :tid, "
+                    "billable = :billable, "
+                    "duronly = :duronly, "
+                    "ui_modified_at = :ui_modified_at, "
+                    "start = :start, stop = :stop, duration = :duration, "
+                    "created_with = :created_with, "
+                    "deleted_at = :deleted_at, "
+                    "updated_at = :updated_at, "
+                    "project_guid = :project_guid "
+                    "where local_id = :local_id");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Description());
+                statement->Use(model->WID());
+                statement->Use(model->GUID());
+                statement->Use(model->PID());
+                statement->Use(model->TID());
+                statement->Use(model->Billable());
+                statement->Use(model->DurOnly());
+                statement->Use(model->UIModifiedAt());
+                statement->Use(model->Start());
+                statement->Use(model->Stop());
+                statement->Use(model->DurationInSeconds());
+                statement->Use(model->CreatedWith());
+                statement->Use(model->DeletedAt());
+                statement->Use(model->UpdatedAt());
+                statement->Use(model->ProjectGUID());
+                statement->Use(model->LocalID());
+                statement->Execute();
             } else {
-                *session << "update time_entries set "
-                         "uid = :uid, description = :description, wid = :wid, "
-                         "guid = :guid, pid = :pid, tid = :tid, "
-                         "billable = :billable, "
-                         "duronly = :duronly, "
-                         "ui_modified_at = :ui_modified_at, "
-                         "start = :start, stop = :stop, duration = :duration, "
-                         "tags = :tags, created_with = :created_with, "
-                         "deleted_at = :deleted_at, "
-                         "updated_at = :updated_at, "
-                         "project_guid = :project_guid "
-                         "where local_id = :local_id",
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Description()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::use(model->GUID()),
-                         Poco::Data::use(model->PID()),
-                         Poco::Data::use(model->TID()),
-                         Poco::Data::use(model->Billable()),
-                         Poco::Data::use(model->DurOnly()),
-                         Poco::Data::use(model->UIModifiedAt()),
-                         Poco::Data::use(model->Start()),
-                         Poco::Data::use(model->Stop()),
-                         Poco::Data::use(model->DurationInSeconds()),
-                         Poco::Data::use(model->Tags()),
-                         Poco::Data::use(model->CreatedWith()),
-                         Poco::Data::use(model->DeletedAt()),
-                         Poco::Data::use(model->UpdatedAt()),
-                         Poco::Data::use(model->ProjectGUID()),
-                         Poco::Data::use(model->LocalID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "time_entries.update",
+                    "update time_entries set "
+                    "uid = :uid, description = :description, wid = :wid, "
+                    "guid = :guid, pid = :pid, tid = :tid, "
+                    "billable = :billable, "
+                    "duronly = :duronly, "
+                    "ui_modified_at = :ui_modified_at, "
+                    "start = :start, stop = :stop, duration = :duration, "
+                    "created_with = :created_with, "
+                    "deleted_at = :deleted_at, "
+                    "updated_at = :updated_at, "
+                    "project_guid = :project_guid "
+                    "where local_id = :local_id");
+                statement->Use(model->UID());
+                statement->Use(model->Description());
+                statement->Use(model->WID());
+                statement->Use(model->GUID());
+                statement->Use(model->PID());
+                statement->Use(model->TID());
+                statement->Use(model->Billable());
+                statement->Use(model->DurOnly());
+                statement->Use(model->UIModifiedAt());
+                statement->Use(model->Start());
+                statement->Use(model->Stop());
+                statement->Use(model->DurationInSeconds());
+                statement->Use(model->CreatedWith());
+                statement->Use(model->DeletedAt());
+                statement->Use(model->UpdatedAt());
+                statement->Use(model->ProjectGUID());
+                statement->Use(model->LocalID());
+                statement->Execute();
             }
             error err = last_error("saveTimeEntry");
             if (err != noError) {
                 return err;
             }
+            if (model->TagsChanged()) {
+                err = saveTimeEntryTags(model);
+                if (err != noError) {
+                    return err;
+                }
+            }
+            err = refreshSearchIndex(model->LocalID(), model->LocalID());
+            if (err != noError) {
+                return err;
+            }
             if (model->DeletedAt()) {
                 changes->push_back(ModelChange(
                     model->ModelName(), "delete", model->ID(), model->GUID()));
@@ -1091,83 +2960,91 @@ error Database::saveModel(
                << " in thread " << Poco::Thread::currentTid();
             logger().debug(ss.str());
             if (model->ID()) {
-                *session << "insert into time_entries(id, uid, description, "
-                         "wid, guid, pid, tid, billable, "
-                         "duronly, ui_modified_at, "
-                         "start, stop, duration, "
-                         "tags, created_with, deleted_at, updated_at, "
-                         "project_guid) "
-                         "values(:id, :uid, :description, :wid, "
-                         ":guid, :pid, :tid, :billable, "
-                         ":duronly, :ui_modified_at, "
-                         ":start, :stop, :duration, "
-                         ":tags, :created_with, :deleted_at, :updated_at, "
-                         ":project_guid)",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Description()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::use(model->GUID()),
-                         Poco::Data::use(model->PID()),
-                         Poco::Data::use(model->TID()),
-                         Poco::Data::use(model->Billable()),
-                         Poco::Data::use(model->DurOnly()),
-                         Poco::Data::use(model->UIModifiedAt()),
-                         Poco::Data::use(model->Start()),
-                         Poco::Data::use(model->Stop()),
-                         Poco::Data::use(model->DurationInSeconds()),
-                         Poco::Data::use(model->Tags()),
-                         Poco::Data::use(model->CreatedWith()),
-                         Poco::Data::use(model->DeletedAt()),
-                         Poco::Data::use(model->UpdatedAt()),
-                         Poco::Data::use(model->ProjectGUID()),
-                         Poco::Data::now;
+                // Entry may be in database already if it started before
+                // the in-memory window; server data replaces it.
+                PreparedStatement *statement = prepared(
+                    "time_entries.insert_with_id",
+                    "insert or replace into time_entries(id, uid, "
+                    "description, "
+                    "wid, guid, pid, tid, billable, "
+                    "duronly, ui_modified_at, "
+                    "start, stop, duration, "
+                    "created_with, deleted_at, updated_at, "
+                    "project_guid) "
+                    "values(:id, :uid, :description, :wid, "
+                    ":guid, :pid, :tid, :billable, "
+                    ":duronly, :ui_modified_at, "
+                    ":start, :stop, :duration, "
+                    ":created_with, :deleted_at, :updated_at, "
+                    ":project_guid)");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Description());
+                statement->Use(model->WID());
+                statement->Use(model->GUID());
+                statement->Use(model->PID());
+                statement->Use(model->TID());
+                statement->Use(model->Billable());
+                statement->Use(model->DurOnly());
+                statement->Use(model->UIModifiedAt());
+                statement->Use(model->Start());
+                statement->Use(model->Stop());
+                statement->Use(model->DurationInSeconds());
+                statement->Use(model->CreatedWith());
+                statement->Use(model->DeletedAt());
+                statement->Use(model->UpdatedAt());
+                statement->Use(model->ProjectGUID());
+                statement->Execute();
             } else {
-                *session << "insert into time_entries(uid, description, wid, "
-                         "guid, pid, tid, billable, "
-                         "duronly, ui_modified_at, "
-                         "start, stop, duration, "
-                         "tags, created_with, deleted_at, updated_at, "
-                         "project_guid "
-                         ") values ("
-                         ":uid, :description, :wid, "
-                         ":guid, :pid, :tid, :billable, "
-                         ":duronly, :ui_modified_at, "
-                         ":start, :stop, :duration, "
-                         ":tags, :created_with, :deleted_at, :updated_at, "
-                         ":project_guid)",
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Description()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::use(model->GUID()),
-                         Poco::Data::use(model->PID()),
-                         Poco::Data::use(model->TID()),
-                         Poco::Data::use(model->Billable()),
-                         Poco::Data::use(model->DurOnly()),
-                         Poco::Data::use(model->UIModifiedAt()),
-                         Poco::Data::use(model->Start()),
-                         Poco::Data::use(model->Stop()),
-                         Poco::Data::use(model->DurationInSeconds()),
-                         Poco::Data::use(model->Tags()),
-                         Poco::Data::use(model->CreatedWith()),
-                         Poco::Data::use(model->DeletedAt()),
-                         Poco::Data::use(model->UpdatedAt()),
-                         Poco::Data::use(model->ProjectGUID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "time_entries.insert",
+                    "insert into time_entries(uid, description, wid, "
+                    "guid, pid, tid, billable, "
+                    "duronly, ui_modified_at, "
+                    "start, stop, duration, "
+                    "created_with, deleted_at, updated_at, "
+                    "project_guid "
+                    ") values ("
+                    ":uid, :description, :wid, "
+                    ":guid, :pid, :tid, :billable, "
+                    ":duronly, :ui_modified_at, "
+                    ":start, :stop, :duration, "
+                    ":created_with, :deleted_at, :updated_at, "
+                    ":project_guid)");
+                statement->Use(model->UID());
+                statement->Use(model->Description());
+                statement->Use(model->WID());
+                statement->Use(model->GUID());
+                statement->Use(model->PID());
+                statement->Use(model->TID());
+                statement->Use(model->Billable());
+                statement->Use(model->DurOnly());
+                statement->Use(model->UIModifiedAt());
+                statement->Use(model->Start());
+                statement->Use(model->Stop());
+                statement->Use(model->DurationInSeconds());
+                statement->Use(model->CreatedWith());
+                statement->Use(model->DeletedAt());
+                statement->Use(model->UpdatedAt());
+                statement->Use(model->ProjectGUID());
+                statement->Execute();
             }
             error err = last_error("saveTimeEntry");
             if (err != noError) {
                 return err;
             }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                     Poco::Data::into(local_id),
-                     Poco::Data::now;
-            err = last_error("saveTimeEntry");
+            Poco::Int64 local_id = lastInsertRowID();
+            model->SetLocalID(local_id);
+            if (!model->TagIDs().empty()) {
+                err = saveTimeEntryTags(model);
+                if (err != noError) {
+                    return err;
+                }
+            }
+            err = refreshSearchIndex(local_id, local_id);
             if (err != noError) {
                 return err;
             }
-            model->SetLocalID(local_id);
             changes->push_back(ModelChange(
                 model->ModelName(), "insert", model->ID(), model->GUID()));
         }
@@ -1192,7 +3069,7 @@ error Database::saveModel(
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         if (model->LocalID()) {
@@ -1201,19 +3078,21 @@ error Database::saveModel(
                << " in thread " << Poco::Thread::currentTid();
             logger().trace(ss.str());
 
-            *session << "update workspaces set "
-                     "id = :id, uid = :uid, name = :name, premium = :premium, "
-                     "only_admins_may_create_projects = "
-                     ":only_admins_may_create_projects, admin = :admin "
-                     "where local_id = :local_id",
-                     Poco::Data::use(model->ID()),
-                     Poco::Data::use(model->UID()),
-                     Poco::Data::use(model->Name()),
-                     Poco::Data::use(model->Premium()),
-                     Poco::Data::use(model->OnlyAdminsMayCreateProjects()),
-                     Poco::Data::use(model->Admin()),
-                     Poco::Data::use(model->LocalID()),
-                     Poco::Data::now;
+            PreparedStatement *statement = prepared(
+                "workspaces.update",
+                "update workspaces set "
+                "id = :id, uid = :uid, name = :name, premium = :premium, "
+                "only_admins_may_create_projects = "
+                ":only_admins_may_create_projects, admin = :admin "
+                "where local_id = :local_id");
+            statement->Use(model->ID());
+            statement->Use(model->UID());
+            statement->Use(model->Name());
+            statement->Use(model->Premium());
+            statement->Use(model->OnlyAdminsMayCreateProjects());
+            statement->Use(model->Admin());
+            statement->Use(model->LocalID());
+            statement->Execute();
             error err = last_error("saveWorkspace");
             if (err != noError) {
                 return err;
@@ -1226,30 +3105,24 @@ error Database::saveModel(
             ss << "Inserting workspace " + model->String()
                << " in thread " << Poco::Thread::currentTid();
             logger().trace(ss.str());
-            *session <<
-                     "insert into workspaces(id, uid, name, premium, "
-                     "only_admins_may_create_projects, admin) "
-                     "values(:id, :uid, :name, :premium, "
-                     ":only_admins_may_create_projects, :admin)",
-                     Poco::Data::use(model->ID()),
-                     Poco::Data::use(model->UID()),
-                     Poco::Data::use(model->Name()),
-                     Poco::Data::use(model->Premium()),
-                     Poco::Data::use(model->OnlyAdminsMayCreateProjects()),
-                     Poco::Data::use(model->Admin()),
-                     Poco::Data::now;
+            PreparedStatement *statement = prepared(
+                "workspaces.insert",
+                "insert into workspaces(id, uid, name, premium, "
+                "only_admins_may_create_projects, admin) "
+                "values(:id, :uid, :name, :premium, "
+                ":only_admins_may_create_projects, :admin)");
+            statement->Use(model->ID());
+            statement->Use(model->UID());
+            statement->Use(model->Name());
+            statement->Use(model->Premium());
+            statement->Use(model->OnlyAdminsMayCreateProjects());
+            statement->Use(model->Admin());
+            statement->Execute();
             error err = last_error("saveWorkspace");
             if (err != noError) {
                 return err;
             }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                     Poco::Data::into(local_id),
-                     Poco::Data::now;
-            err = last_error("saveWorkspace");
-            if (err != noError) {
-                return err;
-            }
+            Poco::Int64 local_id = lastInsertRowID();
             model->SetLocalID(local_id);
             changes->push_back(ModelChange(
                 model->ModelName(), "insert", model->ID(), ""));
@@ -1275,7 +3148,7 @@ error Database::saveModel(
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         if (model->LocalID()) {
@@ -1285,27 +3158,31 @@ error Database::saveModel(
             logger().trace(ss.str());
 
             if (model->GUID().empty()) {
-                *session << "update clients set "
-                         "id = :id, uid = :uid, name = :name, wid = :wid "
-                         "where local_id = :local_id",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Name()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::use(model->LocalID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "clients.update",
+                    "update clients set "
+                    "id = :id, uid = :uid, name = :name, wid = :wid "
+                    "where local_id = :local_id");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Name());
+                statement->Use(model->WID());
+                statement->Use(model->LocalID());
+                statement->Execute();
             } else {
-                *session << "update clients set "
-                         "id = :id, uid = :uid, name = :name, guid = :guid, "
-                         "wid = :wid "
-                         "where local_id = :local_id",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Name()),
-                         Poco::Data::use(model->GUID()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::use(model->LocalID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "clients.update_with_guid",
+                    "update clients set "
+                    "id = :id, uid = :uid, name = :name, guid = :guid, "
+                    "wid = :wid "
+                    "where local_id = :local_id");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Name());
+                statement->Use(model->GUID());
+                statement->Use(model->WID());
+                statement->Use(model->LocalID());
+                statement->Execute();
             }
             error err = last_error("saveClient");
             if (err != noError) {
@@ -1320,35 +3197,32 @@ error Database::saveModel(
                << " in thread " << Poco::Thread::currentTid();
             logger().trace(ss.str());
             if (model->GUID().empty()) {
-                *session << "insert into clients(id, uid, name, wid) "
-                         "values(:id, :uid, :name, :wid)",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Name()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "clients.insert",
+                    "insert into clients(id, uid, name, wid) "
+                    "values(:id, :uid, :name, :wid)");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Name());
+                statement->Use(model->WID());
+                statement->Execute();
             } else {
-                *session << "insert into clients(id, uid, name, guid, wid) "
-                         "values(:id, :uid, :name, :guid, :wid)",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Name()),
-                         Poco::Data::use(model->GUID()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "clients.insert_with_guid",
+                    "insert into clients(id, uid, name, guid, wid) "
+                    "values(:id, :uid, :name, :guid, :wid)");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Name());
+                statement->Use(model->GUID());
+                statement->Use(model->WID());
+                statement->Execute();
             }
             error err = last_error("saveClient");
             if (err != noError) {
                 return err;
             }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                     Poco::Data::into(local_id),
-                     Poco::Data::now;
-            err = last_error("saveClient");
-            if (err != noError) {
-                return err;
-            }
+            Poco::Int64 local_id = lastInsertRowID();
             model->SetLocalID(local_id);
             changes->push_back(ModelChange(
                 model->ModelName(), "insert", model->ID(), model->GUID()));
@@ -1382,7 +3256,7 @@ error Database::saveModel(
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         if (model->LocalID()) {
@@ -1393,71 +3267,79 @@ error Database::saveModel(
 
             if (model->ID()) {
                 if (model->GUID().empty()) {
-                    *session << "update projects set "
-                             "id = :id, uid = :uid, name = :name, "
-                             "wid = :wid, color = :color, cid = :cid, "
-                             "active = :active, billable = :billable "
-                             "where local_id = :local_id",
-                             Poco::Data::use(model->ID()),
-                             Poco::Data::use(model->UID()),
-                             Poco::Data::use(model->Name()),
-                             Poco::Data::use(model->WID()),
-                             Poco::Data::use(model->Color()),
-                             Poco::Data::use(model->CID()),
-                             Poco::Data::use(model->Active()),
-                             Poco::Data::use(model->Billable()),
-                             Poco::Data::use(model->LocalID()),
-                             Poco::Data::now;
+                    PreparedStatement *statement = prepared(
+                        "projects.update_with_id",
+                        "update projects set "
+                        "id = :id, uid = :uid, name = :name, "
+                        "wid = :wid, color = :color, cid = :cid, "
+                        "active = :active, billable = :billable "
+                        "where local_id = :local_id");
+                    statement->Use(model->ID());
+                    statement->Use(model->UID());
+                    statement->Use(model->Name());
+                    statement->Use(model->WID());
+                    statement->Use(model->Color());
+                    statement->Use(model->CID());
+                    statement->Use(model->Active());
+                    statement->Use(model->Billable());
+                    statement->Use(model->LocalID());
+                    statement->Execute();
                 } else {
-                    *session << "update projects set "
-                             "id = :id, uid = :uid, name = :name, guid = :guid,"
-                             "wid = :wid, color = :color, cid = :cid, "
-                             "active = :active, billable = :billable "
-                             "where local_id = :local_id",
-                             Poco::Data::use(model->ID()),
-                             Poco::Data::use(model->UID()),
-                             Poco::Data::use(model->Name()),
-                             Poco::Data::use(model->GUID()),
-                             Poco::Data::use(model->WID()),
-                             Poco::Data::use(model->Color()),
-                             Poco::Data::use(model->CID()),
-                             Poco::Data::use(model->Active()),
-                             Poco::Data::use(model->Billable()),
-                             Poco::Data::use(model->LocalID()),
-                             Poco::Data::now;
+                    PreparedStatement *statement = prepared(
+                        "projects.update_with_id_with_guid",
+                        "update projects set "
+                        "id = :id, uid = :uid, name = :name, guid = :guid,"
+                        "wid = :wid, color = :color, cid = :cid, "
+                        "active = :active, billable = :billable "
+                        "where local_id = :local_id");
+                    statement->Use(model->ID());
+                    statement->Use(model->UID());
+                    statement->Use(model->Name());
+                    statement->Use(model->GUID());
+                    statement->Use(model->WID());
+                    statement->Use(model->Color());
+                    statement->Use(model->CID());
+                    statement->Use(model->Active());
+                    statement->Use(model->Billable());
+                    statement->Use(model->LocalID());
+                    statement->Execute();
                 }
             } else {
                 if (model->GUID().empty()) {
-                    *session << "update projects set "
-                             "uid = :uid, name = :name, "
-                             "wid = :wid, color = :color, cid = :cid, "
-                             "active = :active, billable = :billable "
-                             "where local_id = :local_id",
-                             Poco::Data::use(model->UID()),
-                             Poco::Data::use(model->Name()),
-                             Poco::Data::use(model->WID()),
-                             Poco::Data::use(model->Color()),
-                             Poco::Data::use(model->CID()),
-                             Poco::Data::use(model->Active()),
-                             Poco::Data::use(model->Billable()),
-                             Poco::Data::use(model->LocalID()),
-                             Poco::Data::now;
+                    PreparedStatement *statement = prepared(
+                        "projects.update",
+                        "update projects set "
+                        "uid = :uid, name = :name, "
+                        "wid = :wid, color = :color, cid = :cid, "
+                        "active = :active, billable = :billable "
+                        "where local_id = :local_id");
+                    statement->Use(model->UID());
+                    statement->Use(model->Name());
+                    statement->Use(model->WID());
+                    statement->Use(model->Color());
+                    statement->Use(model->CID());
+                    statement->Use(model->Active());
+                    statement->Use(model->Billable());
+                    statement->Use(model->LocalID());
+                    statement->Execute();
                 } else {
-                    *session << "update projects set "
-                             "uid = :uid, name = :name, guid = :guid,"
-                             "wid = :wid, color = :color, cid = :cid, "
-                             "active = :active, billable = :billable "
-                             "where local_id = :local_id",
-                             Poco::Data::use(model->UID()),
-                             Poco::Data::use(model->Name()),
-                             Poco::Data::use(model->GUID()),
-                             Poco::Data::use(model->WID()),
-                             Poco::Data::use(model->Color()),
-                             Poco::Data::use(model->CID()),
-                             Poco::Data::use(model->Active()),
-                             Poco::Data::use(model->Billable()),
-                             Poco::Data::use(model->LocalID()),
-                             Poco::Data::now;
+                    PreparedStatement *statement = prepared(
+                        "projects.update_with_guid",
+                        "update projects set "
+                        "uid = :uid, name = :name, guid = :guid,"
+                        "wid = :wid, color = :color, cid = :cid, "
+                        "active = :active, billable = :billable "
+                        "where local_id = :local_id");
+                    statement->Use(model->UID());
+                    statement->Use(model->Name());
+                    statement->Use(model->GUID());
+                    statement->Use(model->WID());
+                    statement->Use(model->Color());
+                    statement->Use(model->CID());
+                    statement->Use(model->Active());
+                    statement->Use(model->Billable());
+                    statement->Use(model->LocalID());
+                    statement->Execute();
                 }
             }
             error err = last_error("saveProject");
@@ -1474,98 +3356,95 @@ error Database::saveModel(
             logger().debug(ss.str());
             if (model->ID()) {
                 if (model->GUID().empty()) {
-                    *session <<
-                             "insert into projects("
-                             "id, uid, name, wid, color, cid, active, "
-                             "is_private, billable"
-                             ") values("
-                             ":id, :uid, :name, :wid, :color, :cid, :active, "
-                             ":is_private, :billable"
-                             ")",
-                             Poco::Data::use(model->ID()),
-                             Poco::Data::use(model->UID()),
-                             Poco::Data::use(model->Name()),
-                             Poco::Data::use(model->WID()),
-                             Poco::Data::use(model->Color()),
-                             Poco::Data::use(model->CID()),
-                             Poco::Data::use(model->Active()),
-                             Poco::Data::use(model->IsPrivate()),
-                             Poco::Data::use(model->Billable()),
-                             Poco::Data::now;
+                    PreparedStatement *statement = prepared(
+                        "projects.insert_with_id",
+                        "insert into projects("
+                        "id, uid, name, wid, color, cid, active, "
+                        "is_private, billable"
+                        ") values("
+                        ":id, :uid, :name, :wid, :color, :cid, :active, "
+                        ":is_private, :billable"
+                        ")");
+                    statement->Use(model->ID());
+                    statement->Use(model->UID());
+                    statement->Use(model->Name());
+                    statement->Use(model->WID());
+                    statement->Use(model->Color());
+                    statement->Use(model->CID());
+                    statement->Use(model->Active());
+                    statement->Use(model->IsPrivate());
+                    statement->Use(model->Billable());
+                    statement->Execute();
                 } else {
-                    *session <<
-                             "insert into projects("
-                             "id, uid, name, guid, wid, color, cid, active, "
-                             "is_private, billable"
-                             ") values("
-                             ":id, :uid, :name, :guid, :wid, :color, :cid, "
-                             ":active, :is_private, "
-                             ":billable"
-                             ")",
-                             Poco::Data::use(model->ID()),
-                             Poco::Data::use(model->UID()),
-                             Poco::Data::use(model->Name()),
-                             Poco::Data::use(model->GUID()),
-                             Poco::Data::use(model->WID()),
-                             Poco::Data::use(model->Color()),
-                             Poco::Data::use(model->CID()),
-                             Poco::Data::use(model->Active()),
-                             Poco::Data::use(model->IsPrivate()),
-                             Poco::Data::use(model->Billable()),
-                             Poco::Data::now;
+                    PreparedStatement *statement = prepared(
+                        "projects.insert_with_id_with_guid",
+                        "insert into projects("
+                        "id, uid, name, guid, wid, color, cid, active, "
+                        "is_private, billable"
+                        ") values("
+                        ":id, :uid, :name, :guid, :wid, :color, :cid, "
+                        ":active, :is_private, "
+                        ":billable"
+                        ")");
+                    statement->Use(model->ID());
+                    statement->Use(model->UID());
+                    statement->Use(model->Name());
+                    statement->Use(model->GUID());
+                    statement->Use(model->WID());
+                    statement->Use(model->Color());
+                    statement->Use(model->CID());
+                    statement->Use(model->Active());
+                    statement->Use(model->IsPrivate());
+                    statement->Use(model->Billable());
+                    statement->Execute();
                 }
             } else {
                 if (model->GUID().empty()) {
-                    *session <<
-                             "insert into projects("
-                             "uid, name, wid, color, cid, active, "
-                             "is_private, billable"
-                             ") values("
-                             ":uid, :name, :wid, :color, :cid, :active, "
-                             ":is_private, :billable"
-                             ")",
-                             Poco::Data::use(model->UID()),
-                             Poco::Data::use(model->Name()),
-                             Poco::Data::use(model->WID()),
-                             Poco::Data::use(model->Color()),
-                             Poco::Data::use(model->CID()),
-                             Poco::Data::use(model->Active()),
-                             Poco::Data::use(model->IsPrivate()),
-                             Poco::Data::use(model->Billable()),
-                             Poco::Data::now;
+                    PreparedStatement *statement = prepared(
+                        "projects.insert",
+                        "insert into projects("
+                        "uid, name, wid, color, cid, active, "
+                        "is_private, billable"
+                        ") values("
+                        ":uid, :name, :wid, :color, :cid, :active, "
+                        ":is_private, :billable"
+                        ")");
+                    statement->Use(model->UID());
+                    statement->Use(model->Name());
+                    statement->Use(model->WID());
+                    statement->Use(model->Color());
+                    statement->Use(model->CID());
+                    statement->Use(model->Active());
+                    statement->Use(model->IsPrivate());
+                    statement->Use(model->Billable());
+                    statement->Execute();
                 } else {
-                    *session <<
-                             "insert into projects("
-                             "uid, name, guid, wid, color, cid, active, "
-                             "is_private, billable"
-                             ") values("
-                             ":uid, :name, :guid, :wid, :color, :cid, :active, "
-                             ":is_private, :billable"
-                             ")",
-                             Poco::Data::use(model->UID()),
-                             Poco::Data::use(model->Name()),
-                             Poco::Data::use(model->GUID()),
-                             Poco::Data::use(model->WID()),
-                             Poco::Data::use(model->Color()),
-                             Poco::Data::use(model->CID()),
-                             Poco::Data::use(model->Active()),
-                             Poco::Data::use(model->IsPrivate()),
-                             Poco::Data::use(model->Billable()),
-                             Poco::Data::now;
+                    PreparedStatement *statement = prepared(
+                        "projects.insert_with_guid",
+                        "insert into projects("
+                        "uid, name, guid, wid, color, cid, active, "
+                        "is_private, billable"
+                        ") values("
+                        ":uid, :name, :guid, :wid, :color, :cid, :active, "
+                        ":is_private, :billable"
+                        ")");
+                    statement->Use(model->UID());
+                    statement->Use(model->Name());
+                    statement->Use(model->GUID());
+                    statement->Use(model->WID());
+                    statement->Use(model->Color());
+                    statement->Use(model->CID());
+                    statement->Use(model->Active());
+                    statement->Use(model->IsPrivate());
+                    statement->Use(model->Billable());
+                    statement->Execute();
                 }
             }
             error err = last_error("saveProject");
             if (err != noError) {
                 return err;
             }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                     Poco::Data::into(local_id),
-                     Poco::Data::now;
-            err = last_error("saveProject");
-            if (err != noError) {
-                return err;
-            }
+            Poco::Int64 local_id = lastInsertRowID();
             model->SetLocalID(local_id);
             changes->push_back(ModelChange(
                 model->ModelName(), "insert", model->ID(), model->GUID()));
@@ -1591,7 +3470,7 @@ error Database::saveModel(
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         if (model->LocalID()) {
@@ -1600,17 +3479,19 @@ error Database::saveModel(
                << " in thread " << Poco::Thread::currentTid();
             logger().trace(ss.str());
 
-            *session << "update tasks set "
-                     "id = :id, uid = :uid, name = :name, wid = :wid, "
-                     "pid = :pid "
-                     "where local_id = :local_id",
-                     Poco::Data::use(model->ID()),
-                     Poco::Data::use(model->UID()),
-                     Poco::Data::use(model->Name()),
-                     Poco::Data::use(model->WID()),
-                     Poco::Data::use(model->PID()),
-                     Poco::Data::use(model->LocalID()),
-                     Poco::Data::now;
+            PreparedStatement *statement = prepared(
+                "tasks.update",
+                "update tasks set "
+                "id = :id, uid = :uid, name = :name, wid = :wid, "
+                "pid = :pid "
+                "where local_id = :local_id");
+            statement->Use(model->ID());
+            statement->Use(model->UID());
+            statement->Use(model->Name());
+            statement->Use(model->WID());
+            statement->Use(model->PID());
+            statement->Use(model->LocalID());
+            statement->Execute();
             error err = last_error("saveTask");
             if (err != noError) {
                 return err;
@@ -1623,26 +3504,21 @@ error Database::saveModel(
             ss << "Inserting task " + model->String()
                << " in thread " << Poco::Thread::currentTid();
             logger().trace(ss.str());
-            *session << "insert into tasks(id, uid, name, wid, pid) "
-                     "values(:id, :uid, :name, :wid, :pid)",
-                     Poco::Data::use(model->ID()),
-                     Poco::Data::use(model->UID()),
-                     Poco::Data::use(model->Name()),
-                     Poco::Data::use(model->WID()),
-                     Poco::Data::use(model->PID()),
-                     Poco::Data::now;
+            PreparedStatement *statement = prepared(
+                "tasks.insert",
+                "insert into tasks(id, uid, name, wid, pid) "
+                "values(:id, :uid, :name, :wid, :pid)");
+            statement->Use(model->ID());
+            statement->Use(model->UID());
+            statement->Use(model->Name());
+            statement->Use(model->WID());
+            statement->Use(model->PID());
+            statement->Execute();
             error err = last_error("saveTask");
             if (err != noError) {
                 return err;
             }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                     Poco::Data::into(local_id),
-                     Poco::Data::now;
-            err = last_error("saveTask");
-            if (err != noError) {
-                return err;
-            }
+            Poco::Int64 local_id = lastInsertRowID();
             model->SetLocalID(local_id);
             changes->push_back(ModelChange(
                 model->ModelName(), "insert", model->ID(), ""));
@@ -1668,7 +3544,7 @@ error Database::saveModel(
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         if (model->LocalID()) {
@@ -1678,27 +3554,31 @@ error Database::saveModel(
             logger().trace(ss.str());
 
             if (model->GUID().empty()) {
-                *session << "update tags set "
-                         "id = :id, uid = :uid, name = :name, wid = :wid "
-                         "where local_id = :local_id",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Name()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::use(model->LocalID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "tags.update",
+                    "update tags set "
+                    "id = :id, uid = :uid, name = :name, wid = :wid "
+                    "where local_id = :local_id");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Name());
+                statement->Use(model->WID());
+                statement->Use(model->LocalID());
+                statement->Execute();
             } else {
-                *session << "update tags set "
-                         "id = :id, uid = :uid, name = :name, wid = :wid, "
-                         "guid = :guid "
-                         "where local_id = :local_id",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Name()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::use(model->GUID()),
-                         Poco::Data::use(model->LocalID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "tags.update_with_guid",
+                    "update tags set "
+                    "id = :id, uid = :uid, name = :name, wid = :wid, "
+                    "guid = :guid "
+                    "where local_id = :local_id");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Name());
+                statement->Use(model->WID());
+                statement->Use(model->GUID());
+                statement->Use(model->LocalID());
+                statement->Execute();
             }
             error err = last_error("saveTag");
             if (err != noError) {
@@ -1713,35 +3593,32 @@ error Database::saveModel(
                << " in thread " << Poco::Thread::currentTid();
             logger().trace(ss.str());
             if (model->GUID().empty()) {
-                *session << "insert into tags(id, uid, name, wid) "
-                         "values(:id, :uid, :name, :wid)",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Name()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::now;
+                PreparedStatement *statement = prepared(
+                    "tags.insert",
+                    "insert into tags(id, uid, name, wid) "
+                    "values(:id, :uid, :name, :wid)");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Name());
+                statement->Use(model->WID());
+                statement->Execute();
             } else {
-                *session << "insert into tags(id, uid, name, wid, guid) "
-                         "values(:id, :uid, :name, :wid, :guid)",
-                         Poco::Data::use(model->ID()),
-                         Poco::Data::use(model->UID()),
-                         Poco::Data::use(model->Name()),
-                         Poco::Data::use(model->WID()),
-                         Poco::Data::use(model->GUID()),
-                         Poco::Data::now;
-            }
-            error err = last_error("saveTag");
-            if (err != noError) {
-                return err;
+                PreparedStatement *statement = prepared(
+                    "tags.insert_with_guid",
+                    "insert into tags(id, uid, name, wid, guid) "
+                    "values(:id, :uid, :name, :wid, :guid)");
+                statement->Use(model->ID());
+                statement->Use(model->UID());
+                statement->Use(model->Name());
+                statement->Use(model->WID());
+                statement->Use(model->GUID());
+                statement->Execute();
             }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                     Poco::Data::into(local_id),
-                     Poco::Data::now;
-            err = last_error("saveTag");
+            error err = last_error("saveTag");
             if (err != noError) {
                 return err;
             }
+            Poco::Int64 local_id = lastInsertRowID();
             model->SetLocalID(local_id);
             changes->push_back(ModelChange(
                 model->ModelName(), "insert", model->ID(), model->GUID()));
@@ -1782,7 +3659,18 @@ error Database::SaveUser(
         return error("Missing user ID, cannot save user");
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
+
+    Poco::UInt64 hits = prepared_statement_hits_;
+    Poco::UInt64 misses = prepared_statement_misses_;
+    Poco::Timestamp::TimeDiff compile_time = prepared_statement_compile_time_;
+
+    Poco::UInt64 saved_generation(0);
+
+    saved_models_.clear();
+    saved_totals_ = 0;
+    saved_days_.clear();
+    purge_.clear();
 
     session->begin();
 
@@ -1790,6 +3678,7 @@ error Database::SaveUser(
     // *but* do not return if we don't need to.
     // We might need to save related models, still.
     if (!user->LocalID() || user->Dirty()) {
+        rememberSaved(user, 0);
         try {
             if (user->LocalID()) {
                 std::stringstream ss;
@@ -1818,8 +3707,7 @@ error Database::SaveUser(
                          Poco::Data::now;
                 error err = last_error("SaveUser");
                 if (err != noError) {
-                    session->rollback();
-                    return err;
+                    return rollbackSave(err);
                 }
                 changes->push_back(ModelChange(
                     user->ModelName(), "update", user->ID(), ""));
@@ -1850,8 +3738,7 @@ error Database::SaveUser(
                          Poco::Data::now;
                 error err = last_error("SaveUser");
                 if (err != noError) {
-                    session->rollback();
-                    return err;
+                    return rollbackSave(err);
                 }
                 Poco::Int64 local_id(0);
                 *session << "select last_insert_rowid()",
@@ -1859,8 +3746,7 @@ error Database::SaveUser(
                          Poco::Data::now;
                 err = last_error("SaveUser");
                 if (err != noError) {
-                    session->rollback();
-                    return err;
+                    return rollbackSave(err);
                 }
                 user->SetLocalID(local_id);
                 changes->push_back(ModelChange(
@@ -1868,27 +3754,23 @@ error Database::SaveUser(
             }
             user->ClearDirty();
         } catch(const Poco::Exception& exc) {
-            session->rollback();
-            return exc.displayText();
+            return rollbackSave(exc.displayText());
         } catch(const std::exception& ex) {
-            session->rollback();
-            return ex.what();
+            return rollbackSave(ex.what());
         } catch(const std::string& ex) {
-            session->rollback();
-            return ex;
+            return rollbackSave(ex);
         }
     }
 
     if (with_related_data) {
         // Workspaces
         std::vector<ModelChange> workspace_changes;
-        error err = saveRelatedModels(user->ID(),
+        error err = saveRelatedModels<Workspace>(user->ID(),
                                       "workspaces",
-                                      &user->related.Workspaces,
+                                      &user->related.WorkspaceIndex,
                                       &workspace_changes);
         if (err != noError) {
-            session->rollback();
-            return err;
+            return rollbackSave(err);
         }
         for (std::vector<ModelChange>::const_iterator
                 it = workspace_changes.begin();
@@ -1903,13 +3785,12 @@ error Database::SaveUser(
 
         // Clients
         std::vector<ModelChange> client_changes;
-        err = saveRelatedModels(user->ID(),
+        err = saveRelatedModels<Client>(user->ID(),
                                 "clients",
-                                &user->related.Clients,
+                                &user->related.ClientIndex,
                                 &client_changes);
         if (err != noError) {
-            session->rollback();
-            return err;
+            return rollbackSave(err);
         }
         for (std::vector<ModelChange>::const_iterator
                 it = client_changes.begin();
@@ -1924,13 +3805,12 @@ error Database::SaveUser(
 
         // Projects
         std::vector<ModelChange> project_changes;
-        err = saveRelatedModels(user->ID(),
+        err = saveRelatedModels<Project>(user->ID(),
                                 "projects",
-                                &user->related.Projects,
+                                &user->related.ProjectIndex,
                                 &project_changes);
         if (err != noError) {
-            session->rollback();
-            return err;
+            return rollbackSave(err);
         }
         for (std::vector<ModelChange>::const_iterator
                 it = project_changes.begin();
@@ -1945,13 +3825,12 @@ error Database::SaveUser(
 
         // Tasks
         std::vector<ModelChange> task_changes;
-        err = saveRelatedModels(user->ID(),
+        err = saveRelatedModels<Task>(user->ID(),
                                 "tasks",
-                                &user->related.Tasks,
+                                &user->related.TaskIndex,
                                 &task_changes);
         if (err != noError) {
-            session->rollback();
-            return err;
+            return rollbackSave(err);
         }
         for (std::vector<ModelChange>::const_iterator
                 it = task_changes.begin();
@@ -1964,26 +3843,64 @@ error Database::SaveUser(
             changes->push_back(change);
         }
 
-        err = saveRelatedModels(user->ID(),
+        err = saveRelatedModels<Tag>(user->ID(),
                                 "tags",
-                                &user->related.Tags,
+                                &user->related.TagIndex,
                                 changes);
         if (err != noError) {
-            session->rollback();
-            return err;
+            return rollbackSave(err);
+        }
+
+        err = bulkInsertTimeEntries(user->ID(),
+                                    &user->related.TimeEntryIndex,
+                                    changes);
+        if (err != noError) {
+            return rollbackSave(err);
         }
 
-        err = saveRelatedModels(user->ID(),
+        err = saveRelatedModels<TimeEntry>(user->ID(),
                                 "time_entries",
-                                &user->related.TimeEntries,
+                                &user->related.TimeEntryIndex,
                                 changes);
         if (err != noError) {
-            session->rollback();
-            return err;
+            return rollbackSave(err);
+        }
+
+        saved_totals_ = &user->related.TrackedPerDay;
+        saved_days_ = saved_totals_->ChangedDays();
+        err = saveDailyTotals(user->ID(),
+                              user->related.Columns,
+                              user->related.TimeEntriesLoadedSince,
+                              &user->related.TrackedPerDay);
+        if (err != noError) {
+            return rollbackSave(err);
+        }
+
+        err = bumpGeneration(&saved_generation);
+        if (err != noError) {
+            return rollbackSave(err);
         }
     }
 
-    session->commit();
+    try {
+        session->commit();
+    } catch(const Poco::Exception& exc) {
+        return rollbackSave(exc.displayText());
+    }
+    saved_models_.clear();
+    saved_totals_ = 0;
+    saved_days_.clear();
+
+    if (with_related_data) {
+        RelatedData &related = user->related;
+        purgeDeletedModels(&related.Workspaces, &related.WorkspaceIndex);
+        purgeDeletedModels(&related.Clients, &related.ClientIndex);
+        purgeDeletedModels(&related.Projects, &related.ProjectIndex);
+        purgeDeletedModels(&related.Tasks, &related.TaskIndex);
+        purgeDeletedModels(&related.Tags, &related.TagIndex);
+        purgeDeletedModels(&related.TimeEntries, &related.TimeEntryIndex);
+    }
+    purge_.clear();
 
     stopwatch.stop();
 
@@ -1995,14 +3912,81 @@ error Database::SaveUser(
         logger().debug(ss.str());
     }
 
+    {
+        hits = prepared_statement_hits_ - hits;
+        misses = prepared_statement_misses_ - misses;
+        compile_time = prepared_statement_compile_time_ - compile_time;
+
+        std::stringstream ss;
+        ss  << "Prepared statements: " << hits << " hits, "
+            << misses << " misses";
+        if (hits + misses) {
+            ss << ", hit rate " << (hits * 100 / (hits + misses)) << "%";
+        }
+        ss  << ", compiled in " << compile_time / 1000 << " ms";
+        logger().debug(ss.str());
+    }
+
+    {
+        std::stringstream ss;
+        ss  << "Writer lock contended " << mutex_.ContendedLocks()
+            << " of " << mutex_.Locks() << " times, waited "
+            << mutex_.WaitTime() / 1000 << " ms; reads on reader sessions "
+            << pooled_reads_.value() << ", on writer "
+            << writer_reads_.value();
+        logger().debug(ss.str());
+    }
+
     return noError;
 }
 
+// Applied migration names are loaded with a single query, so that
+// a startup with an up to date schema runs no per-migration queries.
+// Pending migrations are applied in one transaction.
 error Database::initialize_tables() {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    error err = load_migrations();
+    if (err != noError) {
+        return err;
+    }
+    const size_t applied = migrations_.size();
+
+    session->begin();
+    try {
+        err = migrate_tables();
+    } catch(const Poco::Exception& exc) {
+        err = exc.displayText();
+    } catch(const std::exception& ex) {
+        err = ex.what();
+    } catch(const std::string& ex) {
+        err = ex;
+    }
+    if (err != noError) {
+        session->rollback();
+        migrations_.clear();
+        return err;
+    }
+    session->commit();
+
+    stopwatch.stop();
+    schema_check_time_ = stopwatch.elapsed();
+    applied_migrations_ = migrations_.size() - applied;
+
+    std::stringstream ss;
+    ss << "Schema checks took " << schema_check_time_ / 1000 << " ms, "
+       << applied_migrations_ << " migrations applied";
+    logger().debug(ss.str());
 
+    return noError;
+}
+
+error Database::load_migrations() {
     std::string table_name;
     // Check if we have migrations table
     *session <<
@@ -2011,7 +3995,7 @@ error Database::initialize_tables() {
              Poco::Data::into(table_name),
              Poco::Data::limit(1),
              Poco::Data::now;
-    error err = last_error("initialize_tables");
+    error err = last_error("load_migrations");
     if (err != noError) {
         return err;
     }
@@ -2021,7 +4005,7 @@ error Database::initialize_tables() {
                  "create table kopsik_migrations(id integer primary key, "
                  "name varchar not null)",
                  Poco::Data::now;
-        error err = last_error("initialize_tables");
+        error err = last_error("load_migrations");
         if (err != noError) {
             return err;
         }
@@ -2029,12 +4013,48 @@ error Database::initialize_tables() {
                  "CREATE UNIQUE INDEX id_kopsik_migrations_name "
                  "ON kopsik_migrations (name);",
                  Poco::Data::now;
-        err = last_error("initialize_tables");
+        err = last_error("load_migrations");
         if (err != noError) {
             return err;
         }
     }
 
+    migrations_.clear();
+    try {
+        std::vector<std::string> names;
+        *session << "select name from kopsik_migrations",
+                 Poco::Data::into(names),
+                 Poco::Data::now;
+        migrations_.insert(names.begin(), names.end());
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("load_migrations");
+}
+
+error Database::migrate_tables() {
+    error err = migrate("kopsik_generation",
+                        "CREATE TABLE kopsik_generation("
+                        "id INTEGER PRIMARY KEY, "
+                        "generation INTEGER NOT NULL"
+                        "); ");
+    if (err != noError) {
+        return err;
+    }
+
+    // Generations start from a random number, so that a snapshot
+    // is not taken for up to date by a recreated database.
+    err = migrate("kopsik_generation.first",
+                  "INSERT INTO kopsik_generation(id, generation) "
+                  "VALUES(1, abs(random() / 4)); ");
+    if (err != noError) {
+        return err;
+    }
+
     err = migrate("users",
                   "create table users("
                   "local_id integer primary key, "
@@ -2379,125 +4399,417 @@ error Database::initialize_tables() {
         return err;
     }
 
-    err = migrate("time_entries.guid not null, step 4",
-                  "drop table tmp_time_entries;");
+    err = migrate("time_entries.guid not null, step 4",
+                  "drop table tmp_time_entries;");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("time_entries.guid not null, step 5",
+                  "CREATE UNIQUE INDEX id_time_entries_id "
+                  "   ON time_entries (uid, id); ");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("time_entries.guid not null, step 6",
+                  "CREATE UNIQUE INDEX id_time_entries_guid "
+                  "   ON time_entries (uid, guid); ");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("sessions",
+                  "create table sessions("
+                  "local_id integer primary key, "
+                  "api_token varchar not null, "
+                  "active integer not null default 1 "
+                  "); ");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate(
+        "sessions.active",
+        "CREATE UNIQUE INDEX id_sessions_active ON sessions (active); ");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("settings",
+                  "create table settings("
+                  "local_id integer primary key, "
+                  "use_proxy integer not null default 0, "
+                  "proxy_host varchar, "
+                  "proxy_port integer, "
+                  "proxy_username varchar, "
+                  "proxy_password varchar, "
+                  "use_idle_detection integer not null default 1)");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate(
+        "settings.update_channel",
+        "ALTER TABLE settings "
+        "ADD COLUMN update_channel varchar not null default 'stable';");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate(
+        "settings.default",
+        "INSERT INTO settings(update_channel) "
+        "SELECT 'stable' WHERE NOT EXISTS (SELECT 1 FROM settings LIMIT 1);");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("settings.menubar_timer",
+                  "ALTER TABLE settings "
+                  "ADD COLUMN menubar_timer integer not null default 0;");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("settings.dock_icon",
+                  "ALTER TABLE settings "
+                  "ADD COLUMN dock_icon INTEGER NOT NULL DEFAULT 1;");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("settings.on_top",
+                  "ALTER TABLE settings "
+                  "ADD COLUMN on_top INTEGER NOT NULL DEFAULT 0;");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("settings.reminder",
+                  "ALTER TABLE settings "
+                  "ADD COLUMN reminder INTEGER NOT NULL DEFAULT 1;");
+    if (err != noError) {
+        return err;
+    }
+
+    // Time entries are loaded per user, newest first. GUID lookups
+    // are served by the unique (uid, guid) index created above.
+    err = migrate("time_entries.start",
+                  "CREATE INDEX id_time_entries_start "
+                  "   ON time_entries (uid, start); ");
+    if (err != noError) {
+        return err;
+    }
+
+    // Tracked seconds per local day, filled in on first load
+    err = migrate("daily_totals",
+                  "CREATE TABLE daily_totals("
+                  "  uid INTEGER NOT NULL, "
+                  "  day INTEGER NOT NULL, "
+                  "  duration INTEGER NOT NULL, "
+                  "  PRIMARY KEY (uid, day)"
+                  "); ");
+    if (err != noError) {
+        return err;
+    }
+
+    // Running entries are looked up per user regardless of start time
+    err = migrate("time_entries.duration",
+                  "CREATE INDEX id_time_entries_duration "
+                  "   ON time_entries (uid, duration); ");
+    if (err != noError) {
+        return err;
+    }
+
+    err = initialize_tag_tables();
+    if (err != noError) {
+        return err;
+    }
+
+    err = initialize_search_tables();
+    if (err != noError) {
+        return err;
+    }
+
+    return initialize_timeline_tables();
+}
+
+error Database::initialize_search_tables() {
+    // FTS4 is compiled into the bundled SQLite. Without it, time
+    // entries are searched with LIKE, see SearchTimeEntries.
+    Poco::UInt64 fts(0);
+    error err = UInt("SELECT sqlite_compileoption_used('ENABLE_FTS3') "
+                     "OR sqlite_compileoption_used('ENABLE_FTS4')", &fts);
+    if (err != noError) {
+        return err;
+    }
+    full_text_search_ = fts != 0;
+    if (!full_text_search_) {
+        logger().warning("SQLite is built without FTS4, "
+                         "time entries are searched without an index");
+        return noError;
+    }
+
+    // Full-text index of time entry descriptions and project labels,
+    // docid is the local_id of the time entry.
+    err = migrate("time_entry_search",
+                        "CREATE VIRTUAL TABLE time_entry_search "
+                        "USING fts4(description, project_label); ");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("time_entry_search.delete_trigger",
+                  "CREATE TRIGGER time_entries_delete_search "
+                  "AFTER DELETE ON time_entries "
+                  "BEGIN "
+                  "  DELETE FROM time_entry_search "
+                  "  WHERE docid = old.local_id; "
+                  "END; ");
+    if (err != noError) {
+        return err;
+    }
+
+    bool migrated(false);
+    err = isMigrated("time_entry_search.fill", &migrated);
+    if (err != noError || migrated) {
+        return err;
+    }
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    Poco::Int64 last(0);
+    try {
+        *session << "SELECT ifnull(max(local_id), 0) FROM time_entries",
+                 Poco::Data::into(last),
+                 Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    err = last_error("initialize_search_tables");
+    if (err != noError) {
+        return err;
+    }
+
+    for (Poco::Int64 from = 1; from <= last; from += 1000) {
+        err = refreshSearchIndex(from, from + 999);
+        if (err != noError) {
+            return err;
+        }
+    }
+
+    return markMigrated("time_entry_search.fill");
+}
+
+error Database::initialize_tag_tables() {
+    // Tag names are stored once, time entries refer to them by ID
+    error err = migrate("tag_names",
+                        "CREATE TABLE tag_names("
+                        "  id INTEGER PRIMARY KEY, "
+                        "  name VARCHAR NOT NULL"
+                        "); ");
+    if (err != noError) {
+        return err;
+    }
+
+    err = migrate("tag_names.name",
+                  "CREATE UNIQUE INDEX id_tag_names_name "
+                  "   ON tag_names (name); ");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("time_entries.guid not null, step 5",
-                  "CREATE UNIQUE INDEX id_time_entries_id "
-                  "   ON time_entries (uid, id); ");
+    err = migrate("time_entry_tags",
+                  "CREATE TABLE time_entry_tags("
+                  "  time_entry_id INTEGER NOT NULL, "
+                  "  position INTEGER NOT NULL, "
+                  "  tag_name_id INTEGER NOT NULL, "
+                  "  PRIMARY KEY (time_entry_id, position)"
+                  "); ");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("time_entries.guid not null, step 6",
-                  "CREATE UNIQUE INDEX id_time_entries_guid "
-                  "   ON time_entries (uid, guid); ");
+    err = migrate("time_entry_tags.delete_trigger",
+                  "CREATE TRIGGER time_entries_delete_tags "
+                  "AFTER DELETE ON time_entries "
+                  "BEGIN "
+                  "  DELETE FROM time_entry_tags "
+                  "  WHERE time_entry_id = old.local_id; "
+                  "END; ");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("sessions",
-                  "create table sessions("
-                  "local_id integer primary key, "
-                  "api_token varchar not null, "
-                  "active integer not null default 1 "
-                  "); ");
-    if (err != noError) {
+    bool migrated(false);
+    err = isMigrated("time_entry_tags.from_tags_column", &migrated);
+    if (err != noError || migrated) {
         return err;
     }
-
-    err = migrate(
-        "sessions.active",
-        "CREATE UNIQUE INDEX id_sessions_active ON sessions (active); ");
+    err = migrateTagsColumn();
     if (err != noError) {
         return err;
     }
+    return markMigrated("time_entry_tags.from_tags_column");
+}
 
-    err = migrate("settings",
-                  "create table settings("
-                  "local_id integer primary key, "
-                  "use_proxy integer not null default 0, "
-                  "proxy_host varchar, "
-                  "proxy_port integer, "
-                  "proxy_username varchar, "
-                  "proxy_password varchar, "
-                  "use_idle_detection integer not null default 1)");
-    if (err != noError) {
-        return err;
+// Moves "|"-joined tag names from time_entries.tags
+// into time_entry_tags, a chunk of rows at a time.
+error Database::migrateTagsColumn() {
+    CountingMutex::ScopedLock lock(mutex_);
+
+    Poco::Int64 after(0);
+    size_t migrated(0);
+    try {
+        while (true) {
+            PreparedStatement *select = prepared(
+                "time_entries.select_tags_column",
+                "SELECT local_id, tags FROM time_entries "
+                "WHERE local_id > :after AND ifnull(tags, '') <> '' "
+                "ORDER BY local_id LIMIT 500");
+            select->Use(after);
+            std::vector<std::pair<Poco::Int64, std::string> > rows;
+            while (select->Fetch()) {
+                rows.push_back(std::make_pair(select->Int64(0),
+                                              select->String(1)));
+            }
+            error err = last_error("migrateTagsColumn");
+            if (err != noError) {
+                return err;
+            }
+
+            for (size_t i = 0; i < rows.size(); i++) {
+                TimeEntry te;
+                te.SetLocalID(rows[i].first);
+                te.SetTags(rows[i].second);
+                err = saveTimeEntryTags(&te);
+                if (err != noError) {
+                    return err;
+                }
+
+                PreparedStatement *clear = prepared(
+                    "time_entries.clear_tags_column",
+                    "UPDATE time_entries SET tags = NULL "
+                    "WHERE local_id = :local_id");
+                clear->Use(rows[i].first);
+                if (!clear->Execute()) {
+                    err = last_error("migrateTagsColumn");
+                    return err;
+                }
+                after = rows[i].first;
+            }
+            migrated += rows.size();
+
+            if (rows.size() < 500) {
+                break;
+            }
+        }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
     }
 
-    err = migrate(
-        "settings.update_channel",
-        "ALTER TABLE settings "
-        "ADD COLUMN update_channel varchar not null default 'stable';");
+    std::stringstream ss;
+    ss << "Moved tags of " << migrated << " time entries to time_entry_tags";
+    logger().debug(ss.str());
+
+    return noError;
+}
+
+error Database::initialize_timeline_tables() {
+    error err = migrate("timeline_installation",
+                        "CREATE TABLE timeline_installation("
+                        "id INTEGER PRIMARY KEY, "
+                        "desktop_id VARCHAR NOT NULL"
+                        ")");
     if (err != noError) {
         return err;
     }
 
-    err = migrate(
-        "settings.default",
-        "INSERT INTO settings(update_channel) "
-        "SELECT 'stable' WHERE NOT EXISTS (SELECT 1 FROM settings LIMIT 1);");
+    err = migrate("timeline_installation.desktop_id",
+                  "CREATE UNIQUE INDEX id_timeline_installation_desktop_id "
+                  "ON timeline_installation(desktop_id);");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("settings.menubar_timer",
-                  "ALTER TABLE settings "
-                  "ADD COLUMN menubar_timer integer not null default 0;");
+    err = migrate("timeline_events",
+                  "CREATE TABLE timeline_events("
+                  "id INTEGER PRIMARY KEY, "
+                  "user_id INTEGER NOT NULL, "
+                  "title VARCHAR, "
+                  "filename VARCHAR, "
+                  "start_time INTEGER NOT NULL, "
+                  "end_time INTEGER, "
+                  "idle INTEGER NOT NULL"
+                  ")");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("settings.dock_icon",
-                  "ALTER TABLE settings "
-                  "ADD COLUMN dock_icon INTEGER NOT NULL DEFAULT 1;");
+    // Timeline events are uploaded in id order, so ids must
+    // never be reused after uploaded events are deleted.
+    err = migrate("timeline_events.autoincrement, step 1",
+                  "ALTER TABLE timeline_events "
+                  "RENAME TO tmp_timeline_events; ");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("settings.on_top",
-                  "ALTER TABLE settings "
-                  "ADD COLUMN on_top INTEGER NOT NULL DEFAULT 0;");
+    err = migrate("timeline_events.autoincrement, step 2",
+                  "CREATE TABLE timeline_events("
+                  "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                  "user_id INTEGER NOT NULL, "
+                  "title VARCHAR, "
+                  "filename VARCHAR, "
+                  "start_time INTEGER NOT NULL, "
+                  "end_time INTEGER, "
+                  "idle INTEGER NOT NULL"
+                  ")");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("settings.reminder",
-                  "ALTER TABLE settings "
-                  "ADD COLUMN reminder INTEGER NOT NULL DEFAULT 1;");
+    err = migrate("timeline_events.autoincrement, step 3",
+                  "insert into timeline_events("
+                  "   id, user_id, title, filename, start_time, end_time, "
+                  "   idle) "
+                  "select "
+                  "   id, user_id, title, filename, start_time, end_time, "
+                  "   idle "
+                  "from tmp_timeline_events;");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("timeline_installation",
-                  "CREATE TABLE timeline_installation("
-                  "id INTEGER PRIMARY KEY, "
-                  "desktop_id VARCHAR NOT NULL"
-                  ")");
+    err = migrate("timeline_events.autoincrement, step 4",
+                  "drop table tmp_timeline_events;");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("timeline_installation.desktop_id",
-                  "CREATE UNIQUE INDEX id_timeline_installation_desktop_id "
-                  "ON timeline_installation(desktop_id);");
+    // Also serves lookups by user_id alone, the table rebuild
+    // above dropped any separate index on it.
+    err = migrate("timeline_events.user_id_id",
+                  "CREATE INDEX id_timeline_events_user_id_id "
+                  "   ON timeline_events (user_id, id); ");
     if (err != noError) {
         return err;
     }
 
-    err = migrate("timeline_events",
-                  "CREATE TABLE timeline_events("
-                  "id INTEGER PRIMARY KEY, "
-                  "user_id INTEGER NOT NULL, "
-                  "title VARCHAR, "
-                  "filename VARCHAR, "
-                  "start_time INTEGER NOT NULL, "
-                  "end_time INTEGER, "
-                  "idle INTEGER NOT NULL"
+    // Upload cursor per user: events up to this id have been uploaded
+    err = migrate("timeline_uploads",
+                  "CREATE TABLE timeline_uploads("
+                  "user_id INTEGER PRIMARY KEY, "
+                  "acknowledged_id INTEGER NOT NULL DEFAULT 0"
                   ")");
     if (err != noError) {
         return err;
@@ -2523,14 +4835,13 @@ error Database::CurrentAPIToken(std::string *token) {
     poco_assert(session);
     poco_assert(token);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
-
     *token = "";
     try {
-        *session << "select api_token from sessions",
-                 Poco::Data::into(*token),
-                 Poco::Data::limit(1),
-                 Poco::Data::now;
+        ReadSession reader(this);
+        *reader << "select api_token from sessions",
+                Poco::Data::into(*token),
+                Poco::Data::limit(1),
+                Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -2538,13 +4849,13 @@ error Database::CurrentAPIToken(std::string *token) {
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("CurrentAPIToken");
+    return noError;
 }
 
 error Database::ClearCurrentAPIToken() {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         *session << "delete from sessions", Poco::Data::now;
@@ -2561,7 +4872,7 @@ error Database::ClearCurrentAPIToken() {
 error Database::SetCurrentAPIToken(const std::string &token) {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     error err = ClearCurrentAPIToken();
     if (err != noError) {
@@ -2584,7 +4895,7 @@ error Database::SetCurrentAPIToken(const std::string &token) {
 error Database::SaveDesktopID() {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         *session << "INSERT INTO timeline_installation(desktop_id) "
@@ -2601,48 +4912,27 @@ error Database::SaveDesktopID() {
     return last_error("SaveDesktopID");
 }
 
-error Database::migrate(
+error Database::isMigrated(
     const std::string name,
-    const std::string sql) {
-    poco_assert(session);
+    bool *result) {
     poco_assert(!name.empty());
-    poco_assert(!sql.empty());
-
-    Poco::Mutex::ScopedLock lock(mutex_);
-
-    try {
-        int count = 0;
-        *session << "select count(*) from kopsik_migrations where name=:name",
-                 Poco::Data::into(count),
-                 Poco::Data::use(name),
-                 Poco::Data::now;
-        error err = last_error("migrate");
-        if (err != noError) {
-            return err;
-        }
+    poco_assert(result);
 
-        if (count) {
-            return noError;
-        }
+    *result = migrations_.find(name) != migrations_.end();
+    return noError;
+}
 
-        std::stringstream ss;
-        ss  << "Migrating" << "\n"
-            << name << "\n"
-            << sql << "\n";
-        logger().debug(ss.str());
+error Database::markMigrated(
+    const std::string name) {
+    poco_assert(session);
+    poco_assert(!name.empty());
 
-        err = execute(sql);
-        if (err != noError) {
-            return err;
-        }
+    CountingMutex::ScopedLock lock(mutex_);
 
+    try {
         *session << "insert into kopsik_migrations(name) values(:name)",
                  Poco::Data::use(name),
                  Poco::Data::now;
-        err = last_error("migrate");
-        if (err != noError) {
-            return err;
-        }
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -2650,15 +4940,49 @@ error Database::migrate(
     } catch(const std::string& ex) {
         return ex;
     }
+    error err = last_error("migrate");
+    if (err != noError) {
+        return err;
+    }
+    migrations_.insert(name);
     return noError;
 }
 
+error Database::migrate(
+    const std::string name,
+    const std::string sql) {
+    poco_assert(session);
+    poco_assert(!name.empty());
+    poco_assert(!sql.empty());
+
+    CountingMutex::ScopedLock lock(mutex_);
+
+    bool migrated(false);
+    error err = isMigrated(name, &migrated);
+    if (err != noError || migrated) {
+        return err;
+    }
+
+    std::stringstream ss;
+    ss  << "Migrating" << "\n"
+        << name << "\n"
+        << sql << "\n";
+    logger().debug(ss.str());
+
+    err = execute(sql);
+    if (err != noError) {
+        return err;
+    }
+
+    return markMigrated(name);
+}
+
 error Database::execute(
     const std::string sql) {
     poco_assert(session);
     poco_assert(!sql.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
     try {
         *session << sql, Poco::Data::now;
@@ -2690,106 +5014,255 @@ error Database::select_timeline_batch(
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
+
+    try {
+        // Resume after the last batch that was acknowledged,
+        // even if the app was restarted in between.
+        PreparedStatement *cursor = prepared(
+            "timeline_uploads.select",
+            "SELECT ifnull(max(acknowledged_id), 0) "
+            "FROM timeline_uploads WHERE user_id = :user_id");
+        cursor->Use(user_id);
+        Poco::Int64 acknowledged_id(0);
+        if (cursor->Fetch()) {
+            acknowledged_id = cursor->Int64(0);
+            cursor->Fetch();
+        }
+        error err = last_error("select_timeline_batch");
+        if (err != noError) {
+            return err;
+        }
 
-    Poco::Data::Statement select(*session);
-    select << "SELECT id, title, filename, start_time, end_time, idle "
-           "FROM timeline_events WHERE user_id = :user_id "
-           "LIMIT 100",
-           Poco::Data::use(user_id);
-    Poco::Data::RecordSet rs(select);
-    while (!select.done()) {
-        select.execute();
-        bool more = rs.moveFirst();
-        while (more) {
+        PreparedStatement *select = prepared(
+            "timeline_events.select_batch",
+            "SELECT id, title, filename, start_time, end_time, idle "
+            "FROM timeline_events "
+            "WHERE user_id = :user_id AND id > :acknowledged_id "
+            "ORDER BY id "
+            "LIMIT :limit");
+        select->Use(user_id);
+        select->Use(acknowledged_id);
+        select->Use(Poco::UInt64(kTimelineUploadBatchSize));
+        while (select->Fetch()) {
             TimelineEvent event;
-            event.id = rs[0].convert<unsigned int>();
-            event.title = rs[1].convert<std::string>();
-            event.filename = rs[2].convert<std::string>();
-            event.start_time = rs[3].convert<int>();
-            event.end_time = rs[4].convert<int>();
-            event.idle = rs[5].convert<bool>();
+            event.id = static_cast<unsigned int>(select->Int64(0));
+            event.title = select->String(1);
+            event.filename = select->String(2);
+            event.start_time = select->Int64(3);
+            event.end_time = select->Int64(4);
+            event.idle = select->Bool(5);
             event.user_id = static_cast<unsigned int>(user_id);
             timeline_events->push_back(event);
-            more = rs.moveNext();
         }
-    }
-
-    std::stringstream event_count;
-    event_count << "select_batch found " << timeline_events->size()
-                <<  " events.";
-    logger().debug(event_count.str());
+        err = last_error("select_timeline_batch");
+        if (err != noError) {
+            timeline_events->clear();
+            return err;
+        }
 
-    return last_error("select_timeline_batch");
+        std::stringstream event_count;
+        event_count << "select_batch found " << timeline_events->size()
+                    <<  " events.";
+        logger().debug(event_count.str());
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return noError;
 }
 
-error Database::insert_timeline_event(const TimelineEvent& event) {
+error Database::insert_timeline_events(
+    const std::vector<TimelineEvent> &events) {
     std::stringstream out;
-    out << "insert " << event.start_time << ";" << event.end_time << ";"
-        << event.filename << ";" << event.title;
+    out << "insert " << events.size() << " timeline events";
     logger().debug(out.str());
 
-    poco_assert(event.user_id > 0);
-    poco_assert(event.start_time > 0);
-    poco_assert(event.end_time > 0);
+    poco_assert(!events.empty());
     if (!session) {
         logger().warning("insert database is not open, ignoring request");
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
-    *session << "INSERT INTO timeline_events("
-             "user_id, title, filename, start_time, end_time, idle"
-             ") VALUES ("
-             ":user_id, :title, :filename, :start_time, :end_time, :idle"
-             ")",
-             Poco::Data::use(event.user_id),
-             Poco::Data::use(event.title),
-             Poco::Data::use(event.filename),
-             Poco::Data::use(event.start_time),
-             Poco::Data::use(event.end_time),
-             Poco::Data::use(event.idle),
-             Poco::Data::now;
-    return last_error("insert_timeline_event");
+    session->begin();
+    try {
+        PreparedStatement *statement = prepared(
+            "timeline_events.insert",
+            "INSERT INTO timeline_events("
+            "user_id, title, filename, start_time, end_time, idle"
+            ") VALUES ("
+            ":user_id, :title, :filename, :start_time, :end_time, :idle"
+            ")");
+        for (std::vector<TimelineEvent>::const_iterator it = events.begin();
+                it != events.end();
+                ++it) {
+            const TimelineEvent &event = *it;
+            poco_assert(event.user_id > 0);
+            poco_assert(event.start_time > 0);
+            poco_assert(event.end_time > 0);
+            statement->Use(static_cast<Poco::UInt64>(event.user_id));
+            statement->Use(event.title);
+            statement->Use(event.filename);
+            statement->Use(static_cast<Poco::Int64>(event.start_time));
+            statement->Use(static_cast<Poco::Int64>(event.end_time));
+            statement->Use(event.idle);
+            if (!statement->Execute()) {
+                error err = last_error("insert_timeline_events");
+                session->rollback();
+                return err;
+            }
+        }
+        session->commit();
+    } catch(const Poco::Exception& exc) {
+        session->rollback();
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        session->rollback();
+        return ex.what();
+    } catch(const std::string& ex) {
+        session->rollback();
+        return ex;
+    }
+    return last_error("insert_timeline_events");
+}
+
+error Database::FlushTimelineEvents() {
+    Poco::Mutex::ScopedLock flush_lock(timeline_flush_m_);
+    std::vector<TimelineEvent> events;
+    {
+        Poco::Mutex::ScopedLock lock(timeline_buffer_m_);
+        events.swap(timeline_buffer_);
+    }
+    if (events.empty()) {
+        return noError;
+    }
+    error err = insert_timeline_events(events);
+    if (err != noError) {
+        // Keep the events for the next flush
+        Poco::Mutex::ScopedLock lock(timeline_buffer_m_);
+        timeline_buffer_.insert(timeline_buffer_.begin(),
+                                events.begin(), events.end());
+        cap_timeline_buffer();
+    }
+    return err;
+}
+
+void Database::cap_timeline_buffer() {
+    if (timeline_buffer_.size() <= kTimelineBufferMaxEvents) {
+        return;
+    }
+    const size_t dropped = timeline_buffer_.size() - kTimelineBufferMaxEvents;
+    timeline_buffer_.erase(timeline_buffer_.begin(),
+                           timeline_buffer_.begin() + dropped);
+
+    std::stringstream ss;
+    ss << "Timeline events cannot be written, dropped "
+       << dropped << " oldest events";
+    logger().warning(ss.str());
+}
+
+void Database::timeline_writer_loop() {
+    while (!timeline_writer_.isStopped()) {
+        timeline_flush_requested_.tryWait(
+            kTimelineFlushIntervalSeconds * 1000);
+        error err = FlushTimelineEvents();
+        if (err != noError) {
+            logger().error(err);
+        }
+    }
 }
 
-error Database::delete_timeline_batch(
+error Database::acknowledge_timeline_batch(
     const std::vector<TimelineEvent> &timeline_events) {
     std::stringstream out;
-    out << "delete_batch " << timeline_events.size() << " events.";
+    out << "acknowledge_batch " << timeline_events.size() << " events.";
     logger().debug(out.str());
 
     poco_assert(!timeline_events.empty());
     if (!session) {
-        logger().warning("delete_batch database is not open, ignoring request");
+        logger().warning(
+            "acknowledge_batch database is not open, ignoring request");
         return noError;
     }
-    std::vector<int> ids;
+
+    // Batches are selected in id order, a single range covers them
+    Poco::UInt64 user_id = timeline_events.front().user_id;
+    Poco::Int64 acknowledged_id(0);
     for (std::vector<TimelineEvent>::const_iterator i = timeline_events.begin();
             i != timeline_events.end();
             ++i) {
-        const TimelineEvent &event = *i;
-        ids.push_back(event.id);
+        poco_assert(i->user_id == user_id);
+        if (i->id > acknowledged_id) {
+            acknowledged_id = i->id;
+        }
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    CountingMutex::ScopedLock lock(mutex_);
 
-    *session << "DELETE FROM timeline_events WHERE id = :id",
-             Poco::Data::use(ids),
-             Poco::Data::now;
-    return last_error("delete_timeline_batch");
+    session->begin();
+    try {
+        PreparedStatement *cursor = prepared(
+            "timeline_uploads.replace",
+            "INSERT OR REPLACE INTO timeline_uploads(user_id, acknowledged_id) "
+            "VALUES(:user_id, :acknowledged_id)");
+        cursor->Use(user_id);
+        cursor->Use(acknowledged_id);
+        if (!cursor->Execute()) {
+            error err = last_error("acknowledge_timeline_batch");
+            session->rollback();
+            return err;
+        }
+
+        PreparedStatement *uploaded = prepared(
+            "timeline_events.delete_acknowledged",
+            "DELETE FROM timeline_events "
+            "WHERE user_id = :user_id AND id <= :acknowledged_id");
+        uploaded->Use(user_id);
+        uploaded->Use(acknowledged_id);
+        if (!uploaded->Execute()) {
+            error err = last_error("acknowledge_timeline_batch");
+            session->rollback();
+            return err;
+        }
+
+        session->commit();
+    } catch(const Poco::Exception& exc) {
+        session->rollback();
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        session->rollback();
+        return ex.what();
+    } catch(const std::string& ex) {
+        session->rollback();
+        return ex;
+    }
+    return last_error("acknowledge_timeline_batch");
 }
 
 void Database::handleTimelineEventNotification(
     TimelineEventNotification* notification) {
     logger().debug("handleTimelineEventNotification");
-    insert_timeline_event(notification->event);
+    Poco::Mutex::ScopedLock lock(timeline_buffer_m_);
+    timeline_buffer_.push_back(notification->event);
+    cap_timeline_buffer();
+    if (timeline_buffer_.size() >= kTimelineFlushMaxEvents) {
+        timeline_flush_requested_.set();
+    }
 }
 
 void Database::handleCreateTimelineBatchNotification(
     CreateTimelineBatchNotification* notification) {
     logger().debug("handleCreateTimelineBatchNotification");
+    // Upload what has been recorded so far
+    error err = FlushTimelineEvents();
+    if (err != noError) {
+        logger().error(err);
+    }
     std::vector<TimelineEvent> batch;
     select_timeline_batch(notification->user_id, &batch);
     if (batch.empty()) {
@@ -2806,7 +5279,10 @@ void Database::handleDeleteTimelineBatchNotification(
     DeleteTimelineBatchNotification* notification) {
     logger().debug("handleDeleteTimelineBatchNotification");
     poco_assert(!notification->batch.empty());
-    delete_timeline_batch(notification->batch);
+    error err = acknowledge_timeline_batch(notification->batch);
+    if (err != noError) {
+        logger().error(err);
+    }
 }
 
 error Database::String(
@@ -2816,11 +5292,10 @@ error Database::String(
     poco_assert(result);
     poco_assert(!sql.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
-
     try {
+        ReadSession reader(this);
         std::string value("");
-        *session << sql,
+        *reader << sql,
         Poco::Data::into(value),
         Poco::Data::now;
         *result = value;
@@ -2831,7 +5306,7 @@ error Database::String(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("String");
+    return noError;
 }
 
 error Database::UInt(
@@ -2841,11 +5316,10 @@ error Database::UInt(
     poco_assert(result);
     poco_assert(!sql.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
-
     try {
+        ReadSession reader(this);
         Poco::UInt64 value(0);
-        *session << sql,
+        *reader << sql,
         Poco::Data::into(value),
         Poco::Data::now;
         *result = value;
@@ -2856,7 +5330,7 @@ error Database::UInt(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("UInt");
+    return noError;
 }
 
 }   // namespace kopsik
@@ -9,10 +9,17 @@
 #include "sqlite3.h" // NOLINT
 #endif
 
+#include <set>
 #include <string>
 #include <vector>
+#include <map>
 
+#include "Poco/Activity.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/Event.h"
 #include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
 #include "Poco/Data/Common.h"
 #include "Poco/Data/SQLite/Connector.h"
 #include "Poco/NotificationCenter.h"
@@ -26,6 +33,81 @@
 
 namespace kopsik {
 
+// A compiled SQL statement that is kept around and
+// executed again with new values bound to it.
+// Errors are reported through last_error, same as
+// with statements executed via the session.
+class PreparedStatement {
+ public:
+    PreparedStatement(sqlite3 *db, sqlite3_stmt *stmt)
+        : db_(db)
+    , stmt_(stmt)
+    , position_(0) {}
+    ~PreparedStatement();
+
+    // Bind values to placeholders in the order they appear in SQL
+    void Use(const Poco::Int64 value);
+    void Use(const Poco::UInt64 value);
+    void Use(const bool value);
+    void Use(const std::string &value);
+
+    // Returns false if the statement failed
+    bool Execute();
+
+    // Steps to the next result row. Returns false when there
+    // are no more rows or the step failed, and resets the
+    // statement, same as Execute.
+    bool Fetch();
+
+    // Read a column of the current row, NULL reads as 0 or ""
+    Poco::Int64 Int64(const int column) const;
+    Poco::UInt64 UInt64(const int column) const;
+    bool Bool(const int column) const;
+    std::string String(const int column) const;
+
+ private:
+    void reset();
+
+    sqlite3 *db_;
+    sqlite3_stmt *stmt_;
+    int position_;
+};
+
+// Recursive mutex that keeps count of how often
+// and for how long callers had to wait for it.
+// Counters are only changed while the mutex is held.
+class CountingMutex {
+ public:
+    typedef Poco::ScopedLock<CountingMutex> ScopedLock;
+
+    CountingMutex()
+        : locks_(0)
+    , contended_locks_(0)
+    , wait_time_(0) {}
+
+    void lock();
+    void unlock();
+
+    Poco::UInt64 Locks() const {
+        return locks_;
+    }
+    Poco::UInt64 ContendedLocks() const {
+        return contended_locks_;
+    }
+    Poco::Timestamp::TimeDiff WaitTime() const {
+        return wait_time_;
+    }
+
+ private:
+    Poco::Mutex mutex_;
+    Poco::UInt64 locks_;
+    Poco::UInt64 contended_locks_;
+    Poco::Timestamp::TimeDiff wait_time_;
+};
+
+class ReaderSessionPool;
+class ReadSession;
+
 class Database {
  public:
     explicit Database(const std::string db_path);
@@ -88,6 +170,49 @@ class Database {
     error SaveUser(User *user, bool with_related_data,
                    std::vector<ModelChange> *changes);
 
+    // Only time entries of the last given number of days, plus the ones
+    // that are running or not yet pushed, are loaded with the user.
+    // Zero means all time entries are loaded.
+    void SetTimeEntryWindowDays(const Poco::UInt64 days) {
+        time_entry_window_days_ = days;
+    }
+
+    // Pages in time entries of the given number of days
+    // before the ones that are already loaded.
+    error LoadOlderTimeEntries(
+        User *user,
+        const Poco::UInt64 days);
+
+    // Loads a time entry that is outside of the window
+    error LoadTimeEntryByGUID(
+        User *user,
+        const guid GUID,
+        TimeEntry **result);
+
+    // Reads a time entry of the user as it was last saved, or none.
+    // Caller owns it.
+    error TimeEntryByGUID(
+        const Poco::UInt64 UID,
+        const guid GUID,
+        TimeEntry **result);
+
+    // Time entries of the user that match the query by description
+    // or project label, most recently tracked first. Caller owns them.
+    error SearchTimeEntries(
+        const Poco::UInt64 UID,
+        const std::string query,
+        const Poco::UInt64 limit,
+        std::vector<TimeEntry *> *result);
+
+    // Time entries of the user that were tracked at some point between
+    // from and to, latest first, including ones outside of the
+    // in-memory window. Deleted entries are left out. Caller owns them.
+    error LoadTimeEntriesInRange(
+        const Poco::UInt64 UID,
+        const Poco::Int64 from,
+        const Poco::Int64 to,
+        std::vector<TimeEntry *> *result);
+
     error LoadTimeEntriesForUpload(User *user);
 
     error CurrentAPIToken(std::string *token);
@@ -98,6 +223,54 @@ class Database {
 
     static std::string GenerateGUID();
 
+    // Writes buffered timeline events in one transaction
+    error FlushTimelineEvents();
+
+    // Checkpoints the WAL and gives free pages back to the
+    // file system. Meant to be run while the app is idle.
+    error Maintain();
+
+    // Sizes of database and WAL files in bytes, unused pages
+    // in the database file and page cache hits of the writer.
+    error Stats(
+        Poco::UInt64 *file_size,
+        Poco::UInt64 *wal_size,
+        Poco::UInt64 *freelist_pages,
+        double *cache_hit_ratio);
+
+    // Lock contention on the writer session, and how many reads
+    // were served by reader sessions or had to use the writer.
+    void LockStats(
+        Poco::UInt64 *write_locks,
+        Poco::UInt64 *contended_write_locks,
+        Poco::Timestamp::TimeDiff *write_lock_wait,
+        Poco::UInt64 *pooled_reads,
+        Poco::UInt64 *writer_reads);
+
+    // Related data of the user is written into a snapshot file
+    // by WriteSnapshot, and loaded from it if it is up to date.
+    // Empty path turns snapshots off.
+    void SetSnapshotPath(const std::string path) {
+        snapshot_path_ = path;
+    }
+
+    // Writes the snapshot, unless the user has changes that are
+    // not saved yet. Meant to be run at shutdown and while the app
+    // is idle; caller keeps the user from changing meanwhile.
+    error WriteSnapshot(User *user);
+
+    // How often statements were found compiled in the
+    // cache, and how often they had to be compiled.
+    void PreparedStatementStats(
+        Poco::UInt64 *hits,
+        Poco::UInt64 *misses);
+
+    // Time spent checking and migrating the schema on
+    // startup, and how many migrations were applied.
+    void SchemaStats(
+        Poco::Timestamp::TimeDiff *check_time,
+        Poco::UInt64 *applied_migrations) const;
+
  protected:
     void handleTimelineEventNotification(
         TimelineEventNotification* notification);
@@ -109,11 +282,28 @@ class Database {
         DeleteTimelineBatchNotification *notification);
 
  private:
+    friend class ReadSession;
+
     error initialize_tables();
+    error load_migrations();
+    error migrate_tables();
+    error initialize_tag_tables();
+    error initialize_search_tables();
+    error initialize_timeline_tables();
 
     error migrate(
         const std::string name,
         const std::string sql);
+    error isMigrated(
+        const std::string name,
+        bool *result);
+    error markMigrated(
+        const std::string name);
+    error migrateTagsColumn();
+
+    error generation(Poco::UInt64 *result);
+    error bumpGeneration(Poco::UInt64 *result);
+    error loadSnapshot(User *user);
 
     error execute(
         const std::string sql);
@@ -124,6 +314,13 @@ class Database {
     error journalMode(std::string *);
     error setJournalMode(const std::string);
 
+    // Page size and auto vacuum only apply to new database files
+    error configure();
+
+    error pragma(
+        const std::string name,
+        Poco::Int64 *result);
+
     error loadUsersRelatedData(User *user);
 
     error loadWorkspaces(
@@ -148,34 +345,132 @@ class Database {
 
     error loadTimeEntries(
         const Poco::UInt64 UID,
+        const Poco::Int64 since,
         std::vector<TimeEntry *> *list);
 
-    error loadTimeEntriesFromSQLStatement(
-        Poco::Data::Statement *select,
+    error loadTimeEntriesStartedBetween(
+        const Poco::UInt64 UID,
+        const Poco::Int64 from,
+        const Poco::Int64 to,
         std::vector<TimeEntry *> *list);
 
+    error hasTimeEntriesStartedBefore(
+        const Poco::UInt64 UID,
+        const Poco::Int64 before,
+        bool *result);
+
+    error loadDailyTotals(
+        const Poco::UInt64 UID,
+        DailyTotals *totals);
+
+    error saveDailyTotals(
+        const Poco::UInt64 UID,
+        const TimeEntryColumns &columns,
+        const Poco::Int64 loaded_since,
+        DailyTotals *totals);
+
+    // Writes the total of a day, caller holds the mutex
+    bool replaceDailyTotal(
+        const Poco::UInt64 UID,
+        const Poco::Int64 day,
+        const Poco::Int64 seconds);
+
+    // Decodes result rows of a select into new models, appending
+    // them to list. Models are dropped again if the select fails.
+    template <typename T>
+    error fetchModels(
+        PreparedStatement *select,
+        const std::string was_doing,
+        std::vector<T *> *list);
+
+    error fetchTimeEntryTags(
+        PreparedStatement *select,
+        const std::string was_doing,
+        std::vector<TimeEntry *> *list,
+        const size_t first);
+
+    error tagNameID(
+        const Poco::Int64 rowid,
+        TagNameID *result);
+    error tagNameRowID(
+        const TagNameID id,
+        Poco::Int64 *result);
+
+    error saveTimeEntryTags(TimeEntry *model);
+
+    error searchTimeEntriesLike(
+        const Poco::UInt64 UID,
+        const std::string query,
+        const Poco::UInt64 limit,
+        std::vector<TimeEntry *> *result);
+
+    // Re-indexes time entries with local IDs in given range
+    error refreshSearchIndex(
+        const Poco::Int64 from,
+        const Poco::Int64 to);
+
     template <typename T>
     error saveRelatedModels(
         const Poco::UInt64 UID,
         const std::string table_name,
+        ModelIndex *index,
+        std::vector<ModelChange> *changes);
+
+    // Drops models that were deleted by the save from memory,
+    // once their deletion has been committed.
+    template <typename T>
+    void purgeDeletedModels(
         std::vector<T *> *list,
+        ModelIndex *index);
+
+    // Notes down how a model was before it is written by the
+    // SaveUser transaction, see rollbackSave.
+    void rememberSaved(BaseModel *model, ModelIndex *index);
+    void rememberSaved(TimeEntry *model, ModelIndex *index);
+
+    // Rolls back the SaveUser transaction and puts the models and
+    // days it had written back the way they were, so that they
+    // are saved again next time. Returns given error.
+    error rollbackSave(const error err);
+
+    error bulkInsertTimeEntries(
+        const Poco::UInt64 UID,
+        ModelIndex *index,
         std::vector<ModelChange> *changes);
 
     error deleteFromTable(
         const std::string table_name,
         const Poco::Int64 local_id);
 
+    // Returns a cached statement for given key, compiling it on first use.
+    // Key identifies model type and operation, ie "time_entries.update".
+    PreparedStatement *prepared(
+        const std::string key,
+        const std::string sql);
+    void clearPreparedStatements();
+
+    Poco::Int64 lastInsertRowID();
+
     error deleteAllFromTableByUID(
         const std::string table_name,
         const Poco::Int64 UID);
 
-    error insert_timeline_event(const TimelineEvent& info);
+    error insert_timeline_events(const std::vector<TimelineEvent> &events);
+
+    // Activity callback, flushes timeline events in the background
+    void timeline_writer_loop();
+
+    // Drops oldest buffered events over kTimelineBufferMaxEvents.
+    // Must be called with timeline_buffer_m_ held.
+    void cap_timeline_buffer();
 
     error select_timeline_batch(
         const Poco::UInt64 user_id,
         std::vector<TimelineEvent> *timeline_events);
 
-    error delete_timeline_batch(
+    // Moves the upload cursor of the user past the batch and
+    // deletes the uploaded events, in one transaction.
+    error acknowledge_timeline_batch(
         const std::vector<TimelineEvent> &timeline_events);
 
     error saveModel(
@@ -205,9 +500,62 @@ class Database {
     Poco::Logger &logger() const;
 
     Poco::Data::Session *session;
+    std::string db_path_;
     std::string desktop_id_;
 
-    Poco::Mutex mutex_;
+    std::map<std::string, PreparedStatement *> prepared_statements_;
+
+    // Tag name IDs in database and the ones interned in memory
+    std::map<TagNameID, Poco::Int64> tag_name_rowids_;
+    std::map<Poco::Int64, TagNameID> tag_names_by_rowid_;
+    Poco::UInt64 prepared_statement_hits_;
+    Poco::UInt64 prepared_statement_misses_;
+    Poco::Timestamp::TimeDiff prepared_statement_compile_time_;
+
+    Poco::UInt64 time_entry_window_days_;
+
+    // State of models before the current SaveUser transaction
+    // wrote them.
+    struct SavedModel {
+        BaseModel *model;
+        ModelIndex *index;
+        TimeEntry *time_entry;
+        Poco::Int64 local_id;
+        bool dirty;
+        bool tags_changed;
+    };
+    std::vector<SavedModel> saved_models_;
+    DailyTotals *saved_totals_;
+    std::set<Poco::Int64> saved_days_;
+    // Indexes of models deleted by the transaction
+    std::set<ModelIndex *> purge_;
+
+    std::string snapshot_path_;
+
+    // Names of applied migrations, loaded on startup
+    std::set<std::string> migrations_;
+    Poco::Timestamp::TimeDiff schema_check_time_;
+    Poco::UInt64 applied_migrations_;
+
+    // Whether SQLite has FTS4 and time_entry_search exists
+    bool full_text_search_;
+
+    // Read-only sessions; reads do not wait for the writer under WAL
+    ReaderSessionPool *readers_;
+    Poco::AtomicCounter pooled_reads_;
+    Poco::AtomicCounter writer_reads_;
+
+    CountingMutex mutex_;
+
+    // Recorded timeline events are buffered, so that the
+    // recorder thread never waits for the disk.
+    Poco::Mutex timeline_buffer_m_;
+    std::vector<TimelineEvent> timeline_buffer_;
+    // One flush at a time, so that failed events are put back
+    // before the next flush takes the buffer.
+    Poco::Mutex timeline_flush_m_;
+    Poco::Event timeline_flush_requested_;
+    Poco::Activity<Database> timeline_writer_;
 };
 
 }  // namespace kopsik
@@ -216,7 +216,7 @@ void loadUserTagFromJSONNode(
 
     if (!model) {
         model = new Tag();
-        user->related.Tags.push_back(model);
+        user->related.AddTag(model);
     }
     if (alive) {
         alive->insert(id);
@@ -270,7 +270,7 @@ void loadUserTaskFromJSONNode(
 
     if (!model) {
         model = new Task();
-        user->related.Tasks.push_back(model);
+        user->related.AddTask(model);
     }
 
     if (alive) {
@@ -360,7 +360,7 @@ void loadUserWorkspaceFromJSONNode(
 
     if (!model) {
         model = new Workspace();
-        user->related.Workspaces.push_back(model);
+        user->related.AddWorkspace(model);
     }
     if (alive) {
         alive->insert(id);
@@ -375,17 +375,18 @@ error LoadTagsFromJSONNode(
     poco_assert(te);
     poco_assert(list);
 
-    te->TagNames.clear();
+    std::vector<std::string> names;
 
     JSONNODE_ITERATOR current_node = json_begin(list);
     JSONNODE_ITERATOR last_node = json_end(list);
     while (current_node != last_node) {
         std::string tag = std::string(json_as_string(*current_node));
         if (!tag.empty()) {
-            te->TagNames.push_back(tag);
+            names.push_back(tag);
         }
         ++current_node;
     }
+    te->SetTagNames(names);
     return noError;
 }
 
@@ -413,7 +414,7 @@ void loadUserClientFromJSONNode(
 
     if (!model) {
         model = new Client();
-        user->related.Clients.push_back(model);
+        user->related.AddClient(model);
     }
     if (alive) {
         alive->insert(id);
@@ -485,7 +486,7 @@ void loadUserProjectFromJSONNode(
 
     if (!model) {
         model = new Project();
-        user->related.Projects.push_back(model);
+        user->related.AddProject(model);
     }
     if (alive) {
         alive->insert(id);
@@ -523,17 +524,18 @@ error LoadTimeEntryTagsFromJSONNode(
     poco_assert(te);
     poco_assert(list);
 
-    te->TagNames.clear();
+    std::vector<std::string> names;
 
     JSONNODE_ITERATOR current_node = json_begin(list);
     JSONNODE_ITERATOR last_node = json_end(list);
     while (current_node != last_node) {
         std::string tag = std::string(json_as_string(*current_node));
         if (!tag.empty()) {
-            te->TagNames.push_back(tag);
+            names.push_back(tag);
         }
         ++current_node;
     }
+    te->SetTagNames(names);
     return noError;
 }
 
@@ -561,7 +563,7 @@ void loadUserTimeEntryFromJSONNode(
 
     if (!model) {
         model = new TimeEntry();
-        user->related.TimeEntries.push_back(model);
+        user->related.AddTimeEntry(model);
     }
     if (alive) {
         alive->insert(id);
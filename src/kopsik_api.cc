@@ -145,6 +145,12 @@ void kopsik_context_clear(void *context) {
     delete app(context);
 }
 
+_Bool kopsik_flush(void *context) {
+    logger().debug("kopsik_flush");
+
+    return app(context)->FlushSave();
+}
+
 _Bool kopsik_get_settings(
     void *context,
     _Bool *out_use_idle_detection,
@@ -199,6 +205,31 @@ _Bool kopsik_get_settings(
     return true;
 }
 
+_Bool kopsik_db_stats(
+    void *context,
+    uint64_t *file_size,
+    uint64_t *wal_size,
+    uint64_t *freelist_pages,
+    double *cache_hit_ratio) {
+
+    poco_assert(file_size);
+    poco_assert(wal_size);
+    poco_assert(freelist_pages);
+    poco_assert(cache_hit_ratio);
+
+    logger().debug("kopsik_db_stats");
+
+    Poco::UInt64 file(0), wal(0), freelist(0);
+    if (!app(context)->DatabaseStats(&file, &wal, &freelist,
+                                     cache_hit_ratio)) {
+        return false;
+    }
+    *file_size = file;
+    *wal_size = wal;
+    *freelist_pages = freelist;
+    return true;
+}
+
 _Bool kopsik_get_proxy_settings(
     void *context,
     _Bool *out_use_proxy,
@@ -513,38 +544,31 @@ _Bool kopsik_autocomplete_items(
                                     include_tasks,
                                     include_projects);
 
-    KopsikAutocompleteItem *previous = 0;
-    for (std::vector<kopsik::AutocompleteItem>::iterator it =
-        items.begin();
-            it != items.end();
-            it++) {
-        kopsik::AutocompleteItem &item = *it;
+    *first = autocomplete_item_list(items);
 
-        KopsikAutocompleteItem *autocomplete_item =
-            autocomplete_item_init();
-        if (!*first) {
-            *first = autocomplete_item;
-        }
-        if (previous) {
-            previous->Next = autocomplete_item;
-        }
+    return true;
+}
+
+_Bool kopsik_search_time_entries(
+    void *context,
+    const char *query,
+    const unsigned int limit,
+    KopsikAutocompleteItem **first) {
+
+    poco_assert(query);
+    poco_assert(first);
+
+    logger().debug("kopsik_search_time_entries");
 
-        autocomplete_item->Description = strdup(item.Description.c_str());
-        autocomplete_item->Text = strdup(item.Text.c_str());
-        autocomplete_item->ProjectAndTaskLabel =
-            strdup(item.ProjectAndTaskLabel.c_str());
-        autocomplete_item->ProjectColor =
-            strdup(item.ProjectColor.c_str());
-        autocomplete_item->ProjectID =
-            static_cast<unsigned int>(item.ProjectID);
-        autocomplete_item->TaskID =
-            static_cast<unsigned int>(item.TaskID);
-        autocomplete_item->Type =
-            static_cast<unsigned int>(item.Type);
+    *first = 0;
 
-        previous = autocomplete_item;
+    std::vector<kopsik::AutocompleteItem> items;
+    if (!app(context)->SearchTimeEntries(query, limit, &items)) {
+        return false;
     }
 
+    *first = autocomplete_item_list(items);
+
     return true;
 }
 
@@ -577,10 +601,10 @@ _Bool kopsik_workspaces(
     poco_assert(first);
     poco_assert(!*first);
 
-    std::vector<kopsik::Workspace *> workspaces = app(context)->Workspaces();
+    std::vector<kopsik::Workspace> workspaces = app(context)->Workspaces();
 
     *first = 0;
-    for (std::vector<kopsik::Workspace *>::const_iterator it =
+    for (std::vector<kopsik::Workspace>::const_iterator it =
         workspaces.begin();
             it != workspaces.end();
             it++) {
@@ -600,10 +624,10 @@ _Bool kopsik_clients(
     poco_assert(first);
     poco_assert(!*first);
 
-    std::vector<kopsik::Client *> clients = app(context)->Clients(workspace_id);
+    std::vector<kopsik::Client> clients = app(context)->Clients(workspace_id);
 
     *first = 0;
-    for (std::vector<kopsik::Client *>::const_iterator it = clients.begin();
+    for (std::vector<kopsik::Client>::const_iterator it = clients.begin();
             it != clients.end();
             it++) {
         KopsikViewItem *item = client_to_view_item(*it);
@@ -791,7 +815,19 @@ _Bool kopsik_time_entry_view_item_by_guid(
     std::string GUID(guid);
     poco_assert(!GUID.empty());
 
-    kopsik::TimeEntry *te = app(context)->GetTimeEntryByGUID(GUID);
+    kopsik::ViewSnapshotRef snapshot = app(context)->Snapshot();
+    const kopsik::TimeEntryView *view = snapshot->TimeEntryByGUID(GUID);
+    if (view) {
+        *was_found = true;
+        time_entry_to_view_item(*view, view_item, "");
+        return true;
+    }
+
+    // Entries outside of the loaded window are read from database
+    kopsik::TimeEntry *te = 0;
+    if (!app(context)->LoadTimeEntryByGUID(GUID, &te)) {
+        return false;
+    }
     if (!te) {
         *was_found = false;
         return true;
@@ -804,6 +840,7 @@ _Bool kopsik_time_entry_view_item_by_guid(
     app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
 
     time_entry_to_view_item(te, project_label, color_code, view_item, "");
+    delete te;
 
     return true;
 }
@@ -998,22 +1035,10 @@ _Bool kopsik_running_time_entry_view_item(
     logger().debug("kopsik_running_time_entry_view_item");
 
     *out_is_tracking = false;
-    kopsik::TimeEntry *te = 0;
-    if (!app(context)->RunningTimeEntry(&te)) {
-        return false;
-    }
-    if (te) {
+    kopsik::ViewSnapshotRef snapshot = app(context)->Snapshot();
+    if (!snapshot->Running.empty()) {
         *out_is_tracking = true;
-        std::string project_label("");
-        std::string color_code("");
-        app(context)->ProjectLabelAndColorCode(te,
-                                               &project_label,
-                                               &color_code);
-        time_entry_to_view_item(te,
-                                project_label,
-                                color_code,
-                                out_item,
-                                "");
+        time_entry_to_view_item(snapshot->Running.front(), out_item, "");
     }
     return true;
 }
@@ -1026,50 +1051,84 @@ _Bool kopsik_time_entry_view_items(
 
     logger().debug("kopsik_time_entry_view_items");
 
-    std::map<std::string, Poco::Int64> date_durations;
-    std::vector<kopsik::TimeEntry *> visible;
-
-    if (!app(context)->TimeEntries(&date_durations,
-                                   &visible)) {
-        return false;
+    kopsik::ViewSnapshotRef snapshot = app(context)->Snapshot();
+    std::vector<const kopsik::TimeEntryView *> visible;
+    visible.reserve(snapshot->TimeEntries.size());
+    for (size_t i = 0; i < snapshot->TimeEntries.size(); i++) {
+        visible.push_back(&snapshot->TimeEntries[i]);
     }
 
     if (visible.empty()) {
         return true;
     }
 
-    *first = 0;
-    KopsikTimeEntryViewItem *previous = 0;
-    for (unsigned int i = 0; i < visible.size(); i++) {
-        kopsik::TimeEntry *te = visible[i];
-        KopsikTimeEntryViewItem *view_item =
-            kopsik_time_entry_view_item_init();
-        if (previous) {
-            previous->Next = view_item;
+    *first = time_entry_view_item_list(*snapshot, visible);
+    return true;
+}
+
+_Bool kopsik_time_entry_view_items_range(
+    void *context,
+    const uint64_t from,
+    const uint64_t to,
+    KopsikTimeEntryViewItem **first) {
+
+    poco_assert(first);
+
+    logger().debug("kopsik_time_entry_view_items_range");
+
+    kopsik::ViewSnapshotRef snapshot = app(context)->Snapshot();
+    std::vector<const kopsik::TimeEntryView *> visible;
+    std::vector<kopsik::TimeEntryView> loaded;
+    const Poco::Int64 since = snapshot->TimeEntriesLoadedSince;
+    if (since && static_cast<Poco::Int64>(from) < since) {
+        // Range reaches past the loaded window, read it from database
+        std::vector<kopsik::TimeEntry *> list;
+        if (!app(context)->LoadTimeEntriesInRange(
+            static_cast<Poco::Int64>(from),
+            static_cast<Poco::Int64>(to),
+            &list)) {
+            return false;
+        }
+        loaded.reserve(list.size());
+        for (size_t i = 0; i < list.size(); i++) {
+            std::string project_label("");
+            std::string color_code("");
+            app(context)->ProjectLabelAndColorCode(list[i],
+                                                   &project_label,
+                                                   &color_code);
+            loaded.push_back(
+                kopsik::TimeEntryView(*list[i], project_label, color_code));
+            delete list[i];
         }
-        if (!*first) {
-            *first = view_item;
+        for (size_t i = 0; i < loaded.size(); i++) {
+            visible.push_back(&loaded[i]);
         }
+    } else {
+        snapshot->TimeEntriesInRange(
+            static_cast<Poco::Int64>(from),
+            static_cast<Poco::Int64>(to),
+            &visible);
+    }
 
-        Poco::Int64 duration = date_durations[te->DateHeaderString()];
-        std::string formatted =
-            kopsik::Formatter::FormatDurationInSecondsHHMM(duration);
-
-        std::string project_label("");
-        std::string color_code("");
-        app(context)->ProjectLabelAndColorCode(te,
-                                               &project_label,
-                                               &color_code);
-        time_entry_to_view_item(te,
-                                project_label,
-                                color_code,
-                                view_item,
-                                formatted);
-        previous = view_item;
+    if (visible.empty()) {
+        return true;
     }
+
+    *first = time_entry_view_item_list(*snapshot, visible);
     return true;
 }
 
+_Bool kopsik_load_more_time_entries(
+    void *context,
+    _Bool *has_more) {
+
+    poco_assert(has_more);
+
+    logger().debug("kopsik_load_more_time_entries");
+
+    return app(context)->LoadOlderTimeEntries(has_more);
+}
+
 _Bool kopsik_duration_for_date_header(
     void *context,
     const char *date,
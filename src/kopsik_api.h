@@ -224,6 +224,16 @@ extern "C" {
     KOPSIK_EXPORT void kopsik_context_clear(
         void *context);
 
+    // Changes are saved in the background. Functions that change
+    // data return as soon as the change is made in memory; true does
+    // not mean it has been written. Once it's written, the view item
+    // change callback is called for each changed model, and a failed
+    // write is reported to the error callback and retried with the
+    // next save. Waits until queued changes are written to the local
+    // database.
+    KOPSIK_EXPORT _Bool kopsik_flush(
+        void *context);
+
     KOPSIK_EXPORT void kopsik_websocket_switch(
         void *context,
         const _Bool on);
@@ -285,6 +295,15 @@ extern "C" {
         _Bool *on_top,
         _Bool *reminder);
 
+    // Size of the local database and its write-ahead log in bytes,
+    // number of unused pages in it and share of page cache hits.
+    KOPSIK_EXPORT _Bool kopsik_db_stats(
+        void *context,
+        uint64_t *file_size,
+        uint64_t *wal_size,
+        uint64_t *freelist_pages,
+        double *cache_hit_ratio);
+
     KOPSIK_EXPORT _Bool kopsik_get_proxy_settings(
         void *context,
         _Bool *use_proxy,
@@ -334,6 +353,15 @@ extern "C" {
     KOPSIK_EXPORT void kopsik_autocomplete_item_clear(
         KopsikAutocompleteItem *item);
 
+    // Searches descriptions and project labels of all time entries,
+    // including ones not loaded into memory. Clear result with
+    // kopsik_autocomplete_item_clear.
+    KOPSIK_EXPORT _Bool kopsik_search_time_entries(
+        void *context,
+        const char *query,
+        const unsigned int limit,
+        KopsikAutocompleteItem **first);
+
     KOPSIK_EXPORT _Bool kopsik_tags(
         void *context,
         KopsikViewItem **first);
@@ -389,6 +417,21 @@ extern "C" {
         void *context,
         KopsikTimeEntryViewItem **first);
 
+    // Time entries, including the running one, that were tracked at some
+    // point between the given Unix timestamps, for example the visible
+    // week. Ranges older than the loaded entries are read from database.
+    KOPSIK_EXPORT _Bool kopsik_time_entry_view_items_range(
+        void *context,
+        const uint64_t from,
+        const uint64_t to,
+        KopsikTimeEntryViewItem **first);
+
+    // Loads older time entries from local database, so that they
+    // appear among time entry view items.
+    KOPSIK_EXPORT _Bool kopsik_load_more_time_entries(
+        void *context,
+        _Bool *has_more);
+
     KOPSIK_EXPORT _Bool kopsik_duration_for_date_header(
         void *context,
         const char *date,
@@ -2,6 +2,12 @@
 
 #include "./kopsik_api_private.h"
 
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./formatter.h"
+
 KopsikModelChange *model_change_init() {
     KopsikModelChange *change = new KopsikModelChange();
     change->ModelType = 0;
@@ -66,53 +72,70 @@ void time_entry_to_view_item(
     KopsikTimeEntryViewItem *view_item,
     const std::string dateDuration) {
     poco_assert(te);
+    time_entry_to_view_item(
+        kopsik::TimeEntryView(*te, project_and_task_label, color_code),
+        view_item,
+        dateDuration);
+}
+
+void time_entry_to_view_item(
+    const kopsik::TimeEntryView &te,
+    KopsikTimeEntryViewItem *view_item,
+    const std::string dateDuration) {
     poco_assert(view_item);
 
-    view_item->DurationInSeconds = static_cast<int>(te->DurationInSeconds());
+    view_item->DurationInSeconds = static_cast<int>(te.DurationInSeconds);
 
     poco_assert(!view_item->Description);
-    view_item->Description = strdup(te->Description().c_str());
+    view_item->Description = strdup(te.Description.c_str());
 
     poco_assert(!view_item->GUID);
-    view_item->GUID = strdup(te->GUID().c_str());
+    view_item->GUID = strdup(te.GUID.c_str());
 
-    view_item->WID = static_cast<unsigned int>(te->WID());
-    view_item->TID = static_cast<unsigned int>(te->TID());
-    view_item->PID = static_cast<unsigned int>(te->PID());
+    view_item->WID = static_cast<unsigned int>(te.WID);
+    view_item->TID = static_cast<unsigned int>(te.TID);
+    view_item->PID = static_cast<unsigned int>(te.PID);
 
     poco_assert(!view_item->ProjectAndTaskLabel);
-    view_item->ProjectAndTaskLabel = strdup(project_and_task_label.c_str());
+    view_item->ProjectAndTaskLabel = strdup(te.ProjectAndTaskLabel.c_str());
 
     poco_assert(!view_item->Color);
-    view_item->Color = strdup(color_code.c_str());
+    view_item->Color = strdup(te.Color.c_str());
 
     poco_assert(!view_item->Duration);
-    view_item->Duration = strdup(te->DurationString().c_str());
+    if (te.DurationInSeconds < 0) {
+        // Running entry keeps on ticking after the snapshot
+        view_item->Duration = strdup(
+            kopsik::Formatter::FormatDurationInSecondsHHMMSS(
+                te.DurationInSeconds).c_str());
+    } else {
+        view_item->Duration = strdup(te.Duration.c_str());
+    }
 
-    view_item->Started = static_cast<unsigned int>(te->Start());
-    view_item->Ended = static_cast<unsigned int>(te->Stop());
-    if (te->Billable()) {
+    view_item->Started = static_cast<unsigned int>(te.Started);
+    view_item->Ended = static_cast<unsigned int>(te.Ended);
+    if (te.Billable) {
         view_item->Billable = true;
     } else {
         view_item->Billable = false;
     }
 
     poco_assert(!view_item->Tags);
-    if (!te->Tags().empty()) {
-        view_item->Tags = strdup(te->Tags().c_str());
+    if (!te.Tags.empty()) {
+        view_item->Tags = strdup(te.Tags.c_str());
     }
 
-    view_item->UpdatedAt = static_cast<unsigned int>(te->UpdatedAt());
+    view_item->UpdatedAt = static_cast<unsigned int>(te.UpdatedAt);
 
     poco_assert(!view_item->DateHeader);
-    view_item->DateHeader = strdup(te->DateHeaderString().c_str());
+    view_item->DateHeader = strdup(te.DateHeader.c_str());
 
     poco_assert(!view_item->DateDuration);
     if (!dateDuration.empty()) {
         view_item->DateDuration = strdup(dateDuration.c_str());
     }
 
-    if (te->DurOnly()) {
+    if (te.DurOnly) {
         view_item->DurOnly = true;
     } else {
         view_item->DurOnly = false;
@@ -132,6 +155,43 @@ KopsikAutocompleteItem *autocomplete_item_init() {
     return item;
 }
 
+KopsikAutocompleteItem *autocomplete_item_list(
+    const std::vector<kopsik::AutocompleteItem> items) {
+    KopsikAutocompleteItem *first = 0;
+    KopsikAutocompleteItem *previous = 0;
+    for (std::vector<kopsik::AutocompleteItem>::const_iterator it =
+        items.begin();
+            it != items.end();
+            it++) {
+        const kopsik::AutocompleteItem &item = *it;
+
+        KopsikAutocompleteItem *autocomplete_item =
+            autocomplete_item_init();
+        if (!first) {
+            first = autocomplete_item;
+        }
+        if (previous) {
+            previous->Next = autocomplete_item;
+        }
+
+        autocomplete_item->Description = strdup(item.Description.c_str());
+        autocomplete_item->Text = strdup(item.Text.c_str());
+        autocomplete_item->ProjectAndTaskLabel =
+            strdup(item.ProjectAndTaskLabel.c_str());
+        autocomplete_item->ProjectColor =
+            strdup(item.ProjectColor.c_str());
+        autocomplete_item->ProjectID =
+            static_cast<unsigned int>(item.ProjectID);
+        autocomplete_item->TaskID =
+            static_cast<unsigned int>(item.TaskID);
+        autocomplete_item->Type =
+            static_cast<unsigned int>(item.Type);
+
+        previous = autocomplete_item;
+    }
+    return first;
+}
+
 KopsikViewItem *view_item_init() {
     KopsikViewItem *result = new KopsikViewItem();
     result->ID = 0;
@@ -159,18 +219,53 @@ KopsikViewItem *tag_to_view_item(
 }
 
 KopsikViewItem *workspace_to_view_item(
-    kopsik::Workspace * const ws) {
+    const kopsik::Workspace &ws) {
     KopsikViewItem *result = view_item_init();
-    result->ID = static_cast<unsigned int>(ws->ID());
-    result->Name = strdup(ws->Name().c_str());
+    result->ID = static_cast<unsigned int>(ws.ID());
+    result->Name = strdup(ws.Name().c_str());
     return result;
 }
 
 KopsikViewItem *client_to_view_item(
-    kopsik::Client * const c) {
+    const kopsik::Client &c) {
     KopsikViewItem *result = view_item_init();
-    result->ID = static_cast<unsigned int>(c->ID());
-    result->GUID = strdup(c->GUID().c_str());
-    result->Name = strdup(c->Name().c_str());
+    result->ID = static_cast<unsigned int>(c.ID());
+    result->GUID = strdup(c.GUID().c_str());
+    result->Name = strdup(c.Name().c_str());
     return result;
 }
+
+KopsikTimeEntryViewItem *time_entry_view_item_list(
+    const kopsik::ViewSnapshot &snapshot,
+    const std::vector<const kopsik::TimeEntryView *> &visible) {
+    KopsikTimeEntryViewItem *first = 0;
+    KopsikTimeEntryViewItem *previous = 0;
+    for (unsigned int i = 0; i < visible.size(); i++) {
+        const kopsik::TimeEntryView &te = *visible[i];
+        KopsikTimeEntryViewItem *view_item =
+            kopsik_time_entry_view_item_init();
+        if (previous) {
+            previous->Next = view_item;
+        }
+        if (!first) {
+            first = view_item;
+        }
+
+        Poco::Int64 duration(0);
+        std::map<std::string, Poco::Int64>::const_iterator it =
+            snapshot.DateDurations.find(te.DateHeader);
+        if (it != snapshot.DateDurations.end()) {
+            duration = it->second;
+        } else {
+            // Day is not in the list, entry was read from database
+            duration = snapshot.TrackedPerDay.ForDay(
+                static_cast<Poco::Int64>(te.Started));
+        }
+        std::string formatted =
+            kopsik::Formatter::FormatDurationInSecondsHHMM(duration);
+
+        time_entry_to_view_item(te, view_item, formatted);
+        previous = view_item;
+    }
+    return first;
+}
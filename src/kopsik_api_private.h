@@ -4,6 +4,7 @@
 #define SRC_KOPSIK_API_PRIVATE_H_
 
 #include <string>
+#include <vector>
 
 #include "./kopsik_api.h"
 #include "./context.h"
@@ -17,6 +18,11 @@ void time_entry_to_view_item(
     KopsikTimeEntryViewItem *view_item,
     const std::string dateDuration);
 
+void time_entry_to_view_item(
+    const kopsik::TimeEntryView &te,
+    KopsikTimeEntryViewItem *view_item,
+    const std::string dateDuration);
+
 KopsikViewItem *project_to_view_item(
     kopsik::Project * const);
 
@@ -24,10 +30,10 @@ KopsikViewItem *tag_to_view_item(
     const std::string tag_name);
 
 KopsikViewItem *workspace_to_view_item(
-    kopsik::Workspace * const);
+    const kopsik::Workspace &);
 
 KopsikViewItem *client_to_view_item(
-    kopsik::Client * const);
+    const kopsik::Client &);
 
 KopsikModelChange *model_change_init();
 
@@ -43,4 +49,12 @@ void autocomplete_item_clear(
 
 KopsikAutocompleteItem *autocomplete_item_init();
 
+KopsikAutocompleteItem *autocomplete_item_list(
+    const std::vector<kopsik::AutocompleteItem> items);
+
+// View items of the time entries, with durations of their dates
+KopsikTimeEntryViewItem *time_entry_view_item_list(
+    const kopsik::ViewSnapshot &snapshot,
+    const std::vector<const kopsik::TimeEntryView *> &visible);
+
 #endif  // SRC_KOPSIK_API_PRIVATE_H_
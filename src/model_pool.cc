@@ -0,0 +1,99 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./model_pool.h"
+
+#include <new>
+
+#include "Poco/Bugcheck.h"
+
+namespace kopsik {
+
+namespace {
+
+// Blocks are kept at the alignment the heap would give
+const size_t kBlockAlignment = 16;
+
+size_t blockSize(const size_t model_size) {
+    return (model_size + kBlockAlignment - 1)
+           / kBlockAlignment * kBlockAlignment;
+}
+
+}  // namespace
+
+ModelPool::ModelPool(
+    const size_t model_size,
+    const size_t models_per_slab)
+    : model_size_(model_size)
+, block_size_(blockSize(model_size))
+, models_per_slab_(models_per_slab)
+, free_(0)
+, in_use_(0) {
+    // Free blocks hold a pointer to the next one
+    poco_assert(model_size_ >= sizeof(free_));
+    poco_assert(models_per_slab_ > 0);
+}
+
+ModelPool::~ModelPool() {
+    for (size_t i = 0; i < slabs_.size(); i++) {
+        ::operator delete(slabs_[i]);
+    }
+}
+
+void *ModelPool::Allocate(const size_t size) {
+    if (size != model_size_) {
+        return ::operator new(size);
+    }
+
+    Poco::FastMutex::ScopedLock lock(mutex_);
+
+    if (!free_) {
+        addSlab();
+    }
+    FreeBlock *block = free_;
+    free_ = block->next;
+    in_use_++;
+    return block;
+}
+
+void ModelPool::Release(void *p, const size_t size) {
+    if (!p) {
+        return;
+    }
+    if (size != model_size_) {
+        ::operator delete(p);
+        return;
+    }
+
+    Poco::FastMutex::ScopedLock lock(mutex_);
+
+    FreeBlock *block = static_cast<FreeBlock *>(p);
+    block->next = free_;
+    free_ = block;
+    in_use_--;
+}
+
+// Blocks of a new slab are put on the free list in address
+// order, so models allocated one after another are adjacent.
+void ModelPool::addSlab() {
+    char *slab = static_cast<char *>(
+        ::operator new(block_size_ * models_per_slab_));
+    slabs_.push_back(slab);
+    for (size_t i = models_per_slab_; i > 0; i--) {
+        FreeBlock *block =
+            reinterpret_cast<FreeBlock *>(slab + (i - 1) * block_size_);
+        block->next = free_;
+        free_ = block;
+    }
+}
+
+size_t ModelPool::Slabs() const {
+    Poco::FastMutex::ScopedLock lock(mutex_);
+    return slabs_.size();
+}
+
+size_t ModelPool::ModelsInUse() const {
+    Poco::FastMutex::ScopedLock lock(mutex_);
+    return in_use_;
+}
+
+}  // namespace kopsik
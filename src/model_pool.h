@@ -0,0 +1,52 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_MODEL_POOL_H_
+#define SRC_MODEL_POOL_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "Poco/Mutex.h"
+
+namespace kopsik {
+
+// Allocates models of one class from slabs of many models at a time,
+// instead of asking the heap for each of them. Memory of deleted
+// models is kept in a free list and reused by the next allocation;
+// slabs are never given back. Models use it by defining their own
+// operator new and operator delete.
+class ModelPool {
+ public:
+    explicit ModelPool(
+        const size_t model_size,
+        const size_t models_per_slab = 1024);
+    ~ModelPool();
+
+    // Subclasses of different size are allocated from the heap
+    void *Allocate(const size_t size);
+    void Release(void *p, const size_t size);
+
+    size_t Slabs() const;
+    size_t ModelsInUse() const;
+
+ private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    void addSlab();
+
+    const size_t model_size_;
+    const size_t block_size_;
+    const size_t models_per_slab_;
+
+    std::vector<char *> slabs_;
+    FreeBlock *free_;
+    size_t in_use_;
+
+    mutable Poco::FastMutex mutex_;
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_MODEL_POOL_H_
@@ -9,9 +9,25 @@
 #include "Poco/NumberParser.h"
 
 #include "./formatter.h"
+#include "./model_pool.h"
 
 namespace kopsik {
 
+// Never deleted, so that models can be deleted by static destructors
+static ModelPool *project_pool = new ModelPool(sizeof(Project));
+
+void *Project::operator new(size_t size) {
+    return project_pool->Allocate(size);
+}
+
+void Project::operator delete(void *p, size_t size) {
+    project_pool->Release(p, size);
+}
+
+const ModelPool &Project::Pool() {
+    return *project_pool;
+}
+
 const char *known_colors[] = {
     "#4dc3ff", "#bc85e6", "#df7baa", "#f68d38", "#b27636",
     "#8ab734", "#14a88e", "#268bb5", "#6668b4", "#a4506c",
@@ -87,17 +103,32 @@ std::string Project::ColorCode() const {
     return color_codes[index % color_codes.size()];
 }
 
+Poco::UInt64 Project::RelatedID(const RelatedIDKind kind) const {
+    switch (kind) {
+    case kRelatedWID:
+        return wid_;
+    case kRelatedCID:
+        return cid_;
+    default:
+        return 0;
+    }
+}
+
 void Project::SetWID(const Poco::UInt64 value) {
     if (wid_ != value) {
+        Poco::UInt64 previous = wid_;
         wid_ = value;
         SetDirty();
+        relatedIDChanged(kRelatedWID, previous);
     }
 }
 
 void Project::SetCID(const Poco::UInt64 value) {
     if (cid_ != value) {
+        Poco::UInt64 previous = cid_;
         cid_ = value;
         SetDirty();
+        relatedIDChanged(kRelatedCID, previous);
     }
 }
 
@@ -13,6 +13,8 @@
 
 namespace kopsik {
 
+class ModelPool;
+
 class Project : public BaseModel {
  public:
     Project()
@@ -25,6 +27,11 @@ class Project : public BaseModel {
     , private_(false)
     , billable_(false) {}
 
+    // Allocated from a pool, see ModelPool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+    static const ModelPool &Pool();
+
     Poco::UInt64 WID() const {
         return wid_;
     }
@@ -66,6 +73,8 @@ class Project : public BaseModel {
     }
     void SetBillable(const bool value);
 
+    Poco::UInt64 RelatedID(const RelatedIDKind kind) const;
+
     std::string ModelName() const {
         return "project";
     }
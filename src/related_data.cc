@@ -2,6 +2,514 @@
 
 #include "./related_data.h"
 
+#include <algorithm>
+#include <iterator>
+
+#include "./formatter.h"
+
+#include "Poco/LocalDateTime.h"
+#include "Poco/Timestamp.h"
+
 namespace kopsik {
 
+void ModelIndex::Add(BaseModel *model) {
+    poco_assert(model);
+    model->SetIndex(this);
+    if (model->ID()) {
+        by_id_.insert(IDMap::ValueType(model->ID(), model));
+    }
+    if (!model->GUID().empty()) {
+        by_guid_.insert(GUIDMap::ValueType(model->GUID(), model));
+    }
+    for (int kind = 0; kind < kRelatedIDKinds; kind++) {
+        addRelated(model, RelatedIDKind(kind),
+                   model->RelatedID(RelatedIDKind(kind)));
+    }
+    if (model->NeedsToBeSaved()) {
+        Changed(model);
+    }
+}
+
+void ModelIndex::Remove(BaseModel *model) {
+    poco_assert(model);
+    if (model->ID()) {
+        IDMap::Iterator it = by_id_.find(model->ID());
+        if (it != by_id_.end() && it->second == model) {
+            by_id_.erase(it);
+        }
+    }
+    if (!model->GUID().empty()) {
+        GUIDMap::Iterator it = by_guid_.find(model->GUID());
+        if (it != by_guid_.end() && it->second == model) {
+            by_guid_.erase(it);
+        }
+    }
+    for (int kind = 0; kind < kRelatedIDKinds; kind++) {
+        removeRelated(model, RelatedIDKind(kind),
+                      model->RelatedID(RelatedIDKind(kind)));
+    }
+    if (changed_set_.erase(model)) {
+        changed_.erase(
+            std::find(changed_.begin(), changed_.end(), model));
+    }
+    if (model->Index() == this) {
+        model->SetIndex(0);
+    }
+}
+
+void ModelIndex::Clear() {
+    by_id_.clear();
+    by_guid_.clear();
+    for (int kind = 0; kind < kRelatedIDKinds; kind++) {
+        by_related_id_[kind].clear();
+    }
+    ClearChanged();
+}
+
+void ModelIndex::addRelated(
+    BaseModel *model,
+    const RelatedIDKind kind,
+    const Poco::UInt64 id) {
+    if (id) {
+        by_related_id_[kind][id].insert(model);
+    }
+}
+
+void ModelIndex::removeRelated(
+    BaseModel *model,
+    const RelatedIDKind kind,
+    const Poco::UInt64 id) {
+    if (!id) {
+        return;
+    }
+    RelatedIDMap::iterator it = by_related_id_[kind].find(id);
+    if (it == by_related_id_[kind].end()) {
+        return;
+    }
+    it->second.erase(model);
+    if (it->second.empty()) {
+        by_related_id_[kind].erase(it);
+    }
+}
+
+void ModelIndex::RelatedIDChanged(
+    BaseModel *model,
+    const RelatedIDKind kind,
+    const Poco::UInt64 previous) {
+    poco_assert(model);
+    removeRelated(model, kind, previous);
+    addRelated(model, kind, model->RelatedID(kind));
+}
+
+// A copy, as callers often change the related ID they looked up by
+std::vector<BaseModel *> ModelIndex::ByRelatedID(
+    const RelatedIDKind kind,
+    const Poco::UInt64 id) const {
+    std::vector<BaseModel *> result;
+    RelatedIDMap::const_iterator it = by_related_id_[kind].find(id);
+    if (it != by_related_id_[kind].end()) {
+        result.assign(it->second.begin(), it->second.end());
+    }
+    return result;
+}
+
+void ModelIndex::Changed(BaseModel *model) {
+    poco_assert(model);
+    if (changed_set_.insert(model).second) {
+        changed_.push_back(model);
+    }
+}
+
+void ModelIndex::ClearChanged() {
+    changed_.clear();
+    changed_set_.clear();
+}
+
+BaseModel *ModelIndex::ByID(const Poco::UInt64 id) const {
+    IDMap::ConstIterator it = by_id_.find(id);
+    if (it == by_id_.end()) {
+        return 0;
+    }
+    return it->second;
+}
+
+BaseModel *ModelIndex::ByGUID(const guid GUID) const {
+    GUIDMap::ConstIterator it = by_guid_.find(GUID);
+    if (it == by_guid_.end()) {
+        return 0;
+    }
+    return it->second;
+}
+
+void ModelIndex::IDChanged(BaseModel *model, const Poco::UInt64 previous) {
+    poco_assert(model);
+    if (previous) {
+        IDMap::Iterator it = by_id_.find(previous);
+        if (it != by_id_.end() && it->second == model) {
+            by_id_.erase(it);
+        }
+    }
+    if (model->ID()) {
+        by_id_.insert(IDMap::ValueType(model->ID(), model));
+    }
+}
+
+void ModelIndex::GUIDChanged(BaseModel *model, const guid previous) {
+    poco_assert(model);
+    if (!previous.empty()) {
+        GUIDMap::Iterator it = by_guid_.find(previous);
+        if (it != by_guid_.end() && it->second == model) {
+            by_guid_.erase(it);
+        }
+    }
+    if (!model->GUID().empty()) {
+        by_guid_.insert(GUIDMap::ValueType(model->GUID(), model));
+    }
+}
+
+void DailyTotals::Add(const Poco::Int64 at, const Poco::Int64 seconds) {
+    Poco::Int64 day = StartOfDay(at);
+    seconds_[day] += seconds;
+    changed_days_.insert(day);
+}
+
+void DailyTotals::Load(const Poco::Int64 day, const Poco::Int64 seconds) {
+    seconds_[day] = seconds;
+}
+
+void DailyTotals::Clear() {
+    seconds_.clear();
+    changed_days_.clear();
+}
+
+Poco::Int64 DailyTotals::ForDay(const Poco::Int64 at) const {
+    std::map<Poco::Int64, Poco::Int64>::const_iterator it =
+        seconds_.find(StartOfDay(at));
+    if (it == seconds_.end()) {
+        return 0;
+    }
+    return it->second;
+}
+
+Poco::Int64 DailyTotals::ForDateHeader(const std::string date_header) const {
+    Poco::Int64 sum(0);
+    for (std::map<Poco::Int64, Poco::Int64>::const_iterator it =
+        seconds_.begin(); it != seconds_.end(); it++) {
+        if (it->second &&
+                Formatter::FormatDateHeader(it->first) == date_header) {
+            sum += it->second;
+        }
+    }
+    return sum;
+}
+
+Poco::Int64 DailyTotals::StartOfDay(const Poco::Int64 at) {
+    Poco::LocalDateTime date(Poco::Timestamp::fromEpochTime(at));
+    Poco::LocalDateTime midnight(date.year(), date.month(), date.day());
+    return midnight.timestamp().epochTime();
+}
+
+void RunningTimeEntries::Add(TimeEntry *model) {
+    poco_assert(model);
+    entries_.push_back(model);
+}
+
+void RunningTimeEntries::Remove(TimeEntry *model) {
+    poco_assert(model);
+    std::vector<TimeEntry *>::iterator it =
+        std::find(entries_.begin(), entries_.end(), model);
+    if (it != entries_.end()) {
+        entries_.erase(it);
+    }
+}
+
+void TimeEntryOrder::Add(TimeEntry *model) {
+    poco_assert(model);
+    pending_.insert(model);
+}
+
+void TimeEntryOrder::Remove(TimeEntry *model) {
+    poco_assert(model);
+    bool added = pending_.erase(model) && !stale_.count(model);
+    if (!added) {
+        stale_.insert(model);
+    }
+}
+
+void TimeEntryOrder::Moved(TimeEntry *model) {
+    poco_assert(model);
+    if (pending_.insert(model).second) {
+        stale_.insert(model);
+    }
+}
+
+const std::vector<TimeEntry *> &TimeEntryOrder::Ordered() const {
+    repair();
+    return ordered_;
+}
+
+TimeEntry *TimeEntryOrder::First() const {
+    repair();
+    if (ordered_.empty()) {
+        return 0;
+    }
+    return ordered_.front();
+}
+
+// Finds the range by start time with binary search,
+// entries are ordered by start time, latest first.
+void TimeEntryOrder::StartedBetween(
+    const Poco::Int64 from,
+    const Poco::Int64 to,
+    std::vector<TimeEntry *> *result) const {
+    poco_assert(result);
+    repair();
+
+    size_t begin(0), end(ordered_.size());
+    // First entry that started before to
+    while (begin < end) {
+        size_t middle = begin + (end - begin) / 2;
+        if (static_cast<Poco::Int64>(ordered_[middle]->Start()) >= to) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    for (size_t i = begin; i < ordered_.size()
+            && static_cast<Poco::Int64>(ordered_[i]->Start()) >= from; i++) {
+        result->push_back(ordered_[i]);
+    }
+}
+
+void TimeEntryOrder::repair() const {
+    if (pending_.empty() && stale_.empty()) {
+        return;
+    }
+
+    std::vector<TimeEntry *> kept;
+    kept.reserve(ordered_.size() + pending_.size());
+    for (size_t i = 0; i < ordered_.size(); i++) {
+        if (!stale_.count(ordered_[i])) {
+            kept.push_back(ordered_[i]);
+        }
+    }
+
+    std::vector<TimeEntry *> added(pending_.begin(), pending_.end());
+    std::sort(added.begin(), added.end(), CompareTimeEntriesByStart);
+
+    ordered_.clear();
+    ordered_.reserve(kept.size() + added.size());
+    std::merge(kept.begin(), kept.end(), added.begin(), added.end(),
+               std::back_inserter(ordered_), CompareTimeEntriesByStart);
+
+    pending_.clear();
+    stale_.clear();
+}
+
+size_t TimeEntryColumns::Add(TimeEntry *model) {
+    poco_assert(model);
+    size_t row = entries_.size();
+    entries_.push_back(model);
+    start_.push_back(0);
+    stop_.push_back(0);
+    duration_.push_back(0);
+    wid_.push_back(0);
+    pid_.push_back(0);
+    tid_.push_back(0);
+    flags_.push_back(0);
+    set(row, *model);
+    return row;
+}
+
+void TimeEntryColumns::Update(const size_t row, const TimeEntry &model) {
+    poco_assert(row < entries_.size());
+    poco_assert(entries_[row] == &model);
+    set(row, model);
+}
+
+void TimeEntryColumns::set(const size_t row, const TimeEntry &model) {
+    start_[row] = model.Start();
+    stop_[row] = model.Stop();
+    duration_[row] = model.DurationInSeconds();
+    wid_[row] = model.WID();
+    pid_[row] = model.PID();
+    tid_[row] = model.TID();
+    flags_[row] = (model.DeletedAt() ? kDeleted : 0)
+                  | (model.IsMarkedAsDeletedOnServer() ? kDeletedOnServer : 0);
+}
+
+void TimeEntryColumns::Remove(const size_t row) {
+    poco_assert(row < entries_.size());
+    size_t last = entries_.size() - 1;
+    if (row != last) {
+        entries_[row] = entries_[last];
+        start_[row] = start_[last];
+        stop_[row] = stop_[last];
+        duration_[row] = duration_[last];
+        wid_[row] = wid_[last];
+        pid_[row] = pid_[last];
+        tid_[row] = tid_[last];
+        flags_[row] = flags_[last];
+        entries_[row]->columnsRowMoved(row);
+    }
+    entries_.pop_back();
+    start_.pop_back();
+    stop_.pop_back();
+    duration_.pop_back();
+    wid_.pop_back();
+    pid_.pop_back();
+    tid_.pop_back();
+    flags_.pop_back();
+}
+
+// Loops below select instead of branching, so that
+// the compiler can vectorize them.
+Poco::Int64 TimeEntryColumns::Seconds(
+    const Poco::Int64 from,
+    const Poco::Int64 to) const {
+    const size_t n = start_.size();
+    const Poco::Int64 *start = n ? &start_[0] : 0;
+    const Poco::Int64 *duration = n ? &duration_[0] : 0;
+    const Poco::UInt8 *flags = n ? &flags_[0] : 0;
+    Poco::Int64 sum(0);
+    for (size_t i = 0; i < n; i++) {
+        bool counted = (flags[i] == 0) & (duration[i] > 0)
+                       & (start[i] >= from) & (start[i] < to);
+        sum += counted ? duration[i] : 0;
+    }
+    return sum;
+}
+
+// Days are mostly 24 hours long, so the day of an entry is
+// guessed by dividing and then corrected for DST changes.
+void TimeEntryColumns::SecondsPerDay(
+    const Poco::Int64 from,
+    const Poco::Int64 to,
+    std::map<Poco::Int64, Poco::Int64> *result) const {
+    poco_assert(result);
+
+    std::vector<Poco::Int64> days;
+    for (Poco::Int64 day = DailyTotals::StartOfDay(from); day < to;
+            day = DailyTotals::StartOfDay(day + 36 * 3600)) {
+        days.push_back(day);
+    }
+    if (days.empty()) {
+        return;
+    }
+
+    const Poco::Int64 first = days.front();
+    const Poco::Int64 end = DailyTotals::StartOfDay(days.back() + 36 * 3600);
+    const Poco::Int64 last = static_cast<Poco::Int64>(days.size()) - 1;
+    std::vector<Poco::Int64> sums(days.size(), 0);
+
+    const size_t n = start_.size();
+    for (size_t i = 0; i < n; i++) {
+        const Poco::Int64 start = start_[i];
+        if (flags_[i] || duration_[i] <= 0 || start < first || start >= end
+                || start < from || start >= to) {
+            continue;
+        }
+        Poco::Int64 day = (std::min)((start - first) / 86400, last);
+        while (start < days[day]) {
+            day--;
+        }
+        while (day < last && start >= days[day + 1]) {
+            day++;
+        }
+        sums[day] += duration_[i];
+    }
+
+    for (size_t i = 0; i < days.size(); i++) {
+        if (sums[i]) {
+            (*result)[days[i]] += sums[i];
+        }
+    }
+}
+
+void TimeEntryColumns::SecondsPerProject(
+    std::map<Poco::UInt64, Poco::UInt64> *result) const {
+    poco_assert(result);
+
+    // Entries of a project tend to follow each other
+    const size_t n = pid_.size();
+    Poco::UInt64 pid(0);
+    Poco::UInt64 sum(0);
+    for (size_t i = 0; i < n; i++) {
+        if (flags_[i] || duration_[i] <= 0) {
+            continue;
+        }
+        if (pid_[i] != pid) {
+            if (sum) {
+                (*result)[pid] += sum;
+            }
+            pid = pid_[i];
+            sum = 0;
+        }
+        sum += duration_[i];
+    }
+    if (sum) {
+        (*result)[pid] += sum;
+    }
+}
+
+template<typename T>
+void reindexList(const std::vector<T *> &list, ModelIndex *index) {
+    index->Clear();
+    for (size_t i = 0; i < list.size(); i++) {
+        index->Add(list[i]);
+    }
+}
+
+void RelatedData::AddWorkspace(Workspace *model) {
+    Workspaces.push_back(model);
+    WorkspaceIndex.Add(model);
+}
+
+void RelatedData::AddClient(Client *model) {
+    Clients.push_back(model);
+    ClientIndex.Add(model);
+}
+
+void RelatedData::AddProject(Project *model) {
+    Projects.push_back(model);
+    ProjectIndex.Add(model);
+}
+
+void RelatedData::AddTask(Task *model) {
+    Tasks.push_back(model);
+    TaskIndex.Add(model);
+}
+
+void RelatedData::AddTag(Tag *model) {
+    Tags.push_back(model);
+    TagIndex.Add(model);
+}
+
+// Time entries that come from database are already
+// counted in the totals loaded from there.
+void RelatedData::AddTimeEntry(TimeEntry *model) {
+    TimeEntries.push_back(model);
+    TimeEntryIndex.Add(model);
+    model->SetDailyTotals(&TrackedPerDay, model->LocalID() != 0);
+    model->SetRunningTimeEntries(&Running);
+    model->SetTimeEntryOrder(&TimeEntriesByStart);
+    model->SetTimeEntryColumns(&Columns);
+}
+
+void RelatedData::Reindex() {
+    reindexList(Workspaces, &WorkspaceIndex);
+    reindexList(Clients, &ClientIndex);
+    reindexList(Projects, &ProjectIndex);
+    reindexList(Tasks, &TaskIndex);
+    reindexList(Tags, &TagIndex);
+    reindexList(TimeEntries, &TimeEntryIndex);
+    for (size_t i = 0; i < TimeEntries.size(); i++) {
+        TimeEntries[i]->SetDailyTotals(&TrackedPerDay,
+                                       TimeEntries[i]->LocalID() != 0);
+        TimeEntries[i]->SetRunningTimeEntries(&Running);
+        TimeEntries[i]->SetTimeEntryOrder(&TimeEntriesByStart);
+        TimeEntries[i]->SetTimeEntryColumns(&Columns);
+    }
+}
+
 }   // namespace kopsik
@@ -4,7 +4,12 @@
 #define SRC_RELATED_DATA_H_
 
 #include <vector>
+#include <set>
+#include <map>
+#include <string>
 
+#include "./types.h"
+#include "./base_model.h"
 #include "./workspace.h"
 #include "./client.h"
 #include "./project.h"
@@ -12,16 +17,290 @@
 #include "./tag.h"
 #include "./time_entry.h"
 
+#include "Poco/Types.h"
+#include "Poco/HashMap.h"
+
 namespace kopsik {
 
+// Looks up models of a single type by server side ID and by GUID.
+// A model that has been added to an index notifies it when its
+// ID or GUID changes (after pull, batch update etc).
+// If two models share an ID or GUID, the one indexed first wins,
+// same as with a linear scan over the list.
+// The index also tracks which models need to be saved, so that
+// saving the user does not have to walk through all of the models.
+// Models are also indexed by the workspace, client, project and task
+// they belong to, so removing one of those only touches the models
+// that refer to it.
+class ModelIndex {
+ public:
+    ModelIndex() {}
+    // Does not touch the models; they may already be deleted.
+    ~ModelIndex() {}
+
+    void Add(BaseModel *model);
+    void Remove(BaseModel *model);
+    void Clear();
+
+    BaseModel *ByID(const Poco::UInt64 id) const;
+    BaseModel *ByGUID(const guid GUID) const;
+
+    // Models that belong to the workspace, client, project or task
+    std::vector<BaseModel *> ByRelatedID(
+        const RelatedIDKind kind,
+        const Poco::UInt64 id) const;
+
+    void IDChanged(BaseModel *model, const Poco::UInt64 previous);
+    void GUIDChanged(BaseModel *model, const guid previous);
+    void RelatedIDChanged(
+        BaseModel *model,
+        const RelatedIDKind kind,
+        const Poco::UInt64 previous);
+
+    // Models that are new or dirty, in order of first change
+    void Changed(BaseModel *model);
+    const std::vector<BaseModel *> &ChangedModels() const {
+        return changed_;
+    }
+    void ClearChanged();
+
+ private:
+    typedef Poco::HashMap<Poco::UInt64, BaseModel *> IDMap;
+    typedef Poco::HashMap<guid, BaseModel *> GUIDMap;
+
+    typedef std::map<Poco::UInt64, std::set<BaseModel *> > RelatedIDMap;
+
+    void addRelated(
+        BaseModel *model,
+        const RelatedIDKind kind,
+        const Poco::UInt64 id);
+    void removeRelated(
+        BaseModel *model,
+        const RelatedIDKind kind,
+        const Poco::UInt64 id);
+
+    IDMap by_id_;
+    GUIDMap by_guid_;
+    RelatedIDMap by_related_id_[kRelatedIDKinds];
+
+    std::vector<BaseModel *> changed_;
+    std::set<BaseModel *> changed_set_;
+};
+
+// Tracked seconds per local calendar day, keyed by the Unix
+// timestamp of local midnight. Time entries move their own
+// duration between days as they are started, stopped, edited
+// and deleted, so totals never have to be summed up again.
+// Days that have not been saved yet are kept track of, same as
+// changed models in ModelIndex.
+class DailyTotals {
+ public:
+    DailyTotals() {}
+    ~DailyTotals() {}
+
+    // Adds seconds to the day the given time falls on
+    void Add(const Poco::Int64 at, const Poco::Int64 seconds);
+
+    // Sets a total as it was saved, without marking it changed
+    void Load(const Poco::Int64 day, const Poco::Int64 seconds);
+    void Clear();
+
+    const std::map<Poco::Int64, Poco::Int64> &Days() const {
+        return seconds_;
+    }
+    Poco::Int64 ForDay(const Poco::Int64 at) const;
+    Poco::Int64 ForDateHeader(const std::string date_header) const;
+
+    const std::set<Poco::Int64> &ChangedDays() const {
+        return changed_days_;
+    }
+    void Changed(const Poco::Int64 day) {
+        changed_days_.insert(day);
+    }
+    void ClearChanged() {
+        changed_days_.clear();
+    }
+
+    // Unix timestamp of local midnight of the day the given time falls on
+    static Poco::Int64 StartOfDay(const Poco::Int64 at);
+
+ private:
+    std::map<Poco::Int64, Poco::Int64> seconds_;
+    std::set<Poco::Int64> changed_days_;
+};
+
+// Time entries that are running, in the order they started running.
+// Time entries add and remove themselves as their duration changes,
+// so finding the running entry does not mean scanning all of them.
+class RunningTimeEntries {
+ public:
+    RunningTimeEntries() {}
+    ~RunningTimeEntries() {}
+
+    void Add(TimeEntry *model);
+    void Remove(TimeEntry *model);
+
+    TimeEntry *First() const {
+        if (entries_.empty()) {
+            return 0;
+        }
+        return entries_.front();
+    }
+    const std::vector<TimeEntry *> &All() const {
+        return entries_;
+    }
+
+ private:
+    // Multi-tracking is not supported, so there is rarely more than one
+    std::vector<TimeEntry *> entries_;
+};
+
+// Time entries ordered by start time, latest first.
+// Entries that are added or change their start time are only
+// noted down, and put into place on next access with a single
+// merge. Accessing an order that has not changed costs nothing.
+class TimeEntryOrder {
+ public:
+    TimeEntryOrder() : longest_(0) {}
+    ~TimeEntryOrder() {}
+
+    void Add(TimeEntry *model);
+    void Remove(TimeEntry *model);
+    void Moved(TimeEntry *model);
+
+    // Entries report their duration as it changes, so that
+    // the longest one bounds how far back ranges have to look.
+    void Lasts(const Poco::Int64 seconds) {
+        if (seconds > longest_) {
+            longest_ = seconds;
+        }
+    }
+    // Longest duration of a stopped entry seen so far.
+    // Does not shrink when that entry is removed.
+    Poco::Int64 LongestDuration() const {
+        return longest_;
+    }
+
+    const std::vector<TimeEntry *> &Ordered() const;
+    TimeEntry *First() const;
+
+    // Entries started at or after from and before to, latest first
+    void StartedBetween(
+        const Poco::Int64 from,
+        const Poco::Int64 to,
+        std::vector<TimeEntry *> *result) const;
+
+ private:
+    void repair() const;
+
+    mutable std::vector<TimeEntry *> ordered_;
+    // Entries to be put into place, and entries
+    // to be taken out of their current place.
+    mutable std::set<TimeEntry *> pending_;
+    mutable std::set<TimeEntry *> stale_;
+
+    Poco::Int64 longest_;
+};
+
+// Fields of time entries that aggregates need, kept in contiguous
+// columns, so that sums run over plain arrays instead of going through
+// a pointer to each time entry. Time entries update their own row as
+// their fields change. Only stopped entries that are not deleted are
+// counted in sums.
+class TimeEntryColumns {
+ public:
+    TimeEntryColumns() {}
+    ~TimeEntryColumns() {}
+
+    // Copies fields of the time entry into a new row
+    size_t Add(TimeEntry *model);
+    void Update(const size_t row, const TimeEntry &model);
+    // The last row is moved into place of the removed one
+    void Remove(const size_t row);
+
+    size_t Size() const {
+        return start_.size();
+    }
+
+    // Seconds tracked on entries started within given time
+    Poco::Int64 Seconds(
+        const Poco::Int64 from,
+        const Poco::Int64 to) const;
+
+    // Seconds tracked per local day, keyed by local midnight
+    void SecondsPerDay(
+        const Poco::Int64 from,
+        const Poco::Int64 to,
+        std::map<Poco::Int64, Poco::Int64> *result) const;
+
+    // Seconds tracked per project ID of the entry, 0 for no project
+    void SecondsPerProject(
+        std::map<Poco::UInt64, Poco::UInt64> *result) const;
+
+ private:
+    enum {
+        kDeleted = 1,
+        kDeletedOnServer = 2
+    };
+
+    void set(const size_t row, const TimeEntry &model);
+
+    std::vector<TimeEntry *> entries_;
+    std::vector<Poco::Int64> start_;
+    std::vector<Poco::Int64> stop_;
+    std::vector<Poco::Int64> duration_;
+    std::vector<Poco::UInt64> wid_;
+    std::vector<Poco::UInt64> pid_;
+    std::vector<Poco::UInt64> tid_;
+    std::vector<Poco::UInt8> flags_;
+};
+
 class RelatedData {
  public:
+    RelatedData() : TimeEntriesLoadedSince(0) {}
+
     std::vector<Workspace *> Workspaces;
     std::vector<Client *> Clients;
     std::vector<Project *> Projects;
     std::vector<Task *> Tasks;
     std::vector<Tag *> Tags;
     std::vector<TimeEntry *> TimeEntries;
+
+    // Indexes of the lists above. Add models using the Add* methods,
+    // or call Reindex() after filling the lists directly.
+    ModelIndex WorkspaceIndex;
+    ModelIndex ClientIndex;
+    ModelIndex ProjectIndex;
+    ModelIndex TaskIndex;
+    ModelIndex TagIndex;
+    ModelIndex TimeEntryIndex;
+
+    // Totals of time entries in the list above, and of
+    // the ones that are in database only.
+    DailyTotals TrackedPerDay;
+
+    // Running time entries of the list above
+    RunningTimeEntries Running;
+
+    // Fields of time entries of the list above, for aggregates
+    TimeEntryColumns Columns;
+
+    // Time entries of the list above, latest first.
+    // Entries deleted on server are left out.
+    TimeEntryOrder TimeEntriesByStart;
+
+    void AddWorkspace(Workspace *model);
+    void AddClient(Client *model);
+    void AddProject(Project *model);
+    void AddTask(Task *model);
+    void AddTag(Tag *model);
+    void AddTimeEntry(TimeEntry *model);
+
+    void Reindex();
+
+    // Time entries that started before this time may exist in database
+    // only; they are loaded on demand. Zero if all are in memory.
+    Poco::Int64 TimeEntriesLoadedSince;
 };
 
 }  // namespace kopsik
@@ -0,0 +1,250 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./snapshot.h"
+
+#include <cstddef>
+#include <cstring>
+#include <sstream>
+
+#include "Poco/Checksum.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+#include "Poco/SharedMemory.h"
+
+namespace kopsik {
+
+namespace {
+
+// Bump when the layout of rows changes
+const char kSnapshotMagic[] = "kopsik01";
+const size_t kSnapshotMagicSize = 8;
+
+const size_t kSnapshotHeaderSize = kSnapshotMagicSize
+                                   + sizeof(Poco::UInt64)  // UID
+                                   + sizeof(Poco::UInt64)  // generation
+                                   + sizeof(Poco::UInt64)  // size of rows
+                                   + sizeof(Poco::UInt32);  // checksum
+
+const char kIntColumn = 'i';
+const char kStringColumn = 's';
+
+template <typename T>
+void append(std::string *data, const T value) {
+    data->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// Values are not aligned in the file, so they are copied out
+template <typename T>
+T read(const char *at) {
+    T value;
+    memcpy(&value, at, sizeof(value));
+    return value;
+}
+
+Poco::UInt32 checksum(const char *data, const size_t size) {
+    Poco::Checksum crc(Poco::Checksum::TYPE_CRC32);
+    crc.update(data, static_cast<unsigned>(size));
+    return crc.checksum();
+}
+
+}  // namespace
+
+void SnapshotWriter::Int(const Poco::Int64 value) {
+    row_ += kIntColumn;
+    append(&row_, value);
+    columns_++;
+}
+
+void SnapshotWriter::String(const std::string value) {
+    row_ += kStringColumn;
+    append(&row_, static_cast<Poco::UInt32>(value.size()));
+    row_ += value;
+    columns_++;
+}
+
+void SnapshotWriter::EndRow() {
+    append(&data_, columns_);
+    data_ += row_;
+    row_.clear();
+    columns_ = 0;
+}
+
+error SnapshotWriter::Save(
+    const std::string path,
+    const Poco::UInt64 UID,
+    const Poco::UInt64 generation) const {
+    poco_assert(!path.empty());
+    poco_assert(row_.empty());
+
+    std::string header(kSnapshotMagic, kSnapshotMagicSize);
+    append(&header, UID);
+    append(&header, generation);
+    append(&header, static_cast<Poco::UInt64>(data_.size()));
+    append(&header, checksum(data_.data(), data_.size()));
+    poco_assert(header.size() == kSnapshotHeaderSize);
+
+    const std::string temporary_path = path + ".tmp";
+    try {
+        {
+            Poco::FileOutputStream out(temporary_path,
+                                       std::ios::out | std::ios::binary
+                                       | std::ios::trunc);
+            out.write(header.data(), header.size());
+            out.write(data_.data(), data_.size());
+            out.close();
+            if (!out) {
+                return error("Failed to write snapshot " + temporary_path);
+            }
+        }
+        Poco::File(temporary_path).renameTo(path);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return noError;
+}
+
+SnapshotReader::SnapshotReader()
+    : memory_(0)
+, position_(0)
+, end_(0)
+, valid_(true) {}
+
+SnapshotReader::~SnapshotReader() {
+    delete memory_;
+}
+
+error SnapshotReader::Open(
+    const std::string path,
+    const Poco::UInt64 UID,
+    const Poco::UInt64 generation) {
+    poco_assert(!memory_);
+
+    try {
+        Poco::File file(path);
+        if (!file.exists()) {
+            return error("Snapshot not found");
+        }
+        if (file.getSize() < kSnapshotHeaderSize) {
+            return error("Snapshot is truncated");
+        }
+        memory_ = new Poco::SharedMemory(file,
+                                         Poco::SharedMemory::AM_READ);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+
+    const char *header = memory_->begin();
+    const size_t size = memory_->end() - memory_->begin();
+    if (memcmp(header, kSnapshotMagic, kSnapshotMagicSize) != 0) {
+        return error("Snapshot has unknown format");
+    }
+    const char *at = header + kSnapshotMagicSize;
+    if (read<Poco::UInt64>(at) != UID) {
+        return error("Snapshot belongs to another user");
+    }
+    at += sizeof(Poco::UInt64);
+    if (read<Poco::UInt64>(at) != generation) {
+        return error("Snapshot is older than database");
+    }
+    at += sizeof(Poco::UInt64);
+    if (read<Poco::UInt64>(at) != size - kSnapshotHeaderSize) {
+        return error("Snapshot is truncated");
+    }
+    at += sizeof(Poco::UInt64);
+
+    position_ = header + kSnapshotHeaderSize;
+    end_ = memory_->end();
+    if (read<Poco::UInt32>(at) != checksum(position_, end_ - position_)) {
+        return error("Snapshot checksum does not match");
+    }
+    return noError;
+}
+
+bool SnapshotReader::Next() {
+    columns_.clear();
+    if (!valid_ || position_ == end_) {
+        return false;
+    }
+
+    const char *at = position_;
+    if (end_ - at < static_cast<ptrdiff_t>(sizeof(Poco::UInt32))) {
+        valid_ = false;
+        return false;
+    }
+    const Poco::UInt32 count = read<Poco::UInt32>(at);
+    at += sizeof(Poco::UInt32);
+
+    for (Poco::UInt32 i = 0; i < count; i++) {
+        if (at == end_) {
+            valid_ = false;
+            return false;
+        }
+        columns_.push_back(at);
+        const char type = *at++;
+        size_t size(0);
+        if (kIntColumn == type) {
+            size = sizeof(Poco::Int64);
+        } else if (kStringColumn == type
+                   && end_ - at >= static_cast<ptrdiff_t>(
+                       sizeof(Poco::UInt32))) {
+            size = sizeof(Poco::UInt32) + read<Poco::UInt32>(at);
+        } else {
+            valid_ = false;
+            return false;
+        }
+        if (static_cast<size_t>(end_ - at) < size) {
+            valid_ = false;
+            return false;
+        }
+        at += size;
+    }
+
+    position_ = at;
+    return true;
+}
+
+const char *SnapshotReader::column(
+    const size_t index,
+    const char type) const {
+    if (index >= columns_.size() || *columns_[index] != type) {
+        valid_ = false;
+        return 0;
+    }
+    return columns_[index] + 1;
+}
+
+Poco::Int64 SnapshotReader::Int64(const size_t index) const {
+    const char *at = column(index, kIntColumn);
+    if (!at) {
+        return 0;
+    }
+    return read<Poco::Int64>(at);
+}
+
+Poco::UInt64 SnapshotReader::UInt64(const size_t index) const {
+    return static_cast<Poco::UInt64>(Int64(index));
+}
+
+bool SnapshotReader::Bool(const size_t index) const {
+    return Int64(index) != 0;
+}
+
+std::string SnapshotReader::String(const size_t index) const {
+    const char *at = column(index, kStringColumn);
+    if (!at) {
+        return "";
+    }
+    return std::string(at + sizeof(Poco::UInt32),
+                       read<Poco::UInt32>(at));
+}
+
+}  // namespace kopsik
@@ -0,0 +1,90 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_SNAPSHOT_H_
+#define SRC_SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+
+#include "./types.h"
+
+#include "Poco/Types.h"
+
+namespace Poco {
+class SharedMemory;
+}
+
+namespace kopsik {
+
+// A snapshot file is a header followed by rows of integer and
+// string columns. The header holds the user ID and the database
+// generation the rows were written at, and a checksum of the rows.
+// Rows are read in the order they were written, with the same
+// column accessors as PreparedStatement, so models are decoded
+// from a snapshot exactly like from a select.
+class SnapshotWriter {
+ public:
+    SnapshotWriter() : columns_(0) {}
+
+    void Int(const Poco::Int64 value);
+    void String(const std::string value);
+    void EndRow();
+
+    // Writes into a temporary file first and then renames it,
+    // so a reader never sees a half written snapshot.
+    error Save(
+        const std::string path,
+        const Poco::UInt64 UID,
+        const Poco::UInt64 generation) const;
+
+ private:
+    std::string row_;
+    std::string data_;
+    Poco::UInt32 columns_;
+};
+
+class SnapshotReader {
+ public:
+    SnapshotReader();
+    ~SnapshotReader();
+
+    // Maps the file into memory. Fails if the file is missing,
+    // was written for another user or database generation,
+    // or does not match its checksum.
+    error Open(
+        const std::string path,
+        const Poco::UInt64 UID,
+        const Poco::UInt64 generation);
+
+    // Moves to next row. False at the end of file, or if the
+    // file is malformed, in which case Valid() turns false.
+    bool Next();
+
+    size_t Columns() const {
+        return columns_.size();
+    }
+
+    Poco::Int64 Int64(const size_t column) const;
+    Poco::UInt64 UInt64(const size_t column) const;
+    bool Bool(const size_t column) const;
+    std::string String(const size_t column) const;
+
+    // False, if a row was malformed or columns
+    // were read with a wrong type or index.
+    bool Valid() const {
+        return valid_;
+    }
+
+ private:
+    const char *column(const size_t index, const char type) const;
+
+    Poco::SharedMemory *memory_;
+    const char *position_;
+    const char *end_;
+    std::vector<const char *> columns_;
+    mutable bool valid_;
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_SNAPSHOT_H_
@@ -0,0 +1,135 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./string_pool.h"
+
+#include "Poco/Bugcheck.h"
+
+namespace kopsik {
+
+size_t StringPool::Strings() const {
+    Poco::FastMutex::ScopedLock lock(mutex_);
+    return entries_.size();
+}
+
+size_t StringPool::Bytes() const {
+    Poco::FastMutex::ScopedLock lock(mutex_);
+    return bytes_;
+}
+
+size_t StringPool::References() const {
+    Poco::FastMutex::ScopedLock lock(mutex_);
+    return references_;
+}
+
+StringPool::Entry *StringPool::acquire(const std::string &value) {
+    if (value.empty()) {
+        return 0;
+    }
+    Poco::FastMutex::ScopedLock lock(mutex_);
+    std::pair<Entries::iterator, bool> inserted =
+        entries_.insert(Entry(value, 0));
+    if (inserted.second) {
+        bytes_ += value.size();
+    }
+    inserted.first->second++;
+    references_++;
+    return &*inserted.first;
+}
+
+void StringPool::retain(Entry *entry) {
+    if (!entry) {
+        return;
+    }
+    Poco::FastMutex::ScopedLock lock(mutex_);
+    entry->second++;
+    references_++;
+}
+
+void StringPool::release(Entry *entry) {
+    if (!entry) {
+        return;
+    }
+    Poco::FastMutex::ScopedLock lock(mutex_);
+    releaseLocked(entry);
+}
+
+void StringPool::releaseLocked(Entry *entry) {
+    poco_assert(entry->second > 0);
+    references_--;
+    if (--entry->second) {
+        return;
+    }
+    bytes_ -= entry->first.size();
+    entries_.erase(entry->first);
+}
+
+// Same as acquiring the new value and releasing the
+// old one, but only takes the lock once.
+StringPool::Entry *StringPool::replace(
+    Entry *entry,
+    const std::string &value) {
+    if (value.empty()) {
+        release(entry);
+        return 0;
+    }
+    Poco::FastMutex::ScopedLock lock(mutex_);
+    std::pair<Entries::iterator, bool> inserted =
+        entries_.insert(Entry(value, 0));
+    if (inserted.second) {
+        bytes_ += value.size();
+    }
+    inserted.first->second++;
+    references_++;
+    if (entry) {
+        releaseLocked(entry);
+    }
+    return &*inserted.first;
+}
+
+// Never deleted, as strings may be released
+// by models that outlive static destructors.
+static StringPool *string_pool = new StringPool();
+
+static const std::string empty_string;
+
+const StringPool &InternedString::Pool() {
+    return *string_pool;
+}
+
+InternedString::InternedString(const std::string &value)
+    : entry_(string_pool->acquire(value)) {
+}
+
+InternedString::InternedString(const InternedString &other)
+    : entry_(other.entry_) {
+    string_pool->retain(entry_);
+}
+
+InternedString::~InternedString() {
+    string_pool->release(entry_);
+}
+
+InternedString &InternedString::operator=(const InternedString &other) {
+    if (entry_ != other.entry_) {
+        string_pool->retain(other.entry_);
+        string_pool->release(entry_);
+        entry_ = other.entry_;
+    }
+    return *this;
+}
+
+const std::string &InternedString::Value() const {
+    if (!entry_) {
+        return empty_string;
+    }
+    return entry_->first;
+}
+
+void InternedString::SetValue(const std::string &value) {
+    if (entry_ && entry_->first == value) {
+        return;
+    }
+    entry_ = string_pool->replace(entry_, value);
+}
+
+}  // namespace kopsik
@@ -0,0 +1,78 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_STRING_POOL_H_
+#define SRC_STRING_POOL_H_
+
+#include <map>
+#include <string>
+
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+// Keeps one copy of strings that repeat across many models, like
+// descriptions of time entries continued every day or the user agent
+// they were created with. Models hold an InternedString instead of
+// their own copy. A string is dropped when its last holder lets go.
+class StringPool {
+ public:
+    StringPool() : bytes_(0), references_(0) {}
+    ~StringPool() {}
+
+    // Distinct strings in the pool and bytes of their characters
+    size_t Strings() const;
+    size_t Bytes() const;
+
+    // Holders of the strings above
+    size_t References() const;
+
+ private:
+    typedef std::map<std::string, Poco::UInt32> Entries;
+    typedef Entries::value_type Entry;
+
+    friend class InternedString;
+
+    Entry *acquire(const std::string &value);
+    void retain(Entry *entry);
+    void release(Entry *entry);
+    void releaseLocked(Entry *entry);
+    Entry *replace(Entry *entry, const std::string &value);
+
+    Entries entries_;
+    size_t bytes_;
+    size_t references_;
+
+    mutable Poco::FastMutex mutex_;
+};
+
+// A string kept in the process wide StringPool. Empty strings
+// are not pooled. Copying a handle does not copy the string.
+class InternedString {
+ public:
+    InternedString() : entry_(0) {}
+    explicit InternedString(const std::string &value);
+    InternedString(const InternedString &other);
+    ~InternedString();
+
+    InternedString &operator=(const InternedString &other);
+
+    const std::string &Value() const;
+    void SetValue(const std::string &value);
+
+    bool operator==(const InternedString &other) const {
+        return entry_ == other.entry_;
+    }
+    bool operator!=(const InternedString &other) const {
+        return entry_ != other.entry_;
+    }
+
+    static const StringPool &Pool();
+
+ private:
+    StringPool::Entry *entry_;
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_STRING_POOL_H_
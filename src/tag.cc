@@ -4,8 +4,25 @@
 
 #include <sstream>
 
+#include "./model_pool.h"
+
 namespace kopsik {
 
+// Never deleted, so that models can be deleted by static destructors
+static ModelPool *tag_pool = new ModelPool(sizeof(Tag));
+
+void *Tag::operator new(size_t size) {
+    return tag_pool->Allocate(size);
+}
+
+void Tag::operator delete(void *p, size_t size) {
+    tag_pool->Release(p, size);
+}
+
+const ModelPool &Tag::Pool() {
+    return *tag_pool;
+}
+
 std::string Tag::String() const {
     std::stringstream ss;
     ss  << "ID=" << ID()
@@ -16,10 +33,21 @@ std::string Tag::String() const {
     return ss.str();
 }
 
+Poco::UInt64 Tag::RelatedID(const RelatedIDKind kind) const {
+    switch (kind) {
+    case kRelatedWID:
+        return wid_;
+    default:
+        return 0;
+    }
+}
+
 void Tag::SetWID(const Poco::UInt64 value) {
     if (wid_ != value) {
+        Poco::UInt64 previous = wid_;
         wid_ = value;
         SetDirty();
+        relatedIDChanged(kRelatedWID, previous);
     }
 }
 
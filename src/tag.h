@@ -13,6 +13,8 @@
 
 namespace kopsik {
 
+class ModelPool;
+
 class Tag : public BaseModel {
  public:
     Tag()
@@ -20,6 +22,11 @@ class Tag : public BaseModel {
     , wid_(0)
     , name_("") {}
 
+    // Allocated from a pool, see ModelPool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+    static const ModelPool &Pool();
+
     Poco::UInt64 WID() const {
         return wid_;
     }
@@ -32,6 +39,8 @@ class Tag : public BaseModel {
 
     std::string String() const;
 
+    Poco::UInt64 RelatedID(const RelatedIDKind kind) const;
+
     std::string ModelName() const {
         return "tag";
     }
@@ -4,8 +4,25 @@
 
 #include <sstream>
 
+#include "./model_pool.h"
+
 namespace kopsik {
 
+// Never deleted, so that models can be deleted by static destructors
+static ModelPool *task_pool = new ModelPool(sizeof(Task));
+
+void *Task::operator new(size_t size) {
+    return task_pool->Allocate(size);
+}
+
+void Task::operator delete(void *p, size_t size) {
+    task_pool->Release(p, size);
+}
+
+const ModelPool &Task::Pool() {
+    return *task_pool;
+}
+
 std::string Task::String() const {
     std::stringstream ss;
     ss  << "ID=" << ID()
@@ -16,17 +33,32 @@ std::string Task::String() const {
     return ss.str();
 }
 
+Poco::UInt64 Task::RelatedID(const RelatedIDKind kind) const {
+    switch (kind) {
+    case kRelatedWID:
+        return wid_;
+    case kRelatedPID:
+        return pid_;
+    default:
+        return 0;
+    }
+}
+
 void Task::SetPID(const Poco::UInt64 value) {
     if (pid_ != value) {
+        Poco::UInt64 previous = pid_;
         pid_ = value;
         SetDirty();
+        relatedIDChanged(kRelatedPID, previous);
     }
 }
 
 void Task::SetWID(const Poco::UInt64 value) {
     if (wid_ != value) {
+        Poco::UInt64 previous = wid_;
         wid_ = value;
         SetDirty();
+        relatedIDChanged(kRelatedWID, previous);
     }
 }
 
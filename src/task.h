@@ -13,6 +13,8 @@
 
 namespace kopsik {
 
+class ModelPool;
+
 class Task : public BaseModel {
  public:
     Task()
@@ -21,6 +23,11 @@ class Task : public BaseModel {
     , wid_(0)
     , pid_(0) {}
 
+    // Allocated from a pool, see ModelPool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+    static const ModelPool &Pool();
+
     std::string Name() const {
         return name_;
     }
@@ -38,6 +45,8 @@ class Task : public BaseModel {
 
     std::string String() const;
 
+    Poco::UInt64 RelatedID(const RelatedIDKind kind) const;
+
     std::string ModelName() const {
         return "task";
     }
@@ -274,6 +274,8 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
 
     // Start tracking
     ASSERT_TRUE(kopsik_start(ctx, "Test", 0, 0, 0));
+    // Saves are written behind, wait for the model changes
+    ASSERT_TRUE(kopsik_flush(ctx));
 
     ASSERT_EQ("", g_errmsg);
 
@@ -308,6 +310,7 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
     // It should keep on tracking and also the duration should change.
     ASSERT_TRUE(kopsik_set_time_entry_duration(
         ctx, GUID.c_str(), "1 hour"));
+    ASSERT_TRUE(kopsik_flush(ctx));
     is_tracking = false;
     running = kopsik_time_entry_view_item_init();
     ASSERT_TRUE(kopsik_running_time_entry_view_item(
@@ -323,6 +326,7 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
     // The duration should change accordingly to be now - start.
     ASSERT_TRUE(kopsik_set_time_entry_start_iso_8601(ctx,
                 GUID.c_str(), "2013-11-28T13:15:30Z"));
+    ASSERT_TRUE(kopsik_flush(ctx));
     running = kopsik_time_entry_view_item_init();
     ASSERT_TRUE(kopsik_running_time_entry_view_item(
         ctx, running, &is_tracking));
@@ -336,6 +340,7 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
 
     // Stop the time entry
     ASSERT_TRUE(kopsik_stop(ctx));
+    ASSERT_TRUE(kopsik_flush(ctx));
     ASSERT_EQ(std::string("time_entry"), g_model_change_model_type);
     ASSERT_EQ(std::string("update"), g_model_change_change_type);
 
@@ -345,6 +350,7 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
     // Check it was really applied.
     ASSERT_TRUE(kopsik_set_time_entry_duration(
         ctx, g_model_change_guid.c_str(), "2,5 hours"));
+    ASSERT_TRUE(kopsik_flush(ctx));
     KopsikTimeEntryViewItem *stopped = kopsik_time_entry_view_item_init();
     _Bool was_found = false;
     ASSERT_TRUE(kopsik_time_entry_view_item_by_guid(
@@ -361,6 +367,7 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
     // Set a new start time for the stopped entry.
     ASSERT_TRUE(kopsik_set_time_entry_start_iso_8601(ctx,
                 g_model_change_guid.c_str(), "2013-11-27T12:30:00Z"));
+    ASSERT_TRUE(kopsik_flush(ctx));
     stopped = kopsik_time_entry_view_item_init();
     was_found = false;
     ASSERT_TRUE(kopsik_time_entry_view_item_by_guid(
@@ -377,6 +384,7 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
     // Check that the duration changes.
     ASSERT_TRUE(kopsik_set_time_entry_end_iso_8601(ctx,
                 g_model_change_guid.c_str(), "2013-11-27T13:30:00Z"));
+    ASSERT_TRUE(kopsik_flush(ctx));
     stopped = kopsik_time_entry_view_item_init();
     was_found = false;
     ASSERT_TRUE(kopsik_time_entry_view_item_by_guid(
@@ -395,6 +403,7 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
     // Start time should be the same, but end time should change.
     ASSERT_TRUE(kopsik_set_time_entry_duration(
         ctx, g_model_change_guid.c_str(), "2 hours"));
+    ASSERT_TRUE(kopsik_flush(ctx));
     stopped = kopsik_time_entry_view_item_init();
     was_found = false;
     ASSERT_TRUE(kopsik_time_entry_view_item_by_guid(
@@ -431,6 +440,7 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
 
     // Continue the time entry we created in the start.
     ASSERT_TRUE(kopsik_continue(ctx, GUID.c_str()));
+    ASSERT_TRUE(kopsik_flush(ctx));
     ASSERT_NE(std::string(GUID), g_model_change_guid);
 
     ASSERT_EQ("", g_errmsg);
@@ -470,6 +480,7 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
     // Delete the time entry we created in the start.
     ASSERT_TRUE(kopsik_delete_time_entry(
         ctx, GUID.c_str()));
+    ASSERT_TRUE(kopsik_flush(ctx));
 
     // We shouldnt be able to retrieve this time entry now in list.
     KopsikTimeEntryViewItem *visible = 0;
@@ -494,6 +505,72 @@ TEST(KopsikApiTest, kopsik_lifecycle) {
     kopsik_context_clear(ctx);
 }
 
+unsigned int view_item_count(KopsikViewItem *first) {
+    unsigned int result = 0;
+    KopsikViewItem *it = first;
+    while (it) {
+        result++;
+        it = reinterpret_cast<KopsikViewItem *>(it->Next);
+    }
+    return result;
+}
+
+TEST(KopsikApiTest, ViewItemsFollowPublishedSnapshots) {
+    void *ctx = create_test_context();
+
+    wipe_test_db();
+
+    ASSERT_TRUE(kopsik_set_db_path(ctx, TESTDB));
+
+    // Nothing to show before login
+    KopsikViewItem *workspaces = 0;
+    ASSERT_TRUE(kopsik_workspaces(ctx, &workspaces));
+    ASSERT_FALSE(workspaces);
+
+    std::string json = loadTestData();
+    ASSERT_TRUE(kopsik_set_logged_in_user(ctx, json.c_str()));
+
+    workspaces = 0;
+    ASSERT_TRUE(kopsik_workspaces(ctx, &workspaces));
+    ASSERT_LE((unsigned int)2, view_item_count(workspaces));
+    kopsik_view_item_clear(workspaces);
+
+    KopsikViewItem *clients = 0;
+    ASSERT_TRUE(kopsik_clients(ctx, 123456789, &clients));
+    ASSERT_EQ((unsigned int)2, view_item_count(clients));
+    kopsik_view_item_clear(clients);
+
+    KopsikAutocompleteItem *items = 0;
+    ASSERT_TRUE(kopsik_autocomplete_items(ctx, &items, true, true, true));
+    ASSERT_TRUE(items);
+    kopsik_autocomplete_item_clear(items);
+
+    // Started entry is shown in autocomplete once saved
+    ASSERT_TRUE(kopsik_start(ctx, "Published once saved", 0, 0, 0));
+    ASSERT_TRUE(kopsik_stop(ctx));
+    ASSERT_TRUE(kopsik_flush(ctx));
+    items = 0;
+    ASSERT_TRUE(kopsik_autocomplete_items(ctx, &items, true, false, false));
+    bool found(false);
+    for (KopsikAutocompleteItem *it = items; it;
+            it = reinterpret_cast<KopsikAutocompleteItem *>(it->Next)) {
+        ASSERT_NE(std::string(""), std::string(it->Description));
+        if (std::string("Published once saved") == it->Description) {
+            found = true;
+        }
+    }
+    ASSERT_TRUE(found);
+    kopsik_autocomplete_item_clear(items);
+
+    ASSERT_TRUE(kopsik_logout(ctx));
+
+    workspaces = 0;
+    ASSERT_TRUE(kopsik_workspaces(ctx, &workspaces));
+    ASSERT_FALSE(workspaces);
+
+    kopsik_context_clear(ctx);
+}
+
 TEST(KopsikApiTest, kopsik_time_entry_view_item_init) {
     KopsikTimeEntryViewItem *te = kopsik_time_entry_view_item_init();
     ASSERT_TRUE(te);
@@ -2,6 +2,7 @@
 
 #include "./test_data.h"
 
+#include <iomanip>
 #include <sstream>
 
 #include "Poco/FileStream.h"
@@ -13,3 +14,26 @@ std::string loadTestData() {
     fis.close();
     return ss.str();
 }
+
+std::string timeEntriesJSON(const size_t count) {
+    std::stringstream ss;
+    ss << "{\"since\":1379068550,\"data\":{"
+       << "\"id\":10471231,\"api_token\":\"abc\","
+       << "\"default_wid\":123456789,\"email\":\"johnsmith@toggl.com\","
+       << "\"fullname\":\"John Smith\",\"time_entries\":[";
+    for (size_t i = 0; i < count; i++) {
+        if (i) {
+            ss << ",";
+        }
+        ss << "{\"id\":" << (i + 1)
+           << ",\"guid\":\"00000000-0000-0000-0000-"
+           << std::setw(12) << std::setfill('0') << i
+           << "\",\"wid\":123456789,\"billable\":false,"
+           << "\"start\":\"2013-09-05T06:33:50+00:00\","
+           << "\"stop\":\"2013-09-05T08:19:46+00:00\","
+           << "\"duration\":6356,\"description\":\"Entry " << i << "\","
+           << "\"at\":\"2013-09-05T08:19:45+00:00\"}";
+    }
+    ss << "]}}";
+    return ss.str();
+}
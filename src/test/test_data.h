@@ -9,4 +9,7 @@
 
 std::string loadTestData();
 
+// Full sync response with the given number of time entries
+std::string timeEntriesJSON(const size_t count);
+
 #endif  // SRC_TEST_TEST_DATA_H_
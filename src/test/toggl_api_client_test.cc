@@ -1,5 +1,12 @@
 // Copyright 2014 Toggl Desktop developers.
 
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 #include "./../user.h"
@@ -8,15 +15,24 @@
 #include "./../project.h"
 #include "./../task.h"
 #include "./../time_entry.h"
+#include "./../model_pool.h"
+#include "./../string_pool.h"
 #include "./../tag.h"
 #include "./kopsik_api_test.h"
 #include "./../database.h"
 #include "./test_data.h"
 #include "./../json.h"
 #include "./../formatter.h"
+#include "./../const.h"
+#include "./../timeline_constants.h"
+#include "./../view_snapshot.h"
 
+#include "Poco/Data/Common.h"
 #include "Poco/FileStream.h"
 #include "Poco/File.h"
+#include "Poco/String.h"
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
 
 namespace kopsik {
 
@@ -180,6 +196,78 @@ TEST(TogglApiClientTest, SavesModelsAndKnowsToUpdateWithSameUserInstance) {
     }
 }
 
+TEST(TogglApiClientTest, UpdatesModelsWithReusedStatements) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, loadTestData(), true, true);
+
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    for (int i = 0; i < 3; i++) {
+        std::stringstream ss;
+        ss << "Changed " << i;
+        TimeEntry *te = user.GetTimeEntryByID(89818605);
+        ASSERT_TRUE(te);
+        te->SetDescription(ss.str());
+        Project *p = user.GetProjectByID(2567324);
+        ASSERT_TRUE(p);
+        p->SetName(ss.str());
+
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        std::string value("");
+        ASSERT_EQ(noError, db.String(
+            "select description from time_entries where id = 89818605",
+            &value));
+        ASSERT_EQ(ss.str(), value);
+        ASSERT_EQ(noError, db.String(
+            "select name from projects where id = 2567324", &value));
+        ASSERT_EQ(ss.str(), value);
+    }
+}
+
+TEST(TogglApiClientTest, SavesOnlyChangedModels) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, loadTestData(), true, true);
+
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+    ASSERT_GT(changes.size(), size_t(1));
+
+    changes.clear();
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+    ASSERT_EQ(size_t(0), changes.size());
+
+    TimeEntry *te = user.GetTimeEntryByID(89818605);
+    ASSERT_TRUE(te);
+    te->SetDescription("Only this one");
+
+    changes.clear();
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+    ASSERT_EQ(size_t(1), changes.size());
+    ASSERT_EQ(te->GUID(), changes[0].GUID());
+    ASSERT_EQ("update", changes[0].ChangeType());
+
+    Client *c = user.related.Clients[0];
+    c->SetName("Renamed client");
+
+    changes.clear();
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+    ASSERT_EQ(size_t(1), changes.size());
+
+    std::string name("");
+    std::stringstream ss;
+    ss << "select name from clients where local_id = " << c->LocalID();
+    ASSERT_EQ(noError, db.String(ss.str(), &name));
+    ASSERT_EQ("Renamed client", name);
+}
+
 TEST(TogglApiClientTest,
      SavesModelsAndKnowsToUpdateWithSeparateUserInstances) {
     wipe_test_db();
@@ -303,12 +391,17 @@ TEST(TogglApiClientTest, TestDeletionSteps) {
 
     // now, really delete it
     te->MarkAsDeletedOnServer();
+    const Poco::Int64 local_id = te->LocalID();
+    const guid GUID = te->GUID();
+    const size_t columns_size = user.related.Columns.Size();
     ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+    ASSERT_FALSE(user.related.TimeEntryIndex.ByGUID(GUID));
+    ASSERT_EQ(columns_size - 1, user.related.Columns.Size());
     {
         Poco::UInt64 te_count(0);
         std::stringstream query;
         query << "select count(1) from time_entries where local_id = "
-              << te->LocalID();
+              << local_id;
         ASSERT_EQ(noError, db.UInt(query.str(), &te_count));
         ASSERT_EQ(Poco::UInt64(0), te_count);
     }
@@ -371,7 +464,7 @@ TEST(TogglApiClientTest, ParsesAndSavesData) {
     ASSERT_EQ(6356, user.related.TimeEntries[0]->DurationInSeconds());
     ASSERT_EQ("Important things",
               user.related.TimeEntries[0]->Description());
-    ASSERT_EQ(uint(0), user.related.TimeEntries[0]->TagNames.size());
+    ASSERT_EQ(uint(0), user.related.TimeEntries[0]->TagIDs().size());
     ASSERT_FALSE(user.related.TimeEntries[0]->DurOnly());
     ASSERT_EQ(user.ID(), user.related.TimeEntries[0]->UID());
 
@@ -730,6 +823,1309 @@ TEST(TogglApiClientTest, Continue) {
     ASSERT_EQ(count+1, user.related.TimeEntries.size());
 }
 
+
+TEST(TogglApiClientTest, FindsModelsByIDAfterIDChanges) {
+    User user("kopsik_test", "0.1");
+    user.SetID(10471231);
+
+    TimeEntry *te = user.Start("Indexed", "", 0, 0);
+    ASSERT_TRUE(te);
+    ASSERT_FALSE(te->ID());
+    te->EnsureGUID();
+    ASSERT_EQ(te, user.GetTimeEntryByGUID(te->GUID()));
+
+    // Server assigns ID after push
+    te->SetID(123);
+    ASSERT_EQ(te, user.GetTimeEntryByID(123));
+
+    te->SetID(456);
+    ASSERT_FALSE(user.GetTimeEntryByID(123));
+    ASSERT_EQ(te, user.GetTimeEntryByID(456));
+
+    std::string old_guid = te->GUID();
+    te->SetGUID("07fba193-91c4-0ec8-2894-820df0548a8f");
+    ASSERT_FALSE(user.GetTimeEntryByGUID(old_guid));
+    ASSERT_EQ(te, user.GetTimeEntryByGUID(te->GUID()));
+
+    user.related.TimeEntryIndex.Remove(te);
+    ASSERT_FALSE(user.GetTimeEntryByID(456));
+    ASSERT_FALSE(te->Index());
+}
+
+TEST(TogglApiClientTest, FindsModelsByIDAfterLoadingFromDatabase) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, loadTestData(), true, true);
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    User user2("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user2, true));
+    TimeEntry *te = user2.GetTimeEntryByID(89818605);
+    ASSERT_TRUE(te);
+    ASSERT_EQ(te, user2.GetTimeEntryByGUID(te->GUID()));
+    ASSERT_TRUE(user2.GetWorkspaceByID(123456789));
+}
+
+TEST(TogglApiClientTest, MergesFullSyncIntoSameModels) {
+    std::string json = timeEntriesJSON(20000);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, json, true, true);
+    ASSERT_EQ(size_t(20000), user.related.TimeEntries.size());
+    TimeEntry *te = user.GetTimeEntryByID(12345);
+    ASSERT_TRUE(te);
+
+    // Merge the same data again, like a full sync would do
+    LoadUserFromJSONString(&user, json, true, true);
+    ASSERT_EQ(size_t(20000), user.related.TimeEntries.size());
+    ASSERT_EQ(te, user.GetTimeEntryByID(12345));
+    ASSERT_EQ(te, user.related.TimeEntryIndex.ByGUID(te->GUID()));
+    ASSERT_EQ(size_t(20000),
+              user.related.TimeEntryIndex.ChangedModels().size());
+}
+
+void firstSave(
+    const size_t count,
+    const bool with_server_ids) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(count), true, true);
+    if (!with_server_ids) {
+        for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+            user.related.TimeEntries[i]->SetID(0);
+        }
+    }
+
+    Poco::UInt64 hits(0), misses(0);
+    db.PreparedStatementStats(&hits, &misses);
+    const Poco::UInt64 compiled = misses;
+
+    std::vector<ModelChange> changes;
+    EXPECT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    // Statements are compiled once, not once per row
+    db.PreparedStatementStats(&hits, &misses);
+    EXPECT_GT(Poco::UInt64(20), misses - compiled);
+
+    Poco::UInt64 n(0);
+    EXPECT_EQ(noError, db.UInt("select count(1) from time_entries", &n));
+    EXPECT_EQ(count, n);
+    EXPECT_EQ(noError,
+              db.UInt("select count(1) from time_entry_search", &n));
+    EXPECT_EQ(count, n);
+    EXPECT_EQ(count + 1, changes.size());
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        EXPECT_TRUE(user.related.TimeEntries[i]->LocalID());
+        EXPECT_FALSE(user.related.TimeEntries[i]->Dirty());
+    }
+    EXPECT_TRUE(user.related.TimeEntryIndex.ChangedModels().empty());
+}
+
+TEST(TogglApiClientTest, FirstLoginBulkInsertsTimeEntries) {
+    // Entries pulled from server are inserted in bulk,
+    // new local entries are inserted one by one.
+    firstSave(50000, true);
+    firstSave(50000, false);
+}
+
+TEST(TogglApiClientTest, SavesBulkInsertedTimeEntriesAgainAfterRollback) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(1000), true, true);
+
+    // Last row of the bulk insert fails
+    Poco::Data::Session session("SQLite", TESTDB);
+    session << "CREATE TRIGGER fail_bulk_insert "
+            "BEFORE INSERT ON time_entries WHEN NEW.id = 1000 "
+            "BEGIN SELECT RAISE(ABORT, 'failed'); END",
+            Poco::Data::now;
+
+    std::vector<ModelChange> changes;
+    ASSERT_NE(noError, db.SaveUser(&user, true, &changes));
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        ASSERT_FALSE(user.related.TimeEntries[i]->LocalID());
+    }
+    ASSERT_EQ(size_t(1000),
+              user.related.TimeEntryIndex.ChangedModels().size());
+
+    session << "DROP TRIGGER fail_bulk_insert", Poco::Data::now;
+
+    changes.clear();
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+    Poco::UInt64 n(0);
+    ASSERT_EQ(noError, db.UInt("select count(1) from time_entries", &n));
+    ASSERT_EQ(Poco::UInt64(1000), n);
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        ASSERT_TRUE(user.related.TimeEntries[i]->LocalID());
+    }
+}
+
+TEST(TogglApiClientTest, LoadsUserWithTypedRowDecoder) {
+    wipe_test_db();
+    Poco::UInt64 UID(0);
+    {
+        Database db(TESTDB);
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, timeEntriesJSON(20000), true, true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        UID = user.ID();
+    }
+
+    // Cold start, with a fresh connection
+    Database db(TESTDB);
+    User user("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(UID, &user, true));
+
+    ASSERT_EQ(size_t(20000), user.related.TimeEntries.size());
+    TimeEntry *te = user.GetTimeEntryByID(20000);
+    ASSERT_TRUE(te);
+    ASSERT_EQ("Entry 19999", te->Description());
+    ASSERT_EQ("00000000-0000-0000-0000-000000019999", te->GUID());
+    ASSERT_EQ(Poco::UInt64(123456789), te->WID());
+    ASSERT_EQ(6356, te->DurationInSeconds());
+    ASSERT_FALSE(te->Billable());
+    ASSERT_FALSE(te->Dirty());
+    ASSERT_TRUE(user.related.TimeEntryIndex.ChangedModels().empty());
+}
+
+TEST(TogglApiClientTest, LoadsTimeEntriesWithinWindowAndPagesInOlder) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(0), true, true);
+
+    // One entry per day, going back 60 days
+    const Poco::Int64 now = time(0);
+    for (Poco::UInt64 i = 0; i < 60; i++) {
+        TimeEntry *te = new TimeEntry();
+        te->SetID(i + 1);
+        te->SetStart(now - i * 86400);
+        te->SetStop(te->Start() + 3600);
+        te->SetDurationInSeconds(3600);
+        user.related.AddTimeEntry(te);
+    }
+    // Old entry that has not been pushed yet
+    TimeEntry *unpushed = new TimeEntry();
+    unpushed->SetStart(now - 100 * 86400);
+    unpushed->SetStop(unpushed->Start() + 3600);
+    unpushed->SetDurationInSeconds(3600);
+    user.related.AddTimeEntry(unpushed);
+
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    db.SetTimeEntryWindowDays(7);
+
+    User user2("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user2, true));
+    ASSERT_LT(user2.related.TimeEntries.size(), size_t(12));
+    ASSERT_TRUE(user2.GetTimeEntryByID(1));
+    ASSERT_TRUE(user2.GetTimeEntryByGUID(unpushed->GUID()));
+    ASSERT_FALSE(user2.GetTimeEntryByID(41));
+    ASSERT_TRUE(user2.related.TimeEntriesLoadedSince);
+
+    // Lookup falls back to database
+    TimeEntry *te = 0;
+    guid GUID = user.GetTimeEntryByID(41)->GUID();
+    ASSERT_EQ(noError, db.LoadTimeEntryByGUID(&user2, GUID, &te));
+    ASSERT_TRUE(te);
+    ASSERT_EQ(Poco::UInt64(41), te->ID());
+    ASSERT_EQ(te, user2.GetTimeEntryByGUID(GUID));
+
+    // Page in the rest of history
+    int pages(0);
+    while (user2.related.TimeEntriesLoadedSince) {
+        ASSERT_EQ(noError, db.LoadOlderTimeEntries(&user2, 7));
+        pages++;
+    }
+    ASSERT_LT(7, pages);
+    ASSERT_EQ(size_t(61), user2.related.TimeEntries.size());
+
+    // Server data for an entry outside of the window replaces
+    // the one in database.
+    User user3("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user3, true));
+    ASSERT_FALSE(user3.GetTimeEntryByID(50));
+    TimeEntry *from_server = new TimeEntry();
+    from_server->SetID(50);
+    from_server->SetGUID(user.GetTimeEntryByID(50)->GUID());
+    from_server->SetDescription("From server");
+    from_server->SetStart(now - 49 * 86400);
+    from_server->SetDurationInSeconds(60);
+    user3.related.AddTimeEntry(from_server);
+    ASSERT_EQ(noError, db.SaveUser(&user3, true, &changes));
+
+    Poco::UInt64 n(0);
+    ASSERT_EQ(noError, db.UInt("select count(1) from time_entries", &n));
+    ASSERT_EQ(Poco::UInt64(61), n);
+    std::string description("");
+    ASSERT_EQ(noError, db.String(
+        "select description from time_entries where id = 50",
+        &description));
+    ASSERT_EQ("From server", description);
+}
+
+class SaveUserInBackground : public Poco::Runnable {
+ public:
+    SaveUserInBackground(Database *db, User *user)
+        : Error(noError)
+    , db_(db)
+    , user_(user) {}
+
+    void run() {
+        std::vector<ModelChange> changes;
+        Error = db_->SaveUser(user_, true, &changes);
+    }
+
+    error Error;
+
+ private:
+    Database *db_;
+    User *user_;
+};
+
+TEST(TogglApiClientTest, BuffersTimelineEventsUntilFlushed) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    const time_t now = time(0);
+    Poco::NotificationCenter& nc =
+        Poco::NotificationCenter::defaultCenter();
+    for (int i = 0; i < 5; i++) {
+        TimelineEvent event;
+        event.user_id = 10471231;
+        event.start_time = now - 60 + i * 10;
+        event.end_time = event.start_time + 10;
+        event.filename = "terminal";
+        event.title = "bash";
+        nc.postNotification(new TimelineEventNotification(event));
+    }
+
+    // Recorder does not wait for the events to be written
+    Poco::UInt64 n(0);
+    ASSERT_EQ(noError, db.UInt("select count(1) from timeline_events", &n));
+    ASSERT_EQ(Poco::UInt64(0), n);
+
+    ASSERT_EQ(noError, db.FlushTimelineEvents());
+    ASSERT_EQ(noError, db.UInt("select count(1) from timeline_events", &n));
+    ASSERT_EQ(Poco::UInt64(5), n);
+}
+
+TEST(TogglApiClientTest, DropsOldestTimelineEventsWhileFlushFails) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    Poco::Data::Session session("SQLite", TESTDB);
+    session << "CREATE TRIGGER fail_timeline_insert "
+            "BEFORE INSERT ON timeline_events "
+            "BEGIN SELECT RAISE(ABORT, 'failed'); END",
+            Poco::Data::now;
+
+    const time_t now = time(0);
+    const int count = kTimelineBufferMaxEvents + 10;
+    for (int i = 0; i < count; i++) {
+        TimelineEvent event;
+        event.user_id = 10471231;
+        event.start_time = now - count * 10 + i * 10;
+        event.end_time = event.start_time + 10;
+        event.filename = "terminal";
+        event.title = "bash";
+        Poco::NotificationCenter::defaultCenter().postNotification(
+            new TimelineEventNotification(event));
+    }
+    ASSERT_NE(noError, db.FlushTimelineEvents());
+
+    session << "DROP TRIGGER fail_timeline_insert", Poco::Data::now;
+    ASSERT_EQ(noError, db.FlushTimelineEvents());
+
+    Poco::UInt64 n(0);
+    ASSERT_EQ(noError, db.UInt("select count(1) from timeline_events", &n));
+    ASSERT_EQ(Poco::UInt64(kTimelineBufferMaxEvents), n);
+    ASSERT_EQ(noError,
+              db.UInt("select min(start_time) from timeline_events", &n));
+    ASSERT_EQ(Poco::UInt64(now - count * 10 + 100), n);
+}
+
+class TimelineBatchCollector {
+ public:
+    TimelineBatchCollector() {
+        Poco::NotificationCenter::defaultCenter().addObserver(
+            Poco::Observer<TimelineBatchCollector,
+            TimelineBatchReadyNotification>(
+                *this, &TimelineBatchCollector::handleBatch));
+    }
+    ~TimelineBatchCollector() {
+        Poco::NotificationCenter::defaultCenter().removeObserver(
+            Poco::Observer<TimelineBatchCollector,
+            TimelineBatchReadyNotification>(
+                *this, &TimelineBatchCollector::handleBatch));
+    }
+
+    std::vector<TimelineEvent> Next(const Poco::UInt64 user_id) {
+        batch_.clear();
+        Poco::NotificationCenter::defaultCenter().postNotification(
+            new CreateTimelineBatchNotification(user_id));
+        return batch_;
+    }
+
+    void Acknowledge(const std::vector<TimelineEvent> &batch) {
+        Poco::NotificationCenter::defaultCenter().postNotification(
+            new DeleteTimelineBatchNotification(batch));
+    }
+
+ private:
+    void handleBatch(TimelineBatchReadyNotification *notification) {
+        batch_ = notification->batch;
+    }
+
+    std::vector<TimelineEvent> batch_;
+};
+
+void recordTimelineEvents(Database *db, const int count) {
+    const time_t now = time(0);
+    for (int i = 0; i < count; i++) {
+        TimelineEvent event;
+        event.user_id = 10471231;
+        event.start_time = now - 3600 + i * 10;
+        event.end_time = event.start_time + 10;
+        event.filename = "terminal";
+        event.title = "bash";
+        Poco::NotificationCenter::defaultCenter().postNotification(
+            new TimelineEventNotification(event));
+    }
+    ASSERT_EQ(noError, db->FlushTimelineEvents());
+}
+
+TEST(TogglApiClientTest, UploadsTimelineInBatchesAfterAcknowledgedID) {
+    wipe_test_db();
+    TimelineBatchCollector collector;
+    Poco::UInt64 acknowledged_id(0);
+    {
+        Database db(TESTDB);
+        recordTimelineEvents(&db, 150);
+
+        std::vector<TimelineEvent> batch = collector.Next(10471231);
+        ASSERT_EQ(size_t(100), batch.size());
+        for (size_t i = 1; i < batch.size(); i++) {
+            ASSERT_LT(batch[i - 1].id, batch[i].id);
+        }
+        collector.Acknowledge(batch);
+        acknowledged_id = batch.back().id;
+
+        Poco::UInt64 n(0);
+        ASSERT_EQ(noError, db.UInt("select count(1) from timeline_events",
+                                   &n));
+        ASSERT_EQ(Poco::UInt64(50), n);
+        ASSERT_EQ(noError, db.UInt("select acknowledged_id "
+                                   "from timeline_uploads "
+                                   "where user_id = 10471231", &n));
+        ASSERT_EQ(acknowledged_id, n);
+    }
+
+    // After a restart, upload continues after the acknowledged batch
+    Database db(TESTDB);
+    std::vector<TimelineEvent> batch = collector.Next(10471231);
+    ASSERT_EQ(size_t(50), batch.size());
+    ASSERT_LT(acknowledged_id, batch.front().id);
+    collector.Acknowledge(batch);
+    acknowledged_id = batch.back().id;
+
+    Poco::UInt64 n(0);
+    ASSERT_EQ(noError, db.UInt("select count(1) from timeline_events", &n));
+    ASSERT_EQ(Poco::UInt64(0), n);
+
+    // Ids of deleted events are not reused
+    recordTimelineEvents(&db, 1);
+    batch = collector.Next(10471231);
+    ASSERT_EQ(size_t(1), batch.size());
+    ASSERT_LT(acknowledged_id, batch.front().id);
+}
+
+TEST(TogglApiClientTest, ReadsSettingsWhileUserIsBeingSaved) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(50000), true, true);
+
+    // Opens a reader session
+    bool use_proxy(false);
+    Proxy proxy;
+    ASSERT_EQ(noError, db.LoadProxySettings(&use_proxy, &proxy));
+
+    Poco::UInt64 write_locks(0), contended_write_locks(0);
+    Poco::UInt64 pooled_reads(0), writer_reads(0);
+    Poco::Timestamp::TimeDiff write_lock_wait(0);
+    db.LockStats(&write_locks, &contended_write_locks, &write_lock_wait,
+                 &pooled_reads, &writer_reads);
+    const Poco::UInt64 writer_reads_before = writer_reads;
+
+    SaveUserInBackground saver(&db, &user);
+    Poco::Thread thread;
+    thread.start(saver);
+
+    int reads(0);
+    while (thread.isRunning()) {
+        ASSERT_EQ(noError, db.LoadProxySettings(&use_proxy, &proxy));
+        reads++;
+    }
+    thread.join();
+    ASSERT_EQ(noError, saver.Error);
+
+    db.LockStats(&write_locks, &contended_write_locks, &write_lock_wait,
+                 &pooled_reads, &writer_reads);
+
+    // Reads went to reader sessions, not to the writer being saved on
+    ASSERT_EQ(writer_reads_before, writer_reads);
+    ASSERT_LT(Poco::UInt64(reads), pooled_reads);
+}
+
+TEST(TogglApiClientTest, ReaderSessionsCannotWrite) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    Poco::UInt64 n(0);
+    ASSERT_EQ(noError, db.UInt("select count(1) from settings", &n));
+    ASSERT_EQ(Poco::UInt64(1), n);
+    ASSERT_EQ(noError, db.UInt("PRAGMA auto_vacuum", &n));
+
+    ASSERT_NE(noError, db.UInt("delete from settings", &n));
+    ASSERT_NE(noError, db.UInt("PRAGMA user_version = 1", &n));
+
+    ASSERT_EQ(noError, db.UInt("select count(1) from settings", &n));
+    ASSERT_EQ(Poco::UInt64(1), n);
+}
+
+TEST(TogglApiClientTest, MaintenanceGivesFreePagesBackToFileSystem) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    Poco::UInt64 auto_vacuum(0);
+    ASSERT_EQ(noError, db.UInt("PRAGMA auto_vacuum", &auto_vacuum));
+    ASSERT_EQ(Poco::UInt64(2), auto_vacuum);  // incremental
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(5000), true, true);
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+    ASSERT_EQ(noError, db.DeleteUser(&user, true));
+
+    Poco::UInt64 file_size(0), wal_size(0), freelist_before(0);
+    double cache_hit_ratio(0);
+    ASSERT_EQ(noError, db.Stats(&file_size, &wal_size, &freelist_before,
+                                &cache_hit_ratio));
+    ASSERT_LT(Poco::UInt64(0), file_size);
+    ASSERT_LT(Poco::UInt64(0), wal_size);
+    ASSERT_LT(Poco::UInt64(0), freelist_before);
+    ASSERT_LT(0.0, cache_hit_ratio);
+    ASSERT_GE(1.0, cache_hit_ratio);
+
+    ASSERT_EQ(noError, db.Maintain());
+
+    Poco::UInt64 freelist_after(0);
+    ASSERT_EQ(noError, db.Stats(&file_size, &wal_size, &freelist_after,
+                                &cache_hit_ratio));
+    ASSERT_LT(freelist_after, freelist_before);
+}
+
+std::string timeEntryGUIDsWithTag(Database *db, const std::string name) {
+    std::string guids("");
+    EXPECT_EQ(noError, db->String(
+        "select group_concat(guid, ',') from ("
+        "select e.guid from tag_names n "
+        "join time_entry_tags t on t.tag_name_id = n.id "
+        "join time_entries e on e.local_id = t.time_entry_id "
+        "where n.name = '" + name + "' order by e.start desc)", &guids));
+    return guids;
+}
+
+TEST(TogglApiClientTest, StoresTimeEntryTagsInJoinTable) {
+    wipe_test_db();
+    Poco::UInt64 UID(0);
+    guid newest_guid("");
+    {
+        Database db(TESTDB);
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, timeEntriesJSON(0), true, true);
+
+        TimeEntry *newest = new TimeEntry();
+        newest->SetID(1);
+        newest->SetStart(time(0));
+        newest->SetDurationInSeconds(60);
+        newest->SetTags("alfa|beeta");
+        user.related.AddTimeEntry(newest);
+
+        TimeEntry *older = new TimeEntry();
+        older->SetID(2);
+        older->SetStart(time(0) - 3600);
+        older->SetDurationInSeconds(60);
+        older->SetTags("beeta");
+        user.related.AddTimeEntry(older);
+
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_FALSE(newest->TagsChanged());
+
+        newest->SetDescription("Tags stay as they are");
+        ASSERT_FALSE(newest->TagsChanged());
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        ASSERT_EQ(newest->GUID() + "," + older->GUID(),
+                  timeEntryGUIDsWithTag(&db, "beeta"));
+        ASSERT_EQ(newest->GUID(), timeEntryGUIDsWithTag(&db, "alfa"));
+
+        UID = user.ID();
+        newest_guid = newest->GUID();
+    }
+
+    // Tags stored the old way, joined in time_entries.tags
+    sqlite3 *handle = 0;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(TESTDB, &handle));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(
+        handle,
+        "update time_entries set tags = 'gamma|alfa' where id = 2; "
+        "delete from kopsik_migrations "
+        "where name = 'time_entry_tags.from_tags_column';",
+        0, 0, 0));
+    sqlite3_close(handle);
+
+    Database db(TESTDB);
+    Poco::UInt64 n(0);
+    ASSERT_EQ(noError, db.UInt(
+        "select count(1) from time_entries where tags is not null", &n));
+    ASSERT_EQ(Poco::UInt64(0), n);
+
+    User user("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(UID, &user, true));
+
+    TimeEntry *newest = user.GetTimeEntryByID(1);
+    ASSERT_TRUE(newest);
+    ASSERT_EQ("alfa|beeta", newest->Tags());
+    ASSERT_FALSE(newest->Dirty());
+    ASSERT_FALSE(newest->TagsChanged());
+
+    TimeEntry *older = user.GetTimeEntryByID(2);
+    ASSERT_TRUE(older);
+    ASSERT_EQ("gamma|alfa", older->Tags());
+
+    ASSERT_EQ(newest_guid + "," + older->GUID(),
+              timeEntryGUIDsWithTag(&db, "alfa"));
+    ASSERT_EQ(newest_guid, timeEntryGUIDsWithTag(&db, "beeta"));
+}
+
+TEST(TogglApiClientTest, KeepsDailyTotalsUpToDate) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(0), true, true);
+
+    // Noon yesterday and today
+    const Poco::Int64 yesterday =
+        DailyTotals::StartOfDay(time(0) - 86400) + 12 * 3600;
+    const Poco::Int64 today = DailyTotals::StartOfDay(time(0)) + 12 * 3600;
+
+    TimeEntry *a = new TimeEntry();
+    a->SetID(1);
+    a->SetStart(yesterday);
+    a->SetDurationInSeconds(3600);
+    user.related.AddTimeEntry(a);
+
+    TimeEntry *b = new TimeEntry();
+    b->SetID(2);
+    b->SetStart(yesterday + 60);
+    b->SetDurationInSeconds(1800);
+    user.related.AddTimeEntry(b);
+
+    TimeEntry *running = new TimeEntry();
+    running->SetID(3);
+    running->SetStart(yesterday + 120);
+    running->SetDurationInSeconds(-(yesterday + 120));
+    user.related.AddTimeEntry(running);
+
+    DailyTotals *totals = &user.related.TrackedPerDay;
+    ASSERT_EQ(5400, totals->ForDay(yesterday));
+    ASSERT_EQ(0, totals->ForDay(today));
+
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    b->SetStart(today);
+    ASSERT_EQ(3600, totals->ForDay(yesterday));
+    ASSERT_EQ(1800, totals->ForDay(today));
+
+    a->Delete();
+    ASSERT_EQ(0, totals->ForDay(yesterday));
+
+    running->SetDurationInSeconds(600);
+    ASSERT_EQ(600, totals->ForDay(yesterday));
+    ASSERT_EQ(600, totals->ForDateHeader("Yesterday"));
+
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    User loaded("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &loaded, true));
+    ASSERT_EQ(600, loaded.related.TrackedPerDay.ForDay(yesterday));
+    ASSERT_EQ(1800, loaded.related.TrackedPerDay.ForDay(today));
+
+    // Totals are summed up from time entries when there are none
+    sqlite3 *handle = 0;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(TESTDB, &handle));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(handle, "delete from daily_totals",
+                                      0, 0, 0));
+    sqlite3_close(handle);
+
+    User summed("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &summed, true));
+    ASSERT_EQ(600, summed.related.TrackedPerDay.ForDay(yesterday));
+    ASSERT_EQ(1800, summed.related.TrackedPerDay.ForDay(today));
+
+    // Entries loaded from database are counted in the totals already
+    TimeEntry *moved = summed.GetTimeEntryByID(2);
+    ASSERT_TRUE(moved);
+    moved->SetDurationInSeconds(900);
+    ASSERT_EQ(900, summed.related.TrackedPerDay.ForDay(today));
+
+    // Entry outside of the loaded window arrives through sync
+    const Poco::Int64 week_ago = yesterday - 6 * 86400;
+    TimeEntry *old = new TimeEntry();
+    old->SetID(4);
+    old->SetStart(week_ago);
+    old->SetDurationInSeconds(1200);
+    summed.related.AddTimeEntry(old);
+    ASSERT_EQ(noError, db.SaveUser(&summed, true, &changes));
+
+    db.SetTimeEntryWindowDays(3);
+    User windowed("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &windowed, true));
+    ASSERT_FALSE(windowed.GetTimeEntryByID(4));
+    ASSERT_EQ(1200, windowed.related.TrackedPerDay.ForDay(week_ago));
+
+    TimeEntry *synced = new TimeEntry();
+    synced->SetID(4);
+    synced->SetGUID(old->GUID());
+    synced->SetStart(week_ago);
+    synced->SetDurationInSeconds(1500);
+    windowed.related.AddTimeEntry(synced);
+    ASSERT_EQ(noError, db.SaveUser(&windowed, true, &changes));
+    ASSERT_EQ(1500, windowed.related.TrackedPerDay.ForDay(week_ago));
+
+    // Days within the window are summed up in memory
+    windowed.GetTimeEntryByID(2)->SetDurationInSeconds(1200);
+    windowed.GetTimeEntryByID(3)->SetDurationInSeconds(300);
+    ASSERT_EQ(noError, db.SaveUser(&windowed, true, &changes));
+    ASSERT_EQ(1200, windowed.related.TrackedPerDay.ForDay(today));
+    ASSERT_EQ(300, windowed.related.TrackedPerDay.ForDay(yesterday));
+
+    User reloaded("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &reloaded, true));
+    ASSERT_EQ(1200, reloaded.related.TrackedPerDay.ForDay(today));
+    ASSERT_EQ(300, reloaded.related.TrackedPerDay.ForDay(yesterday));
+    ASSERT_EQ(1500, reloaded.related.TrackedPerDay.ForDay(week_ago));
+}
+
+// Collects SQL statements written as string literals in database.cc.
+// Adjacent literals are joined. Statements that are glued together
+// with table names at runtime are skipped.
+std::vector<std::string> databaseStatements() {
+    Poco::FileInputStream fis("src/database.cc");
+    std::stringstream ss;
+    ss << fis.rdbuf();
+    const std::string src = ss.str();
+
+    std::vector<std::string> result;
+    std::string sql("");
+    bool in_literal = false;
+    bool dynamic = false;
+    char previous = 0;
+    for (size_t i = 0; i < src.size(); i++) {
+        char c = src[i];
+        if (c == '"') {
+            if (!in_literal) {
+                dynamic = previous == '+';
+                sql = "";
+            }
+            in_literal = true;
+            for (i++; i < src.size() && src[i] != '"'; i++) {
+                if (src[i] == '\\') {
+                    i++;
+                }
+                sql += src[i];
+            }
+            continue;
+        }
+        if (isspace(c)) {
+            continue;
+        }
+        if (c == '/' && i + 1 < src.size() && src[i + 1] == '/') {
+            i = src.find('\n', i);
+            if (i == std::string::npos) {
+                break;
+            }
+            continue;
+        }
+        if (in_literal) {
+            in_literal = false;
+            size_t start = sql.find_first_not_of(' ');
+            std::string lower = Poco::toLower(
+                sql.substr(start == std::string::npos ? 0 : start));
+            // Migrations copy rows through temporary tables
+            // that only exist while migrating.
+            if (!dynamic && c != '+' &&
+                    lower.find("tmp_") == std::string::npos &&
+                    (lower.find("select ") == 0 ||
+                     lower.find("update ") == 0 ||
+                     lower.find("insert into ") == 0 ||
+                     lower.find("delete from ") == 0)) {
+                result.push_back(sql);
+            }
+        }
+        previous = c;
+    }
+    return result;
+}
+
+TEST(TogglApiClientTest, SearchesTimeEntryDescriptions) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(20000), true, true);
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    std::vector<TimeEntry *> found;
+    ASSERT_EQ(noError, db.SearchTimeEntries(user.ID(), "entry 12345", 10,
+              &found));
+
+    ASSERT_EQ(size_t(1), found.size());
+    ASSERT_EQ("Entry 12345", found[0]->Description());
+    delete found[0];
+    found.clear();
+
+    // Words are matched by prefix, results are limited
+    ASSERT_EQ(noError, db.SearchTimeEntries(user.ID(), "1234", 5, &found));
+    ASSERT_EQ(size_t(5), found.size());
+    for (size_t i = 0; i < found.size(); i++) {
+        delete found[i];
+    }
+    found.clear();
+
+    // Index follows description changes
+    TimeEntry *te = user.GetTimeEntryByID(1);
+    ASSERT_TRUE(te);
+    te->SetDescription("Renamed");
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    ASSERT_EQ(noError, db.SearchTimeEntries(user.ID(), "entry 0", 10,
+              &found));
+    ASSERT_TRUE(found.empty());
+    ASSERT_EQ(noError, db.SearchTimeEntries(user.ID(), "RENAMED", 10,
+              &found));
+    ASSERT_EQ(size_t(1), found.size());
+    ASSERT_EQ(te->GUID(), found[0]->GUID());
+    delete found[0];
+    found.clear();
+
+    ASSERT_EQ(noError, db.SearchTimeEntries(user.ID(), "\"*", 10, &found));
+    ASSERT_TRUE(found.empty());
+}
+
+TEST(TogglApiClientTest, SkipsAppliedMigrationsOnStartup) {
+    wipe_test_db();
+    Poco::Timestamp::TimeDiff first_check(0);
+    Poco::UInt64 applied(0);
+    {
+        Database db(TESTDB);
+        db.SchemaStats(&first_check, &applied);
+        ASSERT_LT(Poco::UInt64(0), applied);
+    }
+
+    Database db(TESTDB);
+    Poco::Timestamp::TimeDiff check(0);
+    db.SchemaStats(&check, &applied);
+    ASSERT_EQ(Poco::UInt64(0), applied);
+}
+
+TEST(TogglApiClientTest, LoadsUserFromSnapshotIfUpToDate) {
+    wipe_test_db();
+    const std::string snapshot(std::string(TESTDB) + ".snapshot");
+    Poco::UInt64 UID(0);
+    {
+        Database db(TESTDB);
+        db.SetSnapshotPath(snapshot);
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, timeEntriesJSON(1000), true, true);
+        user.related.TimeEntries[0]->SetTags("alfa|beeta");
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        UID = user.ID();
+
+        // Saving does not write the snapshot, and it's not
+        // written while there are unsaved changes.
+        ASSERT_FALSE(Poco::File(snapshot).exists());
+        user.GetTimeEntryByID(2)->SetDescription("Unsaved");
+        ASSERT_EQ(noError, db.WriteSnapshot(&user));
+        ASSERT_FALSE(Poco::File(snapshot).exists());
+
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(noError, db.WriteSnapshot(&user));
+    }
+    ASSERT_TRUE(Poco::File(snapshot).exists());
+
+    {
+        Database db(TESTDB);
+        db.SetSnapshotPath(snapshot);
+        User user("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(UID, &user, true));
+        ASSERT_EQ(size_t(1000), user.related.TimeEntries.size());
+        TimeEntry *te = user.GetTimeEntryByID(1);
+        ASSERT_TRUE(te);
+        ASSERT_EQ("Entry 0", te->Description());
+        ASSERT_EQ("alfa|beeta", te->Tags());
+        ASSERT_FALSE(te->Dirty());
+        ASSERT_TRUE(te->LocalID());
+        ASSERT_EQ("Unsaved", user.GetTimeEntryByID(2)->Description());
+        ASSERT_EQ(0, user.related.TimeEntriesLoadedSince);
+
+        // Entries older than the window are left out,
+        // even if they had been paged in.
+        db.SetTimeEntryWindowDays(28);
+        ASSERT_EQ(noError, db.WriteSnapshot(&user));
+    }
+    {
+        Database db(TESTDB);
+        db.SetSnapshotPath(snapshot);
+        db.SetTimeEntryWindowDays(28);
+        User user("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(UID, &user, true));
+        ASSERT_TRUE(user.related.TimeEntries.empty());
+        ASSERT_NE(0, user.related.TimeEntriesLoadedSince);
+        ASSERT_EQ(noError, db.LoadOlderTimeEntries(&user, 10000));
+        ASSERT_EQ(size_t(1000), user.related.TimeEntries.size());
+    }
+
+    // Saving without snapshots makes the snapshot stale
+    {
+        Database db(TESTDB);
+        User user("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(UID, &user, true));
+        user.GetTimeEntryByID(1)->SetDescription("Changed");
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+    }
+    {
+        Database db(TESTDB);
+        db.SetSnapshotPath(snapshot);
+        User user("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(UID, &user, true));
+        ASSERT_EQ("Changed", user.GetTimeEntryByID(1)->Description());
+    }
+
+    // Corrupt snapshot is ignored
+    {
+        Poco::FileOutputStream out(snapshot);
+        out << "kopsik01 is not a snapshot";
+    }
+    Database db(TESTDB);
+    db.SetSnapshotPath(snapshot);
+    User user("kopsik_test", "0.1");
+    ASSERT_EQ(noError, db.LoadUserByID(UID, &user, true));
+    ASSERT_EQ(size_t(1000), user.related.TimeEntries.size());
+    ASSERT_EQ("alfa|beeta", user.GetTimeEntryByID(1)->Tags());
+
+    Poco::File(snapshot).remove();
+}
+
+TEST(TogglApiClientTest, KeepsTrackOfRunningTimeEntries) {
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(20000), true, true);
+    ASSERT_FALSE(user.RunningTimeEntry());
+
+    TimeEntry *first = user.Start("First", "", 0, 0);
+    ASSERT_EQ(first, user.RunningTimeEntry());
+
+    // Running entry from another device
+    TimeEntry *second = user.GetTimeEntryByID(20000);
+    second->SetDurationInSeconds(-time(0));
+    ASSERT_EQ(first, user.RunningTimeEntry());
+
+    std::vector<TimeEntry *> stopped = user.Stop();
+    ASSERT_EQ(size_t(2), stopped.size());
+    ASSERT_FALSE(user.RunningTimeEntry());
+    ASSERT_FALSE(first->IsTracking());
+    ASSERT_FALSE(second->IsTracking());
+
+    second->SetDurationInSeconds(-time(0));
+    ASSERT_EQ(second, user.RunningTimeEntry());
+    second->MarkAsDeletedOnServer();
+    ASSERT_FALSE(user.RunningTimeEntry());
+
+    TimeEntry *third = user.Start("Third", "", 0, 0);
+    ASSERT_EQ(third, user.RunningTimeEntry());
+    ASSERT_EQ(third, user.StopAt(time(0) + 60));
+    ASSERT_FALSE(user.RunningTimeEntry());
+}
+
+TEST(TogglApiClientTest, KeepsTimeEntriesOrderedByStart) {
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(1000), true, true);
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        TimeEntry *te = user.related.TimeEntries[i];
+        te->SetStart(1379068550 + (te->ID() * 7919) % 1000 * 60);
+    }
+
+    const std::vector<TimeEntry *> &ordered =
+        user.related.TimeEntriesByStart.Ordered();
+    ASSERT_EQ(size_t(1000), ordered.size());
+    for (size_t i = 1; i < ordered.size(); i++) {
+        ASSERT_GE(ordered[i - 1]->Start(), ordered[i]->Start());
+    }
+
+    TimeEntry *moved = user.GetTimeEntryByID(500);
+    moved->SetStart(1379068550 + 2000 * 60);
+    ASSERT_EQ(moved, user.Latest());
+
+    ASSERT_FALSE(user.HasTrackedTimeToday());
+    TimeEntry *started = user.Start("Latest", "", 0, 0);
+    ASSERT_EQ(started, user.Latest());
+    ASSERT_TRUE(user.HasTrackedTimeToday());
+
+    moved->MarkAsDeletedOnServer();
+    ASSERT_EQ(size_t(1000),
+              user.related.TimeEntriesByStart.Ordered().size());
+    for (size_t i = 1; i < ordered.size(); i++) {
+        ASSERT_GE(ordered[i - 1]->Start(), ordered[i]->Start());
+        ASSERT_NE(moved, ordered[i]);
+    }
+}
+
+TEST(TogglApiClientTest, ReusesPooledModelsAfterLogout) {
+    std::string json = timeEntriesJSON(50000);
+    const size_t in_use = TimeEntry::Pool().ModelsInUse();
+    size_t slabs[2];
+    for (int i = 0; i < 2; i++) {
+        User *user = new User("kopsik_test", "0.1");
+        LoadUserFromJSONString(user, json, true, true);
+        ASSERT_LE(in_use + 50000, TimeEntry::Pool().ModelsInUse());
+        slabs[i] = TimeEntry::Pool().Slabs();
+
+        delete user;
+        ASSERT_EQ(in_use, TimeEntry::Pool().ModelsInUse());
+    }
+
+    // Second load fits into the slabs of the first one
+    ASSERT_EQ(slabs[0], slabs[1]);
+}
+
+TEST(TogglApiClientTest, KeepsTimeEntryColumnsInSync) {
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(1000), true, true);
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        TimeEntry *te = user.related.TimeEntries[i];
+        te->SetPID(te->ID() % 7);
+        te->SetDurationInSeconds(te->ID() * 10);
+    }
+    user.GetTimeEntryByID(10)->SetDeletedAt(time(0));
+    user.GetTimeEntryByID(20)->MarkAsDeletedOnServer();
+
+    TimeEntry *removed = user.GetTimeEntryByID(1);
+    user.related.TimeEntries.erase(std::find(
+        user.related.TimeEntries.begin(),
+        user.related.TimeEntries.end(),
+        removed));
+    delete removed;
+
+    const TimeEntryColumns &columns = user.related.Columns;
+    ASSERT_EQ(user.related.TimeEntries.size(), columns.Size());
+
+    Poco::Int64 total(0);
+    std::map<Poco::UInt64, Poco::UInt64> expected;
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        TimeEntry *te = user.related.TimeEntries[i];
+        total += te->CountedSeconds();
+        if (te->CountedSeconds()) {
+            expected[te->PID()] += te->CountedSeconds();
+        }
+    }
+    ASSERT_EQ(total, columns.Seconds(0, time(0)));
+
+    std::map<Poco::UInt64, Poco::UInt64> per_project;
+    columns.SecondsPerProject(&per_project);
+    ASSERT_TRUE(expected == per_project);
+
+    std::map<Poco::Int64, Poco::Int64> per_day;
+    columns.SecondsPerDay(0, time(0), &per_day);
+    ASSERT_EQ(size_t(1), per_day.size());
+    ASSERT_EQ(total, per_day.begin()->second);
+
+    user.Start("Today", "", 0, 0);
+    ASSERT_EQ(total, columns.Seconds(0, time(0) + 1));
+}
+
+TEST(TogglApiClientTest, SumsTimeEntryColumnsPerLocalDay) {
+    const Poco::Int64 count = 20000;
+    const Poco::Int64 first = 1379068550;
+
+    // A row every 2 hours and a bit, for about five years
+    TimeEntryColumns columns;
+    TimeEntry te;
+    Poco::Int64 total(0);
+    std::map<Poco::Int64, Poco::Int64> expected;
+    for (Poco::Int64 i = 0; i < count; i++) {
+        te.SetStart(first + i * 7829);
+        te.SetDurationInSeconds(i % 3600 + 1);
+        columns.Add(&te);
+        total += i % 3600 + 1;
+        expected[DailyTotals::StartOfDay(first + i * 7829)] += i % 3600 + 1;
+    }
+    const Poco::Int64 last = first + count * 7829;
+
+    // Every entry is counted once, on the local day it started on,
+    // across daylight saving time changes
+    std::map<Poco::Int64, Poco::Int64> per_day;
+    columns.SecondsPerDay(first, last, &per_day);
+    ASSERT_TRUE(expected == per_day);
+    ASSERT_EQ(total, columns.Seconds(first, last));
+}
+
+TEST(TogglApiClientTest, InternsRepeatedTimeEntryStrings) {
+    wipe_test_db();
+    const size_t strings = InternedString::Pool().Strings();
+    const size_t references = InternedString::Pool().References();
+
+    Poco::UInt64 UID(0);
+    {
+        Database db(TESTDB);
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, timeEntriesJSON(20000), true, true);
+        for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+            TimeEntry *te = user.related.TimeEntries[i];
+            std::stringstream ss;
+            ss << "Weekly planning meeting with team " << i % 10;
+            te->SetDescription(ss.str());
+            te->SetCreatedWith("TogglDesktop/7.0.0 (Linux)");
+        }
+        ASSERT_EQ(strings + 11, InternedString::Pool().Strings());
+        ASSERT_EQ(references + 40000, InternedString::Pool().References());
+
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        UID = user.ID();
+
+        // Strings loaded from database share the same copies
+        User loaded("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(UID, &loaded, true));
+        ASSERT_EQ(size_t(20000), loaded.related.TimeEntries.size());
+        ASSERT_EQ(strings + 11, InternedString::Pool().Strings());
+        ASSERT_EQ(references + 80000, InternedString::Pool().References());
+    }
+
+    // Strings nobody holds are dropped
+    ASSERT_EQ(strings, InternedString::Pool().Strings());
+    ASSERT_EQ(references, InternedString::Pool().References());
+}
+
+TEST(TogglApiClientTest, IndexesModelsByRelatedIDs) {
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(1000), true, true);
+
+    Project *p = new Project();
+    p->SetID(1);
+    p->SetWID(123456789);
+    p->SetCID(5);
+    user.related.AddProject(p);
+
+    Task *t = new Task();
+    t->SetID(2);
+    t->SetWID(123456789);
+    t->SetPID(1);
+    user.related.AddTask(t);
+
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        TimeEntry *te = user.related.TimeEntries[i];
+        if (te->ID() % 10 == 0) {
+            te->SetPID(1);
+        }
+        if (te->ID() % 100 == 0) {
+            te->SetTID(2);
+        }
+    }
+
+    const ModelIndex &index = user.related.TimeEntryIndex;
+    ASSERT_EQ(size_t(1000), index.ByRelatedID(kRelatedWID, 123456789).size());
+    ASSERT_EQ(size_t(100), index.ByRelatedID(kRelatedPID, 1).size());
+    ASSERT_EQ(size_t(10), index.ByRelatedID(kRelatedTID, 2).size());
+
+    // Moved entries follow their setters
+    user.GetTimeEntryByID(10)->SetPID(3);
+    ASSERT_EQ(size_t(99), index.ByRelatedID(kRelatedPID, 1).size());
+    ASSERT_EQ(size_t(1), index.ByRelatedID(kRelatedPID, 3).size());
+
+    user.RemoveTaskFromRelatedModels(2);
+    ASSERT_TRUE(index.ByRelatedID(kRelatedTID, 2).empty());
+    ASSERT_EQ(Poco::UInt64(0), user.GetTimeEntryByID(100)->TID());
+
+    user.RemoveProjectFromRelatedModels(1);
+    ASSERT_TRUE(index.ByRelatedID(kRelatedPID, 1).empty());
+    ASSERT_EQ(Poco::UInt64(0), t->PID());
+    ASSERT_EQ(Poco::UInt64(0), user.GetTimeEntryByID(20)->PID());
+    ASSERT_EQ(Poco::UInt64(3), user.GetTimeEntryByID(10)->PID());
+
+    user.RemoveClientFromRelatedModels(5);
+    ASSERT_EQ(Poco::UInt64(0), p->CID());
+
+    user.DeleteRelatedModelsWithWorkspace(123456789);
+    ASSERT_TRUE(p->IsMarkedAsDeletedOnServer());
+    ASSERT_TRUE(t->IsMarkedAsDeletedOnServer());
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        ASSERT_TRUE(user.related.TimeEntries[i]->IsMarkedAsDeletedOnServer());
+    }
+}
+
+TEST(TogglApiClientTest, QueriesTimeEntriesInRange) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(50000), true, true);
+    const Poco::Int64 base(1379068550);
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        TimeEntry *te = user.related.TimeEntries[i];
+        te->SetStart(base + te->ID() * 600);
+        te->SetStop(base + te->ID() * 600 + 300);
+        te->SetDurationInSeconds(300);
+    }
+
+    // A month long entry reaching into the week
+    const Poco::Int64 from = base + 40000 * 600;
+    const Poco::Int64 to = from + 7 * 86400;
+    TimeEntry *long_entry = user.GetTimeEntryByID(36000);
+    long_entry->SetStop(from + 3600);
+    long_entry->SetDurationInSeconds(from + 3600 - long_entry->Start());
+
+    // Stopped without a stop time, lasts for its duration
+    TimeEntry *no_stop = user.GetTimeEntryByID(39995);
+    no_stop->SetStop(0);
+    no_stop->SetDurationInSeconds(from + 60 - no_stop->Start());
+
+    ViewSnapshot snapshot;
+    const std::vector<TimeEntry *> &ordered =
+        user.related.TimeEntriesByStart.Ordered();
+    for (size_t i = 0; i < ordered.size(); i++) {
+        snapshot.TimeEntries.push_back(TimeEntryView(*ordered[i], "", ""));
+    }
+    snapshot.LongestDuration =
+        user.related.TimeEntriesByStart.LongestDuration();
+
+    std::vector<const TimeEntryView *> found;
+    snapshot.TimeEntriesInRange(from, to, &found);
+
+    size_t expected(0);
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        TimeEntry *te = user.related.TimeEntries[i];
+        if (static_cast<Poco::Int64>(te->Start()) < to
+                && static_cast<Poco::Int64>(te->Start())
+                + te->DurationInSeconds() > from) {
+            expected++;
+        }
+    }
+
+    ASSERT_EQ(size_t(7 * 144 + 2), expected);
+    ASSERT_EQ(expected, found.size());
+    ASSERT_EQ(long_entry->GUID(), found.back()->GUID);
+    ASSERT_EQ(no_stop->GUID(), found[found.size() - 2]->GUID);
+    for (size_t i = 1; i < found.size(); i++) {
+        ASSERT_GE(found[i - 1]->Started, found[i]->Started);
+    }
+
+    // Running entry started in the range is put into place
+    TimeEntry running;
+    running.SetGUID("running");
+    running.SetStart(from + 3030);
+    running.SetDurationInSeconds(-(from + 3030));
+    snapshot.Running.push_back(TimeEntryView(running, "", ""));
+    found.clear();
+    snapshot.TimeEntriesInRange(from, to, &found);
+    ASSERT_EQ(expected + 1, found.size());
+    ASSERT_EQ(std::string("running"), found[found.size() - 9]->GUID);
+    for (size_t i = 1; i < found.size(); i++) {
+        ASSERT_GE(found[i - 1]->Started, found[i]->Started);
+    }
+
+    // Running since long before the range, still running through it
+    TimeEntry *old_running = user.GetTimeEntryByID(100);
+    old_running->SetStop(0);
+    old_running->SetDurationInSeconds(-old_running->Start());
+    old_running->SetTags("running");
+    ASSERT_LT(static_cast<Poco::Int64>(old_running->Start()),
+              from - kMaxTimeEntryDurationSeconds);
+
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    std::vector<TimeEntry *> loaded;
+    ASSERT_EQ(noError, db.LoadTimeEntriesInRange(user.ID(), from, to,
+              &loaded));
+
+    ASSERT_EQ(expected + 1, loaded.size());
+    ASSERT_EQ(old_running->GUID(), loaded.back()->GUID());
+    ASSERT_EQ(std::string("running"), loaded.back()->Tags());
+    ASSERT_EQ(long_entry->GUID(), loaded[loaded.size() - 2]->GUID());
+    ASSERT_EQ(no_stop->GUID(), loaded[loaded.size() - 3]->GUID());
+    for (size_t i = 0; i < loaded.size(); i++) {
+        delete loaded[i];
+    }
+}
+
+TEST(TogglApiClientTest, DatabaseStatementsDoNotScanLargeTables) {
+    wipe_test_db();
+    Database db(TESTDB);
+
+    std::vector<std::string> statements = databaseStatements();
+    ASSERT_LT(size_t(20), statements.size());
+
+    const char *large_tables[] = { "time_entries", "timeline_events" };
+
+    sqlite3 *handle = 0;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(TESTDB, &handle));
+    for (size_t i = 0; i < statements.size(); i++) {
+        std::string plan_sql = "EXPLAIN QUERY PLAN " + statements[i];
+        sqlite3_stmt *stmt = 0;
+        int rc = sqlite3_prepare_v2(handle, plan_sql.c_str(), -1, &stmt, 0);
+        EXPECT_EQ(SQLITE_OK, rc) << statements[i] << ": "
+                                 << sqlite3_errmsg(handle);
+        if (rc != SQLITE_OK) {
+            continue;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            // Older SQLite versions say "SCAN TABLE x", newer "SCAN x"
+            std::string detail(reinterpret_cast<const char *>(
+                sqlite3_column_text(stmt, sqlite3_column_count(stmt) - 1)));
+            for (size_t t = 0; t < 2; t++) {
+                std::string table(large_tables[t]);
+                std::string scan = "SCAN " + table;
+                std::string scan_table = "SCAN TABLE " + table;
+                EXPECT_TRUE(detail != scan
+                            && detail.find(scan + " ") != 0
+                            && detail.find(scan_table) != 0)
+                        << statements[i] << ": " << detail;
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(handle);
+}
+
 }  // namespace kopsik
 
 int main(int argc, char **argv) {
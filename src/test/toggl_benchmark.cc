@@ -0,0 +1,467 @@
+// Copyright 2014 Toggl Desktop developers.
+
+// Timings of the paths that unit tests only check for results.
+// They depend on the machine, so they are printed, not asserted,
+// and are not part of the unit test run. Run with "make benchmark".
+
+#include <algorithm>
+#include <iostream>  // NOLINT
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "./../user.h"
+#include "./../json.h"
+#include "./../database.h"
+#include "./../proxy.h"
+#include "./../model_pool.h"
+#include "./../string_pool.h"
+#include "./../view_snapshot.h"
+#include "./test_data.h"
+
+#include "Poco/Data/Common.h"
+#include "Poco/Data/RecordSet.h"
+#include "Poco/File.h"
+#include "Poco/Logger.h"
+#include "Poco/Runnable.h"
+#include "Poco/Stopwatch.h"
+#include "Poco/Thread.h"
+
+#define BENCHMARKDB "benchmark.db"
+
+namespace kopsik {
+
+void wipeBenchmarkDB() {
+    Poco::File f(BENCHMARKDB);
+    if (f.exists()) {
+        f.remove(false);
+    }
+}
+
+Poco::Timestamp::TimeDiff fullSyncMergeTime(const size_t count) {
+    std::string json = timeEntriesJSON(count);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, json, true, true);
+    EXPECT_EQ(count, user.related.TimeEntries.size());
+
+    // Merge the same data again, like a full sync would do
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+    LoadUserFromJSONString(&user, json, true, true);
+    stopwatch.stop();
+    EXPECT_EQ(count, user.related.TimeEntries.size());
+
+    return stopwatch.elapsed();
+}
+
+TEST(TogglBenchmark, FullSyncMerge) {
+    Poco::Timestamp::TimeDiff small = fullSyncMergeTime(5000);
+    Poco::Timestamp::TimeDiff large = fullSyncMergeTime(20000);
+
+    std::stringstream ss;
+    ss << "Full sync merge of 5000 time entries took "
+       << small / 1000 << " ms, 20000 time entries took "
+       << large / 1000 << " ms";
+    std::cout << ss.str() << std::endl;
+}
+
+Poco::Timestamp::TimeDiff firstSaveTime(
+    const size_t count,
+    const bool with_server_ids) {
+    wipeBenchmarkDB();
+    Database db(BENCHMARKDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(count), true, true);
+    if (!with_server_ids) {
+        for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+            user.related.TimeEntries[i]->SetID(0);
+        }
+    }
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+    std::vector<ModelChange> changes;
+    EXPECT_EQ(noError, db.SaveUser(&user, true, &changes));
+    stopwatch.stop();
+
+    return stopwatch.elapsed();
+}
+
+TEST(TogglBenchmark, FirstLoginBulkInsert) {
+    // Entries pulled from server are inserted in bulk,
+    // new local entries are inserted one by one.
+    Poco::Timestamp::TimeDiff bulk = firstSaveTime(50000, true);
+    Poco::Timestamp::TimeDiff single = firstSaveTime(50000, false);
+
+    std::stringstream ss;
+    ss << "Saving 50000 new time entries took "
+       << bulk / 1000 << " ms in bulk, "
+       << single / 1000 << " ms one by one";
+    std::cout << ss.str() << std::endl;
+}
+
+class SaveUserInBackground : public Poco::Runnable {
+ public:
+    SaveUserInBackground(Database *db, User *user)
+        : Error(noError)
+    , Elapsed(0)
+    , db_(db)
+    , user_(user) {}
+
+    void run() {
+        Poco::Stopwatch stopwatch;
+        stopwatch.start();
+        std::vector<ModelChange> changes;
+        Error = db_->SaveUser(user_, true, &changes);
+        stopwatch.stop();
+        Elapsed = stopwatch.elapsed();
+    }
+
+    error Error;
+    Poco::Timestamp::TimeDiff Elapsed;
+
+ private:
+    Database *db_;
+    User *user_;
+};
+
+TEST(TogglBenchmark, ReadsWhileSaving) {
+    wipeBenchmarkDB();
+    Database db(BENCHMARKDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(50000), true, true);
+
+    // Opens a reader session
+    bool use_proxy(false);
+    Proxy proxy;
+    ASSERT_EQ(noError, db.LoadProxySettings(&use_proxy, &proxy));
+
+    SaveUserInBackground saver(&db, &user);
+    Poco::Thread thread;
+    thread.start(saver);
+
+    int reads(0);
+    Poco::Timestamp::TimeDiff slowest(0);
+    while (thread.isRunning()) {
+        Poco::Stopwatch stopwatch;
+        stopwatch.start();
+        ASSERT_EQ(noError, db.LoadProxySettings(&use_proxy, &proxy));
+        stopwatch.stop();
+        slowest = (std::max)(slowest, stopwatch.elapsed());
+        reads++;
+    }
+    thread.join();
+    ASSERT_EQ(noError, saver.Error);
+
+    std::stringstream ss;
+    ss << reads << " reads while saving user for "
+       << saver.Elapsed / 1000 << " ms, slowest read took "
+       << slowest / 1000 << " ms";
+    std::cout << ss.str() << std::endl;
+}
+
+// Reads time entries the way loaders did before the typed row decoder
+Poco::Timestamp::TimeDiff recordSetLoadTime(const Poco::UInt64 UID) {
+    Poco::Data::Session session("SQLite", BENCHMARKDB);
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+    std::vector<TimeEntry *> list;
+    Poco::Data::Statement select(session);
+    select << "SELECT local_id, id, uid, description, wid, guid, pid, "
+           "tid, billable, duronly, ui_modified_at, start, stop, "
+           "duration, created_with, deleted_at, updated_at, "
+           "project_guid "
+           "FROM time_entries "
+           "WHERE uid = :uid "
+           "ORDER BY start DESC",
+           Poco::Data::use(UID);
+    Poco::Data::RecordSet rs(select);
+    while (!select.done()) {
+        select.execute();
+        bool more = rs.moveFirst();
+        while (more) {
+            TimeEntry *model = new TimeEntry();
+            model->SetLocalID(rs[0].convert<Poco::Int64>());
+            model->SetID(rs[1].convert<Poco::UInt64>());
+            model->SetUID(rs[2].convert<Poco::UInt64>());
+            model->SetDescription(rs[3].convert<std::string>());
+            model->SetWID(rs[4].convert<Poco::UInt64>());
+            model->SetGUID(rs[5].convert<std::string>());
+            model->SetPID(rs[6].convert<Poco::UInt64>());
+            model->SetTID(rs[7].convert<Poco::UInt64>());
+            model->SetBillable(rs[8].convert<bool>());
+            model->SetDurOnly(rs[9].convert<bool>());
+            model->SetUIModifiedAt(rs[10].convert<Poco::UInt64>());
+            model->SetStart(rs[11].convert<Poco::UInt64>());
+            model->SetStop(rs[12].convert<Poco::UInt64>());
+            model->SetDurationInSeconds(rs[13].convert<Poco::Int64>());
+            model->SetCreatedWith(rs[14].convert<std::string>());
+            model->SetDeletedAt(rs[15].convert<Poco::UInt64>());
+            model->SetUpdatedAt(rs[16].convert<Poco::UInt64>());
+            model->SetProjectGUID(rs[17].convert<std::string>());
+            model->ClearDirty();
+            list.push_back(model);
+            more = rs.moveNext();
+        }
+    }
+    stopwatch.stop();
+
+    EXPECT_EQ(size_t(20000), list.size());
+    for (size_t i = 0; i < list.size(); i++) {
+        delete list[i];
+    }
+    return stopwatch.elapsed();
+}
+
+TEST(TogglBenchmark, LoadUserWithTypedRowDecoder) {
+    wipeBenchmarkDB();
+    Poco::UInt64 UID(0);
+    {
+        Database db(BENCHMARKDB);
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, timeEntriesJSON(20000), true, true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        UID = user.ID();
+    }
+
+    // Cold start, with a fresh connection
+    Database db(BENCHMARKDB);
+    User user("kopsik_test", "0.1");
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+    ASSERT_EQ(noError, db.LoadUserByID(UID, &user, true));
+    stopwatch.stop();
+    ASSERT_EQ(size_t(20000), user.related.TimeEntries.size());
+
+    Poco::Timestamp::TimeDiff record_set = recordSetLoadTime(UID);
+
+    std::stringstream ss;
+    ss << "Cold LoadUserByID with 20000 time entries took "
+       << stopwatch.elapsed() / 1000 << " ms, decoding the same time "
+       << "entries from a RecordSet took " << record_set / 1000 << " ms";
+    std::cout << ss.str() << std::endl;
+}
+
+TEST(TogglBenchmark, SearchTimeEntryDescriptions) {
+    wipeBenchmarkDB();
+    Database db(BENCHMARKDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(20000), true, true);
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+    std::vector<TimeEntry *> found;
+    ASSERT_EQ(noError, db.SearchTimeEntries(user.ID(), "entry 12345", 10,
+              &found));
+    stopwatch.stop();
+    ASSERT_EQ(size_t(1), found.size());
+    delete found[0];
+
+    std::stringstream ss;
+    ss << "Searching 20000 time entries took "
+       << stopwatch.elapsed() / 1000 << " ms";
+    std::cout << ss.str() << std::endl;
+}
+
+TEST(TogglBenchmark, SchemaChecksOnStartup) {
+    wipeBenchmarkDB();
+    Poco::Timestamp::TimeDiff first_check(0);
+    Poco::UInt64 applied(0);
+    {
+        Database db(BENCHMARKDB);
+        db.SchemaStats(&first_check, &applied);
+    }
+
+    Database db(BENCHMARKDB);
+    Poco::Timestamp::TimeDiff check(0);
+    db.SchemaStats(&check, &applied);
+
+    std::stringstream ss;
+    ss << "Schema checks took " << first_check / 1000
+       << " ms on a new database, " << check / 1000
+       << " ms on a migrated one";
+    std::cout << ss.str() << std::endl;
+}
+
+TEST(TogglBenchmark, PooledModelsAfterLogout) {
+    std::string json = timeEntriesJSON(50000);
+    Poco::Timestamp::TimeDiff load[2], logout[2];
+    size_t slabs[2];
+    for (int i = 0; i < 2; i++) {
+        Poco::Stopwatch stopwatch;
+        stopwatch.start();
+        User *user = new User("kopsik_test", "0.1");
+        LoadUserFromJSONString(user, json, true, true);
+        stopwatch.stop();
+        load[i] = stopwatch.elapsed();
+        slabs[i] = TimeEntry::Pool().Slabs();
+
+        stopwatch.restart();
+        delete user;
+        stopwatch.stop();
+        logout[i] = stopwatch.elapsed();
+    }
+
+    std::stringstream ss;
+    ss << "Loading 50000 time entries took " << load[0] / 1000
+       << " ms, logout " << logout[0] / 1000 << " ms; again with "
+       << "pooled memory " << load[1] / 1000 << " ms, logout "
+       << logout[1] / 1000 << " ms; " << slabs[1] << " slabs";
+    std::cout << ss.str() << std::endl;
+}
+
+TEST(TogglBenchmark, SumMillionTimeEntryColumns) {
+    const Poco::Int64 count = 1000000;
+    const Poco::Int64 first = 1379068550;
+
+    // Rows are copied from one entry that is changed in between,
+    // a million models would take longer to set up than to sum.
+    TimeEntryColumns columns;
+    TimeEntry te;
+    Poco::Int64 total(0);
+    for (Poco::Int64 i = 0; i < count; i++) {
+        te.SetStart(first + i * 60);
+        te.SetDurationInSeconds(i % 3600 + 1);
+        te.SetPID(i / 100 % 50);
+        columns.Add(&te);
+        total += i % 3600 + 1;
+    }
+    const Poco::Int64 last = first + count * 60;
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+    Poco::Int64 sum = columns.Seconds(first, last);
+    stopwatch.stop();
+    Poco::Timestamp::TimeDiff sum_time = stopwatch.elapsed();
+    ASSERT_EQ(total, sum);
+
+    stopwatch.restart();
+    std::map<Poco::Int64, Poco::Int64> per_day;
+    columns.SecondsPerDay(first, last, &per_day);
+    stopwatch.stop();
+    Poco::Timestamp::TimeDiff per_day_time = stopwatch.elapsed();
+
+    stopwatch.restart();
+    std::map<Poco::UInt64, Poco::UInt64> per_project;
+    columns.SecondsPerProject(&per_project);
+    stopwatch.stop();
+    Poco::Timestamp::TimeDiff per_project_time = stopwatch.elapsed();
+    ASSERT_EQ(size_t(50), per_project.size());
+
+    std::stringstream ss;
+    ss << "Summing " << count << " time entries took "
+       << sum_time / 1000 << " ms, per day over " << per_day.size()
+       << " days " << per_day_time / 1000 << " ms, per project "
+       << per_project_time / 1000 << " ms";
+    std::cout << ss.str() << std::endl;
+}
+
+TEST(TogglBenchmark, InternedTimeEntryStrings) {
+    const size_t bytes = InternedString::Pool().Bytes();
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(20000), true, true);
+    size_t copied_bytes(0);
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        TimeEntry *te = user.related.TimeEntries[i];
+        std::stringstream ss;
+        ss << "Weekly planning meeting with team " << i % 10;
+        te->SetDescription(ss.str());
+        te->SetCreatedWith("TogglDesktop/7.0.0 (Linux)");
+        copied_bytes += te->Description().size()
+                        + te->CreatedWith().size();
+    }
+
+    std::stringstream ss;
+    ss << "Descriptions and user agents of 20000 time entries take "
+       << InternedString::Pool().Bytes() - bytes << " bytes interned, "
+       << copied_bytes << " bytes as copies";
+    std::cout << ss.str() << std::endl;
+}
+
+TEST(TogglBenchmark, TimeEntriesInRange) {
+    wipeBenchmarkDB();
+    Database db(BENCHMARKDB);
+
+    User user("kopsik_test", "0.1");
+    LoadUserFromJSONString(&user, timeEntriesJSON(50000), true, true);
+    const Poco::Int64 base(1379068550);
+    for (size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+        TimeEntry *te = user.related.TimeEntries[i];
+        te->SetStart(base + te->ID() * 600);
+        te->SetStop(base + te->ID() * 600 + 300);
+        te->SetDurationInSeconds(300);
+    }
+    const Poco::Int64 from = base + 40000 * 600;
+    const Poco::Int64 to = from + 7 * 86400;
+
+    ViewSnapshot snapshot;
+    const std::vector<TimeEntry *> &ordered =
+        user.related.TimeEntriesByStart.Ordered();
+    for (size_t i = 0; i < ordered.size(); i++) {
+        snapshot.TimeEntries.push_back(TimeEntryView(*ordered[i], "", ""));
+    }
+    snapshot.LongestDuration =
+        user.related.TimeEntriesByStart.LongestDuration();
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+    std::vector<const TimeEntryView *> found;
+    snapshot.TimeEntriesInRange(from, to, &found);
+    stopwatch.stop();
+    const Poco::Timestamp::TimeDiff indexed = stopwatch.elapsed();
+
+    stopwatch.restart();
+    size_t scanned_count(0);
+    for (size_t i = 0; i < snapshot.TimeEntries.size(); i++) {
+        const TimeEntryView &view = snapshot.TimeEntries[i];
+        if (static_cast<Poco::Int64>(view.Started) < to
+                && static_cast<Poco::Int64>(view.Started)
+                + view.DurationInSeconds > from) {
+            scanned_count++;
+        }
+    }
+    stopwatch.stop();
+    const Poco::Timestamp::TimeDiff scanned = stopwatch.elapsed();
+    ASSERT_EQ(scanned_count, found.size());
+
+    std::vector<ModelChange> changes;
+    ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+    stopwatch.restart();
+    std::vector<TimeEntry *> loaded;
+    ASSERT_EQ(noError, db.LoadTimeEntriesInRange(user.ID(), from, to,
+              &loaded));
+    stopwatch.stop();
+    const Poco::Timestamp::TimeDiff selected = stopwatch.elapsed();
+    ASSERT_EQ(found.size(), loaded.size());
+    for (size_t i = 0; i < loaded.size(); i++) {
+        delete loaded[i];
+    }
+
+    std::stringstream ss;
+    ss << "Week of 50000 time entries took " << indexed
+       << " us from the view snapshot, " << scanned << " us scanning, "
+       << selected / 1000 << " ms from database";
+    std::cout << ss.str() << std::endl;
+}
+
+}  // namespace kopsik
+
+int main(int argc, char **argv) {
+    // Debug logging would be timed too
+    Poco::Logger &logger = Poco::Logger::get("");
+    logger.setLevel(Poco::Message::PRIO_WARNING);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
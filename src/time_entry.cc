@@ -16,14 +16,33 @@
 
 #include "./formatter.h"
 #include "./json.h"
+#include "./model_pool.h"
 #include "./const.h"
+#include "./related_data.h"
 
 #include "Poco/Timestamp.h"
 #include "Poco/DateTime.h"
 #include "Poco/LocalDateTime.h"
+#include "Poco/Mutex.h"
+#include "Poco/HashMap.h"
 
 namespace kopsik {
 
+// Never deleted, so that models can be deleted by static destructors
+static ModelPool *time_entry_pool = new ModelPool(sizeof(TimeEntry));
+
+void *TimeEntry::operator new(size_t size) {
+    return time_entry_pool->Allocate(size);
+}
+
+void TimeEntry::operator delete(void *p, size_t size) {
+    time_entry_pool->Release(p, size);
+}
+
+const ModelPool &TimeEntry::Pool() {
+    return *time_entry_pool;
+}
+
 bool TimeEntry::ResolveError(const kopsik::error err) {
     if (durationTooLarge(err) && Stop() && Start()) {
         Poco::UInt64 seconds =
@@ -88,7 +107,7 @@ std::string TimeEntry::String() const {
     std::stringstream ss;
     ss  << "ID=" << ID()
         << " local_id=" << LocalID()
-        << " description=" << description_
+        << " description=" << Description()
         << " wid=" << wid_
         << " guid=" << GUID()
         << " pid=" << pid_
@@ -128,8 +147,8 @@ void TimeEntry::SetStop(const Poco::UInt64 value) {
 }
 
 void TimeEntry::SetDescription(const std::string value) {
-    if (description_ != value) {
-        description_ = value;
+    if (description_.Value() != value) {
+        description_.SetValue(value);
         SetDirty();
     }
 }
@@ -139,8 +158,8 @@ void TimeEntry::SetStopString(const std::string value) {
 }
 
 void TimeEntry::SetCreatedWith(const std::string value) {
-    if (created_with_ != value) {
-        created_with_ = value;
+    if (created_with_.Value() != value) {
+        created_with_.SetValue(value);
         SetDirty();
     }
 }
@@ -152,10 +171,25 @@ void TimeEntry::SetBillable(const bool value) {
     }
 }
 
+Poco::UInt64 TimeEntry::RelatedID(const RelatedIDKind kind) const {
+    switch (kind) {
+    case kRelatedWID:
+        return wid_;
+    case kRelatedPID:
+        return pid_;
+    case kRelatedTID:
+        return tid_;
+    default:
+        return 0;
+    }
+}
+
 void TimeEntry::SetWID(const Poco::UInt64 value) {
     if (wid_ != value) {
+        Poco::UInt64 previous = wid_;
         wid_ = value;
         SetDirty();
+        relatedIDChanged(kRelatedWID, previous);
     }
 }
 
@@ -178,30 +212,86 @@ void TimeEntry::SetStopUserInput(const std::string value) {
 
 void TimeEntry::SetTID(const Poco::UInt64 value) {
     if (tid_ != value) {
+        Poco::UInt64 previous = tid_;
         tid_ = value;
         SetDirty();
+        relatedIDChanged(kRelatedTID, previous);
     }
 }
 
 void TimeEntry::SetTags(const std::string tags) {
-    if (Tags() != tags) {
-        TagNames.clear();
-        if (!tags.empty()) {
-            std::stringstream ss(tags);
-            while (ss.good()) {
-                std::string tag;
-                getline(ss, tag, '|');
-                TagNames.push_back(tag);
-            }
+    std::vector<TagNameID> ids;
+    if (!tags.empty()) {
+        std::stringstream ss(tags);
+        while (ss.good()) {
+            std::string tag;
+            getline(ss, tag, '|');
+            ids.push_back(InternTagName(tag));
         }
+    }
+    SetTagIDs(ids);
+}
+
+void TimeEntry::SetTagIDs(const std::vector<TagNameID> &value) {
+    if (tag_ids_ != value) {
+        tag_ids_ = value;
+        tags_changed_ = true;
         SetDirty();
     }
 }
 
+void TimeEntry::SetTagNames(const std::vector<std::string> &value) {
+    std::vector<TagNameID> ids;
+    ids.reserve(value.size());
+    for (std::vector<std::string>::const_iterator it = value.begin();
+            it != value.end();
+            it++) {
+        ids.push_back(InternTagName(*it));
+    }
+    SetTagIDs(ids);
+}
+
+std::vector<std::string> TimeEntry::TagNames() const {
+    std::vector<std::string> result;
+    result.reserve(tag_ids_.size());
+    for (std::vector<TagNameID>::const_iterator it = tag_ids_.begin();
+            it != tag_ids_.end();
+            it++) {
+        result.push_back(TagName(*it));
+    }
+    return result;
+}
+
+static Poco::FastMutex tag_names_mutex;
+static std::vector<std::string> interned_tag_names;
+static Poco::HashMap<std::string, TagNameID> interned_tag_name_ids;
+
+TagNameID TimeEntry::InternTagName(const std::string name) {
+    Poco::FastMutex::ScopedLock lock(tag_names_mutex);
+    Poco::HashMap<std::string, TagNameID>::ConstIterator it =
+        interned_tag_name_ids.find(name);
+    if (it != interned_tag_name_ids.end()) {
+        return it->second;
+    }
+    interned_tag_names.push_back(name);
+    TagNameID id = static_cast<TagNameID>(interned_tag_names.size());
+    interned_tag_name_ids.insert(
+        Poco::HashMap<std::string, TagNameID>::ValueType(name, id));
+    return id;
+}
+
+std::string TimeEntry::TagName(const TagNameID id) {
+    Poco::FastMutex::ScopedLock lock(tag_names_mutex);
+    poco_assert(id > 0 && id <= interned_tag_names.size());
+    return interned_tag_names[id - 1];
+}
+
 void TimeEntry::SetPID(const Poco::UInt64 value) {
     if (pid_ != value) {
+        Poco::UInt64 previous = pid_;
         pid_ = value;
         SetDirty();
+        relatedIDChanged(kRelatedPID, previous);
     }
 }
 
@@ -240,30 +330,166 @@ void TimeEntry::SetDurationUserInput(const std::string value) {
 }
 
 void TimeEntry::SetProjectGUID(const std::string value) {
-    if (project_guid_ != value) {
-        project_guid_ = value;
+    if (project_guid_.Value() != value) {
+        project_guid_.SetValue(value);
         SetDirty();
     }
 }
 
 std::string TimeEntry::Tags() const {
-    std::stringstream ss;
-    for (std::vector<std::string>::const_iterator it =
-        TagNames.begin();
-            it != TagNames.end();
+    std::string result("");
+    for (std::vector<TagNameID>::const_iterator it = tag_ids_.begin();
+            it != tag_ids_.end();
             it++) {
-        if (it != TagNames.begin()) {
-            ss << "|";
+        if (it != tag_ids_.begin()) {
+            result += "|";
         }
-        ss << *it;
+        result += TagName(*it);
     }
-    return ss.str();
+    return result;
 }
 
 std::string TimeEntry::DateHeaderString() const {
     return Formatter::FormatDateHeader(start_);
 }
 
+Poco::Int64 TimeEntry::CountedSeconds() const {
+    if (duration_in_seconds_ < 0 || DeletedAt() ||
+            IsMarkedAsDeletedOnServer()) {
+        return 0;
+    }
+    return duration_in_seconds_;
+}
+
+void TimeEntry::SetDailyTotals(DailyTotals *value, const bool persisted) {
+    if (daily_totals_ == value) {
+        return;
+    }
+    daily_totals_ = value;
+    counted_start_ = start_;
+    counted_seconds_ = 0;
+    if (persisted) {
+        counted_seconds_ = CountedSeconds();
+        return;
+    }
+    fieldChanged();
+}
+
+TimeEntry::~TimeEntry() {
+    if (listed_as_running_) {
+        running_->Remove(this);
+    }
+    if (listed_in_order_) {
+        order_->Remove(this);
+    }
+    if (columns_) {
+        columns_->Remove(columns_row_);
+    }
+}
+
+void TimeEntry::SetRunningTimeEntries(RunningTimeEntries *value) {
+    if (running_ == value) {
+        return;
+    }
+    if (listed_as_running_) {
+        running_->Remove(this);
+        listed_as_running_ = false;
+    }
+    running_ = value;
+    updateRunning();
+}
+
+// Entries deleted on server are about to be removed from
+// memory, so they are not listed even if they were running.
+void TimeEntry::updateRunning() {
+    if (!running_) {
+        return;
+    }
+    bool running = IsTracking() && !IsMarkedAsDeletedOnServer();
+    if (running == listed_as_running_) {
+        return;
+    }
+    if (running) {
+        running_->Add(this);
+    } else {
+        running_->Remove(this);
+    }
+    listed_as_running_ = running;
+}
+
+void TimeEntry::SetTimeEntryOrder(TimeEntryOrder *value) {
+    if (order_ == value) {
+        return;
+    }
+    if (listed_in_order_) {
+        order_->Remove(this);
+        listed_in_order_ = false;
+    }
+    order_ = value;
+    updateOrder();
+}
+
+void TimeEntry::SetTimeEntryColumns(TimeEntryColumns *value) {
+    if (columns_ == value) {
+        return;
+    }
+    if (columns_) {
+        columns_->Remove(columns_row_);
+    }
+    columns_ = value;
+    if (columns_) {
+        columns_row_ = columns_->Add(this);
+    }
+}
+
+void TimeEntry::updateOrder() {
+    if (!order_) {
+        return;
+    }
+    bool listed = !IsMarkedAsDeletedOnServer();
+    if (listed != listed_in_order_) {
+        if (listed) {
+            order_->Add(this);
+        } else {
+            order_->Remove(this);
+        }
+        listed_in_order_ = listed;
+    } else if (listed && start_ != ordered_start_) {
+        order_->Moved(this);
+    }
+    ordered_start_ = start_;
+    if (listed) {
+        order_->Lasts(duration_in_seconds_);
+    }
+}
+
+// Moves what the entry adds to daily totals, only
+// looking up local days when start or duration changed.
+void TimeEntry::fieldChanged() {
+    updateRunning();
+    updateOrder();
+    if (columns_) {
+        columns_->Update(columns_row_, *this);
+    }
+
+    if (!daily_totals_) {
+        return;
+    }
+    Poco::Int64 seconds = CountedSeconds();
+    if (seconds == counted_seconds_ &&
+            (!seconds || start_ == counted_start_)) {
+        return;
+    }
+    if (counted_seconds_) {
+        daily_totals_->Add(counted_start_, -counted_seconds_);
+    }
+    if (seconds) {
+        daily_totals_->Add(start_, seconds);
+    }
+    counted_start_ = start_;
+    counted_seconds_ = seconds;
+}
+
 std::string TimeEntry::DurationString() const {
     return Formatter::FormatDurationInSecondsHHMMSS(duration_in_seconds_);
 }
@@ -382,10 +608,10 @@ JSONNODE *TimeEntry::SaveToJSONNode() const {
 
     JSONNODE *tag_nodes = json_new(JSON_ARRAY);
     json_set_name(tag_nodes, "tags");
-    for (std::vector<std::string>::const_iterator it = TagNames.begin();
-            it != TagNames.end();
+    for (std::vector<TagNameID>::const_iterator it = tag_ids_.begin();
+            it != tag_ids_.end();
             it++) {
-        std::string tag_name = *it;
+        std::string tag_name = TagName(*it);
         json_push_back(
             tag_nodes,
             json_new_a(NULL,
@@ -399,17 +625,19 @@ JSONNODE *TimeEntry::SaveToJSONNode() const {
 void TimeEntry::loadTagsFromJSONNode(JSONNODE * const list) {
     poco_assert(list);
 
-    TagNames.clear();
+    std::vector<TagNameID> ids;
 
     JSONNODE_ITERATOR current_node = json_begin(list);
     JSONNODE_ITERATOR last_node = json_end(list);
     while (current_node != last_node) {
         std::string tag = std::string(json_as_string(*current_node));
         if (!tag.empty()) {
-            TagNames.push_back(tag);
+            ids.push_back(InternTagName(tag));
         }
         ++current_node;
     }
+
+    SetTagIDs(ids);
 }
 
 }   // namespace kopsik
@@ -8,11 +8,23 @@
 
 #include "./types.h"
 #include "./base_model.h"
+#include "./string_pool.h"
 
 #include "Poco/Types.h"
 
 namespace kopsik {
 
+class ModelPool;
+
+class DailyTotals;
+class RunningTimeEntries;
+class TimeEntryOrder;
+class TimeEntryColumns;
+
+// Tag names are interned per process, time entries
+// keep a small ID for each of their tags.
+typedef Poco::UInt32 TagNameID;
+
 class TimeEntry : public BaseModel {
  public:
     TimeEntry()
@@ -24,17 +36,51 @@ class TimeEntry : public BaseModel {
     , start_(0)
     , stop_(0)
     , duration_in_seconds_(0)
-    , description_("")
     , duronly_(false)
-    , created_with_("")
-    , project_guid_("") {}
-    virtual ~TimeEntry() {}
+    , daily_totals_(0)
+    , counted_start_(0)
+    , counted_seconds_(0)
+    , running_(0)
+    , listed_as_running_(false)
+    , order_(0)
+    , ordered_start_(0)
+    , listed_in_order_(false)
+    , columns_(0)
+    , columns_row_(0)
+    , tags_changed_(false) {}
+    virtual ~TimeEntry();
+
+    // Allocated from a pool, see ModelPool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+    static const ModelPool &Pool();
+
+    const std::vector<TagNameID> &TagIDs() const {
+        return tag_ids_;
+    }
+    void SetTagIDs(const std::vector<TagNameID> &value);
 
-    std::vector<std::string> TagNames;
+    std::vector<std::string> TagNames() const;
+    void SetTagNames(const std::vector<std::string> &value);
 
+    // Tag names joined with "|", as the UI expects them
     std::string Tags() const;
     void SetTags(const std::string tags);
 
+    // Tags have changed since they were last saved to database
+    bool TagsChanged() const {
+        return tags_changed_;
+    }
+    void ClearTagsChanged() {
+        tags_changed_ = false;
+    }
+    void MarkTagsChanged() {
+        tags_changed_ = true;
+    }
+
+    static TagNameID InternTagName(const std::string name);
+    static std::string TagName(const TagNameID id);
+
     Poco::UInt64 WID() const {
         return wid_;
     }
@@ -67,8 +113,8 @@ class TimeEntry : public BaseModel {
     }
     void SetDurOnly(const bool value);
 
-    std::string Description() const {
-        return description_;
+    const std::string &Description() const {
+        return description_.Value();
     }
     void SetDescription(const std::string value);
 
@@ -90,8 +136,8 @@ class TimeEntry : public BaseModel {
     }
     void SetStop(const Poco::UInt64 value);
 
-    std::string CreatedWith() const {
-        return created_with_;
+    const std::string &CreatedWith() const {
+        return created_with_.Value();
     }
     void SetCreatedWith(const std::string value);
 
@@ -101,11 +147,13 @@ class TimeEntry : public BaseModel {
 
     bool IsToday() const;
 
-    std::string ProjectGUID() const {
-        return project_guid_;
+    const std::string &ProjectGUID() const {
+        return project_guid_.Value();
     }
     void SetProjectGUID(const std::string);
 
+    Poco::UInt64 RelatedID(const RelatedIDKind kind) const;
+
     std::string ModelName() const {
         return "time_entry";
     }
@@ -129,6 +177,27 @@ class TimeEntry : public BaseModel {
 
     virtual bool ResolveError(const kopsik::error err);
 
+    // Daily totals the entry is counted in. Pass persisted = true
+    // if the totals already include the entry as it is now, for
+    // example when it has just been loaded from database.
+    void SetDailyTotals(DailyTotals *value, const bool persisted);
+
+    // List the entry adds itself to while it's running
+    void SetRunningTimeEntries(RunningTimeEntries *value);
+
+    // Order the entry keeps itself in by start time
+    void SetTimeEntryOrder(TimeEntryOrder *value);
+
+    // Columns the entry keeps a row of its fields in
+    void SetTimeEntryColumns(TimeEntryColumns *value);
+
+    // Seconds the entry adds to the total of the day it started on.
+    // Running and deleted entries are not counted.
+    Poco::Int64 CountedSeconds() const;
+
+ protected:
+    void fieldChanged();
+
  private:
     Poco::UInt64 wid_;
     Poco::UInt64 pid_;
@@ -137,10 +206,36 @@ class TimeEntry : public BaseModel {
     Poco::UInt64 start_;
     Poco::UInt64 stop_;
     Poco::Int64 duration_in_seconds_;
-    std::string description_;
+    InternedString description_;
     bool duronly_;
-    std::string created_with_;
-    std::string project_guid_;
+    InternedString created_with_;
+    InternedString project_guid_;
+
+    // What the entry has last added to daily totals
+    DailyTotals *daily_totals_;
+    Poco::UInt64 counted_start_;
+    Poco::Int64 counted_seconds_;
+
+    RunningTimeEntries *running_;
+    bool listed_as_running_;
+
+    TimeEntryOrder *order_;
+    Poco::UInt64 ordered_start_;
+    bool listed_in_order_;
+
+    TimeEntryColumns *columns_;
+    size_t columns_row_;
+
+    std::vector<TagNameID> tag_ids_;
+    bool tags_changed_;
+
+    void updateRunning();
+    void updateOrder();
+
+    friend class TimeEntryColumns;
+    void columnsRowMoved(const size_t row) {
+        columns_row_ = row;
+    }
 
     bool setDurationStringHHMMSS(const std::string value);
     bool setDurationStringHHMM(const std::string value);
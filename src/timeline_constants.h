@@ -6,8 +6,18 @@
 const unsigned int kTimelineUploadIntervalSeconds = 60;
 const unsigned int kTimelineUploadMaxBackoffSeconds =
     kTimelineUploadIntervalSeconds * 10;
+const unsigned int kTimelineUploadBatchSize = 100;
 
 const unsigned int kWindowFocusThresholdSeconds = 5;
 const unsigned int kWindowChangeRecordingIntervalMillis = 500;
 
+// Recorded events are written to database in batches, when
+// this many are buffered, or after this many seconds.
+const unsigned int kTimelineFlushMaxEvents = 20;
+const unsigned int kTimelineFlushIntervalSeconds = 30;
+
+// While events cannot be written, at most this many are kept
+// in memory; the oldest are dropped first.
+const unsigned int kTimelineBufferMaxEvents = 1000;
+
 #endif  // SRC_TIMELINE_CONSTANTS_H_
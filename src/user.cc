@@ -52,7 +52,7 @@ Project *User::AddProject(
     p->SetUID(ID());
     p->SetActive(true);
     p->SetPrivate(is_private);
-    related.Projects.push_back(p);
+    related.AddProject(p);
     return p;
 }
 
@@ -110,7 +110,7 @@ TimeEntry *User::Start(
     te->SetDurOnly(!StoreStartAndStopTime());
     te->SetUIModified();
 
-    related.TimeEntries.push_back(te);
+    related.AddTimeEntry(te);
     return te;
 }
 
@@ -151,38 +151,20 @@ kopsik::error User::Continue(
         (*result)->SetCreatedWith(kopsik::UserAgent(app_name_, app_version_));
         (*result)->SetDurationInSeconds(-time(0));
         (*result)->SetBillable(existing->Billable());
-        (*result)->SetTags(existing->Tags());
-        related.TimeEntries.push_back((*result));
+        (*result)->SetTagIDs(existing->TagIDs());
+        related.AddTimeEntry(*result);
     }
     (*result)->SetUIModified();
     return kopsik::noError;
 }
 
 TimeEntry *User::Latest() const {
-    if (related.TimeEntries.empty()) {
-        return 0;
-    }
-    std::vector<TimeEntry *> list(related.TimeEntries);
-    std::sort(list.begin(), list.end(), CompareTimeEntriesByStart);
-    return list[0];
+    return related.TimeEntriesByStart.First();
 }
 
 std::string User::DateDuration(TimeEntry * const te) const {
-    Poco::Int64 date_duration(0);
-    std::string date_header = te->DateHeaderString();
-    for (std::vector<TimeEntry *>::const_iterator it =
-        related.TimeEntries.begin();
-            it != related.TimeEntries.end();
-            it++) {
-        TimeEntry *n = *it;
-        if (n->DateHeaderString() == date_header) {
-            Poco::Int64 duration = n->DurationInSeconds();
-            if (duration > 0) {
-                date_duration += duration;
-            }
-        }
-    }
-    return Formatter::FormatDurationInSecondsHHMMSS(date_duration);
+    return Formatter::FormatDurationInSecondsHHMMSS(
+        related.TrackedPerDay.ForDay(te->Start()));
 }
 
 bool User::HasPremiumWorkspaces() const {
@@ -279,12 +261,10 @@ void User::SetLastTEDate(const std::string value) {
 // all of them are stopped (multi-tracking is not supported by Toggl).
 // Do not save here, dirtyness will be handled outside of this module.
 std::vector<TimeEntry *> User::Stop() {
-    std::vector<TimeEntry *> result;
-    TimeEntry *te = RunningTimeEntry();
-    while (te) {
-        result.push_back(te);
-        te->StopTracking();
-        te = RunningTimeEntry();
+    // Entries remove themselves from the running list as they stop
+    std::vector<TimeEntry *> result = related.Running.All();
+    for (size_t i = 0; i < result.size(); i++) {
+        result[i]->StopTracking();
     }
     return result;
 }
@@ -304,80 +284,53 @@ TimeEntry *User::StopAt(const Poco::Int64 at) {
 }
 
 TimeEntry *User::RunningTimeEntry() const {
-    for (std::vector<TimeEntry *>::const_iterator it =
-        related.TimeEntries.begin();
-            it != related.TimeEntries.end();
-            it++) {
-        if ((*it)->DurationInSeconds() < 0) {
-            return *it;
-        }
-    }
-    return 0;
+    return related.Running.First();
 }
 
 bool User::HasTrackedTimeToday() const {
-    for (std::vector<TimeEntry *>::const_iterator it =
-        related.TimeEntries.begin();
-            it != related.TimeEntries.end();
-            it++) {
-        if ((*it)->IsToday()) {
-            return true;
-        }
-    }
-    return false;
+    Poco::Int64 today = DailyTotals::StartOfDay(time(0));
+    Poco::Int64 tomorrow = DailyTotals::StartOfDay(today + 36 * 3600);
+    std::vector<TimeEntry *> started;
+    related.TimeEntriesByStart.StartedBetween(today, tomorrow, &started);
+    return !started.empty();
 }
 
 template<typename T>
-T *getModelByID(const Poco::UInt64 id, std::vector<T *> *list) {
+T *getModelByID(const Poco::UInt64 id, const ModelIndex &index) {
     poco_assert(id > 0);
-    typedef typename std::vector<T *>::const_iterator iterator;
-    for (iterator it = list->begin(); it != list->end(); it++) {
-        T *model = *it;
-        if (model->ID() == id) {
-            return model;
-        }
-    }
-    return 0;
+    return static_cast<T *>(index.ByID(id));
 }
 
 Task *User::GetTaskByID(const Poco::UInt64 id) {
-    return getModelByID<Task>(id, &related.Tasks);
+    return getModelByID<Task>(id, related.TaskIndex);
 }
 
 Client *User::GetClientByID(const Poco::UInt64 id) {
-    return getModelByID(id, &related.Clients);
+    return getModelByID<Client>(id, related.ClientIndex);
 }
 
 Project *User::GetProjectByID(const Poco::UInt64 id) {
-    return getModelByID(id, &related.Projects);
+    return getModelByID<Project>(id, related.ProjectIndex);
 }
 
 template <typename T>
-T *getModelByGUID(const guid GUID, std::vector<T *> *list) {
+T *getModelByGUID(const guid GUID, const ModelIndex &index) {
     if (GUID.empty()) {
         return 0;
     }
-    typedef typename std::vector<T *>::const_iterator iterator;
-    for (iterator it = list->begin(); it != list->end(); it++) {
-        T *model = *it;
-        if (model->GUID() == GUID) {
-            return model;
-        }
-    }
-    return 0;
+    return static_cast<T *>(index.ByGUID(GUID));
 }
 
-
 TimeEntry *User::GetTimeEntryByGUID(const guid GUID) {
-    return getModelByGUID(GUID, &related.TimeEntries);
+    return getModelByGUID<TimeEntry>(GUID, related.TimeEntryIndex);
 }
 
 Tag *User::GetTagByGUID(const guid GUID) {
-    return getModelByGUID(GUID, &related.Tags);
+    return getModelByGUID<Tag>(GUID, related.TagIndex);
 }
 
 Tag *User::GetTagByID(const Poco::UInt64 id) {
-    return getModelByID(id, &related.Tags);
+    return getModelByID<Tag>(id, related.TagIndex);
 }
 
 void User::CollectPushableTimeEntries(
@@ -419,49 +372,67 @@ void User::CollectPushableProjects(
 }
 
 error User::FullSync(
-    HTTPSClient *https_client) {
-    BasicAuthUsername = APIToken();
-    BasicAuthPassword = "api_token";
-    error err = pull(https_client, true, true);
+    HTTPSClient *https_client,
+    Poco::Mutex *models_m) {
+    poco_assert(models_m);
+    {
+        Poco::Mutex::ScopedLock lock(*models_m);
+        BasicAuthUsername = APIToken();
+        BasicAuthPassword = "api_token";
+    }
+    error err = pull(https_client, true, true, models_m);
     if (err != noError) {
         return err;
     }
-    return push(https_client);
+    return push(https_client, models_m);
 }
 
 error User::PartialSync(
-    HTTPSClient *https_client) {
-    BasicAuthUsername = APIToken();
-    BasicAuthPassword = "api_token";
+    HTTPSClient *https_client,
+    Poco::Mutex *models_m) {
+    poco_assert(models_m);
+    {
+        Poco::Mutex::ScopedLock lock(*models_m);
+        BasicAuthUsername = APIToken();
+        BasicAuthPassword = "api_token";
+    }
     // FIXME: if last sync was a while ago, fetch data using "since" parameter
-    return push(https_client);
+    return push(https_client, models_m);
 }
 
-error User::push(HTTPSClient *https_client) {
+error User::push(
+    HTTPSClient *https_client,
+    Poco::Mutex *models_m) {
+    poco_assert(models_m);
     try {
         Poco::Stopwatch stopwatch;
         stopwatch.start();
 
-        std::map<std::string, BaseModel *> models;
+        std::string json("");
+        std::string api_token("");
+        {
+            Poco::Mutex::ScopedLock lock(*models_m);
 
-        std::vector<TimeEntry *> time_entries;
-        CollectPushableTimeEntries(&time_entries, &models);
+            std::vector<TimeEntry *> time_entries;
+            CollectPushableTimeEntries(&time_entries);
 
-        std::vector<Project *> projects;
-        CollectPushableProjects(&projects, &models);
+            std::vector<Project *> projects;
+            CollectPushableProjects(&projects);
 
-        if (time_entries.empty() && projects.empty()) {
-            return noError;
-        }
+            if (time_entries.empty() && projects.empty()) {
+                return noError;
+            }
 
-        std::string json = UpdateJSON(&projects, &time_entries);
+            json = UpdateJSON(&projects, &time_entries);
+            api_token = APIToken();
+        }
 
         logger().debug(json);
 
         std::string response_body("");
         error err = https_client->PostJSON("/api/v8/batch_updates",
                                            json,
-                                           APIToken(),
+                                           api_token,
                                            "api_token",
                                            &response_body);
         if (err != noError) {
@@ -472,8 +443,28 @@ error User::push(HTTPSClient *https_client) {
         BatchUpdateResult::ParseResponseArray(response_body, &results);
 
         std::vector<error> errors;
+        {
+            // Models may have changed or gone away during the
+            // request, so they are looked up again by GUID.
+            Poco::Mutex::ScopedLock lock(*models_m);
+
+            std::map<std::string, BaseModel *> models;
+            for (std::vector<BatchUpdateResult>::const_iterator it =
+                results.begin();
+                    it != results.end();
+                    it++) {
+                BaseModel *model = related.TimeEntryIndex.ByGUID(it->GUID);
+                if (!model) {
+                    model = related.ProjectIndex.ByGUID(it->GUID);
+                }
+                if (model) {
+                    models[it->GUID] = model;
+                }
+            }
 
-        BatchUpdateResult::ProcessResponseArray(&results, &models, &errors);
+            BatchUpdateResult::ProcessResponseArray(
+                &results, &models, &errors);
+        }
 
         if (!errors.empty()) {
             return collectErrors(&errors);
@@ -511,13 +502,17 @@ error User::Login(
     const std::string &password) {
     BasicAuthUsername = email;
     BasicAuthPassword = password;
-    return pull(https_client, true, true);
+    // User that is logging in is not shared yet
+    Poco::Mutex models_m;
+    return pull(https_client, true, true, &models_m);
 }
 
 error User::pull(
     HTTPSClient *https_client,
     const bool full_sync,
-    const bool with_related_data) {
+    const bool with_related_data,
+    Poco::Mutex *models_m) {
+    poco_assert(models_m);
     try {
         Poco::Stopwatch stopwatch;
         stopwatch.start();
@@ -531,20 +526,28 @@ error User::pull(
             relative_url << "&with_related_data=false";
         }
 
-        if (!full_sync) {
-            relative_url << "&since=" << since_;
+        std::string username("");
+        std::string password("");
+        {
+            Poco::Mutex::ScopedLock lock(*models_m);
+            if (!full_sync) {
+                relative_url << "&since=" << since_;
+            }
+            username = BasicAuthUsername;
+            password = BasicAuthPassword;
         }
 
         std::string response_body("");
 
         error err = https_client->GetJSON(relative_url.str(),
-                                          BasicAuthUsername,
-                                          BasicAuthPassword,
+                                          username,
+                                          password,
                                           &response_body);
         if (err != noError) {
             return err;
         }
 
+        Poco::Mutex::ScopedLock lock(*models_m);
         LoadUserFromJSONString(this,
                                response_body,
                                full_sync,
@@ -591,75 +594,68 @@ error User::collectErrors(std::vector<error> * const errors) const {
 }
 
 Workspace *User::GetWorkspaceByID(const Poco::UInt64 id) {
-    return getModelByID(id, &related.Workspaces);
+    return getModelByID<Workspace>(id, related.WorkspaceIndex);
 }
 
 Project *User::GetProjectByGUID(const guid GUID) {
-    return getModelByGUID(GUID, &related.Projects);
+    return getModelByGUID<Project>(GUID, related.ProjectIndex);
 }
 
 Client *User::GetClientByGUID(const guid GUID) {
-    return getModelByGUID(GUID, &related.Clients);
+    return getModelByGUID<Client>(GUID, related.ClientIndex);
 }
 
 TimeEntry *User::GetTimeEntryByID(const Poco::UInt64 id) {
-    return getModelByID(id, &related.TimeEntries);
+    return getModelByID<TimeEntry>(id, related.TimeEntryIndex);
 }
 
-template <typename T>
 void deleteRelatedModelsWithWorkspace(const Poco::UInt64 wid,
-                                      std::vector<T *> *list) {
-    typedef typename std::vector<T *>::iterator iterator;
-    for (iterator it = list->begin(); it != list->end(); it++) {
-        T *model = *it;
-        if (model->WID() == wid) {
-            model->MarkAsDeletedOnServer();
-        }
+                                      const ModelIndex &index) {
+    std::vector<BaseModel *> models = index.ByRelatedID(kRelatedWID, wid);
+    for (std::vector<BaseModel *>::const_iterator it = models.begin();
+            it != models.end(); it++) {
+        (*it)->MarkAsDeletedOnServer();
     }
 }
 
 void User::DeleteRelatedModelsWithWorkspace(const Poco::UInt64 wid) {
-    deleteRelatedModelsWithWorkspace(wid, &related.Clients);
-    deleteRelatedModelsWithWorkspace(wid, &related.Projects);
-    deleteRelatedModelsWithWorkspace(wid, &related.Tasks);
-    deleteRelatedModelsWithWorkspace(wid, &related.TimeEntries);
-    deleteRelatedModelsWithWorkspace(wid, &related.Tags);
+    deleteRelatedModelsWithWorkspace(wid, related.ClientIndex);
+    deleteRelatedModelsWithWorkspace(wid, related.ProjectIndex);
+    deleteRelatedModelsWithWorkspace(wid, related.TaskIndex);
+    deleteRelatedModelsWithWorkspace(wid, related.TimeEntryIndex);
+    deleteRelatedModelsWithWorkspace(wid, related.TagIndex);
 }
 
 void User::RemoveClientFromRelatedModels(const Poco::UInt64 cid) {
-    for (std::vector<Project *>::iterator it = related.Projects.begin();
-            it != related.Projects.end(); it++) {
-        Project *model = *it;
-        if (model->CID() == cid) {
-            model->SetCID(0);
-        }
+    std::vector<BaseModel *> models =
+        related.ProjectIndex.ByRelatedID(kRelatedCID, cid);
+    for (std::vector<BaseModel *>::const_iterator it = models.begin();
+            it != models.end(); it++) {
+        static_cast<Project *>(*it)->SetCID(0);
     }
 }
 
 template <typename T>
 void removeProjectFromRelatedModels(const Poco::UInt64 pid,
-                                    std::vector<T *> *list) {
-    typedef typename std::vector<T *>::iterator iterator;
-    for (iterator it = list->begin(); it != list->end(); it++) {
-        T *model = *it;
-        if (model->PID() == pid) {
-            model->SetPID(0);
-        }
+                                    const ModelIndex &index) {
+    std::vector<BaseModel *> models = index.ByRelatedID(kRelatedPID, pid);
+    for (std::vector<BaseModel *>::const_iterator it = models.begin();
+            it != models.end(); it++) {
+        static_cast<T *>(*it)->SetPID(0);
     }
 }
 
 void User::RemoveProjectFromRelatedModels(const Poco::UInt64 pid) {
-    removeProjectFromRelatedModels(pid, &related.Tasks);
-    removeProjectFromRelatedModels(pid, &related.TimeEntries);
+    removeProjectFromRelatedModels<Task>(pid, related.TaskIndex);
+    removeProjectFromRelatedModels<TimeEntry>(pid, related.TimeEntryIndex);
 }
 
 void User::RemoveTaskFromRelatedModels(const Poco::UInt64 tid) {
-    for (std::vector<TimeEntry *>::iterator it = related.TimeEntries.begin();
-            it != related.TimeEntries.end(); it++) {
-        TimeEntry *model = *it;
-        if (model->TID() == tid) {
-            model->SetTID(0);
-        }
+    std::vector<BaseModel *> models =
+        related.TimeEntryIndex.ByRelatedID(kRelatedTID, tid);
+    for (std::vector<BaseModel *>::const_iterator it = models.begin();
+            it != models.end(); it++) {
+        static_cast<TimeEntry *>(*it)->SetTID(0);
     }
 }
 
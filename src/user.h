@@ -24,6 +24,7 @@
 
 #include "Poco/Types.h"
 #include "Poco/Logger.h"
+#include "Poco/Mutex.h"
 
 namespace kopsik {
 
@@ -47,8 +48,14 @@ class User : public BaseModel {
 
     ~User();
 
-    error FullSync(HTTPSClient *https_client);
-    error PartialSync(HTTPSClient *https_client);
+    // Models are only read and changed while holding models_m,
+    // requests to the server are made without holding it.
+    error FullSync(
+        HTTPSClient *https_client,
+        Poco::Mutex *models_m);
+    error PartialSync(
+        HTTPSClient *https_client,
+        Poco::Mutex *models_m);
     error Login(
         HTTPSClient *https_client,
         const std::string &email,
@@ -176,9 +183,11 @@ class User : public BaseModel {
     error pull(
         HTTPSClient *https_client,
         const bool full_sync,
-        const bool with_related_data);
+        const bool with_related_data,
+        Poco::Mutex *models_m);
     error push(
-        HTTPSClient *https_client);
+        HTTPSClient *https_client,
+        Poco::Mutex *models_m);
 
     std::string dirtyObjectsJSON(std::vector<TimeEntry *> * const) const;
     void processResponseArray(
@@ -0,0 +1,130 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./view_snapshot.h"
+
+#include <time.h>
+
+#include "Poco/Bugcheck.h"
+
+namespace kopsik {
+
+TimeEntryView::TimeEntryView(
+    const TimeEntry &te,
+    const std::string project_and_task_label,
+    const std::string color_code)
+    : GUID(te.GUID())
+, Description(te.Description())
+, ProjectAndTaskLabel(project_and_task_label)
+, Color(color_code)
+, Duration(te.DurationString())
+, DateHeader(te.DateHeaderString())
+, Tags(te.Tags())
+, WID(te.WID())
+, TID(te.TID())
+, PID(te.PID())
+, DurationInSeconds(te.DurationInSeconds())
+, Started(te.Start())
+, Ended(te.Stop())
+, UpdatedAt(te.UpdatedAt())
+, Billable(te.Billable())
+, DurOnly(te.DurOnly()) {
+}
+
+const TimeEntryView *ViewSnapshot::TimeEntryByGUID(
+    const std::string GUID) const {
+    for (size_t i = 0; i < Running.size(); i++) {
+        if (Running[i].GUID == GUID) {
+            return &Running[i];
+        }
+    }
+    std::map<std::string, size_t>::const_iterator it =
+        rows_by_guid_.find(GUID);
+    if (it == rows_by_guid_.end()) {
+        return 0;
+    }
+    return &TimeEntries[it->second];
+}
+
+void ViewSnapshot::Reindex() {
+    rows_by_guid_.clear();
+    for (size_t i = 0; i < TimeEntries.size(); i++) {
+        rows_by_guid_[TimeEntries[i].GUID] = i;
+    }
+}
+
+// Running entries last until now, stopped entries
+// without a stop time last for their duration.
+static Poco::Int64 endOf(const TimeEntryView &te, const Poco::Int64 now) {
+    if (te.DurationInSeconds < 0) {
+        return now;
+    }
+    if (te.Ended) {
+        return static_cast<Poco::Int64>(te.Ended);
+    }
+    return static_cast<Poco::Int64>(te.Started) + te.DurationInSeconds;
+}
+
+static bool trackedBetween(
+    const TimeEntryView &te,
+    const Poco::Int64 from,
+    const Poco::Int64 to,
+    const Poco::Int64 now) {
+    const Poco::Int64 started = static_cast<Poco::Int64>(te.Started);
+    if (started >= to) {
+        return false;
+    }
+    return started >= from || endOf(te, now) > from;
+}
+
+void ViewSnapshot::TimeEntriesInRange(
+    const Poco::Int64 from,
+    const Poco::Int64 to,
+    std::vector<const TimeEntryView *> *result) const {
+    poco_assert(result);
+    if (from >= to) {
+        return;
+    }
+    const Poco::Int64 now = time(0);
+    const size_t first = result->size();
+
+    // First entry that started before to
+    size_t begin(0), end(TimeEntries.size());
+    while (begin < end) {
+        size_t middle = begin + (end - begin) / 2;
+        if (static_cast<Poco::Int64>(TimeEntries[middle].Started) >= to) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+
+    // Entries that started earlier than the longest
+    // duration before from cannot reach into the range
+    const Poco::Int64 earliest = from - LongestDuration;
+    for (size_t i = begin; i < TimeEntries.size(); i++) {
+        const TimeEntryView &te = TimeEntries[i];
+        const Poco::Int64 started = static_cast<Poco::Int64>(te.Started);
+        if (started < earliest) {
+            break;
+        }
+        if (trackedBetween(te, from, to, now)) {
+            result->push_back(&te);
+        }
+    }
+
+    // Running entries are not in the list, put them into place
+    for (size_t i = 0; i < Running.size(); i++) {
+        const TimeEntryView &te = Running[i];
+        if (!trackedBetween(te, from, to, now)) {
+            continue;
+        }
+        std::vector<const TimeEntryView *>::iterator it =
+            result->begin() + first;
+        while (it != result->end() && (*it)->Started >= te.Started) {
+            it++;
+        }
+        result->insert(it, &te);
+    }
+}
+
+}  // namespace kopsik
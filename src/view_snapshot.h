@@ -0,0 +1,127 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_VIEW_SNAPSHOT_H_
+#define SRC_VIEW_SNAPSHOT_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./autocomplete_item.h"
+#include "./workspace.h"
+#include "./client.h"
+#include "./time_entry.h"
+#include "./related_data.h"
+
+#include "Poco/Types.h"
+#include "Poco/SharedPtr.h"
+
+namespace kopsik {
+
+// What a time entry shows in the time entry list
+class TimeEntryView {
+ public:
+    TimeEntryView(
+        const TimeEntry &te,
+        const std::string project_and_task_label,
+        const std::string color_code);
+
+    std::string GUID;
+    std::string Description;
+    std::string ProjectAndTaskLabel;
+    std::string Color;
+    std::string Duration;
+    std::string DateHeader;
+    std::string Tags;
+    Poco::UInt64 WID;
+    Poco::UInt64 TID;
+    Poco::UInt64 PID;
+    Poco::Int64 DurationInSeconds;
+    Poco::UInt64 Started;
+    Poco::UInt64 Ended;
+    Poco::UInt64 UpdatedAt;
+    bool Billable;
+    bool DurOnly;
+};
+
+// Everything UI queries read of the user's data, built after each
+// change and never modified after that. Context publishes a new
+// snapshot when data changes; a query keeps reading the snapshot it
+// started with, so it never waits for a sync that is running.
+class ViewSnapshot {
+ public:
+    ViewSnapshot() : LongestDuration(0), TimeEntriesLoadedSince(0) {}
+    ~ViewSnapshot() {}
+
+    // Time entries in the list, latest first. Running
+    // and deleted entries are not shown in the list.
+    std::vector<TimeEntryView> TimeEntries;
+
+    // Running time entry, if there is one
+    std::vector<TimeEntryView> Running;
+
+    // Entry of the list or the running entry, or none
+    const TimeEntryView *TimeEntryByGUID(const std::string GUID) const;
+
+    // Indexes entries above by GUID, once they have been added
+    void Reindex();
+
+    // Time entries of the list above and the running entry that were
+    // tracked at some point between from and to, latest first. Same
+    // as Database::LoadTimeEntriesInRange for entries in the list.
+    void TimeEntriesInRange(
+        const Poco::Int64 from,
+        const Poco::Int64 to,
+        std::vector<const TimeEntryView *> *result) const;
+
+    // Longest duration of a time entry, see TimeEntryOrder
+    Poco::Int64 LongestDuration;
+
+    // Entries started before this are in database only,
+    // see RelatedData
+    Poco::Int64 TimeEntriesLoadedSince;
+
+    // Tracked time of each date header in the list
+    std::map<std::string, Poco::Int64> DateDurations;
+
+    // Tracked time per day, including days outside of the list
+    DailyTotals TrackedPerDay;
+
+    // Sorted with CompareAutocompleteItems
+    std::vector<AutocompleteItem> AutocompleteItems;
+
+    // Distinct tag names, sorted
+    std::vector<std::string> Tags;
+
+    // Sorted by name
+    std::vector<Workspace> Workspaces;
+
+    // Clients of each workspace, sorted by name
+    std::map<Poco::UInt64, std::vector<Client> > ClientsByWorkspace;
+
+ private:
+    // Rows of TimeEntries by GUID
+    std::map<std::string, size_t> rows_by_guid_;
+};
+
+// Keeps a published snapshot alive while a query reads it,
+// and lets the query only read it.
+class ViewSnapshotRef {
+ public:
+    explicit ViewSnapshotRef(const Poco::SharedPtr<ViewSnapshot> &snapshot)
+        : snapshot_(snapshot) {}
+
+    const ViewSnapshot *operator->() const {
+        return snapshot_.get();
+    }
+    const ViewSnapshot &operator*() const {
+        return *snapshot_;
+    }
+
+ private:
+    Poco::SharedPtr<ViewSnapshot> snapshot_;
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_VIEW_SNAPSHOT_H_